@@ -87,6 +87,14 @@ static inline void ce_hi(uint8_t ce) {
     dev_barrier();
 }
 
+// one pipe tag per packet slot on <recvq>: only possible when 
+// every packet starts at a multiple of <nbytes>.
+static uint8_t *nrf_rx_pipes_alloc(unsigned nbytes) {
+    if(CQ_N % nbytes != 0)
+        return 0;
+    return kmalloc(CQ_N / nbytes);
+}
+
 // initialize the NRF: [extension: pass in a channel]
 nrf_t *nrf_init(nrf_conf_t c, uint32_t rxaddr, unsigned acked_p) {
     // to write yours, comment this out and start editing below.
@@ -106,7 +114,9 @@ nrf_t *nrf_init(nrf_conf_t c, uint32_t rxaddr, unsigned acked_p) {
     n->spi = nrf_spi_init(c.ce_pin, c.spi_chip);
 
     n->rxaddr = rxaddr;     // set the rxaddr
+    n->bcast_addr = 0;      // no broadcast pipe until <nrf_listen_bcast>
     cq_init(&n->recvq, 1);  // initialize the circular queue
+    n->rx_pipes = nrf_rx_pipes_alloc(c.nbytes);
 
     // p22: put in PWR_DOWN so can configure.
     nrf_put8_chk(n, NRF_CONFIG, 0);
@@ -246,7 +256,9 @@ nrf_t *nrf_init(nrf_conf_t c, uint32_t rxaddr, unsigned acked_p) {
     // we skip reg=0x9 (RPD)
     // we skip reg=0xA (P0)
     // we skip reg=0x10 (TX_ADDR): used only when sending.
-    nrf_put8_chk(n, NRF_FEATURE, 0);
+    // p63: EN_DYN_ACK, so <nrf_tx_send_noack> works on an acked radio 
+    // too (e.g., broadcasts and replies next to acked data).
+    nrf_put8_chk(n, NRF_FEATURE, set_bit(EN_DYN_ACK_BIT));
     nrf_put8_chk(n, NRF_DYNPD, 0);
 
     // pg 22: go from <PowerDown> to <Standby-I>
@@ -261,6 +273,7 @@ nrf_t *nrf_init(nrf_conf_t c, uint32_t rxaddr, unsigned acked_p) {
 
 
     // should be true after setup.
+    nrf_opt_assert(n, nrf_dyn_ack_enabled(n));
     if(acked_p) {
         nrf_opt_assert(n, nrf_get8(n, NRF_CONFIG) == rx_config);
         nrf_opt_assert(n, nrf_pipe_is_enabled(n, 0));
@@ -292,7 +305,9 @@ nrf_t *nrf_init_piped(nrf_conf_t c, uint32_t rxaddr) {
     n->spi = nrf_spi_init(c.ce_pin, c.spi_chip);
 
     n->rxaddr = rxaddr;     // set the rxaddr
+    n->bcast_addr = 0;      // no broadcast pipe until <nrf_listen_bcast>
     cq_init(&n->recvq, 1);  // initialize the circular queue
+    n->rx_pipes = nrf_rx_pipes_alloc(c.nbytes);
 
     // p22: put in PWR_DOWN so can configure.
     nrf_put8_chk(n, NRF_CONFIG, 0);
@@ -403,6 +418,41 @@ nrf_t *nrf_init_piped(nrf_conf_t c, uint32_t rxaddr) {
     return n;
 }
 
+// listen on pipe 0 for <bcast_addr> as well as our own address.
+// pipe 0 is the only other pipe with a full address of its own, so 
+// this works after both <nrf_init> (acked or not) and <nrf_init_piped>.
+// pipe 0 is never acked while receiving: every node that hears a 
+// broadcast would ack it at once.
+void nrf_listen_bcast(nrf_t *n, uint32_t bcast_addr) {
+    assert(bcast_addr && bcast_addr != n->rxaddr);
+    nrf_opt_assert(n, nrf_is_rx(n));
+
+    // pg 75: only change addresses while not receiving.
+    ce_lo(n->config.ce_pin);
+    nrf_set_addr(n, NRF_RX_ADDR_P0, bcast_addr, nrf_default_addr_nbytes);
+    nrf_put8_chk(n, NRF_RX_PW_P0, n->config.nbytes);
+    nrf_put8_chk(n, NRF_EN_AA, nrf_get8(n, NRF_EN_AA) & ~set_bit(0));
+    nrf_put8_chk(n, NRF_EN_RXADDR, nrf_get8(n, NRF_EN_RXADDR) | set_bit(0));
+    n->bcast_addr = bcast_addr;
+    ce_hi(n->config.ce_pin);
+    delay_us(130);
+
+    // not an opt assert: if this is wrong, broadcasts silently vanish.
+    assert(nrf_pipe_is_enabled(n, 0));
+    assert(!nrf_pipe_is_acked(n, 0));
+    assert(nrf_get_addr(n, NRF_RX_ADDR_P0, nrf_default_addr_nbytes) == bcast_addr);
+    assert(nrf_get8(n, NRF_RX_PW_P0) == n->config.nbytes);
+}
+
+// after an acked send borrowed pipe 0: point it back at the broadcast
+// address and stop acking on it.
+static void nrf_bcast_restore(nrf_t *n) {
+    if(!n->bcast_addr)
+        return;
+    nrf_set_addr(n, NRF_RX_ADDR_P0, n->bcast_addr, nrf_default_addr_nbytes);
+    nrf_put8_chk(n, NRF_EN_AA, nrf_get8(n, NRF_EN_AA) & ~set_bit(0));
+}
+
 // put the device in RX mode: 
 //   - go to <Standby-I> so we can transition in 
 //     a legal state (*i think*)
@@ -461,7 +511,7 @@ int nrf_tx_send_ack(nrf_t *n, uint32_t txaddr,
     nrf_opt_assert(n, nrf_get8(n, NRF_CONFIG) == rx_config);
     nrf_opt_assert(n, nrf_pipe_is_enabled(n, 0));
     nrf_opt_assert(n, nrf_pipe_is_enabled(n, 1));
-    nrf_opt_assert(n, nrf_pipe_is_acked(n, 0));
+    nrf_opt_assert(n, nrf_pipe_is_acked(n, 0) || n->bcast_addr);
     nrf_opt_assert(n, nrf_pipe_is_acked(n, 1));
     nrf_opt_assert(n, nrf_tx_fifo_empty(n));
 
@@ -490,7 +540,11 @@ int nrf_tx_send_ack(nrf_t *n, uint32_t txaddr,
     nrf_set_addr(n, NRF_TX_ADDR, txaddr, nrf_default_addr_nbytes);
 
     // 1. set the rx addr for pipe 0 as the tx addr (to receive acks back)
+    //    if pipe 0 is our broadcast pipe, borrow it: it has to be acked
+    //    for the ack to come back [p75].
     nrf_set_addr(n, NRF_RX_ADDR_P0, txaddr, nrf_default_addr_nbytes);
+    if(n->bcast_addr)
+        nrf_put8_chk(n, NRF_EN_AA, nrf_get8(n, NRF_EN_AA) | set_bit(0));
 
     // 2. put packet on TX fifo.
     nrf_putn(n, NRF_W_TX_PAYLOAD, msg, nbytes);
@@ -500,9 +554,23 @@ int nrf_tx_send_ack(nrf_t *n, uint32_t txaddr,
 
     // 4. wait for TX interrupt.
     while (!nrf_has_tx_intr(n)) {
-        // check if max rt interrupts
+        // the receiver never acked, even after all the retransmissions:
+        // drop the packet and return 0 so the caller can decide (retry 
+        // later, try another route, give up).
         if (nrf_has_max_rt_intr(n)) {
-            panic("Max retransmission interrupts reached\n");
+            uint8_t cnt = nrf_get8(n, NRF_OBSERVE_TX);
+            n->tot_retrans  += bits_get(cnt,0,3);
+            n->tot_lost++;
+
+            // MAX_RT leaves the packet on the FIFO.
+            nrf_tx_flush(n);
+            nrf_rt_intr_clr(n);
+            nrf_rx_mode(n);
+            nrf_bcast_restore(n);
+
+            nrf_opt_assert(n, !nrf_has_max_rt_intr(n));
+            nrf_opt_assert(n, nrf_get8(n, NRF_CONFIG) == rx_config);
+            return 0;
         }
     }
 
@@ -517,6 +585,7 @@ int nrf_tx_send_ack(nrf_t *n, uint32_t txaddr,
     //   - If nRF24L01+ is in standby-II mode, it goes to 
     //     standby-I mode immediately if CE is set low.
     nrf_rx_mode(n);
+    nrf_bcast_restore(n);
 
     // How to increment the total number of retransmissions.
     uint8_t cnt = nrf_get8(n, NRF_OBSERVE_TX);
@@ -537,11 +606,11 @@ int nrf_tx_send_ack(nrf_t *n, uint32_t txaddr,
 int nrf_tx_send_noack(nrf_t *n, uint32_t txaddr, 
     const void *msg, unsigned nbytes) {
 
-    // default state for no-ack config.
+    // works on acked and no-ack radios alike: W_TX_PAYLOAD_NO_ACK 
+    // turns the ack off for just this packet [p63].
     nrf_opt_assert(n, nrf_get8(n, NRF_CONFIG) == rx_config);
-    nrf_opt_assert(n, !nrf_pipe_is_enabled(n, 0));
     nrf_opt_assert(n, nrf_pipe_is_enabled(n, 1));
-    nrf_opt_assert(n, !nrf_pipe_is_acked(n, 1));
+    nrf_opt_assert(n, nrf_dyn_ack_enabled(n));
     nrf_opt_assert(n, nrf_tx_fifo_empty(n));
 
     // if interrupts not enabled: make sure we check for packets.
@@ -602,8 +671,9 @@ int nrf_tx_send_noack(nrf_t *n, uint32_t txaddr,
 //     get dropped b/c the receiver is not listening.  can use
 //     interrupts.
 int nrf_get_pkts(nrf_t *n) {
-    // you can't check for packets unless in RX mode.
-    nrf_opt_assert(n, nrf_get8(n, NRF_CONFIG) == rx_config);
+    // you can't check for packets unless in RX mode (interrupts may
+    // be unmasked: see <nrf_rx_intr_enable>).
+    nrf_opt_assert(n, (nrf_get8(n, NRF_CONFIG) | mask_int) == rx_config);
     if(!nrf_rx_has_packet(n)) 
         return 0; 
 
@@ -626,7 +696,16 @@ int nrf_get_pkts(nrf_t *n) {
 
     do {
         //    0. assert(pipeid from STATUS != PIPEID_EMPTY)
-        nrf_opt_assert(n, nrf_rx_get_pipeid(n) != NRF_PIPEID_EMPTY);
+        //    remember the pipe: it tells the sender apart for free.
+        //    the field is 3 bits (6 = unused, 7 = empty): those get
+        //    tagged as-is (so the slot never keeps an old tag) but
+        //    only real pipes are counted.
+        unsigned pipe = nrf_rx_get_pipeid(n);
+        nrf_opt_assert(n, pipe != NRF_PIPEID_EMPTY);
+        if(n->rx_pipes)
+            n->rx_pipes[n->recvq.head / n->config.nbytes] = pipe;
+        if(pipe < NRF_NPIPES)
+            n->tot_pipe_msgs[pipe]++;
 
         //    1. read packet through spi [nrf_getn]
         uint8_t packet[n->config.nbytes];
@@ -647,6 +726,89 @@ int nrf_get_pkts(nrf_t *n) {
         //       a packet arrives b/n (1) and (2)
     } while (!nrf_rx_fifo_empty(n));
 
-    nrf_opt_assert(n, nrf_get8(n, NRF_CONFIG) == rx_config);
+    nrf_opt_assert(n, (nrf_get8(n, NRF_CONFIG) | mask_int) == rx_config);
     return res;
 }
+
+// dedicated transmitter: go RX -> StandbyI -> Standby-II and stay
+// there.  with CE held high, the radio moves to TX by itself whenever
+// the FIFO has something in it, and drops back to Standby-II when 
+// it's empty [p22].
+void nrf_tx_only(nrf_t *n) {
+    nrf_opt_assert(n, nrf_is_rx(n));
+    nrf_opt_assert(n, nrf_tx_fifo_empty(n));
+
+    // keep anything that already arrived.
+    while(nrf_get_pkts(n))
+        ;
+
+    ce_lo(n->config.ce_pin);
+    nrf_put8_chk(n, NRF_CONFIG, tx_config);
+    ce_hi(n->config.ce_pin);
+
+    nrf_opt_assert(n, nrf_is_tx(n));
+}
+
+// the FIFO status only says empty or full, so "partly full" has
+// to count as room for one.
+int nrf_tx_fifo_room(nrf_t *n) {
+    nrf_opt_assert(n, nrf_is_tx(n));
+
+    if(nrf_tx_fifo_empty(n)) {
+        // TX_DS is set after every no-ack packet: clear it so it
+        // doesn't pile up on the IRQ line.
+        if(nrf_has_tx_intr(n))
+            nrf_tx_intr_clr(n);
+        return NRF_TX_FIFO_DEPTH;
+    }
+    return nrf_tx_fifo_full(n) ? 0 : 1;
+}
+
+int nrf_tx_load_noack(nrf_t *n, uint32_t txaddr, 
+    const void *msg, unsigned nbytes) {
+    nrf_opt_assert(n, nrf_is_tx(n));
+    nrf_opt_assert(n, !nrf_tx_fifo_full(n));
+    nrf_opt_assert(n, nrf_dyn_ack_enabled(n));
+
+    // the address is read as each packet goes out, so only change
+    // it when nothing is waiting.
+    if(nrf_tx_fifo_empty(n))
+        nrf_set_addr(n, NRF_TX_ADDR, txaddr, nrf_default_addr_nbytes);
+    else
+        nrf_opt_assert(n, 
+            nrf_get_addr(n, NRF_TX_ADDR, nrf_default_addr_nbytes) == txaddr);
+
+    nrf_putn(n, W_TX_PAYLOAD_NO_ACK, msg, nbytes);
+
+    n->tot_sent_msgs++;
+    n->tot_sent_bytes += nbytes;
+    return nbytes;
+}
+
+// the IRQ pin is active low and stays low while RX_DR is set, so 
+// the edge fires once per burst: clear the event *before* draining
+// the FIFO so a packet that lands mid-drain raises a new one.
+void nrf_rx_intr_enable(nrf_t *n) {
+    nrf_opt_assert(n, nrf_is_rx(n));
+    unsigned pin = n->config.int_pin;
+
+    gpio_set_input(pin);
+    gpio_set_pullup(pin);
+    gpio_int_falling_edge(pin);
+
+    // unmask RX_DR only [p57: a 1 masks].
+    nrf_put8_chk(n, NRF_CONFIG, rx_config & ~set_bit(6));
+
+    // packets that arrived before we armed the edge won't raise one.
+    gpio_event_clear(pin);
+    while(nrf_get_pkts(n))
+        ;
+}
+
+int nrf_rx_intr_handler(nrf_t *n) {
+    unsigned pin = n->config.int_pin;
+    if(!gpio_event_detected(pin))
+        return 0;
+    gpio_event_clear(pin);
+    return nrf_get_pkts(n);
+}
@@ -351,7 +351,8 @@ void nrf_dump(const char *msg, nrf_t *nic) {
         bit_get(x,1),
         bit_get(x,0));
 
-    assert(nrf_get8(nic, NRF_FEATURE) == 0);
+    // only EN_DYN_ACK (see <nrf_init>).
+    assert((nrf_get8(nic, NRF_FEATURE) & ~(1 << EN_DYN_ACK_BIT)) == 0);
     assert(nrf_get8(nic, NRF_DYNPD) == 0);
     nrf_output("---------------------------------------------\n");
 }
@@ -417,4 +418,11 @@ void nrf_stat_print(nrf_t *nic, const char *fmt, ...) {
         nrf_output("\ttotal received bytes=%d bandwidth=[%d.%d kb/s]\n", 
                 tot_bytes, bw.whole, bw.fraction);
     }
+
+    // only worth printing if more than pipe 1 got anything.
+    if(nic->tot_pipe_msgs[1] != nic->tot_recv_msgs)
+        for(int i = 0; i < NRF_NPIPES; i++)
+            if(nic->tot_pipe_msgs[i])
+                nrf_output("\tpipe %d received messages=%d\n", 
+                    i, nic->tot_pipe_msgs[i]);
 }
@@ -216,6 +216,18 @@ static inline int nrf_tx_fifo_full(nrf_t *nic) {
     return nrf_bit_isset(nic, NRF_FIFO_STATUS, 5);
 }
 
+/****************************************************
+ * FEATURE=0x1d, p63
+ */
+
+// EN_DYN_ACK: lets W_TX_PAYLOAD_NO_ACK skip the ack for one packet,
+// so an acked radio can also send no-ack packets.
+enum { EN_DYN_ACK_BIT = 0 };
+
+static inline int nrf_dyn_ack_enabled(nrf_t *nic) {
+    return nrf_bit_isset(nic, NRF_FEATURE, EN_DYN_ACK_BIT);
+}
+
 /****************************************************
  * NRF state: should probably extend.
  */
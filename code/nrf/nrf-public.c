@@ -19,6 +19,13 @@ int nrf_nbytes_avail(nrf_t *n) {
     return cq_nelem(&n->recvq);
 }
 
+// look up the tag <nrf_get_pkts> left for the packet at <offset>.
+int nrf_pkt_pipe(nrf_t *n, unsigned offset) {
+    if(!n->rx_pipes)
+        return -1;
+    return n->rx_pipes[(offset % CQ_N) / n->config.nbytes];
+}
+
 // non-blocking read from nrf.
 //  - if there is less than <nbytes> of data on the receive queue
 //    <recvq> return 0 immediately.  
@@ -37,6 +37,15 @@
 // maximum hw supported packet size.
 enum { NRF_PKT_MAX = 32 };
 
+// number of RX pipes the hardware has.
+enum { NRF_NPIPES = 6 };
+
+// address of RX pipe <pipe> (1-5) on a radio set up with 
+// <nrf_init_piped> at <rxaddr>: pipes 2-5 share all but the low 
+// byte with pipe 1 (whose address is <rxaddr>).
+#define NRF_PIPE_ADDR(rxaddr, pipe) \
+    (((rxaddr) & ~0xFFu) | (((rxaddr) + 2 * ((pipe) - 1)) & 0xFFu))
+
 // configuration settigs for NRF.
 typedef struct {
     uint8_t spi_chip,   // which spi chip are we using.
@@ -70,6 +79,10 @@ typedef struct nrf {
     //    it's interrupts. 
     uint32_t rxaddr;
 
+    // shared address pipe 0 also listens on (see <nrf_listen_bcast>),
+    // 0 if none.
+    uint32_t bcast_addr;
+
     // queue holding message data in order of arrival.  note:
     //   - if you have hardware acks, there can be duplicates (caused 
     //     by retrans). 
@@ -79,6 +92,12 @@ typedef struct nrf {
     //     them later, or if want to handle now, what to do.
     cq_t     recvq;
 
+    // the pipe each packet on <recvq> arrived on, indexed by the
+    // packet's offset in <recvq> divided by the packet size.  NULL if 
+    // the packet size doesn't divide the queue size (then packets 
+    // wrap around it and the index doesn't work).
+    uint8_t *rx_pipes;
+
     void     *data; // opaque client data pointer.
 
     // some simple statistics.  maybe seperate this out into a struct.
@@ -91,6 +110,9 @@ typedef struct nrf {
 
              tot_recv_msgs,
              tot_recv_bytes;
+
+    // received messages per pipe.
+    uint32_t tot_pipe_msgs[NRF_NPIPES];
 } nrf_t;
 
 // initialize the NRF hardware described by config <c>  (which specifies
@@ -103,6 +125,13 @@ nrf_t * nrf_init(const nrf_conf_t c, uint32_t rxaddr, unsigned acked_p);
 nrf_t * nrf_init_piped(const nrf_conf_t c, uint32_t rxaddr);
 nrf_t * staff_nrf_init(const nrf_conf_t c, uint32_t rxaddr, unsigned acked_p);
 
+// also receive packets sent to the shared address <bcast_addr> (e.g.,
+// routing updates every node should hear), on pipe 0.  pipes 2-5 can't
+// be used: they only differ from pipe 1 in the low byte.  on an acked
+// radio pipe 0 is borrowed for acks during <nrf_tx_send_ack>, which
+// puts the address back afterwards, and it never acks broadcasts.
+void nrf_listen_bcast(nrf_t *n, uint32_t bcast_addr);
+
 static inline nrf_t *nrf_init_acked(nrf_conf_t c, uint32_t rxaddr) {
     return nrf_init(c,rxaddr,1);
 }
@@ -121,15 +150,52 @@ int staff_nrf_get_pkts(nrf_t *n);
 
 // send <nbytes> of data pointed to by <msg> to <txaddr> using NRF <n>,
 // expect a hardware ack.  the NRF must have been configured for acks,
-// obviously.
+// obviously.  returns <nbytes> if acked, 0 if the receiver never acked
+// (after the hardware gave up retransmitting: counted in <tot_lost>).
 int nrf_tx_send_ack(nrf_t *n, uint32_t txaddr, const void *msg, unsigned nbytes);
 int staff_nrf_tx_send_ack(nrf_t *n, uint32_t txaddr, const void *msg, unsigned nbytes);
 
 // send <nbytes> of data pointed to by <msg> to <txaddr> using NRF <n>,
-// no hardware ack.  the NRF must have been configured for no-ACKs.
+// no hardware ack.  works on acked radios too: only this packet goes 
+// without an ack.
 int nrf_tx_send_noack(nrf_t *n, uint32_t txaddr, const void *msg, unsigned nbytes);
 int staff_nrf_tx_send_noack(nrf_t *n, uint32_t txaddr, const void *msg, unsigned nbytes);
 
+/*********************************************************************
+ * full-duplex support: one radio that only receives, one that only
+ * sends, so neither ever pays for the RX<->TX turnaround.
+ */
+
+// packets the hardware TX FIFO holds.
+enum { NRF_TX_FIFO_DEPTH = 3 };
+
+// make <n> a dedicated transmitter: leave RX for good and hold CE 
+// high (Standby-II), so anything loaded onto the TX FIFO goes out 
+// right away, back to back.  the radio no longer receives.
+void nrf_tx_only(nrf_t *n);
+
+// how many packets a dedicated transmitter can take right now:
+//  - NRF_TX_FIFO_DEPTH if everything loaded before has gone out.
+//  - 1 if the FIFO is partly full (it only reports empty/full).
+//  - 0 if it's full.
+int nrf_tx_fifo_room(nrf_t *n);
+
+// load a no-ack packet onto a dedicated transmitter's TX FIFO and 
+// return without waiting for it to go out.  the TX address is shared
+// by everything in the FIFO, so <txaddr> must match what's already 
+// queued unless the FIFO is empty.
+int nrf_tx_load_noack(nrf_t *n, uint32_t txaddr, const void *msg, unsigned nbytes);
+
+// route RX_DR to <n>'s IRQ pin and detect its falling edge, so packets
+// can be pulled off from an interrupt handler.  after this the radio 
+// should only receive.
+void nrf_rx_intr_enable(nrf_t *n);
+
+// call from the interrupt handler: if <n> raised the interrupt, pull 
+// its packets onto <recvq>.  returns the number pulled (0 if it wasn't
+// <n>).
+int nrf_rx_intr_handler(nrf_t *n);
+
 // print out the NRF configuration by reading it from the hardware.
 // we give you this.  you should use it alot during lab to make sure 
 // that things are looking like what you expect.
@@ -146,6 +212,8 @@ static inline void nrf_stat_start(nrf_t *nic) {
     nic->tot_lost = 0;
     nic->tot_recv_msgs = 0;
     nic->tot_recv_bytes = 0;
+    for(int i = 0; i < NRF_NPIPES; i++)
+        nic->tot_pipe_msgs[i] = 0;
 }
 void nrf_stat_print(nrf_t *nic, const char *msg, ...);
 
@@ -171,6 +239,11 @@ int nrf_nbytes_avail(nrf_t *n);
 //  - 0 if there was < <nbytes> of data.
 int nrf_read_exact_noblk(nrf_t *nic, void *msg, unsigned nbytes);
 
+// the RX pipe (0-5, 0 = broadcast) of the packet starting at byte <offset> of <n>'s
+// <recvq>, or -1 if it isn't known.  the next packet to read is at 
+// <recvq.tail>.
+int nrf_pkt_pipe(nrf_t *n, unsigned offset);
+
 // blocking read of exactly <nbytes> of data from <nic> into <msg>
 // keeps trying until it gets <nbytes>
 int nrf_read_exact(nrf_t *nic, void *msg, unsigned nbytes);
@@ -185,7 +258,7 @@ int nrf_read_exact_timeout(nrf_t *nic, void *msg, unsigned nbytes,
     unsigned usec_timeout);
 
 // send an acked packet <msg> of <nbytes> to address <txaddr>
-// using NRF <nic>
+// using NRF <nic>: returns 0 if it was never acked.
 int nrf_send_ack(nrf_t *nic, uint32_t txaddr, const void *msg, unsigned nbytes);
 
 // send a non-acked packet <msg> of <nbytes> to address <txaddr>
@@ -43,8 +43,11 @@ static inline bytestream_t bs_init(void);
 static inline size_t bs_bytes_available(const bytestream_t *bs);
 static inline size_t bs_remaining_capacity(const bytestream_t *bs);
 static inline size_t bs_peek(const bytestream_t *bs, uint8_t *data, size_t len);
+static inline size_t bs_peek_at(const bytestream_t *bs, size_t offset, uint8_t *data, size_t len);
 static inline size_t bs_read(bytestream_t *bs, uint8_t *data, size_t len);
 static inline size_t bs_write(bytestream_t *bs, const uint8_t *data, size_t len);
+static inline bool bs_reserve(bytestream_t *bs, size_t min, uint8_t **ptr, size_t *len);
+static inline void bs_commit(bytestream_t *bs, size_t len);
 static inline size_t bs_bytes_written(const bytestream_t *bs);
 static inline size_t bs_bytes_popped(const bytestream_t *bs);
 static inline bool bs_reader_finished(const bytestream_t *bs);
@@ -98,23 +101,41 @@ static inline size_t bs_remaining_capacity(const bytestream_t *bs) {
  * @return Number of bytes actually peeked
  */
 static inline size_t bs_peek(const bytestream_t *bs, uint8_t *data, size_t len) {
+    return bs_peek_at(bs, 0, data, len);
+}
+
+/**
+ * Peek at data starting <offset> bytes past the read position without removing it
+ *
+ * @param bs Pointer to the bytestream
+ * @param offset Number of readable bytes to skip before peeking
+ * @param data Buffer where the peeked data will be stored
+ * @param len Maximum number of bytes to peek
+ * @return Number of bytes actually peeked
+ */
+static inline size_t bs_peek_at(const bytestream_t *bs, size_t offset, uint8_t *data, size_t len) {
     assert(bs);
     assert(data);
 
-    // Don't peek more than what's available
-    size_t bytes_to_peek = MIN(len, bs_bytes_available(bs));
+    // Don't peek more than what's available past the offset
+    size_t available = bs_bytes_available(bs);
+    if (offset >= available) {
+        return 0;
+    }
+    size_t bytes_to_peek = MIN(len, available - offset);
     if (bytes_to_peek == 0) {
         return 0;
     }
 
     // Handle buffer wraparound - may need to peek in two parts
-    size_t first_chunk = BS_CAPACITY - bs->read_pos;
+    size_t start = (bs->read_pos + offset) % BS_CAPACITY;
+    size_t first_chunk = BS_CAPACITY - start;
     if (bytes_to_peek <= first_chunk) {
         // Can peek all data in one chunk
-        memcpy(data, bs->buffer + bs->read_pos, bytes_to_peek);
+        memcpy(data, bs->buffer + start, bytes_to_peek);
     } else {
         // Need to split the peek into two parts due to wraparound
-        memcpy(data, bs->buffer + bs->read_pos, first_chunk);
+        memcpy(data, bs->buffer + start, first_chunk);
         memcpy(data + first_chunk, bs->buffer, bytes_to_peek - first_chunk);
     }
 
@@ -183,6 +204,51 @@ static inline size_t bs_write(bytestream_t *bs, const uint8_t *data, size_t len)
     return bytes_to_write;
 }
 
+/**
+ * Reserve a contiguous region of the buffer so the caller can write into it directly
+ *
+ * The region always ends at the wraparound point or at the read position, so it may be
+ * smaller than the remaining capacity. If the stream is empty, the positions are reset
+ * to the start of the buffer so the whole capacity is contiguous.
+ *
+ * @param bs Pointer to the bytestream
+ * @param min Minimum number of contiguous bytes the caller needs
+ * @param ptr Set to the start of the writable region
+ * @param len Set to the number of contiguous bytes that can be written
+ * @return true if at least <min> contiguous bytes are writable
+ */
+static inline bool bs_reserve(bytestream_t *bs, size_t min, uint8_t **ptr, size_t *len) {
+    assert(bs);
+    assert(ptr);
+    assert(len);
+
+    // Nothing buffered: rewind so the reservation doesn't straddle the wraparound
+    if (bs->bytes_available == 0) {
+        bs->read_pos = 0;
+        bs->write_pos = 0;
+    }
+
+    *ptr = bs->buffer + bs->write_pos;
+    *len = MIN(bs_remaining_capacity(bs), BS_CAPACITY - bs->write_pos);
+
+    return *len >= min && *len > 0;
+}
+
+/**
+ * Commit bytes the caller wrote into a region returned by bs_reserve
+ *
+ * @param bs Pointer to the bytestream
+ * @param len Number of bytes that were written (must not exceed the reserved length)
+ */
+static inline void bs_commit(bytestream_t *bs, size_t len) {
+    assert(bs);
+    assert(len <= MIN(bs_remaining_capacity(bs), BS_CAPACITY - bs->write_pos));
+
+    bs->write_pos = (bs->write_pos + len) % BS_CAPACITY;
+    bs->bytes_available += len;
+    bs->bytes_written += len;
+}
+
 /**
  * Get total number of bytes written to the stream
  *
@@ -0,0 +1,291 @@
+#pragma once
+
+#include "bytestream.h"
+
+/**
+ * Streaming LZ compression for a bytestream
+ *
+ * A small LZ77 variant that compresses data as the app writes it and expands it as the
+ * app reads it. Both sides keep the last LZ_WINDOW bytes of the uncompressed stream, so
+ * matches can refer back across writes and segments. Tokens are byte-aligned and
+ * self-delimiting, so every write is compressed and handed to the sender right away
+ * (nothing waits for more input), and the reader can stop in the middle of a token.
+ *
+ * Token format:
+ *   0LLLLLLL                    Literal run: the next L+1 bytes (1-128) are copied as is
+ *   1LLLLOOO OOOOOOOO           Match: copy L+3 bytes (3-18) from O+1 bytes back (1-2048)
+ *
+ * Worst case, incompressible data grows by one byte per 128. RAM use is LZ_WINDOW plus
+ * the hash table for the encoder and LZ_WINDOW for the decoder.
+ */
+
+#define LZ_WINDOW 2048     /* Bytes of history (power of 2, at most 2048 for the offset) */
+#define LZ_HASH_BITS 10    /* Encoder hash table size (log2 entries) */
+#define LZ_MIN_MATCH 3     /* Shortest match worth a token */
+#define LZ_MAX_MATCH 18    /* Longest match a token can describe */
+#define LZ_MAX_LITERALS 128 /* Longest literal run a token can describe */
+#define LZ_CHUNK 128       /* Input bytes compressed at a time */
+#define LZ_CHUNK_MAX_OUT (LZ_CHUNK + 1) /* Most output bytes for one chunk */
+
+#define LZ_MATCH_FLAG 0x80 /* Top bit of a token's first byte marks a match */
+
+/* Matches can't reach into history the current chunk overwrites */
+#define LZ_MAX_DIST (LZ_WINDOW - LZ_CHUNK)
+
+/**
+ * Compression state (sending side)
+ */
+typedef struct lz_encoder {
+    uint32_t pos;                         /* Stream position of the next input byte */
+    uint8_t hist[LZ_WINDOW];              /* Last LZ_WINDOW input bytes, by position */
+    uint16_t head[1 << LZ_HASH_BITS];     /* Latest position (low 16 bits) for each hash */
+    uint8_t stage[LZ_CHUNK];              /* Staging area for tcp_write_reserve */
+} lz_encoder_t;
+
+/**
+ * Decompression state (receiving side)
+ */
+typedef struct lz_decoder {
+    uint32_t pos;            /* Stream position of the next output byte */
+    uint8_t hist[LZ_WINDOW]; /* Last LZ_WINDOW output bytes, by position */
+    uint8_t lit_remaining;   /* Literal bytes left in the current run */
+    uint8_t match_remaining; /* Bytes left to copy for the current match */
+    uint16_t match_dist;     /* Distance back to copy the current match from */
+} lz_decoder_t;
+
+/* Forward declarations for all functions */
+static inline void lz_encoder_init(lz_encoder_t *enc);
+static inline void lz_decoder_init(lz_decoder_t *dec);
+static inline size_t lz_compress_chunk(lz_encoder_t *enc, const uint8_t *data, size_t len,
+                                       uint8_t *out);
+static inline size_t lz_write(lz_encoder_t *enc, bytestream_t *bs, const uint8_t *data,
+                              size_t len);
+static inline size_t lz_read(lz_decoder_t *dec, bytestream_t *bs, uint8_t *data, size_t len);
+static inline bool lz_has_output(const lz_decoder_t *dec, const bytestream_t *bs);
+
+/**
+ * Initialize compression state for a new stream
+ *
+ * @param enc The encoder to initialize
+ */
+static inline void lz_encoder_init(lz_encoder_t *enc) {
+    assert(enc);
+    memset(enc, 0, sizeof(*enc));
+}
+
+/**
+ * Initialize decompression state for a new stream
+ *
+ * @param dec The decoder to initialize
+ */
+static inline void lz_decoder_init(lz_decoder_t *dec) {
+    assert(dec);
+    memset(dec, 0, sizeof(*dec));
+}
+
+/* Hash the 3 bytes at <p> */
+static inline uint32_t lz_hash(const uint8_t *p) {
+    uint32_t x = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (x * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Write literal-run tokens for <len> bytes at <data> to <out>, returning the bytes written */
+static inline size_t lz_emit_literals(const uint8_t *data, size_t len, uint8_t *out) {
+    size_t n = 0;
+    while (len > 0) {
+        size_t run = len < LZ_MAX_LITERALS ? len : LZ_MAX_LITERALS;
+        out[n++] = run - 1;
+        memcpy(out + n, data, run);
+        n += run;
+        data += run;
+        len -= run;
+    }
+    return n;
+}
+
+/**
+ * Compress one chunk of input
+ *
+ * @param enc The encoder
+ * @param data The input
+ * @param len The input length (at most LZ_CHUNK)
+ * @param out Buffer for the tokens (at least LZ_CHUNK_MAX_OUT bytes)
+ * @return The number of bytes written to <out>
+ */
+static inline size_t lz_compress_chunk(lz_encoder_t *enc, const uint8_t *data, size_t len,
+                                       uint8_t *out) {
+    assert(enc);
+    assert(data || len == 0);
+    assert(out);
+    assert(len <= LZ_CHUNK);
+
+    const uint32_t base = enc->pos;
+    const uint32_t mask = LZ_WINDOW - 1;
+
+    // Add the chunk to the history first, so matches can overlap the bytes they produce
+    for (size_t i = 0; i < len; i++) {
+        enc->hist[(base + i) & mask] = data[i];
+    }
+
+    size_t n = 0, i = 0, lit_start = 0;
+    while (i < len) {
+        size_t match_len = 0;
+        uint32_t dist = 0;
+
+        // Matches need 3 bytes to hash, and don't look past the end of the chunk
+        if (i + LZ_MIN_MATCH <= len) {
+            uint32_t here = base + i;
+            uint32_t h = lz_hash(data + i);
+            dist = (uint16_t)(here - enc->head[h]);
+            enc->head[h] = here;
+
+            if (dist >= 1 && dist <= LZ_MAX_DIST && dist <= here) {
+                size_t max_len = len - i < LZ_MAX_MATCH ? len - i : LZ_MAX_MATCH;
+                while (match_len < max_len &&
+                       enc->hist[(here - dist + match_len) & mask] == data[i + match_len]) {
+                    match_len++;
+                }
+            }
+        }
+
+        if (match_len < LZ_MIN_MATCH) {
+            i++;
+            continue;
+        }
+
+        n += lz_emit_literals(data + lit_start, i - lit_start, out + n);
+
+        uint32_t len_code = match_len - LZ_MIN_MATCH;
+        uint32_t dist_code = dist - 1;
+        out[n++] = LZ_MATCH_FLAG | (len_code << 3) | (dist_code >> 8);
+        out[n++] = dist_code & 0xFF;
+
+        // Hash the positions the match covered so later data can refer to them
+        for (size_t j = i + 1; j < i + match_len && j + LZ_MIN_MATCH <= len; j++) {
+            enc->head[lz_hash(data + j)] = base + j;
+        }
+
+        i += match_len;
+        lit_start = i;
+    }
+    n += lz_emit_literals(data + lit_start, len - lit_start, out + n);
+
+    enc->pos += len;
+    return n;
+}
+
+/**
+ * Compress data into a bytestream
+ * - Input is only taken while the worst-case output is sure to fit, so the compressed
+ *   stream never ends in the middle of a token.
+ *
+ * @param enc The encoder
+ * @param bs The bytestream to write the compressed data to
+ * @param data The uncompressed data
+ * @param len The length of the data
+ * @return The number of uncompressed bytes taken
+ */
+static inline size_t lz_write(lz_encoder_t *enc, bytestream_t *bs, const uint8_t *data,
+                              size_t len) {
+    assert(enc);
+    assert(bs);
+    assert(data || len == 0);
+
+    uint8_t out[LZ_CHUNK_MAX_OUT];
+    size_t taken = 0;
+    while (taken < len) {
+        size_t chunk = len - taken < LZ_CHUNK ? len - taken : LZ_CHUNK;
+        if (bs_remaining_capacity(bs) < chunk + 1) {
+            break;
+        }
+
+        size_t n = lz_compress_chunk(enc, data + taken, chunk, out);
+        bs_write(bs, out, n);
+        taken += chunk;
+    }
+    return taken;
+}
+
+/**
+ * Decompress data from a bytestream
+ *
+ * @param dec The decoder
+ * @param bs The bytestream holding compressed data
+ * @param data The buffer to decompress into
+ * @param len The size of the buffer
+ * @return The number of uncompressed bytes produced
+ */
+static inline size_t lz_read(lz_decoder_t *dec, bytestream_t *bs, uint8_t *data, size_t len) {
+    assert(dec);
+    assert(bs);
+    assert(data || len == 0);
+
+    const uint32_t mask = LZ_WINDOW - 1;
+    size_t n = 0;
+
+    while (n < len) {
+        // Finish the current match first (it may overlap the bytes it produces)
+        if (dec->match_remaining > 0) {
+            size_t copy = len - n < dec->match_remaining ? len - n : dec->match_remaining;
+            for (size_t i = 0; i < copy; i++) {
+                uint8_t b = dec->hist[(dec->pos - dec->match_dist) & mask];
+                dec->hist[dec->pos++ & mask] = b;
+                data[n++] = b;
+            }
+            dec->match_remaining -= copy;
+            continue;
+        }
+
+        // Then the current literal run, straight out of the bytestream
+        if (dec->lit_remaining > 0) {
+            size_t want = len - n < dec->lit_remaining ? len - n : dec->lit_remaining;
+            size_t got = bs_read(bs, data + n, want);
+            if (got == 0) {
+                break;
+            }
+            for (size_t i = 0; i < got; i++) {
+                dec->hist[dec->pos++ & mask] = data[n + i];
+            }
+            n += got;
+            dec->lit_remaining -= got;
+            continue;
+        }
+
+        // Start the next token, if all of its header has arrived
+        uint8_t token[2];
+        size_t avail = bs_peek(bs, token, 2);
+        if (avail == 0 || ((token[0] & LZ_MATCH_FLAG) && avail < 2)) {
+            break;
+        }
+
+        if (token[0] & LZ_MATCH_FLAG) {
+            bs_read(bs, token, 2);
+            dec->match_remaining = ((token[0] >> 3) & 0xF) + LZ_MIN_MATCH;
+            dec->match_dist = (((token[0] & 0x7) << 8) | token[1]) + 1;
+        } else {
+            bs_read(bs, token, 1);
+            dec->lit_remaining = token[0] + 1;
+        }
+    }
+    return n;
+}
+
+/**
+ * Check if lz_read would produce any data
+ *
+ * @param dec The decoder
+ * @param bs The bytestream holding compressed data
+ * @return True if at least one uncompressed byte can be read
+ */
+static inline bool lz_has_output(const lz_decoder_t *dec, const bytestream_t *bs) {
+    assert(dec);
+    assert(bs);
+
+    size_t avail = bs_bytes_available(bs);
+    if (dec->match_remaining > 0 || (dec->lit_remaining > 0 && avail > 0)) {
+        return true;
+    }
+
+    // A token header on its own produces nothing; anything after it does
+    return avail >= 2;
+}
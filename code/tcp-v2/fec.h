@@ -0,0 +1,210 @@
+#pragma once
+
+#include "rcp-header.h"
+
+/**
+ * Forward error correction for bulk transfers
+ *
+ * When FEC is on, the sender splits the new data it sends into groups of <k> segments and
+ * follows each group with one parity segment, so the receiver can rebuild one lost segment
+ * per group without waiting for a retransmission.
+ *
+ * Parity is computed over stream bytes rather than whole segments: parity byte j is the
+ * XOR of every byte in the group whose offset from the group's first byte is j modulo
+ * FEC_WIDTH. A lost segment is a run of at most FEC_WIDTH consecutive bytes, so it leaves at
+ * most one unknown byte in each column and can be rebuilt without knowing where the
+ * segment boundaries were. Segments are capped at FEC_WIDTH bytes while FEC is on.
+ *
+ * The group size can be fixed or follow the observed loss rate (see fec_note_segment).
+ */
+
+#define FEC_WIDTH (RCP_TOTAL_SIZE - RCP_COMPACT_PARITY_LENGTH) /* Parity bytes per group */
+#define FEC_MAX_GROUP 8      /* Most data segments one parity segment protects */
+#define FEC_MAX_SPAN (FEC_MAX_GROUP * FEC_WIDTH) /* Most stream bytes in a group (fits a byte) */
+#define FEC_HISTORY 256      /* Delivered bytes the receiver keeps for repairs (power of 2) */
+#define FEC_ADAPT_SEGS 64    /* Data segments per loss measurement in adaptive mode */
+#define FEC_MIN_LOSS_PCT 1   /* Loss rate (in percent) below which adaptive mode turns FEC off */
+
+/**
+ * Sender-side FEC state
+ */
+typedef struct fec_encoder {
+    uint8_t k;            /* Data segments per group (0 when FEC is off) */
+    bool adaptive;        /* Whether <k> follows the observed loss rate */
+    uint8_t n_segs;       /* Data segments in the current group */
+    uint16_t start_seqno; /* Sequence number of the current group's first byte */
+    uint8_t span;         /* Stream bytes in the current group */
+    uint8_t parity[FEC_WIDTH]; /* Column parity of the current group */
+
+    uint8_t window_segs;   /* Data segments sent in the current loss measurement */
+    uint8_t window_losses; /* Retransmissions in the current loss measurement */
+    uint8_t loss_pct;      /* Smoothed loss estimate (in percent) */
+} fec_encoder_t;
+
+/* Forward declarations for all functions */
+static inline fec_encoder_t fec_encoder_init(void);
+static inline bool fec_in_use(const fec_encoder_t *fec);
+static inline uint8_t fec_group_for_loss(uint8_t loss_pct);
+static inline void fec_set_group(fec_encoder_t *fec, uint8_t k, bool adaptive);
+static inline bool fec_add(fec_encoder_t *fec, uint16_t seqno, const uint8_t *data, size_t len);
+static inline void fec_take_parity(fec_encoder_t *fec, uint16_t *seqno, uint8_t *span,
+                                   uint8_t *parity);
+static inline void fec_note_segment(fec_encoder_t *fec);
+static inline void fec_note_loss(fec_encoder_t *fec);
+
+/**
+ * Initialize the sender-side FEC state (FEC starts off)
+ *
+ * @return Initialized FEC state
+ */
+static inline fec_encoder_t fec_encoder_init(void) {
+    fec_encoder_t fec;
+    memset(&fec, 0, sizeof(fec));
+    return fec;
+}
+
+/**
+ * Check if new data segments should be added to a group
+ * - A group that was started before FEC was turned off still gets its parity.
+ *
+ * @param fec The FEC state
+ * @return True if FEC is on or a group is still open
+ */
+static inline bool fec_in_use(const fec_encoder_t *fec) {
+    assert(fec);
+    return fec->k > 0 || fec->n_segs > 0;
+}
+
+/**
+ * Choose a group size for a loss rate
+ * - Aims for about half a lost packet per group (data plus parity), so that groups with
+ *   two losses, which FEC can't repair, stay rare.
+ *
+ * @param loss_pct The loss rate in percent
+ * @return Data segments per parity segment, or 0 to turn FEC off
+ */
+static inline uint8_t fec_group_for_loss(uint8_t loss_pct) {
+    if (loss_pct < FEC_MIN_LOSS_PCT) {
+        return 0;
+    }
+
+    uint8_t k = 50 / loss_pct;
+    return k < 2 ? 2 : k > FEC_MAX_GROUP ? FEC_MAX_GROUP : k;
+}
+
+/**
+ * Set the FEC group size
+ * - A new size takes effect at the next group.
+ *
+ * @param fec The FEC state
+ * @param k Data segments per parity segment (0 turns FEC off, larger than FEC_MAX_GROUP
+ *          is clamped); the starting size in adaptive mode
+ * @param adaptive Whether to retune <k> from the observed loss rate
+ */
+static inline void fec_set_group(fec_encoder_t *fec, uint8_t k, bool adaptive) {
+    assert(fec);
+
+    fec->k = k > FEC_MAX_GROUP ? FEC_MAX_GROUP : k;
+    fec->adaptive = adaptive;
+}
+
+/**
+ * Add a newly sent data segment to the current group
+ *
+ * @param fec The FEC state
+ * @param seqno Sequence number of the segment's first byte
+ * @param data The segment payload
+ * @param len The payload length (at most FEC_WIDTH)
+ * @return True if the group is complete and its parity should be sent
+ */
+static inline bool fec_add(fec_encoder_t *fec, uint16_t seqno, const uint8_t *data,
+                           size_t len) {
+    assert(fec);
+    assert(data || len == 0);
+    assert(len <= FEC_WIDTH);
+
+    if (fec->n_segs == 0) {
+        fec->start_seqno = seqno;
+        fec->span = 0;
+        memset(fec->parity, 0, FEC_WIDTH);
+    }
+
+    // Fold the bytes into their columns, continuing where the last segment stopped
+    size_t col = fec->span % FEC_WIDTH;
+    for (size_t i = 0; i < len; i++) {
+        fec->parity[col] ^= data[i];
+        if (++col == FEC_WIDTH) {
+            col = 0;
+        }
+    }
+
+    fec->span += len;
+    fec->n_segs++;
+    return fec->n_segs >= fec->k;
+}
+
+/**
+ * Take the parity of the current group and start a new one
+ *
+ * @param fec The FEC state
+ * @param seqno Set to the sequence number of the group's first byte
+ * @param span Set to the number of stream bytes the group covers
+ * @param parity Filled with the FEC_WIDTH parity bytes
+ */
+static inline void fec_take_parity(fec_encoder_t *fec, uint16_t *seqno, uint8_t *span,
+                                   uint8_t *parity) {
+    assert(fec);
+    assert(seqno);
+    assert(span);
+    assert(parity);
+
+    *seqno = fec->start_seqno;
+    *span = fec->span;
+    memcpy(parity, fec->parity, FEC_WIDTH);
+    fec->n_segs = 0;
+}
+
+/* Fold the current measurement into the loss estimate and retune the group size */
+static inline void fec_adapt(fec_encoder_t *fec) {
+    uint8_t losses =
+        fec->window_losses < fec->window_segs ? fec->window_losses : fec->window_segs;
+    uint8_t measured = losses * 100 / fec->window_segs;
+
+    // Repaired losses don't cause retransmissions, so the measured rate drops once FEC is
+    // working; let the estimate decay slowly instead of switching FEC back off right away
+    uint8_t decayed = fec->loss_pct * 3 / 4;
+    fec->loss_pct = measured > decayed ? measured : decayed;
+    fec->k = fec_group_for_loss(fec->loss_pct);
+
+    fec->window_segs = 0;
+    fec->window_losses = 0;
+}
+
+/**
+ * Count a newly sent data segment toward the loss measurement
+ *
+ * @param fec The FEC state
+ */
+static inline void fec_note_segment(fec_encoder_t *fec) {
+    assert(fec);
+
+    if (!fec->adaptive) {
+        return;
+    }
+    if (++fec->window_segs == FEC_ADAPT_SEGS) {
+        fec_adapt(fec);
+    }
+}
+
+/**
+ * Count a retransmission toward the loss measurement
+ *
+ * @param fec The FEC state
+ */
+static inline void fec_note_loss(fec_encoder_t *fec) {
+    assert(fec);
+
+    if (fec->adaptive && fec->window_losses < UINT8_MAX) {
+        fec->window_losses++;
+    }
+}
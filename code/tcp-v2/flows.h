@@ -0,0 +1,273 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "rpi.h"
+
+/**
+ * Router flow table
+ *
+ * Counts the traffic a router handles by (source, destination): packets, payload bytes,
+ * drops, and when each flow was last seen. Counting is a hash and a short probe, and the
+ * table is only printed every <dump_us> (see flows_tick), so the router can keep it on
+ * while it forwards at full speed instead of printing a line per packet.
+ *
+ * A line takes about 3 ms at 115200 baud, and even one is far longer than the radio's
+ * 3-packet RX FIFO lasts, so printk can't be used from the forwarding loop. flows_tick
+ * formats a line at a time into a buffer and only hands the UART as many bytes as its
+ * transmit FIFO has room for, so it never waits and the router drains the radio between
+ * calls. Other printk output in the meantime lands in the middle of the dump.
+ *
+ * The table is a fixed array of FLOW_SLOTS 16-byte entries with open addressing: a flow
+ * lives in the first free slot at or after its hash, and lookups probe at most
+ * FLOW_MAX_PROBE slots forward, so one usually touches a single cache line. When every
+ * slot in a new flow's probe window is taken, the one seen longest ago is reused in place
+ * (which keeps the other flows' probe chains intact) and counted as evicted.
+ *
+ * Dump format (one summary line, then a CSV header and one row per flow, busiest first):
+ *   FLOW-STATS: v=1 elapsed_us=<n> flows=<n> evicted=<n>
+ *   FLOW: src,dst,packets,bytes,drops,idle_ms
+ *   FLOW: <src>,<dst>,<packets>,<bytes>,<drops>,<idle_ms>
+ */
+
+#define FLOW_BITS 6                   /* Log2 of the entries in the table */
+#define FLOW_SLOTS (1 << FLOW_BITS)   /* Entries in the table */
+#define FLOW_MAX_PROBE 8              /* Most slots a lookup looks at */
+#define FLOW_DUMP_US 5000000          /* Default time between dumps */
+#define FLOW_MAX_DROPS 0xFFFF         /* Drop counts stop here */
+#define FLOW_LINE_MAX 80              /* Longest dump line, with its newline and NUL */
+
+/**
+ * Traffic from one source to one destination
+ */
+typedef struct flow {
+    uint8_t src;      /* Source RCP address */
+    uint8_t dst;      /* Destination RCP address */
+    uint16_t drops;   /* Packets dropped (up to FLOW_MAX_DROPS) */
+    uint32_t packets; /* Packets seen (0: the slot is free) */
+    uint32_t bytes;   /* Payload bytes seen */
+    uint32_t last_us; /* When the last packet was seen */
+} flow_t;
+
+/**
+ * Flow table for one router
+ * - <dump_us> may be changed after flows_init.
+ */
+typedef struct flows {
+    uint32_t dump_us;      /* Time between dumps (0: only dump on request) */
+    uint32_t next_dump_us; /* When the next dump is due */
+    uint32_t start_us;     /* When counting started */
+    uint32_t n_flows;      /* Slots in use */
+    uint32_t n_evicted;    /* Flows pushed out to make room for new ones */
+
+    bool dumping;                   /* A dump has lines left to format (see flows_tick) */
+    uint8_t dump_line;              /* Next line of it to format */
+    uint8_t dump_rows;              /* Flows in it */
+    uint32_t dump_start_us;         /* When it started */
+    uint8_t dump_order[FLOW_SLOTS]; /* Its flows' slots, busiest first */
+    uint8_t dump_sent;              /* Bytes of <dump_text> handed to the UART */
+    char dump_text[FLOW_LINE_MAX];  /* The line being sent ("" once it's all gone) */
+
+    flow_t slots[FLOW_SLOTS]; /* The table */
+} flows_t;
+
+/* Forward declarations for all functions */
+static inline void flows_init(flows_t *ft);
+static inline flow_t *flows_count(flows_t *ft, uint8_t src, uint8_t dst, uint32_t bytes);
+static inline flow_t *flows_find(flows_t *ft, uint8_t src, uint8_t dst);
+static inline void flow_drop(flow_t *flow);
+static inline void flows_dump(flows_t *ft);
+static inline bool flows_tick(flows_t *ft);
+
+/* Home slot of a flow */
+static inline unsigned flows_hash(uint8_t src, uint8_t dst) {
+    uint32_t key = src << 8 | dst;
+    return (key * 2654435761u) >> (32 - FLOW_BITS);
+}
+
+/**
+ * Start an empty flow table
+ *
+ * @param ft The flow table to initialize
+ */
+static inline void flows_init(flows_t *ft) {
+    assert(ft);
+
+    memset(ft, 0, sizeof(*ft));
+    ft->dump_us = FLOW_DUMP_US;
+    ft->start_us = timer_get_usec();
+    ft->next_dump_us = ft->start_us + ft->dump_us;
+}
+
+/**
+ * Count one packet, adding its flow if it's new
+ *
+ * @param ft The flow table
+ * @param src The packet's source RCP address
+ * @param dst The packet's destination RCP address
+ * @param bytes The packet's payload length
+ * @return The packet's flow (for flow_drop)
+ */
+static inline flow_t *flows_count(flows_t *ft, uint8_t src, uint8_t dst, uint32_t bytes) {
+    assert(ft);
+
+    uint32_t now_us = timer_get_usec();
+    unsigned home = flows_hash(src, dst);
+    flow_t *stalest = NULL;
+    flow_t *flow = NULL;
+    for (unsigned i = 0; i < FLOW_MAX_PROBE; i++) {
+        flow_t *f = &ft->slots[(home + i) & (FLOW_SLOTS - 1)];
+        if (f->packets == 0) {
+            ft->n_flows++;
+            flow = f;
+            break;
+        }
+        if (f->src == src && f->dst == dst) {
+            f->packets++;
+            f->bytes += bytes;
+            f->last_us = now_us;
+            return f;
+        }
+        if (!stalest || now_us - f->last_us > now_us - stalest->last_us) {
+            stalest = f;
+        }
+    }
+    if (!flow) {
+        flow = stalest;
+        ft->n_evicted++;
+    }
+
+    flow->src = src;
+    flow->dst = dst;
+    flow->drops = 0;
+    flow->packets = 1;
+    flow->bytes = bytes;
+    flow->last_us = now_us;
+    return flow;
+}
+
+/**
+ * Look up a flow without counting anything
+ *
+ * @param ft The flow table
+ * @param src The source RCP address
+ * @param dst The destination RCP address
+ * @return The flow, or NULL if it isn't in the table
+ */
+static inline flow_t *flows_find(flows_t *ft, uint8_t src, uint8_t dst) {
+    assert(ft);
+
+    unsigned home = flows_hash(src, dst);
+    for (unsigned i = 0; i < FLOW_MAX_PROBE; i++) {
+        flow_t *f = &ft->slots[(home + i) & (FLOW_SLOTS - 1)];
+        if (f->packets == 0) {
+            return NULL;
+        }
+        if (f->src == src && f->dst == dst) {
+            return f;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Count a dropped packet against its flow
+ *
+ * @param flow The flow (from flows_count or flows_find)
+ */
+static inline void flow_drop(flow_t *flow) {
+    assert(flow);
+    if (flow->drops < FLOW_MAX_DROPS) {
+        flow->drops++;
+    }
+}
+
+/* Start a dump: order the flows by packets, off the forwarding path */
+static inline void flows_dump_start(flows_t *ft) {
+    size_t n = 0;
+    for (size_t i = 0; i < FLOW_SLOTS; i++) {
+        uint32_t packets = ft->slots[i].packets;
+        if (packets == 0) {
+            continue;
+        }
+        size_t j = n++;
+        for (; j > 0 && ft->slots[ft->dump_order[j - 1]].packets < packets; j--) {
+            ft->dump_order[j] = ft->dump_order[j - 1];
+        }
+        ft->dump_order[j] = i;
+    }
+    ft->dumping = true;
+    ft->dump_line = 0;
+    ft->dump_rows = n;
+    ft->dump_start_us = timer_get_usec();
+}
+
+/* Format the next line of the dump in progress into <dump_text>
+   - Rows show each flow as it is when formatted. */
+static inline void flows_dump_line(flows_t *ft) {
+    uint32_t now_us = timer_get_usec();
+    unsigned line = ft->dump_line++;
+    char *text = ft->dump_text;
+    if (line == 0) {
+        snprintk(text, FLOW_LINE_MAX, "FLOW-STATS: v=1 elapsed_us=%u flows=%u evicted=%u\n",
+                 ft->dump_start_us - ft->start_us, ft->n_flows, ft->n_evicted);
+    } else if (line == 1) {
+        snprintk(text, FLOW_LINE_MAX, "FLOW: src,dst,packets,bytes,drops,idle_ms\n");
+    } else {
+        const flow_t *f = &ft->slots[ft->dump_order[line - 2]];
+        snprintk(text, FLOW_LINE_MAX, "FLOW: %u,%u,%u,%u,%u,%u\n", f->src, f->dst,
+                 f->packets, f->bytes, f->drops, (now_us - f->last_us) / 1000);
+    }
+    ft->dump_sent = 0;
+    ft->dumping = ft->dump_line < 2 + ft->dump_rows;
+}
+
+/**
+ * Print the whole table at once (see the format above), busiest flows first
+ * - Takes milliseconds per flow: a router should let flows_tick print it a bit at a time.
+ *
+ * @param ft The flow table
+ */
+static inline void flows_dump(flows_t *ft) {
+    assert(ft);
+
+    flows_dump_start(ft);
+    while (ft->dumping) {
+        flows_dump_line(ft);
+        printk("%s", ft->dump_text);
+    }
+    ft->dump_text[0] = 0;
+}
+
+/**
+ * Send the next bit of a dump, starting one if it's due
+ * - Each call only fills the UART's transmit FIFO (8 bytes on the mini UART) and never
+ *   waits for it, so the caller can handle packets between calls. The next dump is due
+ *   <dump_us> after this one started.
+ *
+ * @param ft The flow table
+ * @return True if a dump was in progress (call again until it isn't)
+ */
+static inline bool flows_tick(flows_t *ft) {
+    assert(ft);
+
+    char *text = ft->dump_text;
+    if (!ft->dumping && !text[ft->dump_sent]) {
+        uint32_t now_us = timer_get_usec();
+        if (ft->dump_us == 0 || (int32_t)(now_us - ft->next_dump_us) < 0) {
+            return false;
+        }
+        flows_dump_start(ft);
+        ft->next_dump_us = now_us + ft->dump_us;
+    }
+    while (uart_can_put8()) {
+        if (!text[ft->dump_sent]) {
+            if (!ft->dumping) {
+                break;
+            }
+            flows_dump_line(ft);
+        }
+        uart_put8(text[ft->dump_sent++]);
+    }
+    return true;
+}
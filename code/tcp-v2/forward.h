@@ -0,0 +1,817 @@
+#pragma once
+
+#include "flows.h"
+#include "fragment.h"
+#include "mcast.h"
+#include "outq.h"
+#include "rcp-batch.h"
+#include "router.h"
+#include "rpi-interrupts.h"
+
+/**
+ * Router fast path: forward packets without parsing them
+ *
+ * A router only needs to know where a packet is going, and the destination sits at the
+ * same offset in every wire form (full header, compact header, and fragment), so the
+ * forwarding loop reads that one byte out of the raw frame and sends the frame on as it
+ * arrived, one hop limit lighter. Each pass takes every whole packet queued on the
+ * receive radio in a batch (see rcp-batch.h) and sends them back to back, with no
+ * per-packet tracing.
+ *
+ * - Checksums aren't checked here: the frame goes out as it came in (the hop limit isn't
+ *   checksummed), and the endpoint verifies it. A corrupt destination byte just sends the
+ *   packet the wrong way (or drops it for lack of a route), where the checksum catches it.
+ * - Route updates (sent to RCP_BROADCAST) go to route_dv, if the router learns routes.
+ * - Multicast packets (see mcast.h) aren't forwarded as they are: they go to the router's
+ *   own multicast state (see fwd_use_mcast), which keeps each new chunk and sends it on.
+ * - With output queues (see fwd_use_outq and outq.h), frames are queued by next hop and
+ *   sent afterwards, ACKs first, and the receive queue is emptied again after each send.
+ * - In full-duplex mode (see fwd_start_duplex), one radio only receives and the other
+ *   only sends, so the router never turns a radio around and both run at once.
+ * - Each neighbor sends to its own receive pipe (see router_pipe_nbr), so the pipe the
+ *   radio tagged a frame with names the previous hop. Frames are counted by pipe, and a
+ *   frame whose next hop is the neighbor it came from is dropped: that's a routing loop.
+ * - Every frame sent on has its hop limit counted down, and one that arrives with none
+ *   left is dropped. With duplicate suppression (see fwd_use_dedup), a copy of a data
+ *   frame seen moments ago that comes back from a different neighbor is dropped too, so
+ *   a routing loop dies after one lap.
+ * - With hop-by-hop ARQ (see fwd_use_arq), each frame is sent with a hardware ACK, and
+ *   one the next hop never acknowledged is held and retried locally a few times, so a
+ *   loss on one hop costs that hop's RTT instead of an end-to-end RTO.
+ * - With a flow table (see fwd_use_flows and flows.h), every unicast frame is counted by
+ *   (source, destination), along with the ones dropped, and fwd_run dumps the table every
+ *   so often. Nothing is printed per packet. Compact frames leave out their source, so
+ *   they're counted under the neighbor they came from (see fwd_frame_src).
+ */
+
+#define FWD_BATCH_MAX RCP_BATCH_MAX /* Most packets taken off the queue at a time */
+#define FWD_ARQ_SLOTS 8              /* Most frames held for a local retry */
+#define FWD_ARQ_TRIES 3              /* Default local retries of an unacknowledged frame */
+#define FWD_DUP_BITS 6               /* Log2 of the entries in the duplicate table */
+#define FWD_DUP_US 20000             /* Default time copies of a data frame are dropped */
+
+typedef struct fwd fwd_t;
+
+/* Sends one frame (RCP_TOTAL_SIZE bytes) to <nrf_addr> */
+typedef void (*fwd_transmit_fn)(fwd_t *fwd, uint32_t nrf_addr, const uint8_t *frame);
+
+/* Takes a frame addressed to the router itself */
+typedef void (*fwd_deliver_fn)(fwd_t *fwd, const uint8_t *frame);
+
+/* Gets how many frames the transmit radio can take right now */
+typedef size_t (*fwd_room_fn)(fwd_t *fwd);
+
+/* Sends one frame to <nrf_addr> and says whether the next hop acknowledged it */
+typedef bool (*fwd_link_send_fn)(fwd_t *fwd, uint32_t nrf_addr, const uint8_t *frame);
+
+/**
+ * A frame waiting for a local retry
+ */
+typedef struct fwd_held {
+    uint32_t nrf_addr;             /* Next hop that didn't acknowledge it */
+    uint8_t tries;                 /* Local retries so far */
+    uint8_t src;                   /* Its source, for the flow table (see fwd_frame_src) */
+    uint8_t frame[RCP_TOTAL_SIZE]; /* The frame, as received */
+} fwd_held_t;
+
+/**
+ * A data frame recently forwarded (duplicate suppression)
+ */
+typedef struct fwd_dup {
+    bool in_use;       /* Whether the entry holds a frame */
+    uint64_t key;      /* The frame's identity (see rcp_frame_key) */
+    uint32_t prev_hop; /* NRF address of the neighbor it came from (0: unknown) */
+    uint32_t seen_us;  /* When it was first forwarded */
+} fwd_dup_t;
+
+/**
+ * Forwarding state for a router
+ */
+struct fwd {
+    nrf_t *rx;                  /* Radio packets arrive on */
+    nrf_t *tx;                  /* Radio packets are forwarded from */
+    uint8_t local_addr;         /* The router's own RCP address */
+    const uint32_t *rtable;     /* Fixed next hops by RCP address (used without route_dv) */
+    const uint32_t *pipe_nbr;   /* NRF address of the neighbor on each receive pipe */
+    fwd_transmit_fn transmit;   /* Sends a frame (nrf_send_noack on <tx> by default) */
+    fwd_deliver_fn deliver;     /* Takes frames for the router (NULL to drop them) */
+    void *arg;                  /* Passed through for <transmit> and <deliver> */
+    outq_t *outq;               /* Output queues (NULL to send each frame right away) */
+    fwd_room_fn tx_room;        /* Room on the transmit radio (NULL: send and wait) */
+    bool rx_intr;               /* The receive radio is drained from its interrupt */
+    uint32_t tx_addr;           /* Next hop of the frames last loaded to send */
+    fwd_link_send_fn link_send; /* Acked send for hop-by-hop ARQ (NULL without ARQ) */
+    uint8_t arq_tries;          /* Local retries before an unacknowledged frame is lost */
+    size_t n_held;              /* Frames in <held> */
+    uint32_t dup_us;            /* How long copies of a data frame are dropped (0: never) */
+    mcast_t *mcast;             /* Multicast group the router passes on (NULL: drop them) */
+    flows_t *flows;             /* Traffic by (source, destination) (NULL: not counted) */
+    uint8_t frame_src;          /* Source of the frame being forwarded (see fwd_frame_src) */
+    uint32_t pipes_mapped;      /* route_dv's <route_changes> when <pipe_src> was filled */
+
+    fwd_held_t held[FWD_ARQ_SLOTS];       /* Unacknowledged frames, oldest first */
+    fwd_dup_t dups[1 << FWD_DUP_BITS];    /* Data frames recently forwarded, by key hash */
+
+    uint8_t frames[FWD_BATCH_MAX][RCP_TOTAL_SIZE]; /* Batch copied out of the queue */
+
+    uint32_t n_forwarded;    /* Frames sent on to a next hop */
+    uint32_t n_no_route;     /* Frames dropped for lack of a route */
+    uint32_t n_local;        /* Frames addressed to the router itself */
+    uint32_t n_updates;      /* Route updates received */
+    uint32_t n_batches;      /* Non-empty batches taken off the queue */
+    uint32_t n_tx_loads;     /* Times frames were loaded onto the transmit radio */
+    uint32_t n_bounced;      /* Frames dropped for going back where they came from */
+    uint32_t n_link_retries; /* Local retransmissions (ARQ) */
+    uint32_t n_link_lost;    /* Frames the next hop never acknowledged (ARQ) */
+    uint32_t n_expired;      /* Frames dropped for running out of hops */
+    uint32_t n_duplicates;   /* Copies of recently forwarded data frames dropped */
+    uint32_t n_mcast;        /* Multicast packets received */
+
+    uint32_t n_from_pipe[NRF_NPIPES]; /* Frames received by pipe (previous hop) */
+    uint8_t pipe_src[NRF_NPIPES];     /* RCP address of the neighbor on each pipe */
+};
+
+/* Forward declarations for all functions */
+static inline uint8_t rcp_frame_dst(const uint8_t *frame);
+static inline uint8_t rcp_frame_src(const uint8_t *frame);
+static inline size_t rcp_frame_payload_len(const uint8_t *frame);
+static inline uint64_t rcp_frame_key(const uint8_t *frame);
+static inline uint8_t fwd_frame_src(const fwd_t *fwd, const uint8_t *frame, int pipe);
+static inline void fwd_init(fwd_t *fwd, nrf_t *rx, nrf_t *tx, uint8_t local_addr);
+static inline void fwd_use_outq(fwd_t *fwd, outq_t *outq);
+static inline void fwd_start_duplex(fwd_t *fwd, bool rx_intr);
+static inline void fwd_use_arq(fwd_t *fwd, uint8_t tries);
+static inline void fwd_use_dedup(fwd_t *fwd, uint32_t dup_us);
+static inline void fwd_use_mcast(fwd_t *fwd, mcast_t *mc);
+static inline void fwd_use_flows(fwd_t *fwd, flows_t *ft);
+static inline size_t fwd_arq_retry(fwd_t *fwd);
+static inline int fwd_intr(fwd_t *fwd);
+static inline void fwd_frame(fwd_t *fwd, uint8_t *frame);
+static inline void fwd_frame_from(fwd_t *fwd, uint8_t *frame, int pipe);
+static inline size_t fwd_drain_cq(fwd_t *fwd, cq_t *q);
+static inline size_t fwd_tx_refill(fwd_t *fwd);
+static inline size_t fwd_send_queued(fwd_t *fwd);
+static inline size_t fwd_poll(fwd_t *fwd);
+static inline void fwd_run(fwd_t *fwd);
+
+/**
+ * Read the destination RCP address straight out of a raw frame
+ * - Valid for every wire form: they all keep the destination right after the checksum.
+ *
+ * @param frame The frame as received
+ * @return The destination RCP address
+ */
+static inline uint8_t rcp_frame_dst(const uint8_t *frame) { return frame[1 + RCP_CKSUM_LENGTH]; }
+
+/**
+ * Read the source RCP address straight out of a raw frame
+ * - Full headers and fragments keep it right after the hop limit. Compact frames don't
+ *   carry it (their connection implies it), so they all count as RCP_BROADCAST: see
+ *   fwd_frame_src for a router's best guess.
+ *
+ * @param frame The frame as received
+ * @return The source RCP address, or RCP_BROADCAST for a compact frame
+ */
+static inline uint8_t rcp_frame_src(const uint8_t *frame) {
+    return frame[0] & RCP_COMPACT ? RCP_BROADCAST : frame[RCP_HOPS_OFFSET + 1];
+}
+
+/**
+ * Get the payload length of a raw frame of any form, from its first byte
+ *
+ * @param frame The frame as received
+ * @return The number of payload bytes it carries
+ */
+static inline size_t rcp_frame_payload_len(const uint8_t *frame) {
+    uint8_t first = frame[0];
+
+    if (first & RCP_COMPACT) {
+        if (first & RCP_COMPACT_DATA) {
+            return first & RCP_COMPACT_LEN_MASK;
+        }
+        return first & RCP_COMPACT_PARITY ? FEC_WIDTH : 0;
+    }
+    return rcp_is_fragment(frame) ? first & FRAG_LEN_MASK : first;
+}
+
+/**
+ * Identify a data frame by its source and sequence number, straight out of the raw frame
+ * - Full headers give (src, seqno) and fragments (src, datagram ID, index).
+ * - Compact frames don't carry their source, so they give (first byte, check value, dst,
+ *   seqno) instead. The check value covers the payload but not the hop limit, so every
+ *   copy of a frame has the same one, and two connections' frames to the same destination
+ *   only match if their sequence numbers and check values both do.
+ * - The top bits say which form the key came from, so different forms never match.
+ *
+ * @param frame The frame as received (a data frame)
+ * @return The frame's key
+ */
+static inline uint64_t rcp_frame_key(const uint8_t *frame) {
+    const uint8_t *fields = frame + RCP_HOPS_OFFSET + 1;  // Everything after the hop limit
+
+    if (frame[0] & RCP_COMPACT) {
+        uint64_t id = (uint64_t)frame[0] << 16 | rcp_packet_cksum_load(frame);
+        return id << 32 | rcp_frame_dst(frame) << 16 | fields[0] << 8 | fields[1];
+    }
+    if (frame[0] > RCP_MAX_PAYLOAD) {
+        return fields[0] << 16 | fields[1] << 8 | fields[2];  // A fragment
+    }
+    return 1u << 24 | fields[0] << 16 | fields[1] << 8 | fields[2];
+}
+
+/**
+ * Find the source of a frame a router received, for counting it
+ * - Compact frames are put down to the neighbor they came from (which is their source
+ *   when it sent them itself, as endpoints do), or RCP_BROADCAST if that's not known.
+ *
+ * @param fwd The forwarding state
+ * @param frame The frame as received
+ * @param pipe The receive pipe it arrived on (-1 if unknown)
+ * @return The source RCP address
+ */
+static inline uint8_t fwd_frame_src(const fwd_t *fwd, const uint8_t *frame, int pipe) {
+    if (!(frame[0] & RCP_COMPACT)) {
+        return rcp_frame_src(frame);
+    }
+    return pipe >= 0 && pipe < NRF_NPIPES ? fwd->pipe_src[pipe] : RCP_BROADCAST;
+}
+
+/* Work out the RCP address of the neighbor on each receive pipe, from the neighbors
+   route_dv has heard or the fixed table's next hops */
+static inline void fwd_map_pipes(fwd_t *fwd) {
+    for (int pipe = 0; pipe < NRF_NPIPES; pipe++) {
+        uint32_t nbr = fwd->pipe_nbr ? fwd->pipe_nbr[pipe] : 0;
+        fwd->pipe_src[pipe] = RCP_BROADCAST;
+        for (unsigned addr = 0; nbr && addr < DV_MAX_NODES; addr++) {
+            bool match = route_dv ? route_dv->neighbors[addr].in_use &&
+                                        route_dv->neighbors[addr].nrf_addr == nbr
+                                  : addr != fwd->local_addr && fwd->rtable[addr] == nbr;
+            if (match) {
+                fwd->pipe_src[pipe] = addr;
+                break;
+            }
+        }
+    }
+    fwd->pipes_mapped = route_dv ? route_dv->route_changes : 0;
+}
+
+/* Default transmit: send the frame from the router's transmit radio without an ACK */
+static inline void fwd_transmit_nrf(fwd_t *fwd, uint32_t nrf_addr, const uint8_t *frame) {
+    nrf_send_noack(fwd->tx, nrf_addr, frame, RCP_TOTAL_SIZE);
+}
+
+/* Full-duplex transmit: load the frame onto the transmit radio's FIFO without waiting */
+static inline void fwd_transmit_fifo(fwd_t *fwd, uint32_t nrf_addr, const uint8_t *frame) {
+    nrf_tx_load_noack(fwd->tx, nrf_addr, frame, RCP_TOTAL_SIZE);
+}
+
+/* ARQ link send: wait for the next hop's hardware ACK (nrf_send_ack returns 0 without)
+   - With learned routes, how the send went also feeds the next hop's link estimate. */
+static inline bool fwd_link_send_nrf(fwd_t *fwd, uint32_t nrf_addr, const uint8_t *frame) {
+    if (route_dv) {
+        uint8_t nbr = dv_hop_addr(route_dv, rcp_frame_dst(frame), nrf_addr);
+        return dv_link_send(route_dv, fwd->tx, nbr, nrf_addr, frame, RCP_TOTAL_SIZE) ==
+               RCP_TOTAL_SIZE;
+    }
+    return nrf_send_ack(fwd->tx, nrf_addr, frame, RCP_TOTAL_SIZE) == RCP_TOTAL_SIZE;
+}
+
+/* Count a drop against the frame's flow, if flows are counted */
+static inline void fwd_flow_drop(flow_t *flow) {
+    if (flow) {
+        flow_drop(flow);
+    }
+}
+
+/* Count a frame from <src> the next hop never acknowledged as lost (ARQ) */
+static inline void fwd_arq_lost(fwd_t *fwd, uint8_t src, const uint8_t *frame) {
+    fwd->n_link_lost++;
+    if (fwd->flows) {
+        fwd_flow_drop(flows_find(fwd->flows, src, rcp_frame_dst(frame)));
+    }
+}
+
+/* Hold an unacknowledged frame for a local retry (it's lost if there's no room)
+   - Only frames forwarded as they arrive have <frame_src> set: a compact frame sent
+     from the output queues has lost track of its pipe. */
+static inline void fwd_arq_hold(fwd_t *fwd, uint32_t nrf_addr, const uint8_t *frame) {
+    uint8_t src = frame[0] & RCP_COMPACT ? fwd->frame_src : rcp_frame_src(frame);
+    if (fwd->n_held == FWD_ARQ_SLOTS || fwd->arq_tries == 0) {
+        fwd_arq_lost(fwd, src, frame);
+        return;
+    }
+    fwd_held_t *h = &fwd->held[fwd->n_held++];
+    h->nrf_addr = nrf_addr;
+    h->tries = 0;
+    h->src = src;
+    memcpy(h->frame, frame, RCP_TOTAL_SIZE);
+}
+
+/* Whether frames for <nrf_addr> are being held */
+static inline bool fwd_arq_holding(fwd_t *fwd, uint32_t nrf_addr) {
+    for (size_t i = 0; i < fwd->n_held; i++) {
+        if (fwd->held[i].nrf_addr == nrf_addr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* ARQ transmit: a frame for a next hop that's already behind waits its turn, so frames
+   to each next hop stay in order and a dead link isn't tried once per frame */
+static inline void fwd_transmit_arq(fwd_t *fwd, uint32_t nrf_addr, const uint8_t *frame) {
+    if (fwd_arq_holding(fwd, nrf_addr) || !fwd->link_send(fwd, nrf_addr, frame)) {
+        fwd_arq_hold(fwd, nrf_addr, frame);
+    }
+}
+
+/* Whether this data frame went through moments ago and has come back around a loop (and
+   remember it if it's new) */
+static inline bool fwd_dup_seen(fwd_t *fwd, const uint8_t *frame, uint32_t prev_hop) {
+    uint64_t key = rcp_frame_key(frame);
+    uint32_t hash = (uint32_t)(key ^ key >> 32) * 2654435761u;
+    fwd_dup_t *d = &fwd->dups[hash >> (32 - FWD_DUP_BITS)];
+    uint32_t now_us = timer_get_usec();
+
+    if (d->in_use && d->key == key && now_us - d->seen_us < fwd->dup_us) {
+        // The same neighbor sending it again is a retransmission, not a loop
+        return prev_hop != d->prev_hop;
+    }
+    d->in_use = true;
+    d->key = key;
+    d->prev_hop = prev_hop;
+    d->seen_us = now_us;
+    return false;
+}
+
+/* Full-duplex room: what the transmit radio's FIFO can take */
+static inline size_t fwd_tx_room_nrf(fwd_t *fwd) { return nrf_tx_fifo_room(fwd->tx); }
+
+/* The pipe the frame at <offset> in <q> came in on (-1 if <q> isn't the radio's queue) */
+static inline int fwd_pipe(fwd_t *fwd, cq_t *q, unsigned offset) {
+    return fwd->rx && q == &fwd->rx->recvq ? nrf_pkt_pipe(fwd->rx, offset) : -1;
+}
+
+/* Move packets from the receive radio onto its queue, unless its interrupt does that */
+static inline void fwd_pull(fwd_t *fwd) {
+    if (fwd->rx && !fwd->rx_intr) {
+        nrf_nbytes_avail(fwd->rx);
+    }
+}
+
+/**
+ * Initialize a router's forwarding state
+ * - Next hops come from route_dv if it's set, and router_rtable otherwise.
+ * - Neighbors are told apart by receive pipe using router_pipe_nbr.
+ *
+ * @param fwd The forwarding state to initialize
+ * @param rx The radio packets arrive on (set up with nrf_init_piped, see ROUTER_USER1_ADDR)
+ * @param tx The radio to forward packets from (may be the same as <rx>)
+ * @param local_addr The router's own RCP address
+ */
+static inline void fwd_init(fwd_t *fwd, nrf_t *rx, nrf_t *tx, uint8_t local_addr) {
+    assert(fwd);
+
+    memset(fwd, 0, sizeof(*fwd));
+    fwd->rx = rx;
+    fwd->tx = tx;
+    fwd->local_addr = local_addr;
+    fwd->rtable = router_rtable;
+    fwd->pipe_nbr = router_pipe_nbr;
+    fwd->transmit = fwd_transmit_nrf;
+    fwd->frame_src = RCP_BROADCAST;
+    fwd_map_pipes(fwd);
+}
+
+/**
+ * Queue forwarded frames by next hop instead of sending them as they're handled
+ *
+ * @param fwd The forwarding state
+ * @param outq Initialized output queues (NULL to go back to sending right away)
+ */
+static inline void fwd_use_outq(fwd_t *fwd, outq_t *outq) {
+    assert(fwd);
+    fwd->outq = outq;
+}
+
+/**
+ * Run the router full duplex: <rx> only receives and <tx> only sends
+ * - <tx> leaves RX for good (nrf_tx_only). Queued frames are loaded onto its FIFO up to
+ *   NRF_TX_FIFO_DEPTH at a time, all for one next hop, and go out back to back while
+ *   the router goes on receiving. Needs output queues (fwd_use_outq) and two radios.
+ * - With <rx_intr>, the receive radio is drained into its queue from the interrupt
+ *   handler: call fwd_intr from interrupt_vector, then enable interrupts. Both radios
+ *   share the SPI bus, so the main loop keeps interrupts off while it talks to <tx>.
+ * - Neither radio can send route updates any more, so route_dv needs a radio of its own.
+ *
+ * @param fwd The forwarding state
+ * @param rx_intr Whether to drain the receive radio from its interrupt
+ */
+static inline void fwd_start_duplex(fwd_t *fwd, bool rx_intr) {
+    assert(fwd);
+    assert(fwd->outq);
+    assert(fwd->rx && fwd->tx && fwd->rx != fwd->tx);
+    assert(!fwd->link_send);  // FIFO loads go out without ACKs
+
+    nrf_tx_only(fwd->tx);
+    fwd->transmit = fwd_transmit_fifo;
+    fwd->tx_room = fwd_tx_room_nrf;
+    if (rx_intr) {
+        nrf_rx_intr_enable(fwd->rx);
+        fwd->rx_intr = true;
+    }
+}
+
+/**
+ * Retransmit unacknowledged frames locally (hop-by-hop ARQ)
+ * - Each forwarded frame goes out with a hardware ACK (nrf_send_ack), which already
+ *   retransmits it on its own; a frame still unacknowledged after that is held and
+ *   retried on later passes, up to <tries> times, while the router goes on receiving.
+ * - The transmit radio has to be set up for ACKs (nrf_init_acked), and so do the next
+ *   hops' receive pipes. Not for full-duplex mode, which sends without ACKs.
+ *
+ * @param fwd The forwarding state
+ * @param tries Local retries per frame (0 to send with ACKs but not retry)
+ */
+static inline void fwd_use_arq(fwd_t *fwd, uint8_t tries) {
+    assert(fwd);
+    assert(!fwd->tx_room);
+
+    fwd->transmit = fwd_transmit_arq;
+    fwd->link_send = fwd_link_send_nrf;
+    fwd->arq_tries = tries;
+}
+
+/**
+ * Drop copies of data frames forwarded moments ago that come back from another neighbor
+ * - A copy that comes back within <dup_us> from a different previous hop than the first
+ *   went around a routing loop. One from the same previous hop is a retransmission (a
+ *   fast retransmit, or a link-layer one whose ACK was lost) and is forwarded again.
+ *   Previous hops come from the receive pipe, so this needs a piped receive radio.
+ * - <dup_us> only has to cover a lap of a loop, and is kept short so a retransmission
+ *   that takes a new route soon after still gets through.
+ * - Only data frames (see rcp_frame_class) are checked: duplicate ACKs are sent on purpose.
+ *   That covers stream data too, in compact frames keyed by their check value in place of
+ *   the source they leave out (see rcp_frame_key). Two connections' frames to the same
+ *   destination, with the same sequence number and check value, from different
+ *   neighbors within <dup_us> look like a loop, and the second is dropped for the
+ *   sender to retransmit; that takes a 1 in 256 chance with the default checksum.
+ * - The table is direct-mapped: a collision forgets the older frame, and never drops a
+ *   frame that isn't a copy.
+ *
+ * @param fwd The forwarding state
+ * @param dup_us How long copies are dropped for (FWD_DUP_US by default; 0 to stop)
+ */
+static inline void fwd_use_dedup(fwd_t *fwd, uint32_t dup_us) {
+    assert(fwd);
+
+    fwd->dup_us = dup_us;
+    memset(fwd->dups, 0, sizeof(fwd->dups));
+}
+
+/**
+ * Pass on a multicast group's objects
+ * - Multicast packets for the group are handed to <mc>, and fwd_run ticks it. Its
+ *   broadcasts go out on its own NRF interface, so in full-duplex mode it needs a radio
+ *   of its own, as route_dv does.
+ *
+ * @param fwd The forwarding state
+ * @param mc The router's multicast state for the group (NULL to drop multicast packets)
+ */
+static inline void fwd_use_mcast(fwd_t *fwd, mcast_t *mc) {
+    assert(fwd);
+    fwd->mcast = mc;
+}
+
+/**
+ * Count traffic by (source, destination) in a flow table
+ * - Every unicast frame the router handles is counted, including those for the router
+ *   itself, and so is every one it drops: for lack of a route, hops, or queue space, as a
+ *   duplicate or a bounce, or (with ARQ) because the next hop never acknowledged it.
+ * - Compact frames are counted under the neighbor they came from (see fwd_frame_src),
+ *   worked out from <pipe_nbr> and the routes here; fwd_run keeps it up to date as
+ *   route_dv changes. Set <pipe_nbr> and <rtable> before this.
+ * - fwd_run dumps the table every <ft->dump_us>, handing the UART only what fits in its
+ *   transmit FIFO each pass so the radio is drained in between; otherwise call
+ *   flows_tick or flows_dump.
+ *
+ * @param fwd The forwarding state
+ * @param ft An initialized flow table (NULL to stop counting)
+ */
+static inline void fwd_use_flows(fwd_t *fwd, flows_t *ft) {
+    assert(fwd);
+    fwd->flows = ft;
+    fwd_map_pipes(fwd);
+}
+
+/**
+ * Retry every held frame once, oldest first
+ * - Once a next hop misses a retry, its other frames wait for the next pass.
+ *
+ * @param fwd The forwarding state (with ARQ)
+ * @return The number of held frames the next hop acknowledged this time
+ */
+static inline size_t fwd_arq_retry(fwd_t *fwd) {
+    assert(fwd);
+    assert(fwd->link_send);
+
+    uint32_t down[FWD_ARQ_SLOTS];
+    size_t n_down = 0;
+    size_t n_acked = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < fwd->n_held; i++) {
+        fwd_held_t *h = &fwd->held[i];
+        bool skip = false;
+        for (size_t j = 0; j < n_down && !skip; j++) {
+            skip = down[j] == h->nrf_addr;
+        }
+
+        if (!skip) {
+            fwd->n_link_retries++;
+            h->tries++;
+            if (fwd->link_send(fwd, h->nrf_addr, h->frame)) {
+                n_acked++;
+                continue;
+            }
+            down[n_down++] = h->nrf_addr;
+            if (h->tries >= fwd->arq_tries) {
+                fwd_arq_lost(fwd, h->src, h->frame);
+                continue;
+            }
+        }
+        if (kept != i) {
+            fwd->held[kept] = *h;
+        }
+        kept++;
+    }
+    fwd->n_held = kept;
+    return n_acked;
+}
+
+/**
+ * Handle the receive radio's interrupt (call from interrupt_vector)
+ *
+ * @param fwd The forwarding state
+ * @return The number of packets pulled off the radio (0 if it didn't interrupt)
+ */
+static inline int fwd_intr(fwd_t *fwd) { return nrf_rx_intr_handler(fwd->rx); }
+
+/**
+ * Forward, deliver, or drop one frame, going by its destination byte alone
+ *
+ * @param fwd The forwarding state
+ * @param frame The frame (RCP_TOTAL_SIZE bytes)
+ */
+static inline void fwd_frame(fwd_t *fwd, uint8_t *frame) { fwd_frame_from(fwd, frame, -1); }
+
+/**
+ * Forward, deliver, or drop one frame that arrived on a known receive pipe
+ *
+ * @param fwd The forwarding state
+ * @param frame The frame (RCP_TOTAL_SIZE bytes; its hop limit is counted down in place)
+ * @param pipe The receive pipe it arrived on (-1 if unknown)
+ */
+static inline void fwd_frame_from(fwd_t *fwd, uint8_t *frame, int pipe) {
+    uint8_t dst = rcp_frame_dst(frame);
+    uint32_t prev_hop = 0;
+    if (pipe >= 0 && pipe < NRF_NPIPES) {
+        fwd->n_from_pipe[pipe]++;
+        prev_hop = fwd->pipe_nbr ? fwd->pipe_nbr[pipe] : 0;
+    }
+
+    if (dst == RCP_BROADCAST) {
+        fwd->n_updates++;
+        if (route_dv) {
+            dv_process_packet(route_dv, frame, RCP_TOTAL_SIZE);
+        }
+        return;
+    }
+    if (rcp_is_mcast(dst)) {
+        fwd->n_mcast++;
+        if (fwd->mcast) {
+            mcast_process_packet(fwd->mcast, frame, RCP_TOTAL_SIZE);
+        }
+        return;
+    }
+
+    flow_t *flow = NULL;
+    uint8_t src = RCP_BROADCAST;
+    if (fwd->flows) {
+        src = fwd_frame_src(fwd, frame, pipe);
+        flow = flows_count(fwd->flows, src, dst, rcp_frame_payload_len(frame));
+    }
+    if (dst == fwd->local_addr) {
+        fwd->n_local++;
+        if (fwd->deliver) {
+            fwd->deliver(fwd, frame);
+        }
+        return;
+    }
+
+    if (frame[RCP_HOPS_OFFSET] == 0) {
+        fwd->n_expired++;
+        fwd_flow_drop(flow);
+        return;
+    }
+    if (fwd->dup_us && rcp_frame_class(frame) == OUTQ_DATA &&
+        fwd_dup_seen(fwd, frame, prev_hop)) {
+        fwd->n_duplicates++;
+        fwd_flow_drop(flow);
+        return;
+    }
+
+    uint32_t next_hop = route_dv ? route_next_hop(fwd->local_addr, dst) : fwd->rtable[dst];
+    if (!next_hop) {
+        fwd->n_no_route++;
+        fwd_flow_drop(flow);
+        return;
+    }
+    if (next_hop == prev_hop) {
+        fwd->n_bounced++;
+        fwd_flow_drop(flow);
+        return;
+    }
+
+    frame[RCP_HOPS_OFFSET]--;
+    if (fwd->outq) {
+        // The queues count their own drops
+        if (!outq_push(fwd->outq, next_hop, frame)) {
+            fwd_flow_drop(flow);
+        }
+        return;
+    }
+    fwd->frame_src = src;
+    fwd->transmit(fwd, next_hop, frame);
+    fwd->frame_src = RCP_BROADCAST;
+    fwd->n_forwarded++;
+}
+
+/**
+ * Forward every whole frame in a receive queue
+ * - Between frames, the receive radio's FIFO is emptied onto the queue, so packets that
+ *   arrive during a burst are neither lost nor left for the next pass.
+ * - Frames from the receive radio's own queue keep the pipe they arrived on.
+ *
+ * @param fwd The forwarding state
+ * @param q The queue to take frames from
+ * @return The number of frames handled
+ */
+static inline size_t fwd_drain_cq(fwd_t *fwd, cq_t *q) {
+    assert(fwd);
+    assert(q);
+
+    size_t total = 0;
+    int pipes[FWD_BATCH_MAX];
+    while (1) {
+        // Only frames already queued have their tags written (the driver tags a slot before
+        // pushing into it), so count them once and take no more than that
+        size_t n = cq_nelem(q) / RCP_TOTAL_SIZE;
+        if (n > FWD_BATCH_MAX) {
+            n = FWD_BATCH_MAX;
+        }
+        if (n == 0) {
+            break;
+        }
+        gcc_mb();
+
+        // Tags first: once a slot is popped, the receive interrupt may reuse it
+        for (size_t i = 0; i < n; i++) {
+            pipes[i] = fwd_pipe(fwd, q, q->tail + i * RCP_TOTAL_SIZE);
+        }
+        n = rcp_cq_pop_packets(q, &fwd->frames[0][0], n);
+        fwd->n_batches++;
+        for (size_t i = 0; i < n; i++) {
+            fwd_frame_from(fwd, fwd->frames[i], pipes[i]);
+            fwd_pull(fwd);
+        }
+        total += n;
+    }
+    return total;
+}
+
+/**
+ * Load queued frames onto the transmit radio, as many as it has room for
+ * - When the FIFO is empty, the next frame is picked by priority and the rest of the
+ *   load comes from the same next hop, since the FIFO shares one TX address. While it's
+ *   still sending, it's only topped up for that same next hop; a control frame for
+ *   another one waits at most for the FIFO to empty.
+ *
+ * @param fwd The forwarding state (full duplex)
+ * @return The number of frames loaded
+ */
+static inline size_t fwd_tx_refill(fwd_t *fwd) {
+    assert(fwd);
+    assert(fwd->outq && fwd->tx_room);
+
+    if (fwd->rx_intr) {
+        disable_interrupts();
+    }
+
+    uint8_t frame[RCP_TOTAL_SIZE];
+    size_t room = fwd->tx_room(fwd);
+    bool sending = room < NRF_TX_FIFO_DEPTH;
+    size_t n = 0;
+    for (; n < room; n++) {
+        uint32_t nrf_addr = fwd->tx_addr;
+        bool ok = sending || n > 0 ? outq_pop_from(fwd->outq, nrf_addr, frame)
+                                   : outq_pop(fwd->outq, &nrf_addr, frame);
+        if (!ok) {
+            break;
+        }
+        fwd->transmit(fwd, nrf_addr, frame);
+        fwd->tx_addr = nrf_addr;
+    }
+
+    if (fwd->rx_intr) {
+        enable_interrupts();
+    }
+
+    if (n > 0) {
+        fwd->n_forwarded += n;
+        fwd->n_tx_loads++;
+    }
+    return n;
+}
+
+/**
+ * Send as many frames as were queued when called
+ * - In full-duplex mode, this only loads what the transmit radio has room for, and the
+ *   rest waits for the next pass.
+ * - After each send, whatever arrived meanwhile is queued too, so a new ACK can still go
+ *   ahead of data that was already waiting. Those arrivals don't add to this call's
+ *   budget: at a busy next hop they'd keep coming as fast as frames leave, and the router
+ *   would never get back to its routes, retries and flow dumps.
+ *
+ * @param fwd The forwarding state (with output queues)
+ * @return The number of frames sent
+ */
+static inline size_t fwd_send_queued(fwd_t *fwd) {
+    assert(fwd);
+    assert(fwd->outq);
+
+    if (fwd->tx_room) {
+        return fwd_tx_refill(fwd);
+    }
+
+    uint8_t frame[RCP_TOTAL_SIZE];
+    uint32_t nrf_addr;
+    size_t n = 0;
+    size_t budget = outq_count(fwd->outq);
+    while (n < budget && outq_pop(fwd->outq, &nrf_addr, frame)) {
+        fwd->transmit(fwd, nrf_addr, frame);
+        fwd->n_forwarded++;
+        n++;
+        if (fwd->rx) {
+            fwd_pull(fwd);
+            fwd_drain_cq(fwd, &fwd->rx->recvq);
+        }
+    }
+    return n;
+}
+
+/**
+ * Forward everything the receive radio has, without blocking
+ *
+ * @param fwd The forwarding state
+ * @return The number of frames handled
+ */
+static inline size_t fwd_poll(fwd_t *fwd) {
+    assert(fwd);
+    assert(fwd->rx);
+
+    fwd_pull(fwd);
+    size_t n = fwd_drain_cq(fwd, &fwd->rx->recvq);
+    if (fwd->outq) {
+        fwd_send_queued(fwd);
+    }
+    if (fwd->n_held) {
+        fwd_arq_retry(fwd);
+    }
+    return n;
+}
+
+/**
+ * Forward packets forever, keeping learned routes up to date, multicast objects moving,
+ * and the flow table dumped
+ *
+ * @param fwd The forwarding state
+ */
+static inline void fwd_run(fwd_t *fwd) {
+    assert(fwd);
+
+    while (1) {
+        fwd_poll(fwd);
+        if (route_dv) {
+            dv_tick(route_dv);
+        }
+        if (fwd->mcast) {
+            mcast_tick(fwd->mcast);
+        }
+        if (fwd->flows) {
+            if (route_dv && route_dv->route_changes != fwd->pipes_mapped) {
+                fwd_map_pipes(fwd);
+            }
+            flows_tick(fwd->flows);
+        }
+    }
+}
@@ -0,0 +1,546 @@
+#pragma once
+
+#include "rcp-header.h"
+
+#include "nrf.h"
+#include "pi-random.h"
+#include "router.h"
+
+/**
+ * Connectionless RCP fragmentation
+ *
+ * Splits a datagram of up to FRAG_MAX_DATAGRAM bytes into numbered fragments that each fit
+ * in one NRF frame, and puts them back together at the destination. Nothing is
+ * acknowledged or retransmitted: a datagram that loses a fragment is dropped when its
+ * reassembly context times out. This is meant for traffic (e.g. telemetry bursts) that
+ * doesn't need the reliable stream in tcp.h.
+ *
+ * Fragment format (8 bytes of header with the default checksum):
+ * Byte 0:     0 | 1 | Payload Length (6 bits)
+ * Byte 1:     Checksum (1 byte; 2 bytes in the CRC modes, which shifts the rest by one)
+ * Byte 2:     Destination Address (1 byte)
+ * Byte 3:     Hop Limit (1 byte)
+ * Byte 4:     Source Address (1 byte)
+ * Byte 5:     Datagram ID (1 byte)
+ * Byte 6:     Fragment Index (1 byte)
+ * Byte 7:     Fragment Count (1 byte)
+ *
+ * A full RCP header starts with a payload length of at most RCP_MAX_PAYLOAD and a compact
+ * one has the top bit set, so 01 in the top two bits marks a fragment. The destination and
+ * hop limit are at the same offsets as in the other forms, so routers forward fragments
+ * like any other packet.
+ *
+ * Every fragment but the last carries exactly FRAG_MAX_PAYLOAD bytes, so a fragment's
+ * offset in the datagram is its index times FRAG_MAX_PAYLOAD.
+ *
+ * Reassembly contexts are keyed by (source, datagram ID), so several sources can be
+ * reassembled at once. Memory is bounded two ways: there are FRAG_MAX_CONTEXTS contexts,
+ * and each reassembles into its own stretch of one pool of FRAG_MEM_CAP bytes
+ * (FRAG_MAX_PAYLOAD per expected fragment), of which only the first <mem_cap> are used.
+ * When either runs out, the oldest incomplete datagram is evicted.
+ */
+
+#define FRAG_MARK 0x40      /* Top two bits of byte 0 of a fragment */
+#define FRAG_MARK_MASK 0xC0 /* Bits that identify a fragment */
+#define FRAG_LEN_MASK 0x3F  /* Payload length of a fragment */
+
+#define FRAG_HEADER_LENGTH (7 + RCP_CKSUM_LENGTH)                /* Fragment header length */
+#define FRAG_MAX_PAYLOAD (RCP_TOTAL_SIZE - FRAG_HEADER_LENGTH) /* Payload per fragment */
+
+#define FRAG_MAX_DATAGRAM 4096   /* Largest datagram that can be fragmented */
+#define FRAG_MAX_CONTEXTS 4      /* Datagrams that can be reassembled at once */
+#define FRAG_TIMEOUT_US 1000000  /* Default time to wait for a datagram's missing fragments */
+#define FRAG_MEM_CAP (2 * FRAG_MAX_DATAGRAM) /* Reassembly space shared by all contexts */
+
+/* Most fragments a datagram can have (fits the 1-byte count) */
+#define FRAG_MAX_COUNT ((FRAG_MAX_DATAGRAM + FRAG_MAX_PAYLOAD - 1) / FRAG_MAX_PAYLOAD)
+
+/**
+ * Header of a single fragment
+ */
+typedef struct frag_header {
+    uint8_t payload_len; /* Length of this fragment's payload */
+    uint16_t cksum;      /* Checksum covering header and payload (see rcp-checksum.h) */
+    uint8_t dst;         /* Destination address */
+    uint8_t hops;        /* Hop limit (see rcp-header.h) */
+    uint8_t src;         /* Source address */
+    uint8_t id;          /* Datagram ID, chosen by the source */
+    uint8_t index;       /* Position of this fragment in the datagram */
+    uint8_t count;       /* Number of fragments in the datagram */
+} frag_header_t;
+
+/**
+ * State for one datagram being reassembled
+ */
+typedef struct frag_ctx {
+    bool in_use;                         /* Whether this context holds a datagram */
+    bool complete;                       /* All fragments arrived; waiting for frag_recv */
+    uint8_t src;                         /* Source of the datagram */
+    uint8_t id;                          /* ID of the datagram */
+    uint8_t count;                       /* Number of fragments expected */
+    uint8_t n_received;                  /* Number of distinct fragments received */
+    uint16_t len;                        /* Datagram length (known once the last arrives) */
+    uint32_t first_us;                   /* Time the first fragment arrived */
+    uint32_t done_seq;                   /* Completion order, for delivering in order */
+    uint32_t received[(FRAG_MAX_COUNT + 31) / 32]; /* Bitmap of received fragments */
+    uint8_t *data;                       /* Reassembly buffer, in the pool */
+} frag_ctx_t;
+
+/**
+ * Fragmentation layer state for one node
+ * - <timeout_us> and <mem_cap> may be changed after frag_init.
+ */
+typedef struct frag {
+    nrf_t *nrf;          /* NRF interface used to send and receive fragments */
+    uint8_t local_addr;  /* Local RCP address */
+    uint8_t next_id;     /* ID to give the next datagram we send */
+    uint32_t timeout_us; /* Time to wait for a datagram's missing fragments */
+    size_t mem_cap;      /* Cap on the pool space used (at most FRAG_MEM_CAP) */
+    size_t mem_used;     /* Reassembly space currently reserved */
+    uint32_t done_seq;   /* Number of datagrams completed so far */
+
+    frag_ctx_t ctx[FRAG_MAX_CONTEXTS]; /* Reassembly contexts */
+    uint8_t pool[FRAG_MEM_CAP];        /* Reassembly space, shared out to the contexts */
+
+    uint32_t frags_sent;     /* Fragments transmitted */
+    uint32_t frags_recv;     /* Valid fragments for us received */
+    uint32_t dgrams_sent;    /* Datagrams transmitted */
+    uint32_t dgrams_recv;    /* Datagrams fully reassembled */
+    uint32_t timeouts;       /* Incomplete datagrams dropped by the timeout */
+    uint32_t evictions;      /* Incomplete datagrams dropped to make room */
+    uint32_t drops;          /* Fragments dropped because no context could be found */
+} frag_t;
+
+/* Forward declarations for all functions */
+static inline bool rcp_is_fragment(const uint8_t *data);
+static inline int frag_encode(const frag_header_t *hdr, const uint8_t *payload, uint8_t *data,
+                              size_t max_length);
+static inline int frag_decode(frag_header_t *hdr, const uint8_t **payload, const uint8_t *data,
+                              size_t length);
+static inline void frag_init(frag_t *frag, nrf_t *nrf, uint8_t local_addr);
+static inline bool frag_send(frag_t *frag, uint8_t dst, const void *data, size_t len);
+static inline bool frag_process_packet(frag_t *frag, const uint8_t *data, size_t length);
+static inline void frag_check_incoming(frag_t *frag);
+static inline void frag_check_timeouts(frag_t *frag);
+static inline void frag_tick(frag_t *frag);
+static inline bool frag_has_datagram(const frag_t *frag);
+static inline int frag_recv(frag_t *frag, uint8_t *src, uint8_t *data, size_t len);
+
+/**
+ * Check if a packet is a fragment
+ *
+ * @param data The packet
+ * @return True if the packet has a fragment header
+ */
+static inline bool rcp_is_fragment(const uint8_t *data) {
+    assert(data);
+    return (data[0] & FRAG_MARK_MASK) == FRAG_MARK;
+}
+
+/**
+ * Serialize a fragment and fill in its checksum
+ *
+ * @param hdr The fragment header (the checksum field is ignored)
+ * @param payload The fragment payload (hdr->payload_len bytes)
+ * @param data The buffer to write the fragment to
+ * @param max_length The size of <data>
+ * @return Number of bytes written, or -1 if the fragment doesn't fit
+ */
+static inline int frag_encode(const frag_header_t *hdr, const uint8_t *payload, uint8_t *data,
+                              size_t max_length) {
+    assert(hdr);
+    assert(data);
+    assert(payload || hdr->payload_len == 0);
+
+    size_t total_length = FRAG_HEADER_LENGTH + hdr->payload_len;
+    if (hdr->payload_len > FRAG_MAX_PAYLOAD || max_length < total_length) {
+        return -1;
+    }
+
+    uint8_t *fields = data + 1 + RCP_CKSUM_LENGTH;
+    data[0] = FRAG_MARK | hdr->payload_len;
+    fields[0] = hdr->dst;
+    fields[1] = hdr->hops;
+    fields[2] = hdr->src;
+    fields[3] = hdr->id;
+    fields[4] = hdr->index;
+    fields[5] = hdr->count;
+    if (hdr->payload_len > 0) {
+        memcpy(data + FRAG_HEADER_LENGTH, payload, hdr->payload_len);
+    }
+
+    rcp_packet_cksum_store(data, rcp_packet_checksum(data, total_length));
+    return total_length;
+}
+
+/**
+ * Parse and verify a fragment
+ *
+ * @param hdr The header to fill in
+ * @param payload Set to the fragment's payload, which stays in <data>
+ * @param data The received packet
+ * @param length The number of bytes received
+ * @return True if the fragment is well-formed and its checksum matches
+ */
+static inline int frag_decode(frag_header_t *hdr, const uint8_t **payload, const uint8_t *data,
+                              size_t length) {
+    assert(hdr);
+    assert(payload);
+    assert(data);
+
+    if (length < FRAG_HEADER_LENGTH || !rcp_is_fragment(data)) {
+        return 0;
+    }
+
+    size_t payload_len = data[0] & FRAG_LEN_MASK;
+    size_t total_length = FRAG_HEADER_LENGTH + payload_len;
+    if (payload_len > FRAG_MAX_PAYLOAD || length < total_length) {
+        return 0;  // Invalid length or not enough data
+    }
+
+    if (rcp_packet_checksum(data, total_length) != rcp_packet_cksum_load(data)) {
+        return 0;  // Invalid checksum
+    }
+
+    const uint8_t *fields = data + 1 + RCP_CKSUM_LENGTH;
+    hdr->payload_len = payload_len;
+    hdr->cksum = rcp_packet_cksum_load(data);
+    hdr->dst = fields[0];
+    hdr->hops = fields[1];
+    hdr->src = fields[2];
+    hdr->id = fields[3];
+    hdr->index = fields[4];
+    hdr->count = fields[5];
+
+    // Every fragment but the last is full, and the datagram has to fit in a context
+    if (hdr->count == 0 || hdr->count > FRAG_MAX_COUNT || hdr->index >= hdr->count) {
+        return 0;
+    }
+    if (hdr->index + 1 < hdr->count && payload_len != FRAG_MAX_PAYLOAD) {
+        return 0;
+    }
+    if (hdr->index * FRAG_MAX_PAYLOAD + payload_len > FRAG_MAX_DATAGRAM) {
+        return 0;  // The last of FRAG_MAX_COUNT fragments can only be partly full
+    }
+
+    *payload = data + FRAG_HEADER_LENGTH;
+    return 1;
+}
+
+/**
+ * Initialize the fragmentation layer in place
+ *
+ * @param frag The fragmentation layer to initialize
+ * @param nrf The NRF interface to send and receive fragments on
+ * @param local_addr The local RCP address
+ */
+static inline void frag_init(frag_t *frag, nrf_t *nrf, uint8_t local_addr) {
+    assert(frag);
+
+    memset(frag, 0, sizeof(*frag));
+    frag->nrf = nrf;
+    frag->local_addr = local_addr;
+    frag->next_id = pi_random();
+    frag->timeout_us = FRAG_TIMEOUT_US;
+    frag->mem_cap = FRAG_MEM_CAP;
+}
+
+/**
+ * Split a datagram into fragments and send them to <dst>
+ *
+ * @param frag The fragmentation layer
+ * @param dst The destination RCP address
+ * @param data The datagram
+ * @param len The datagram length (at most FRAG_MAX_DATAGRAM)
+ * @return True if the datagram was sent
+ */
+static inline bool frag_send(frag_t *frag, uint8_t dst, const void *data, size_t len) {
+    assert(frag);
+    assert(data || len == 0);
+
+    if (len > FRAG_MAX_DATAGRAM) {
+        return false;
+    }
+
+    /* Get the next hop NRF address from the routing table */
+    uint32_t next_hop_nrf = route_next_hop(frag->local_addr, dst);
+
+    frag_header_t hdr = {
+        .dst = dst,
+        .hops = RCP_DEFAULT_HOPS,
+        .src = frag->local_addr,
+        .id = frag->next_id++,
+        .count = len ? (len + FRAG_MAX_PAYLOAD - 1) / FRAG_MAX_PAYLOAD : 1,
+    };
+
+    const uint8_t *bytes = data;
+    uint8_t buffer[RCP_TOTAL_SIZE];
+    for (size_t i = 0; i < hdr.count; i++) {
+        size_t offset = i * FRAG_MAX_PAYLOAD;
+        hdr.index = i;
+        hdr.payload_len = len - offset < FRAG_MAX_PAYLOAD ? len - offset : FRAG_MAX_PAYLOAD;
+
+        int length = frag_encode(&hdr, bytes + offset, buffer, sizeof(buffer));
+        nrf_send_noack(frag->nrf, next_hop_nrf, buffer, length);
+        frag->frags_sent++;
+    }
+
+    frag->dgrams_sent++;
+    return true;
+}
+
+/* Release a context and the space it reserved */
+static inline void frag_ctx_release(frag_t *frag, frag_ctx_t *ctx) {
+    frag->mem_used -= ctx->count * FRAG_MAX_PAYLOAD;
+    ctx->in_use = false;
+}
+
+/* Find the context reassembling datagram <id> from <src>, or NULL */
+static inline frag_ctx_t *frag_ctx_find(frag_t *frag, uint8_t src, uint8_t id) {
+    for (size_t i = 0; i < FRAG_MAX_CONTEXTS; i++) {
+        frag_ctx_t *ctx = &frag->ctx[i];
+        if (ctx->in_use && ctx->src == src && ctx->id == id) {
+            return ctx;
+        }
+    }
+    return NULL;
+}
+
+/* Find <reserve> free bytes in the first <mem_cap> of the pool, right at its start or
+   right after some context's space. Returns NULL if no gap is big enough. */
+static inline uint8_t *frag_pool_fit(frag_t *frag, size_t reserve) {
+    for (size_t i = 0; i <= FRAG_MAX_CONTEXTS; i++) {
+        size_t start = 0;
+        if (i < FRAG_MAX_CONTEXTS) {
+            frag_ctx_t *ctx = &frag->ctx[i];
+            if (!ctx->in_use) {
+                continue;
+            }
+            start = ctx->data - frag->pool + ctx->count * FRAG_MAX_PAYLOAD;
+        }
+        if (start + reserve > frag->mem_cap) {
+            continue;
+        }
+
+        size_t j = 0;
+        for (; j < FRAG_MAX_CONTEXTS; j++) {
+            frag_ctx_t *ctx = &frag->ctx[j];
+            size_t ctx_start = ctx->in_use ? ctx->data - frag->pool : 0;
+            if (ctx->in_use && ctx_start < start + reserve &&
+                start < ctx_start + ctx->count * FRAG_MAX_PAYLOAD) {
+                break;  // Overlaps this context's space
+            }
+        }
+        if (j == FRAG_MAX_CONTEXTS) {
+            return frag->pool + start;
+        }
+    }
+    return NULL;
+}
+
+/* Get a context for a new datagram, evicting the oldest incomplete ones if we're out of
+   contexts or space. Returns NULL if there's no room even then. */
+static inline frag_ctx_t *frag_ctx_alloc(frag_t *frag, const frag_header_t *hdr) {
+    assert(frag->mem_cap <= FRAG_MEM_CAP);
+
+    size_t reserve = hdr->count * FRAG_MAX_PAYLOAD;
+    if (reserve > frag->mem_cap) {
+        return NULL;
+    }
+
+    while (1) {
+        frag_ctx_t *free_ctx = NULL;
+        frag_ctx_t *oldest = NULL;
+        uint32_t now = timer_get_usec();
+
+        for (size_t i = 0; i < FRAG_MAX_CONTEXTS; i++) {
+            frag_ctx_t *ctx = &frag->ctx[i];
+            if (!ctx->in_use) {
+                free_ctx = ctx;
+            } else if (!ctx->complete &&
+                       (!oldest || now - ctx->first_us > now - oldest->first_us)) {
+                oldest = ctx;
+            }
+        }
+
+        uint8_t *space = free_ctx ? frag_pool_fit(frag, reserve) : NULL;
+        if (space) {
+            free_ctx->in_use = true;
+            free_ctx->data = space;
+            free_ctx->complete = false;
+            free_ctx->src = hdr->src;
+            free_ctx->id = hdr->id;
+            free_ctx->count = hdr->count;
+            free_ctx->n_received = 0;
+            free_ctx->len = 0;
+            free_ctx->first_us = now;
+            memset(free_ctx->received, 0, sizeof(free_ctx->received));
+            frag->mem_used += reserve;
+            return free_ctx;
+        }
+
+        // Completed datagrams are never evicted: they're only waiting to be read (so the
+        // space they leave between them may be too short even with room to spare)
+        if (!oldest) {
+            return NULL;
+        }
+        frag_ctx_release(frag, oldest);
+        frag->evictions++;
+    }
+}
+
+/**
+ * Process a packet that may be a fragment
+ * - Use this when the NRF interface is shared with other traffic; frag_check_incoming
+ *   reads the interface itself.
+ *
+ * @param frag The fragmentation layer
+ * @param data The received packet
+ * @param length The number of bytes received
+ * @return True if the packet was a valid fragment addressed to us
+ */
+static inline bool frag_process_packet(frag_t *frag, const uint8_t *data, size_t length) {
+    assert(frag);
+    assert(data);
+
+    frag_header_t hdr;
+    const uint8_t *payload;
+    if (!frag_decode(&hdr, &payload, data, length) || hdr.dst != frag->local_addr) {
+        return false;
+    }
+    frag->frags_recv++;
+
+    frag_ctx_t *ctx = frag_ctx_find(frag, hdr.src, hdr.id);
+    if (!ctx) {
+        ctx = frag_ctx_alloc(frag, &hdr);
+        if (!ctx) {
+            frag->drops++;
+            return true;
+        }
+    }
+
+    // Ignore duplicates and fragments that disagree with the ones we already have
+    uint32_t bit = 1u << (hdr.index % 32);
+    if (ctx->complete || hdr.count != ctx->count || (ctx->received[hdr.index / 32] & bit)) {
+        return true;
+    }
+
+    size_t offset = hdr.index * FRAG_MAX_PAYLOAD;
+    memcpy(ctx->data + offset, payload, hdr.payload_len);
+    ctx->received[hdr.index / 32] |= bit;
+    ctx->n_received++;
+
+    if (hdr.index + 1 == hdr.count) {
+        ctx->len = offset + hdr.payload_len;
+    }
+
+    if (ctx->n_received == ctx->count) {
+        ctx->complete = true;
+        ctx->done_seq = frag->done_seq++;
+        frag->dgrams_recv++;
+    }
+    return true;
+}
+
+/**
+ * Check for and process one incoming fragment
+ *
+ * @param frag The fragmentation layer
+ */
+static inline void frag_check_incoming(frag_t *frag) {
+    assert(frag);
+
+    uint8_t buffer[RCP_TOTAL_SIZE];
+
+    /* Try to receive a packet from NRF with a 1 ms timeout */
+    int ret = nrf_read_exact_timeout(frag->nrf, buffer, RCP_TOTAL_SIZE, 1000);
+    if (ret <= 0) {
+        return; /* No data or error */
+    }
+
+    frag_process_packet(frag, buffer, ret);
+}
+
+/**
+ * Drop incomplete datagrams that have waited longer than the timeout
+ *
+ * @param frag The fragmentation layer
+ */
+static inline void frag_check_timeouts(frag_t *frag) {
+    assert(frag);
+
+    uint32_t now = timer_get_usec();
+    for (size_t i = 0; i < FRAG_MAX_CONTEXTS; i++) {
+        frag_ctx_t *ctx = &frag->ctx[i];
+        if (ctx->in_use && !ctx->complete && now - ctx->first_us >= frag->timeout_us) {
+            frag_ctx_release(frag, ctx);
+            frag->timeouts++;
+        }
+    }
+}
+
+/**
+ * Process incoming fragments and expire stale datagrams
+ *
+ * @param frag The fragmentation layer
+ */
+static inline void frag_tick(frag_t *frag) {
+    assert(frag);
+
+    frag_check_incoming(frag);
+    frag_check_timeouts(frag);
+}
+
+/**
+ * Check if a reassembled datagram is waiting to be read
+ *
+ * @param frag The fragmentation layer
+ * @return True if frag_recv would return a datagram
+ */
+static inline bool frag_has_datagram(const frag_t *frag) {
+    assert(frag);
+
+    for (size_t i = 0; i < FRAG_MAX_CONTEXTS; i++) {
+        if (frag->ctx[i].in_use && frag->ctx[i].complete) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Read the reassembled datagram that was completed first
+ *
+ * @param frag The fragmentation layer
+ * @param src Set to the datagram's source address (may be NULL)
+ * @param data The buffer to copy the datagram into
+ * @param len The size of <data>
+ * @return The datagram length, or -1 if there is none or it doesn't fit in <data> (it is
+ *         left in place)
+ */
+static inline int frag_recv(frag_t *frag, uint8_t *src, uint8_t *data, size_t len) {
+    assert(frag);
+    assert(data || len == 0);
+
+    frag_ctx_t *first = NULL;
+    for (size_t i = 0; i < FRAG_MAX_CONTEXTS; i++) {
+        frag_ctx_t *ctx = &frag->ctx[i];
+        if (ctx->in_use && ctx->complete &&
+            (!first || ctx->done_seq - frag->done_seq < first->done_seq - frag->done_seq)) {
+            first = ctx;
+        }
+    }
+
+    if (!first || first->len > len) {
+        return -1;
+    }
+
+    if (src) {
+        *src = first->src;
+    }
+    memcpy(data, first->data, first->len);
+
+    int ret = first->len;
+    frag_ctx_release(frag, first);
+    return ret;
+}
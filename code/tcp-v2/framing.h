@@ -0,0 +1,149 @@
+#pragma once
+
+#include "bytestream.h"
+
+/**
+ * Message framing on top of a bytestream
+ *
+ * Each message is written as a 1-byte length followed by the message bytes, so several
+ * small messages can share one segment and boundaries survive the byte stream.
+ *
+ * On the receiving side, the framer remembers where the next unparsed frame header is
+ * (as a stream index) and how many complete messages are buffered. Every header is
+ * parsed exactly once as bytes arrive, so checking for a complete message is O(1) and
+ * never rescans the stream.
+ */
+
+#define MSG_HEADER_LEN 1       /* Length prefix size in bytes */
+#define MSG_MAX_LEN UINT8_MAX /* Largest message the length prefix can describe */
+
+/**
+ * Receive-side framing state
+ */
+typedef struct msg_framer {
+    size_t scan_idx;   /* Stream index of the next frame header that hasn't been parsed */
+    size_t n_complete; /* Number of complete messages buffered in the stream */
+} msg_framer_t;
+
+/* Forward declarations for all functions */
+static inline msg_framer_t framer_init(void);
+static inline bool framer_write(bytestream_t *bs, const uint8_t *data, size_t len);
+static inline void framer_scan(msg_framer_t *framer, const bytestream_t *bs);
+static inline bool framer_has_msg(const msg_framer_t *framer);
+static inline int framer_read(msg_framer_t *framer, bytestream_t *bs, uint8_t *data, size_t len);
+
+/**
+ * Initialize a framer for a fresh bytestream
+ *
+ * @return Initialized framer structure
+ */
+static inline msg_framer_t framer_init(void) {
+    msg_framer_t framer = {
+        .scan_idx = 0,
+        .n_complete = 0,
+    };
+    return framer;
+}
+
+/**
+ * Write one message to the bytestream
+ * - The message is written whole or not at all, so a full stream never splits a frame.
+ *
+ * @param bs Pointer to the bytestream to write to
+ * @param data The message bytes
+ * @param len The message length (at most MSG_MAX_LEN)
+ * @return True if the message was written
+ */
+static inline bool framer_write(bytestream_t *bs, const uint8_t *data, size_t len) {
+    assert(bs);
+    assert(data || len == 0);
+
+    if (len > MSG_MAX_LEN || bs_remaining_capacity(bs) < MSG_HEADER_LEN + len) {
+        return false;
+    }
+
+    uint8_t header = len;
+    bs_write(bs, &header, MSG_HEADER_LEN);
+    if (len > 0) {
+        bs_write(bs, data, len);
+    }
+    return true;
+}
+
+/**
+ * Parse any frame headers that became complete since the last scan
+ * - Call after new bytes are written to the bytestream.
+ *
+ * @param framer The framer to update
+ * @param bs The bytestream the messages are arriving on
+ */
+static inline void framer_scan(msg_framer_t *framer, const bytestream_t *bs) {
+    assert(framer);
+    assert(bs);
+
+    const size_t end_idx = bs_bytes_written(bs);
+    const size_t popped_idx = bs_bytes_popped(bs);
+
+    while (framer->scan_idx + MSG_HEADER_LEN <= end_idx) {
+        uint8_t header = 0;
+        bs_peek_at(bs, framer->scan_idx - popped_idx, &header, MSG_HEADER_LEN);
+
+        // Stop at the first message whose body hasn't fully arrived
+        size_t frame_end_idx = framer->scan_idx + MSG_HEADER_LEN + header;
+        if (frame_end_idx > end_idx) {
+            break;
+        }
+
+        framer->scan_idx = frame_end_idx;
+        framer->n_complete++;
+    }
+}
+
+/**
+ * Check if a complete message is buffered
+ *
+ * @param framer The framer to check
+ * @return True if framer_read would return a message
+ */
+static inline bool framer_has_msg(const msg_framer_t *framer) {
+    assert(framer);
+    return framer->n_complete > 0;
+}
+
+/**
+ * Read the next complete message from the bytestream
+ * - If <len> is smaller than the message, the message is truncated and the rest of it
+ *   is discarded.
+ *
+ * @param framer The framer tracking the bytestream
+ * @param bs The bytestream to read from
+ * @param data Buffer where the message will be stored
+ * @param len The size of the buffer
+ * @return The length of the message, or -1 if no complete message is buffered
+ */
+static inline int framer_read(msg_framer_t *framer, bytestream_t *bs, uint8_t *data, size_t len) {
+    assert(framer);
+    assert(bs);
+    assert(data || len == 0);
+
+    if (!framer_has_msg(framer)) {
+        return -1;
+    }
+
+    uint8_t header = 0;
+    bs_read(bs, &header, MSG_HEADER_LEN);
+
+    size_t copy_len = MIN(len, header);
+    if (copy_len > 0) {
+        bs_read(bs, data, copy_len);
+    }
+
+    // Discard whatever didn't fit in the caller's buffer
+    uint8_t discard[32];
+    for (size_t left = header - copy_len; left > 0;) {
+        left -= bs_read(bs, discard, MIN(left, sizeof(discard)));
+    }
+
+    framer->n_complete--;
+    return header;
+}
@@ -0,0 +1,104 @@
+// Time the RCP packet routines on the host, in nanoseconds per packet.
+//
+// The numbers are only comparable between runs on the same machine, but a jump in any of
+// them points at a regression before it shows up on the Pi.
+//
+// usage: bench-rcp [packets per routine]
+#include <stdlib.h>
+
+#include "rcp-compact.h"
+
+#include "pi-random.h"
+
+#define N_SAMPLES 64 /* Distinct packets cycled through (so nothing is constant-folded) */
+
+static uint8_t wire[N_SAMPLES][RCP_TOTAL_SIZE];         /* Full-header packets */
+static uint8_t compact_wire[N_SAMPLES][RCP_TOTAL_SIZE]; /* Compact data packets */
+static rcp_datagram_t dgrams[N_SAMPLES];
+
+// Keeps the results live so the loops aren't optimized away
+static volatile uint32_t sink;
+
+static void make_samples(void) {
+    for (size_t i = 0; i < N_SAMPLES; i++) {
+        uint8_t payload[RCP_MAX_PAYLOAD];
+        for (size_t j = 0; j < sizeof(payload); j++) {
+            payload[j] = pi_random();
+        }
+
+        rcp_datagram_t *dgram = &dgrams[i];
+        *dgram = rcp_datagram_init();
+        dgram->header.dst = 2;
+        dgram->header.src = 1;
+        dgram->header.seqno = pi_random();
+        dgram->header.window = 1024;
+        rcp_datagram_set_payload(dgram, payload, 1 + i % RCP_MAX_PAYLOAD);
+        assert(rcp_datagram_encode(dgram, wire[i], RCP_TOTAL_SIZE) > 0);
+        assert(rcp_compact_encode(dgram, compact_wire[i], RCP_TOTAL_SIZE) > 0);
+    }
+}
+
+static void report(const char *name, uint64_t start_ns, unsigned n) {
+    uint64_t elapsed = fake_time_ns() - start_ns;
+    printk("  %-16s %4u.%02u ns/packet\n", name, (unsigned)(elapsed / n),
+           (unsigned)(elapsed * 100 / n % 100));
+}
+
+int main(int argc, char *argv[]) {
+    unsigned n = argc > 1 ? strtoul(argv[1], NULL, 0) : 4000000;
+    make_samples();
+
+    printk("RCP routines (%u-byte checksum, %u packets each):\n", RCP_CKSUM_LENGTH, n);
+    uint8_t out[RCP_TOTAL_SIZE];
+    rcp_datagram_t dgram = rcp_datagram_init();
+
+    uint64_t start = fake_time_ns();
+    for (unsigned i = 0; i < n; i++) {
+        sink += rcp_datagram_parse(&dgram, wire[i % N_SAMPLES], RCP_TOTAL_SIZE);
+        sink += dgram.header.seqno;
+    }
+    report("parse", start, n);
+
+    start = fake_time_ns();
+    for (unsigned i = 0; i < n; i++) {
+        sink += rcp_datagram_serialize(&dgrams[i % N_SAMPLES], out, sizeof(out));
+        sink += out[i % sizeof(out)];
+    }
+    report("serialize", start, n);
+
+    start = fake_time_ns();
+    for (unsigned i = 0; i < n; i++) {
+        sink += rcp_packet_checksum(wire[i % N_SAMPLES], RCP_TOTAL_SIZE);
+    }
+    report("checksum", start, n);
+
+    start = fake_time_ns();
+    for (unsigned i = 0; i < n; i++) {
+        sink += rcp_datagram_decode(&dgram, wire[i % N_SAMPLES], RCP_TOTAL_SIZE);
+        sink += dgram.header.seqno;
+    }
+    report("decode", start, n);
+
+    start = fake_time_ns();
+    for (unsigned i = 0; i < n; i++) {
+        sink += rcp_datagram_encode(&dgrams[i % N_SAMPLES], out, sizeof(out));
+        sink += out[i % sizeof(out)];
+    }
+    report("encode", start, n);
+
+    start = fake_time_ns();
+    for (unsigned i = 0; i < n; i++) {
+        sink += rcp_compact_decode(&dgram, compact_wire[i % N_SAMPLES], RCP_TOTAL_SIZE, 1);
+        sink += dgram.header.seqno;
+    }
+    report("compact decode", start, n);
+
+    start = fake_time_ns();
+    for (unsigned i = 0; i < n; i++) {
+        sink += rcp_compact_encode(&dgrams[i % N_SAMPLES], out, sizeof(out));
+        sink += out[i % sizeof(out)];
+    }
+    report("compact encode", start, n);
+
+    return 0;
+}
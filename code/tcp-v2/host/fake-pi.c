@@ -0,0 +1,48 @@
+// Host (Linux) versions of the Pi routines the tcp-v2 headers call.
+#include <stdlib.h>
+#include <time.h>
+
+#include "rpi.h"
+
+int printk(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vprintf(fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+int vprintk(const char *fmt, va_list ap) { return vprintf(fmt, ap); }
+
+void clean_reboot(void) {
+    fflush(stdout);
+    exit(0);
+}
+
+uint64_t fake_time_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+uint32_t timer_get_usec(void) { return fake_time_ns() / 1000; }
+
+void delay_us(uint32_t us) {
+    uint32_t start = timer_get_usec();
+    while (timer_get_usec() - start < us)
+        ;
+}
+
+void delay_ms(uint32_t ms) { delay_us(ms * 1000); }
+
+// Deterministic, so a failing fuzz run can be repeated
+static uint32_t rand_state = 1;
+uint32_t pi_random(void) {
+    // xorshift32
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+void pi_random_seed(uint32_t seed) { rand_state = seed ? seed : 1; }
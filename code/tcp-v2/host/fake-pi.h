@@ -0,0 +1,14 @@
+#ifndef __FAKE_PI_H__
+#define __FAKE_PI_H__
+// Pulled in by rpi.h when building with -DRPI_UNIX: declares the host versions of the
+// Pi routines the tcp-v2 headers use (defined in fake-pi.c).
+#include <stdio.h>
+
+uint32_t timer_get_usec(void);
+void delay_us(uint32_t us);
+void delay_ms(uint32_t ms);
+
+// Nanoseconds since boot, for timing on the host
+uint64_t fake_time_ns(void);
+
+#endif
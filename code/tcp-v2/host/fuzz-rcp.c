@@ -0,0 +1,299 @@
+// Fuzz the RCP parsers and the bytestream on the host.
+//
+// Every input is copied into a heap buffer of exactly its length, so with the sanitizers
+// on (see Makefile) any read past the end of a packet is caught. Parsers must either
+// reject an input or produce a datagram that re-encodes and re-parses to the same thing.
+//
+// usage: fuzz-rcp [iterations] [seed]
+#include <stdlib.h>
+
+#include "bytestream.h"
+#include "rcp-compact.h"
+
+#include "pi-random.h"
+
+#define MAX_INPUT 40 /* Longest random input (a little past a whole packet) */
+
+static unsigned n_accepted[3]; /* parse, decode, compact decode */
+
+// Copy <len> bytes into a buffer of exactly that size
+static uint8_t *exact_copy(const uint8_t *data, size_t len) {
+    uint8_t *buf = malloc(len ? len : 1);
+    assert(buf);
+    memcpy(buf, data, len);
+    return buf;
+}
+
+static int header_equal(const rcp_header_t *a, const rcp_header_t *b) {
+    return a->payload_len == b->payload_len && a->dst == b->dst && a->src == b->src &&
+           a->seqno == b->seqno && a->flags == b->flags && a->ackno == b->ackno &&
+           a->window == b->window;
+}
+
+// A datagram's payload must lie inside the input it was parsed from
+static void check_payload_bounds(const rcp_datagram_t *dgram, const uint8_t *data, size_t len) {
+    const uint8_t *payload = rcp_datagram_payload(dgram);
+    if (dgram->header.payload_len == 0) {
+        return;
+    }
+    assert(payload >= data && payload + dgram->header.payload_len <= data + len);
+}
+
+// The length a packet claims to have, going by its first byte
+static size_t packet_length(const uint8_t *pkt) {
+    if (!rcp_is_compact(pkt)) {
+        return RCP_HEADER_LENGTH + pkt[0];
+    }
+    if (pkt[0] & RCP_COMPACT_DATA) {
+        return RCP_COMPACT_DATA_LENGTH + (pkt[0] & RCP_COMPACT_LEN_MASK);
+    }
+    return pkt[0] & RCP_COMPACT_PARITY ? RCP_TOTAL_SIZE : RCP_COMPACT_ACK_LENGTH;
+}
+
+static void fuzz_parse(const uint8_t *input, size_t len) {
+    uint8_t *data = exact_copy(input, len);
+    rcp_datagram_t dgram = rcp_datagram_init();
+
+    if (rcp_datagram_parse(&dgram, data, len)) {
+        n_accepted[0]++;
+        assert(dgram.header.payload_len <= RCP_MAX_PAYLOAD);
+        assert(RCP_HEADER_LENGTH + dgram.header.payload_len <= len);
+        check_payload_bounds(&dgram, data, len);
+
+        // Parse doesn't check the checksum, so serializing gives back the same bytes
+        uint8_t out[RCP_TOTAL_SIZE];
+        int n = rcp_datagram_serialize(&dgram, out, sizeof(out));
+        assert(n == RCP_HEADER_LENGTH + dgram.header.payload_len);
+        assert(memcmp(out, data, n) == 0);
+    }
+    free(data);
+}
+
+static void fuzz_decode(const uint8_t *input, size_t len) {
+    uint8_t *data = exact_copy(input, len);
+    rcp_datagram_t dgram = rcp_datagram_init();
+
+    if (rcp_datagram_decode(&dgram, data, len)) {
+        n_accepted[1]++;
+        size_t total = RCP_HEADER_LENGTH + dgram.header.payload_len;
+        assert(total <= len);
+        check_payload_bounds(&dgram, data, len);
+        assert(rcp_packet_checksum(data, total) == rcp_packet_cksum_load(data));
+
+        // A verified packet re-encodes to exactly the same bytes
+        uint8_t out[RCP_TOTAL_SIZE];
+        assert(rcp_datagram_encode(&dgram, out, sizeof(out)) == (int)total);
+        assert(memcmp(out, data, total) == 0);
+    }
+    free(data);
+}
+
+static void fuzz_compact_decode(const uint8_t *input, size_t len) {
+    uint8_t *data = exact_copy(input, len);
+    rcp_datagram_t dgram = rcp_datagram_init();
+
+    if (rcp_compact_decode(&dgram, data, len, 7)) {
+        n_accepted[2]++;
+        int total = packet_length(data);
+        assert(total <= (int)len);
+        assert(dgram.header.payload_len <= RCP_COMPACT_MAX_PAYLOAD);
+        check_payload_bounds(&dgram, data, len);
+
+        // Unused header bits are ignored, so compare what the fields decode to instead
+        uint8_t out[RCP_TOTAL_SIZE];
+        int n = rcp_compact_encode(&dgram, out, sizeof(out));
+        assert(n == total);
+        rcp_datagram_t again = rcp_datagram_init();
+        assert(rcp_compact_decode(&again, out, n, 7));
+        assert(header_equal(&again.header, &dgram.header));
+        assert(memcmp(rcp_datagram_payload(&again), rcp_datagram_payload(&dgram),
+                      dgram.header.payload_len) == 0);
+    }
+    free(data);
+}
+
+// Build a valid packet of a random kind into <pkt>, returning its length
+static size_t make_valid(uint8_t *pkt) {
+    uint8_t payload[RCP_COMPACT_MAX_PAYLOAD];
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = pi_random();
+    }
+
+    rcp_datagram_t dgram = rcp_datagram_init();
+    dgram.header.dst = pi_random();
+    dgram.header.src = 7;
+    dgram.header.seqno = pi_random();
+    dgram.header.ackno = pi_random();
+    dgram.header.window = pi_random();
+
+    int n;
+    switch (pi_random() % 4) {
+    case 0:
+        dgram.header.flags = pi_random() & (RCP_FLAG_FIN | RCP_FLAG_SYN | RCP_FLAG_ACK);
+        rcp_datagram_set_payload(&dgram, payload, pi_random() % (RCP_MAX_PAYLOAD + 1));
+        n = rcp_datagram_encode(&dgram, pkt, RCP_TOTAL_SIZE);
+        break;
+    case 1:
+        rcp_set_flag(&dgram.header, RCP_FLAG_ACK);
+        n = rcp_compact_encode(&dgram, pkt, RCP_TOTAL_SIZE);
+        break;
+    case 2:
+        rcp_set_flag(&dgram.header, RCP_FLAG_FEC);
+        dgram.header.ackno &= 0xFF;
+        rcp_datagram_borrow_payload(&dgram, payload, FEC_WIDTH);
+        n = rcp_compact_encode(&dgram, pkt, RCP_TOTAL_SIZE);
+        break;
+    default:
+        rcp_datagram_borrow_payload(&dgram, payload, pi_random() % (RCP_COMPACT_MAX_PAYLOAD + 1));
+        n = rcp_compact_encode(&dgram, pkt, RCP_TOTAL_SIZE);
+        break;
+    }
+    assert(n > 0);
+    return n;
+}
+
+// Damage a valid packet: flip bits, overwrite bytes, truncate or extend it
+static size_t mutate(uint8_t *pkt, size_t len) {
+    int n_mutations = 1 + pi_random() % 3;
+    for (int m = 0; m < n_mutations; m++) {
+        size_t at = pi_random() % RCP_TOTAL_SIZE;
+        switch (pi_random() % 4) {
+        case 0:
+            pkt[at] ^= 1 << (pi_random() % 8);
+            break;
+        case 1:
+            pkt[at] = pi_random();
+            break;
+        case 2:
+            len = pi_random() % (len + 1);
+            break;
+        default:
+            len = len + pi_random() % (MAX_INPUT - len + 1);
+            break;
+        }
+    }
+
+    // Half the time, fix the checksum up so the parsers look past it
+    if (len >= 1 + RCP_CKSUM_LENGTH && pi_random() % 2) {
+        size_t covered = packet_length(pkt);
+        if (covered <= len) {
+            rcp_packet_cksum_store(pkt, rcp_packet_checksum(pkt, covered));
+        }
+    }
+    return len;
+}
+
+static void fuzz_packets(unsigned iterations) {
+    uint8_t input[MAX_INPUT];
+
+    for (unsigned i = 0; i < iterations; i++) {
+        size_t len;
+        if (i % 2 == 0) {
+            len = pi_random() % (MAX_INPUT + 1);
+            for (size_t j = 0; j < len; j++) {
+                input[j] = pi_random();
+            }
+        } else {
+            memset(input, 0, sizeof(input));
+            len = mutate(input, make_valid(input));
+        }
+
+        fuzz_parse(input, len);
+        fuzz_decode(input, len);
+        fuzz_compact_decode(input, len);
+    }
+
+    printk("PASS: %u packets (accepted: parse=%u decode=%u compact=%u)\n", iterations,
+           n_accepted[0], n_accepted[1], n_accepted[2]);
+}
+
+// Reference copy of the stream (a plain ring, much bigger than BS_CAPACITY)
+static uint8_t model[1 << 20];
+
+static void model_put(size_t pos, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        model[(pos + i) % sizeof(model)] = data[i];
+    }
+}
+
+static int model_matches(size_t pos, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (model[(pos + i) % sizeof(model)] != data[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Run random operations on a bytestream and check it against the reference copy
+static void fuzz_bytestream(unsigned iterations) {
+    static bytestream_t bs;
+    static uint8_t buf[4096];
+    size_t written = 0, popped = 0;
+    bs = bs_init();
+
+    for (unsigned i = 0; i < iterations; i++) {
+        size_t len = pi_random() % sizeof(buf);
+        size_t avail = written - popped;
+
+        switch (pi_random() % 5) {
+        case 0: {
+            for (size_t j = 0; j < len; j++) {
+                buf[j] = pi_random();
+            }
+            size_t n = bs_write(&bs, buf, len);
+            assert(n == MIN(len, BS_CAPACITY - avail));
+            model_put(written, buf, n);
+            written += n;
+            break;
+        }
+        case 1: {
+            uint8_t *ptr;
+            size_t room;
+            if (bs_reserve(&bs, len, &ptr, &room)) {
+                assert(room >= len && room <= BS_CAPACITY - avail);
+                size_t n = pi_random() % (room + 1);
+                for (size_t j = 0; j < n; j++) {
+                    ptr[j] = pi_random();
+                }
+                model_put(written, ptr, n);
+                bs_commit(&bs, n);
+                written += n;
+            }
+            break;
+        }
+        case 2: {
+            size_t n = bs_read(&bs, buf, len);
+            assert(n == MIN(len, avail));
+            assert(model_matches(popped, buf, n));
+            popped += n;
+            break;
+        }
+        case 3: {
+            size_t offset = avail ? pi_random() % (avail + 1) : 0;
+            size_t n = bs_peek_at(&bs, offset, buf, len);
+            assert(n == MIN(len, avail - offset));
+            assert(model_matches(popped + offset, buf, n));
+            break;
+        }
+        default:
+            assert(bs_bytes_available(&bs) == avail);
+            assert(bs_remaining_capacity(&bs) == BS_CAPACITY - avail);
+            assert(bs_bytes_written(&bs) == written && bs_bytes_popped(&bs) == popped);
+            break;
+        }
+    }
+
+    printk("PASS: %u bytestream operations\n", iterations);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+    unsigned seed = argc > 2 ? strtoul(argv[2], NULL, 0) : 1;
+    pi_random_seed(seed);
+
+    printk("Fuzzing RCP parsers (%u-byte checksum, seed %u)...\n", RCP_CKSUM_LENGTH, seed);
+    fuzz_packets(iterations);
+    fuzz_bytestream(iterations / 10);
+    return 0;
+}
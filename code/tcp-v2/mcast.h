@@ -0,0 +1,480 @@
+#pragma once
+
+#include "rcp-datagram.h"
+#include "routing.h"
+
+#include "nrf.h"
+#include "pi-random.h"
+
+/**
+ * Multicast dissemination with NACK repair
+ *
+ * Spreads one object (a config blob, a firmware image) from a source to every node on a
+ * multicast group for about one broadcast per node per chunk, however many nodes want it,
+ * instead of one stream per recipient. Every packet goes without ACKs to a shared NRF
+ * address (DV_BROADCAST_NRF by default, the same as routing updates) that mcast_init sets
+ * the node's radio to receive on with nrf_listen_bcast, so one send reaches all of a
+ * node's neighbors at once.
+ *
+ * The object is split into numbered chunks of MCAST_CHUNK bytes and flooded: a node that
+ * hears a chunk it didn't have keeps it and broadcasts it once, so each chunk crosses every
+ * hop of the network with no tree to build or repair. Losses are recovered with NACKs:
+ * - A node missing chunks broadcasts a report listing them once nothing new has arrived for
+ *   <nack_us>, and again every <nack_us> until it has them all. Overhearing a neighbor ask
+ *   for some of the same chunks puts its own report off once, since the repair will be
+ *   broadcast too.
+ * - A neighbor that has the chunks sends them again after a random wait of up to
+ *   <repair_us>, skipping any it overhears someone else send first.
+ * - A node with the whole object advertises it every <adv_us> with an empty report, so a
+ *   node that missed the flood, joined late, or has an older version finds out. Hearing an
+ *   older version makes a node speak up soon, so a stale neighbor catches up quickly.
+ * Objects carry a 16-bit version, and a newer one replaces the old one everywhere.
+ *
+ * Packet format (a full RCP header with RCP_FLAG_MCAST set and dst = the group):
+ *   chunk:  src = sender, seqno = chunk index, ackno = version, window = chunk count;
+ *           payload = the chunk (MCAST_CHUNK bytes, except for the last one)
+ *   report: the same, with RCP_FLAG_ACK set and seqno = the first chunk asked for;
+ *           payload = bitmap of missing chunks from there (chunk seqno + k is bit k % 8 of
+ *           byte k / 8), or nothing if the sender has them all
+ * Multicast packets only ever go one hop: each node sends on what it keeps itself.
+ */
+
+#define MCAST_CHUNK RCP_MAX_PAYLOAD            /* Object bytes per chunk */
+#define MCAST_MAX_CHUNKS 1024                  /* Most chunks in an object */
+#define MCAST_NACK_SPAN (RCP_MAX_PAYLOAD * 8)  /* Most chunks one report can ask for */
+#define MCAST_MAP_WORDS (MCAST_MAX_CHUNKS / 32) /* Words in a chunk bitmap */
+
+#define MCAST_NACK_US 50000   /* Default quiet time before asking for missing chunks */
+#define MCAST_REPAIR_US 10000 /* Default longest wait before answering a report */
+#define MCAST_ADV_US 1000000  /* Default time between advertisements of a whole object */
+
+typedef struct mcast mcast_t;
+
+/* Callback to broadcast one multicast packet */
+typedef void (*mcast_transmit_fn)(mcast_t *mc, const uint8_t *pkt, size_t len);
+
+/**
+ * Multicast state for one group on one node
+ * - The timing fields may be changed after mcast_init.
+ */
+struct mcast {
+    nrf_t *nrf;                 /* NRF interface to broadcast on */
+    mcast_transmit_fn transmit; /* How packets are sent (defaults to the NRF broadcast) */
+    void *arg;                  /* Opaque pointer for <transmit> */
+    uint32_t bcast_nrf;         /* NRF address packets are broadcast to */
+    uint8_t local_addr;         /* Local RCP address */
+    uint8_t group;              /* Multicast group (see rcp_is_mcast) */
+    uint8_t *buf;               /* Where the object is kept */
+    size_t cap;                 /* Size of <buf> */
+
+    uint32_t nack_us;   /* Quiet time before asking for missing chunks, and between asks */
+    uint32_t repair_us; /* Longest wait before answering a report */
+    uint32_t adv_us;    /* Time between advertisements of a whole object */
+
+    bool has_object;        /* Whether an object has been heard of (or published) */
+    uint16_t version;       /* Its version */
+    uint16_t n_chunks;      /* Its number of chunks */
+    uint16_t n_have;        /* Chunks of it we have */
+    size_t len;             /* Its length (known once the last chunk is in) */
+    uint32_t nack_due_us;   /* When to ask for missing chunks */
+    bool nack_deferred;     /* A neighbor's report already put ours off */
+    bool repair_pending;    /* Chunks were asked for */
+    uint32_t repair_due_us; /* When to send them */
+    uint32_t adv_due_us;    /* When to advertise the whole object */
+
+    uint32_t have[MCAST_MAP_WORDS];   /* Chunks we have */
+    uint32_t relay[MCAST_MAP_WORDS];  /* New chunks to broadcast once */
+    uint32_t repair[MCAST_MAP_WORDS]; /* Chunks neighbors asked for */
+
+    uint32_t chunks_sent;  /* Chunks broadcast the first time */
+    uint32_t repairs_sent; /* Chunks broadcast again for a report */
+    uint32_t nacks_sent;   /* Reports asking for chunks */
+    uint32_t adverts_sent; /* Reports advertising a whole object */
+    uint32_t chunks_recv;  /* New chunks received */
+    uint32_t dups_recv;    /* Chunks received that we already had */
+    uint32_t objects_done; /* Objects received whole */
+    uint32_t too_big;      /* Objects ignored because they don't fit in <buf> */
+};
+
+/* Forward declarations for all functions */
+static inline void mcast_init(mcast_t *mc, nrf_t *nrf, uint8_t local_addr, uint8_t group,
+                              uint8_t *buf, size_t cap);
+static inline bool mcast_publish(mcast_t *mc, uint16_t version, const void *data, size_t len);
+static inline bool mcast_complete(const mcast_t *mc);
+static inline int mcast_object(const mcast_t *mc, const uint8_t **data);
+static inline bool mcast_process_datagram(mcast_t *mc, const rcp_datagram_t *dgram);
+static inline bool mcast_process_packet(mcast_t *mc, const uint8_t *data, size_t length);
+static inline void mcast_tick(mcast_t *mc);
+
+/* Broadcast a packet on the NRF */
+static inline void mcast_transmit_nrf(mcast_t *mc, const uint8_t *pkt, size_t len) {
+    nrf_send_noack(mc->nrf, mc->bcast_nrf, pkt, len);
+}
+
+static inline bool mcast_bit(const uint32_t *map, unsigned i) {
+    return (map[i / 32] >> (i % 32)) & 1;
+}
+
+static inline void mcast_set(uint32_t *map, unsigned i) { map[i / 32] |= 1u << (i % 32); }
+
+static inline void mcast_clear(uint32_t *map, unsigned i) { map[i / 32] &= ~(1u << (i % 32)); }
+
+/* Check if <now> is at or past <deadline> (safe across timer wraparound) */
+static inline bool mcast_due(uint32_t now, uint32_t deadline) {
+    return (int32_t)(now - deadline) >= 0;
+}
+
+/* Check if version <a> is newer than <b> (safe across wraparound) */
+static inline bool mcast_newer(uint16_t a, uint16_t b) { return (int16_t)(a - b) > 0; }
+
+/* A random wait between half of <us> and all of it, so neighbors don't act in step */
+static inline uint32_t mcast_jitter(uint32_t us) {
+    return us / 2 + (us ? pi_random() % (us / 2 + 1) : 0);
+}
+
+/* Move <*due> up to <at> if that's sooner */
+static inline void mcast_sooner(uint32_t *due, uint32_t at) {
+    if ((int32_t)(*due - at) > 0) {
+        *due = at;
+    }
+}
+
+/**
+ * Initialize a node's multicast state for one group
+ * - Every node that should receive or pass on the group's objects needs one, routers
+ *   included, with a buffer as big as the largest object.
+ * - <nrf> is set up to also receive DV_BROADCAST_NRF. A node that receives on another
+ *   radio, or changes <bcast_nrf>, has to call nrf_listen_bcast on that radio itself.
+ *
+ * @param mc The multicast state to initialize
+ * @param nrf The NRF interface to broadcast on (NULL if <transmit> is replaced)
+ * @param local_addr The local RCP address
+ * @param group The multicast group
+ * @param buf Where to keep the object
+ * @param cap The size of <buf> (at most MCAST_MAX_CHUNKS * MCAST_CHUNK is used)
+ */
+static inline void mcast_init(mcast_t *mc, nrf_t *nrf, uint8_t local_addr, uint8_t group,
+                              uint8_t *buf, size_t cap) {
+    assert(mc);
+    assert(rcp_is_mcast(group));
+    assert(buf || cap == 0);
+
+    memset(mc, 0, sizeof(*mc));
+    mc->nrf = nrf;
+    mc->transmit = mcast_transmit_nrf;
+    mc->bcast_nrf = DV_BROADCAST_NRF;
+    mc->local_addr = local_addr;
+    mc->group = group;
+    mc->buf = buf;
+    mc->cap = cap;
+
+    mc->nack_us = MCAST_NACK_US;
+    mc->repair_us = MCAST_REPAIR_US;
+    mc->adv_us = MCAST_ADV_US;
+
+    if (nrf) {
+        nrf_listen_bcast(nrf, mc->bcast_nrf);
+    }
+}
+
+/* Forget the current object and start on <version> with <n_chunks> chunks */
+static inline void mcast_start(mcast_t *mc, uint16_t version, uint16_t n_chunks, uint32_t now) {
+    mc->has_object = true;
+    mc->version = version;
+    mc->n_chunks = n_chunks;
+    mc->n_have = 0;
+    mc->len = 0;
+    mc->nack_due_us = now + mcast_jitter(mc->nack_us);
+    mc->nack_deferred = false;
+    mc->repair_pending = false;
+    memset(mc->have, 0, sizeof(mc->have));
+    memset(mc->relay, 0, sizeof(mc->relay));
+    memset(mc->repair, 0, sizeof(mc->repair));
+}
+
+/**
+ * Send an object to every node on the group
+ * - Replaces whatever object the group had; <version> has to be newer than it for other
+ *   nodes to take it. The chunks go out on the following mcast_tick calls.
+ *
+ * @param mc The multicast state
+ * @param version The object's version
+ * @param data The object (may already be in the buffer)
+ * @param len The object's length (at most the buffer's size)
+ * @return True if the object will be sent
+ */
+static inline bool mcast_publish(mcast_t *mc, uint16_t version, const void *data, size_t len) {
+    assert(mc);
+    assert(data || len == 0);
+
+    size_t n_chunks = len ? (len + MCAST_CHUNK - 1) / MCAST_CHUNK : 1;
+    if (len > mc->cap || n_chunks > MCAST_MAX_CHUNKS) {
+        return false;
+    }
+    if (len > 0 && data != mc->buf) {
+        memmove(mc->buf, data, len);
+    }
+
+    uint32_t now = timer_get_usec();
+    mcast_start(mc, version, n_chunks, now);
+    for (size_t i = 0; i < n_chunks; i++) {
+        mcast_set(mc->have, i);
+        mcast_set(mc->relay, i);
+    }
+    mc->n_have = n_chunks;
+    mc->len = len;
+    mc->adv_due_us = now + mcast_jitter(mc->adv_us);
+    return true;
+}
+
+/**
+ * Check if the group's current object is all here
+ *
+ * @param mc The multicast state
+ * @return True if every chunk of it has arrived (or it was published here)
+ */
+static inline bool mcast_complete(const mcast_t *mc) {
+    assert(mc);
+    return mc->has_object && mc->n_have == mc->n_chunks;
+}
+
+/**
+ * Get the group's current object
+ * - It stays in the buffer, and is replaced when a newer version starts arriving.
+ *
+ * @param mc The multicast state
+ * @param data Set to the object (may be NULL)
+ * @return The object's length (its version is in mc->version), or -1 if it isn't complete
+ */
+static inline int mcast_object(const mcast_t *mc, const uint8_t **data) {
+    assert(mc);
+
+    if (!mcast_complete(mc)) {
+        return -1;
+    }
+    if (data) {
+        *data = mc->buf;
+    }
+    return mc->len;
+}
+
+/* Take in a chunk of the current object */
+static inline void mcast_recv_chunk(mcast_t *mc, unsigned index, const uint8_t *payload,
+                                    size_t len, uint32_t now) {
+    // Whoever sent it answered any report asking for it
+    mcast_clear(mc->repair, index);
+    if (mcast_bit(mc->have, index)) {
+        mc->dups_recv++;
+        return;
+    }
+
+    size_t offset = index * MCAST_CHUNK;
+    if (offset + len > mc->cap) {
+        return;
+    }
+    memcpy(mc->buf + offset, payload, len);
+    mcast_set(mc->have, index);
+    mcast_set(mc->relay, index);
+    mc->n_have++;
+    mc->chunks_recv++;
+    if (index + 1 == mc->n_chunks) {
+        mc->len = offset + len;
+    }
+
+    // Only ask for what's missing once the chunks stop coming
+    mc->nack_due_us = now + mcast_jitter(mc->nack_us);
+    if (mc->n_have == mc->n_chunks) {
+        mc->objects_done++;
+        mc->adv_due_us = now + mcast_jitter(mc->adv_us);
+    }
+}
+
+/* Take in a neighbor's report on the current object */
+static inline void mcast_recv_report(mcast_t *mc, unsigned first, const uint8_t *map, size_t len,
+                                     uint32_t now) {
+    bool asked = false;   // It asked for a chunk we can send
+    bool overlap = false; // It asked for a chunk we're missing too
+    for (unsigned k = 0; k < len * 8 && first + k < mc->n_chunks; k++) {
+        if (!((map[k / 8] >> (k % 8)) & 1)) {
+            continue;
+        }
+        if (mcast_bit(mc->have, first + k)) {
+            mcast_set(mc->repair, first + k);
+            asked = true;
+        } else {
+            overlap = true;
+        }
+    }
+
+    if (asked && !mc->repair_pending) {
+        mc->repair_pending = true;
+        mc->repair_due_us = now + mcast_jitter(mc->repair_us);
+    }
+
+    // The repair will be broadcast, so wait to see what it leaves us missing
+    if (overlap && !mc->nack_deferred) {
+        mc->nack_due_us = now + mcast_jitter(mc->nack_us);
+        mc->nack_deferred = true;
+    }
+}
+
+/**
+ * Apply a multicast packet for the group
+ *
+ * @param mc The multicast state
+ * @param dgram The packet (already verified)
+ * @return True if the datagram was a well-formed chunk or report for the group
+ */
+static inline bool mcast_process_datagram(mcast_t *mc, const rcp_datagram_t *dgram) {
+    assert(mc);
+    assert(dgram);
+
+    const rcp_header_t *hdr = &dgram->header;
+    bool report = rcp_has_flag(hdr, RCP_FLAG_ACK);
+    uint16_t n_chunks = hdr->window;
+    size_t len = hdr->payload_len;
+    if (!rcp_has_flag(hdr, RCP_FLAG_MCAST) || hdr->dst != mc->group ||
+        hdr->src == mc->local_addr || n_chunks == 0 || n_chunks > MCAST_MAX_CHUNKS) {
+        return false;
+    }
+    if (!report && (hdr->seqno >= n_chunks || (hdr->seqno + 1 < n_chunks && len != MCAST_CHUNK))) {
+        return false;
+    }
+
+    uint32_t now = timer_get_usec();
+    if (mc->has_object && mcast_newer(mc->version, hdr->ackno)) {
+        // A neighbor is behind: tell it about ours soon
+        uint32_t soon = now + mcast_jitter(mc->repair_us);
+        mcast_sooner(mcast_complete(mc) ? &mc->adv_due_us : &mc->nack_due_us, soon);
+        return true;
+    }
+    if (!mc->has_object || mcast_newer(hdr->ackno, mc->version)) {
+        if ((size_t)(n_chunks - 1) * MCAST_CHUNK >= mc->cap) {
+            mc->too_big++;
+            return true;
+        }
+        mcast_start(mc, hdr->ackno, n_chunks, now);
+    } else if (n_chunks != mc->n_chunks) {
+        return false;  // Same version, different object
+    }
+
+    const uint8_t *payload = rcp_datagram_payload(dgram);
+    if (report) {
+        mcast_recv_report(mc, hdr->seqno, payload, len, now);
+    } else {
+        mcast_recv_chunk(mc, hdr->seqno, payload, len, now);
+    }
+    return true;
+}
+
+/**
+ * Verify a raw packet and apply it if it is a multicast packet for the group
+ *
+ * @param mc The multicast state
+ * @param data The received packet
+ * @param length The number of bytes received
+ * @return True if the packet was a valid chunk or report for the group
+ */
+static inline bool mcast_process_packet(mcast_t *mc, const uint8_t *data, size_t length) {
+    assert(mc);
+    assert(data);
+
+    rcp_datagram_t dgram = rcp_datagram_init();
+    if (!rcp_datagram_decode(&dgram, data, length)) {
+        return false;
+    }
+    return mcast_process_datagram(mc, &dgram);
+}
+
+/* Broadcast one multicast packet about the current object */
+static inline void mcast_send(mcast_t *mc, uint8_t flags, uint16_t seqno, const uint8_t *payload,
+                              size_t len) {
+    rcp_datagram_t dgram = rcp_datagram_init();
+    dgram.header.dst = mc->group;
+    dgram.header.hops = 1;
+    dgram.header.src = mc->local_addr;
+    dgram.header.seqno = seqno;
+    dgram.header.ackno = mc->version;
+    dgram.header.window = mc->n_chunks;
+    rcp_set_flag(&dgram.header, RCP_FLAG_MCAST | flags);
+    rcp_datagram_borrow_payload(&dgram, payload, len);
+
+    uint8_t pkt[RCP_TOTAL_SIZE];
+    int n = rcp_datagram_encode(&dgram, pkt, sizeof(pkt));
+    assert(n > 0);
+    mc->transmit(mc, pkt, n);
+}
+
+/* Broadcast chunk <index> (which we have) */
+static inline void mcast_send_chunk(mcast_t *mc, unsigned index) {
+    size_t offset = index * MCAST_CHUNK;
+    size_t len = index + 1 < mc->n_chunks ? MCAST_CHUNK : mc->len - offset;
+    mcast_send(mc, 0, index, mc->buf + offset, len);
+    mcast_clear(mc->relay, index);
+    mcast_clear(mc->repair, index);
+}
+
+/* Broadcast every chunk marked in <map>, and return how many there were */
+static inline uint32_t mcast_send_marked(mcast_t *mc, uint32_t *map) {
+    uint32_t n = 0;
+    for (unsigned w = 0; w < MCAST_MAP_WORDS; w++) {
+        while (map[w]) {
+            mcast_send_chunk(mc, w * 32 + __builtin_ctz(map[w]));
+            n++;
+        }
+    }
+    return n;
+}
+
+/* Ask for the missing chunks from the first one on (or advertise, if there are none) */
+static inline void mcast_send_report(mcast_t *mc) {
+    uint8_t map[MCAST_NACK_SPAN / 8] = {0};
+    unsigned first = 0;
+    size_t len = 0;
+    if (!mcast_complete(mc)) {
+        while (mcast_bit(mc->have, first)) {
+            first++;
+        }
+        for (unsigned k = 0; k < MCAST_NACK_SPAN && first + k < mc->n_chunks; k++) {
+            if (!mcast_bit(mc->have, first + k)) {
+                map[k / 8] |= 1 << (k % 8);
+                len = k / 8 + 1;
+            }
+        }
+    }
+    mcast_send(mc, RCP_FLAG_ACK, first, map, len);
+}
+
+/**
+ * Run the protocol: pass on new chunks, answer reports, and ask for or advertise the
+ * object when that's due
+ * - Incoming packets are applied with mcast_process_datagram / mcast_process_packet as
+ *   they are received.
+ *
+ * @param mc The multicast state
+ */
+static inline void mcast_tick(mcast_t *mc) {
+    assert(mc);
+
+    if (!mc->has_object) {
+        return;
+    }
+
+    uint32_t now = timer_get_usec();
+    mc->chunks_sent += mcast_send_marked(mc, mc->relay);
+    if (mc->repair_pending && mcast_due(now, mc->repair_due_us)) {
+        mc->repairs_sent += mcast_send_marked(mc, mc->repair);
+        mc->repair_pending = false;
+    }
+
+    if (!mcast_complete(mc) && mcast_due(now, mc->nack_due_us)) {
+        mcast_send_report(mc);
+        mc->nacks_sent++;
+        mc->nack_due_us = now + mcast_jitter(mc->nack_us);
+        mc->nack_deferred = false;
+    } else if (mcast_complete(mc) && mcast_due(now, mc->adv_due_us)) {
+        mcast_send_report(mc);
+        mc->adverts_sent++;
+        mc->adv_due_us = now + mcast_jitter(mc->adv_us);
+    }
+}
@@ -0,0 +1,348 @@
+#pragma once
+
+#include "rcp-compact.h"
+
+#include "pi-random.h"
+
+/**
+ * Router output queues
+ *
+ * A router that sends each packet as it arrives stalls on every transmission, and
+ * anything arriving meanwhile piles up in the radio's three-entry RX FIFO or is lost.
+ * Instead, forwarded frames wait here in fixed 32-byte slots, one set of queues per next
+ * hop, and are sent as the radio frees up.
+ *
+ * - Each next hop has two queues: control (ACKs, SYNs and FINs) and data. Control frames
+ *   always go first, so a sender's feedback doesn't wait behind a burst of bulk data.
+ * - Next hops with frames queued take turns, one frame each, within a class. A next hop
+ *   keeps its entry (and its RED average) until another one needs it and it's idle.
+ * - The data queue uses RED: past <red_min> slots of average depth, arriving frames are
+ *   dropped with a probability that rises to <red_max_p> at <red_max>, and every frame is
+ *   dropped above that. Senders back off on the early losses before the queue overflows
+ *   and drops a whole burst. The control queue is plain drop-tail.
+ * - Only the first byte or two of a frame are looked at; nothing is parsed or verified.
+ */
+
+#define OUTQ_MAX_HOPS 8 /* Next hops with queues at once */
+#define OUTQ_SLOTS 16   /* Frames per queue */
+
+#define OUTQ_CONTROL 0   /* Queue for ACKs, SYNs and FINs */
+#define OUTQ_DATA 1      /* Queue for everything else */
+#define OUTQ_N_CLASSES 2 /* Number of queues per next hop */
+
+#define OUTQ_AVG_ONE 256        /* Fixed-point 1.0 for the average queue depth */
+#define OUTQ_PROB_ONE 4096      /* Fixed-point 1.0 for drop probabilities */
+#define OUTQ_RED_MIN 4          /* Default average depth where early drops start */
+#define OUTQ_RED_MAX 12         /* Default average depth where every frame is dropped */
+#define OUTQ_RED_MAX_P 410      /* Default drop probability at <red_max> (about 10%) */
+#define OUTQ_RED_WEIGHT_SHIFT 2 /* The average moves 1/4 of the way per arrival */
+
+/**
+ * A ring of frames
+ */
+typedef struct outq_ring {
+    uint8_t slots[OUTQ_SLOTS][RCP_TOTAL_SIZE]; /* Queued frames */
+    uint8_t head;                              /* Slot of the oldest frame */
+    uint8_t count;                             /* Number of frames queued */
+} outq_ring_t;
+
+/**
+ * The queues for one next hop
+ */
+typedef struct outq_hop {
+    bool in_use;                          /* Whether this entry belongs to a next hop */
+    uint32_t nrf_addr;                    /* The next hop's NRF address */
+    outq_ring_t rings[OUTQ_N_CLASSES];    /* Control and data queues */
+    uint32_t avg;                         /* Average data queue depth (OUTQ_AVG_ONE = 1) */
+    uint32_t since_drop;                  /* Data frames queued since the last early drop */
+} outq_hop_t;
+
+/**
+ * Output queues for every next hop
+ */
+typedef struct outq {
+    outq_hop_t hops[OUTQ_MAX_HOPS]; /* Queues by next hop */
+    unsigned next;                  /* Next hop to look at first when sending */
+
+    uint32_t red_min;   /* Average depth where early drops start */
+    uint32_t red_max;   /* Average depth where every data frame is dropped */
+    uint32_t red_max_p; /* Drop probability at <red_max> (OUTQ_PROB_ONE = 1) */
+
+    uint32_t n_queued[OUTQ_N_CLASSES];     /* Frames queued */
+    uint32_t n_sent[OUTQ_N_CLASSES];       /* Frames taken off to send */
+    uint32_t n_tail_drops[OUTQ_N_CLASSES]; /* Frames dropped because the queue was full */
+    uint32_t n_red_drops;                  /* Data frames dropped early by RED */
+    uint32_t n_no_hop;                     /* Frames dropped because every entry was busy */
+} outq_t;
+
+/* Forward declarations for all functions */
+static inline int rcp_frame_class(const uint8_t *frame);
+static inline void outq_init(outq_t *q);
+static inline bool outq_push(outq_t *q, uint32_t nrf_addr, const uint8_t *frame);
+static inline bool outq_pop(outq_t *q, uint32_t *nrf_addr, uint8_t *frame);
+static inline bool outq_pop_from(outq_t *q, uint32_t nrf_addr, uint8_t *frame);
+static inline size_t outq_depth(const outq_t *q, uint32_t nrf_addr, int cls);
+static inline bool outq_empty(const outq_t *q);
+static inline size_t outq_count(const outq_t *q);
+
+/**
+ * Pick the queue for a raw frame
+ * - Compact ACKs, and full headers with the ACK, SYN or FIN flag, are control. Data
+ *   segments, FEC parity and fragments are data.
+ *
+ * @param frame The frame as received
+ * @return OUTQ_CONTROL or OUTQ_DATA
+ */
+static inline int rcp_frame_class(const uint8_t *frame) {
+    uint8_t first = frame[0];
+
+    if (first & RCP_COMPACT) {
+        return first & (RCP_COMPACT_DATA | RCP_COMPACT_PARITY) ? OUTQ_DATA : OUTQ_CONTROL;
+    }
+    if (first > RCP_MAX_PAYLOAD) {
+        return OUTQ_DATA;  // A fragment
+    }
+
+    uint8_t flags = frame[6 + RCP_CKSUM_LENGTH];
+    if (flags & RCP_FLAG_FEC) {
+        return OUTQ_DATA;
+    }
+    return flags & (RCP_FLAG_ACK | RCP_FLAG_SYN | RCP_FLAG_FIN) ? OUTQ_CONTROL : OUTQ_DATA;
+}
+
+/**
+ * Initialize empty output queues with the default RED settings
+ *
+ * @param q The queues to initialize
+ */
+static inline void outq_init(outq_t *q) {
+    assert(q);
+
+    memset(q, 0, sizeof(*q));
+    q->red_min = OUTQ_RED_MIN;
+    q->red_max = OUTQ_RED_MAX;
+    q->red_max_p = OUTQ_RED_MAX_P;
+}
+
+/* Find the queues for <nrf_addr>, taking over an idle entry if it has none (NULL if none) */
+static inline outq_hop_t *outq_hop(outq_t *q, uint32_t nrf_addr) {
+    outq_hop_t *unused = NULL, *idle = NULL;
+    for (size_t i = 0; i < OUTQ_MAX_HOPS; i++) {
+        outq_hop_t *hop = &q->hops[i];
+        if (!hop->in_use) {
+            unused = unused ? unused : hop;
+        } else if (hop->nrf_addr == nrf_addr) {
+            return hop;
+        } else if (!hop->rings[OUTQ_CONTROL].count && !hop->rings[OUTQ_DATA].count) {
+            idle = idle ? idle : hop;
+        }
+    }
+
+    // Prefer an unused entry, so idle next hops keep their RED averages
+    outq_hop_t *spare = unused ? unused : idle;
+    if (!spare) {
+        return NULL;
+    }
+
+    memset(spare, 0, sizeof(*spare));
+    spare->in_use = true;
+    spare->nrf_addr = nrf_addr;
+    return spare;
+}
+
+/**
+ * Decide whether RED drops a data frame arriving at <hop>
+ * - Between the thresholds the drop probability rises linearly, and it's spread out by
+ *   the number of frames let through since the last drop, so drops come at roughly even
+ *   intervals instead of in clusters.
+ */
+static inline bool outq_red_drop(outq_t *q, outq_hop_t *hop) {
+    // Move the average toward the current depth
+    int32_t depth = hop->rings[OUTQ_DATA].count * OUTQ_AVG_ONE;
+    int32_t avg = hop->avg;
+    hop->avg = avg + ((depth - avg) >> OUTQ_RED_WEIGHT_SHIFT);
+
+    uint32_t min = q->red_min * OUTQ_AVG_ONE;
+    uint32_t max = q->red_max * OUTQ_AVG_ONE;
+    if (hop->avg < min) {
+        hop->since_drop = 0;
+        return false;
+    }
+    if (hop->avg >= max) {
+        hop->since_drop = 0;
+        return true;
+    }
+
+    uint32_t p = q->red_max_p * (hop->avg - min) / (max - min);
+    uint32_t spread = hop->since_drop * p;
+    if (spread >= OUTQ_PROB_ONE || pi_random() % (OUTQ_PROB_ONE - spread) < p) {
+        hop->since_drop = 0;
+        return true;
+    }
+    hop->since_drop++;
+    return false;
+}
+
+/**
+ * Queue a frame for a next hop
+ *
+ * @param q The output queues
+ * @param nrf_addr The next hop's NRF address
+ * @param frame The frame (RCP_TOTAL_SIZE bytes)
+ * @return True if the frame was queued, false if it was dropped
+ */
+static inline bool outq_push(outq_t *q, uint32_t nrf_addr, const uint8_t *frame) {
+    assert(q);
+    assert(frame);
+
+    outq_hop_t *hop = outq_hop(q, nrf_addr);
+    if (!hop) {
+        q->n_no_hop++;
+        return false;
+    }
+
+    int cls = rcp_frame_class(frame);
+    outq_ring_t *ring = &hop->rings[cls];
+    if (cls == OUTQ_DATA && outq_red_drop(q, hop)) {
+        q->n_red_drops++;
+        return false;
+    }
+    if (ring->count == OUTQ_SLOTS) {
+        q->n_tail_drops[cls]++;
+        return false;
+    }
+
+    memcpy(ring->slots[(ring->head + ring->count) % OUTQ_SLOTS], frame, RCP_TOTAL_SIZE);
+    ring->count++;
+    q->n_queued[cls]++;
+    return true;
+}
+
+/* Take the oldest frame from one of <hop>'s queues (which must not be empty) */
+static inline void outq_take(outq_t *q, outq_hop_t *hop, int cls, uint8_t *frame) {
+    outq_ring_t *ring = &hop->rings[cls];
+    memcpy(frame, ring->slots[ring->head], RCP_TOTAL_SIZE);
+    ring->head = (ring->head + 1) % OUTQ_SLOTS;
+    ring->count--;
+    q->n_sent[cls]++;
+}
+
+/**
+ * Take the next frame to send
+ * - Any queued control frame goes before any data frame. Within a class, next hops take
+ *   turns.
+ *
+ * @param q The output queues
+ * @param nrf_addr Set to the NRF address to send the frame to
+ * @param frame Filled with the frame (RCP_TOTAL_SIZE bytes)
+ * @return True if a frame was taken, false if every queue is empty
+ */
+static inline bool outq_pop(outq_t *q, uint32_t *nrf_addr, uint8_t *frame) {
+    assert(q);
+    assert(nrf_addr);
+    assert(frame);
+
+    for (int cls = 0; cls < OUTQ_N_CLASSES; cls++) {
+        for (size_t i = 0; i < OUTQ_MAX_HOPS; i++) {
+            size_t at = (q->next + i) % OUTQ_MAX_HOPS;
+            outq_hop_t *hop = &q->hops[at];
+            if (!hop->in_use || hop->rings[cls].count == 0) {
+                continue;
+            }
+
+            outq_take(q, hop, cls, frame);
+            *nrf_addr = hop->nrf_addr;
+            q->next = (at + 1) % OUTQ_MAX_HOPS;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Take the next frame for one particular next hop
+ * - For topping up a transmit FIFO that's already sending to <nrf_addr>. The hop's
+ *   control frames still go before its data, but other next hops aren't looked at.
+ *
+ * @param q The output queues
+ * @param nrf_addr The next hop's NRF address
+ * @param frame Filled with the frame (RCP_TOTAL_SIZE bytes)
+ * @return True if a frame was taken, false if nothing is queued for <nrf_addr>
+ */
+static inline bool outq_pop_from(outq_t *q, uint32_t nrf_addr, uint8_t *frame) {
+    assert(q);
+    assert(frame);
+
+    for (size_t i = 0; i < OUTQ_MAX_HOPS; i++) {
+        outq_hop_t *hop = &q->hops[i];
+        if (!hop->in_use || hop->nrf_addr != nrf_addr) {
+            continue;
+        }
+        for (int cls = 0; cls < OUTQ_N_CLASSES; cls++) {
+            if (hop->rings[cls].count > 0) {
+                outq_take(q, hop, cls, frame);
+                return true;
+            }
+        }
+        return false;
+    }
+    return false;
+}
+
+/**
+ * Get the number of frames queued for a next hop
+ *
+ * @param q The output queues
+ * @param nrf_addr The next hop's NRF address
+ * @param cls OUTQ_CONTROL or OUTQ_DATA
+ * @return The number of frames in that queue
+ */
+static inline size_t outq_depth(const outq_t *q, uint32_t nrf_addr, int cls) {
+    assert(q);
+    assert(cls >= 0 && cls < OUTQ_N_CLASSES);
+
+    for (size_t i = 0; i < OUTQ_MAX_HOPS; i++) {
+        const outq_hop_t *hop = &q->hops[i];
+        if (hop->in_use && hop->nrf_addr == nrf_addr) {
+            return hop->rings[cls].count;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Check whether any frame is waiting to be sent
+ *
+ * @param q The output queues
+ * @return True if every queue is empty
+ */
+static inline bool outq_empty(const outq_t *q) {
+    assert(q);
+
+    for (size_t i = 0; i < OUTQ_MAX_HOPS; i++) {
+        const outq_hop_t *hop = &q->hops[i];
+        if (hop->in_use && (hop->rings[OUTQ_CONTROL].count || hop->rings[OUTQ_DATA].count)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Get the number of frames waiting to be sent, to every next hop
+ *
+ * @param q The output queues
+ * @return The number of frames queued
+ */
+static inline size_t outq_count(const outq_t *q) {
+    assert(q);
+
+    size_t n = 0;
+    for (size_t i = 0; i < OUTQ_MAX_HOPS; i++) {
+        const outq_hop_t *hop = &q->hops[i];
+        if (hop->in_use) {
+            n += hop->rings[OUTQ_CONTROL].count + hop->rings[OUTQ_DATA].count;
+        }
+    }
+    return n;
+}
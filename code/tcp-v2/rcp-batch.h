@@ -0,0 +1,138 @@
+#pragma once
+
+#include "nrf.h"
+#include "rcp-compact.h"
+
+/**
+ * Batch receive: parse every packet queued on an NRF in one go
+ *
+ * Reading one packet at a time goes through cq_pop once per byte, with memory barriers
+ * around each. A batch instead copies every complete packet out of <recvq> with at most
+ * two memcpys (one per side of the wraparound), moves the queue's tail once, and then
+ * verifies and parses the packets back to back, so a burst is handed to the TCP layer
+ * together.
+ */
+
+#define RCP_BATCH_MAX 16 /* Most packets taken in one batch */
+
+/**
+ * Packets taken from the receive queue in one batch
+ * - Parsed datagrams borrow their payloads from <wire>, so they're valid as long as the
+ *   batch is.
+ */
+typedef struct rcp_batch {
+    uint8_t wire[RCP_BATCH_MAX][RCP_TOTAL_SIZE]; /* Packets as copied out of the queue */
+    rcp_datagram_t pkts[RCP_BATCH_MAX];          /* Packets that passed verification */
+    size_t count;                                /* Number of entries in <pkts> */
+    size_t n_dropped;                            /* Packets that failed verification */
+} rcp_batch_t;
+
+/* Forward declarations for all functions */
+static inline size_t rcp_cq_pop_packets(cq_t *q, uint8_t *dst, size_t max);
+static inline size_t rcp_parse_batch(rcp_batch_t *batch, size_t n, uint8_t compact_src);
+static inline size_t rcp_recv_batch_cq(cq_t *q, rcp_batch_t *batch, size_t max,
+                                       uint8_t compact_src);
+static inline size_t rcp_recv_batch(nrf_t *nrf, rcp_batch_t *batch, size_t max,
+                                    uint8_t compact_src);
+
+/**
+ * Copy whole packets out of a receive queue in bulk
+ *
+ * @param q The queue to take packets from (bytes pushed by the NRF driver)
+ * @param dst Where to copy the packets (RCP_TOTAL_SIZE bytes each, back to back)
+ * @param max The most packets to take
+ * @return The number of packets copied
+ */
+static inline size_t rcp_cq_pop_packets(cq_t *q, uint8_t *dst, size_t max) {
+    assert(q);
+    assert(dst || max == 0);
+
+    size_t n = cq_nelem(q) / RCP_TOTAL_SIZE;
+    if (n > max) {
+        n = max;
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    // The queued bytes are contiguous except where they wrap around the end of the buffer
+    size_t nbytes = n * RCP_TOTAL_SIZE;
+    unsigned tail = q->tail;
+    size_t first = CQ_N - tail < nbytes ? CQ_N - tail : nbytes;
+    memcpy(dst, (const uint8_t *)&q->c_buf[tail], first);
+    memcpy(dst + first, (const uint8_t *)q->c_buf, nbytes - first);
+
+    // Release the space only after the copy is done, as cq_pop does for one byte
+    gcc_mb();
+    q->tail = (tail + nbytes) % CQ_N;
+    gcc_mb();
+    return n;
+}
+
+/**
+ * Verify and parse the first <n> packets in a batch's wire buffer
+ * - Packets with a bad length or checksum, and packets that aren't RCP datagrams (such
+ *   as fragments), are dropped.
+ *
+ * @param batch The batch whose <wire> holds the packets
+ * @param n The number of packets in <wire>
+ * @param compact_src The source address for compact headers, which leave it out
+ * @return The number of packets that were kept
+ */
+static inline size_t rcp_parse_batch(rcp_batch_t *batch, size_t n, uint8_t compact_src) {
+    assert(batch);
+    assert(n <= RCP_BATCH_MAX);
+
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        const uint8_t *pkt = batch->wire[i];
+        rcp_datagram_t *dgram = &batch->pkts[count];
+        int ok = rcp_is_compact(pkt)
+                     ? rcp_compact_decode(dgram, pkt, RCP_TOTAL_SIZE, compact_src)
+                     : rcp_datagram_decode(dgram, pkt, RCP_TOTAL_SIZE);
+        count += ok ? 1 : 0;
+    }
+
+    batch->count = count;
+    batch->n_dropped = n - count;
+    return count;
+}
+
+/**
+ * Take and parse every complete packet in a receive queue
+ *
+ * @param q The queue to take packets from
+ * @param batch Filled with the parsed packets
+ * @param max The most packets to take (at most RCP_BATCH_MAX)
+ * @param compact_src The source address for compact headers, which leave it out
+ * @return The number of valid packets in <batch>
+ */
+static inline size_t rcp_recv_batch_cq(cq_t *q, rcp_batch_t *batch, size_t max,
+                                       uint8_t compact_src) {
+    assert(q);
+    assert(batch);
+    assert(max <= RCP_BATCH_MAX);
+
+    size_t n = rcp_cq_pop_packets(q, &batch->wire[0][0], max);
+    return rcp_parse_batch(batch, n, compact_src);
+}
+
+/**
+ * Take and parse every packet an NRF has received
+ * - Doesn't block: returns 0 if no complete packet is queued.
+ *
+ * @param nrf The NRF to read from
+ * @param batch Filled with the parsed packets
+ * @param max The most packets to take (at most RCP_BATCH_MAX)
+ * @param compact_src The source address for compact headers, which leave it out
+ * @return The number of valid packets in <batch>
+ */
+static inline size_t rcp_recv_batch(nrf_t *nrf, rcp_batch_t *batch, size_t max,
+                                    uint8_t compact_src) {
+    assert(nrf);
+    assert(batch);
+
+    // Pull anything still in the radio's FIFO onto the queue first
+    nrf_nbytes_avail(nrf);
+    return rcp_recv_batch_cq(&nrf->recvq, batch, max, compact_src);
+}
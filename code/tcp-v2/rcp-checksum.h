@@ -0,0 +1,296 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "rpi.h"
+
+#include "crc.h" /* Needs the integer types from rpi.h */
+
+/**
+ * Packet integrity checks for RCP
+ *
+ * The mode is chosen at build time (e.g. CFLAGS += -DRCP_INTEGRITY=RCP_INTEGRITY_CRC16)
+ * and both ends of a link must agree on it. The CRC modes carry a 16-bit check value, so
+ * they use one more header byte (and one less payload byte) than the default sum.
+ *
+ * Every check covers the packet as it appears on the wire, minus the check value itself
+ * and the hop limit, which routers count down in flight (see rcp-header.h).
+ */
+
+#define RCP_INTEGRITY_SUM8 0  /* 16-bit one's complement sum folded to 8 bits (default) */
+#define RCP_INTEGRITY_CRC16 1 /* CRC-16-CCITT (poly 0x1021, init 0xFFFF) */
+#define RCP_INTEGRITY_CRC32 2 /* Low 16 bits of the standard CRC-32 */
+
+#ifndef RCP_INTEGRITY
+#define RCP_INTEGRITY RCP_INTEGRITY_SUM8
+#endif
+
+#if RCP_INTEGRITY == RCP_INTEGRITY_SUM8
+#define RCP_CKSUM_LENGTH 1 /* Bytes of check value in the header */
+#elif RCP_INTEGRITY == RCP_INTEGRITY_CRC16 || RCP_INTEGRITY == RCP_INTEGRITY_CRC32
+#define RCP_CKSUM_LENGTH 2
+#else
+#error "RCP_INTEGRITY must be RCP_INTEGRITY_SUM8, RCP_INTEGRITY_CRC16, or RCP_INTEGRITY_CRC32"
+#endif
+
+/* Offset of the hop limit in every wire form (right after the destination) */
+#define RCP_HOPS_OFFSET (2 + RCP_CKSUM_LENGTH)
+
+/* A 32-bit word that may alias the bytes it's loaded from */
+typedef uint32_t __attribute__((may_alias)) rcp_word_t;
+
+/* CRC-16-CCITT lookup table (one entry per value of the next input byte) */
+static const uint16_t rcp_crc16_tab[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+    0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+    0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+    0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+    0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+    0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+    0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+    0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+    0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+    0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+    0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+    0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+    0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+    0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+    0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+    0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0
+};
+
+/* Forward declarations for all functions */
+static inline uint32_t rcp_checksum_add(uint32_t sum, const uint8_t *data, size_t len, bool odd);
+static inline uint32_t rcp_checksum_add_fast(uint32_t sum, const uint8_t *data, size_t len,
+                                             bool odd);
+static inline uint8_t rcp_checksum_fold(uint32_t sum);
+static inline uint16_t rcp_crc16_update(uint16_t crc, const uint8_t *data, size_t len);
+static inline uint16_t rcp_sum8(const uint8_t *data, size_t len);
+static inline uint16_t rcp_crc16(const uint8_t *data, size_t len);
+static inline uint16_t rcp_crc32_16(const uint8_t *data, size_t len);
+static inline uint16_t rcp_packet_checksum(const uint8_t *pkt, size_t len);
+static inline uint16_t rcp_packet_cksum_load(const uint8_t *pkt);
+static inline void rcp_packet_cksum_store(uint8_t *pkt, uint16_t cksum);
+
+/**
+ * Add bytes to a running one's complement sum of big-endian 16-bit words
+ *
+ * @param sum The running sum
+ * @param data The bytes to add
+ * @param len The number of bytes
+ * @param odd Whether data[0] is the low byte of a word
+ * @return The updated sum (fold it with rcp_checksum_fold)
+ */
+static inline uint32_t rcp_checksum_add(uint32_t sum, const uint8_t *data, size_t len, bool odd) {
+    for (size_t i = 0; i < len; i++) {
+        sum += ((i & 1) == odd) ? (uint32_t)data[i] << 8 : data[i];
+    }
+    return sum;
+}
+
+/**
+ * Add bytes to a running one's complement sum, four bytes at a time
+ * - Gives exactly the same result as rcp_checksum_add.
+ * - Aligned words are split into two pairs of 16-bit lanes: one collects bytes 0 and 2 of
+ *   every word, the other bytes 1 and 3. On ARMv6 each pair is one UXTAB16 (zero-extend
+ *   two bytes and add them to two halfwords); elsewhere it's a mask and an add. The lanes
+ *   are shifted into place by parity once at the end, so the loop has no shifts or carry
+ *   handling.
+ *
+ * @param sum The running sum
+ * @param data The bytes to add
+ * @param len The number of bytes
+ * @param odd Whether data[0] is the low byte of a word
+ * @return The updated sum (fold it with rcp_checksum_fold)
+ */
+static inline uint32_t rcp_checksum_add_fast(uint32_t sum, const uint8_t *data, size_t len,
+                                             bool odd) {
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+    return rcp_checksum_add(sum, data, len, odd);
+#else
+    size_t i = 0;
+
+    // Leading bytes up to a word boundary
+    for (; i < len && ((uintptr_t)(data + i) & 3); i++) {
+        sum += ((i & 1) == odd) ? (uint32_t)data[i] << 8 : data[i];
+    }
+
+    // Bytes 0 and 2 of each word are high bytes if the first word starts on a high byte
+    const bool even_lanes_high = (i & 1) == odd;
+
+    while (len - i >= 4) {
+        // A 16-bit lane overflows after 257 bytes of 0xFF, so flush every 256 words
+        size_t n_words = (len - i) / 4 < 256 ? (len - i) / 4 : 256;
+        const rcp_word_t *words = (const rcp_word_t *)(data + i);
+        uint32_t lanes02 = 0, lanes13 = 0;
+
+        for (size_t w = 0; w < n_words; w++) {
+            uint32_t x = words[w];
+#ifdef __ARM_FEATURE_SIMD32
+            asm("uxtab16 %0, %0, %1" : "+r"(lanes02) : "r"(x));
+            asm("uxtab16 %0, %0, %1, ror #8" : "+r"(lanes13) : "r"(x));
+#else
+            lanes02 += x & 0x00FF00FF;
+            lanes13 += (x >> 8) & 0x00FF00FF;
+#endif
+        }
+        i += n_words * 4;
+
+        uint32_t sum02 = (lanes02 & 0xFFFF) + (lanes02 >> 16);
+        uint32_t sum13 = (lanes13 & 0xFFFF) + (lanes13 >> 16);
+        sum += even_lanes_high ? (sum02 << 8) + sum13 : sum02 + (sum13 << 8);
+    }
+
+    // Trailing bytes
+    for (; i < len; i++) {
+        sum += ((i & 1) == odd) ? (uint32_t)data[i] << 8 : data[i];
+    }
+    return sum;
+#endif
+}
+
+/**
+ * Fold a running sum into the 8-bit checksum
+ *
+ * @param sum The running sum
+ * @return The 8-bit checksum
+ */
+static inline uint8_t rcp_checksum_fold(uint32_t sum) {
+    // Add carries back in to get the 16-bit one's complement sum
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+
+    // Take one's complement
+    sum = ~sum & 0xFFFF;
+
+    // Return 8-bit checksum (fold the 16-bit value)
+    return (uint8_t)((sum & 0xFF) + ((sum >> 8) & 0xFF));
+}
+
+/**
+ * Add bytes to a running CRC-16-CCITT
+ *
+ * @param crc The running CRC (start from 0xFFFF)
+ * @param data The bytes to add
+ * @param len The number of bytes
+ * @return The updated CRC
+ */
+static inline uint16_t rcp_crc16_update(uint16_t crc, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        crc = (crc << 8) ^ rcp_crc16_tab[(crc >> 8) ^ data[i]];
+    }
+    return crc;
+}
+
+/**
+ * Folded 8-bit one's complement sum of a byte range
+ *
+ * @param data The bytes to check
+ * @param len The number of bytes
+ * @return The check value
+ */
+static inline uint16_t rcp_sum8(const uint8_t *data, size_t len) {
+    return rcp_checksum_fold(rcp_checksum_add_fast(0, data, len, false));
+}
+
+/**
+ * CRC-16-CCITT of a byte range
+ *
+ * @param data The bytes to check
+ * @param len The number of bytes
+ * @return The check value
+ */
+static inline uint16_t rcp_crc16(const uint8_t *data, size_t len) {
+    return rcp_crc16_update(0xFFFF, data, len);
+}
+
+/**
+ * CRC-32 of a byte range, truncated to 16 bits (uses libpi's table-driven CRC-32)
+ *
+ * @param data The bytes to check
+ * @param len The number of bytes
+ * @return The check value
+ */
+static inline uint16_t rcp_crc32_16(const uint8_t *data, size_t len) {
+    return our_crc32(data, len) & 0xFFFF;
+}
+
+/**
+ * Compute the check value of a wire-format packet in the configured mode
+ * - The check value field (bytes 1 through RCP_CKSUM_LENGTH) and the hop limit (byte
+ *   RCP_HOPS_OFFSET) are skipped.
+ *
+ * @param pkt The packet bytes
+ * @param len The packet length (header and payload)
+ * @return The check value
+ */
+static inline uint16_t rcp_packet_checksum(const uint8_t *pkt, size_t len) {
+    assert(pkt);
+    assert(len > RCP_HOPS_OFFSET);
+
+#if RCP_INTEGRITY == RCP_INTEGRITY_SUM8
+    // Subtracting the skipped bytes is cheaper than splitting the words they share; both
+    // are the low bytes of theirs
+    return rcp_checksum_fold(rcp_checksum_add_fast(0, pkt, len, false) - pkt[1] -
+                             pkt[RCP_HOPS_OFFSET]);
+#else
+    // Run the CRC over the length byte, the destination, then everything after the hop
+    // limit
+    const uint8_t *dst = pkt + 1 + RCP_CKSUM_LENGTH;
+    const uint8_t *rest = pkt + RCP_HOPS_OFFSET + 1;
+    size_t rest_len = len - RCP_HOPS_OFFSET - 1;
+#if RCP_INTEGRITY == RCP_INTEGRITY_CRC16
+    uint16_t crc = rcp_crc16_update(rcp_crc16_update(0xFFFF, pkt, 1), dst, 1);
+    return rcp_crc16_update(crc, rest, rest_len);
+#else
+    uint32_t crc = our_crc32_inc(dst, 1, our_crc32_inc(pkt, 1, 0));
+    return our_crc32_inc(rest, rest_len, crc) & 0xFFFF;
+#endif
+#endif
+}
+
+/**
+ * Read the check value carried in a wire-format packet
+ *
+ * @param pkt The packet bytes
+ * @return The check value
+ */
+static inline uint16_t rcp_packet_cksum_load(const uint8_t *pkt) {
+#if RCP_CKSUM_LENGTH == 1
+    return pkt[1];
+#else
+    return (pkt[1] << 8) | pkt[2];
+#endif
+}
+
+/**
+ * Write the check value into a wire-format packet
+ *
+ * @param pkt The packet bytes
+ * @param cksum The check value
+ */
+static inline void rcp_packet_cksum_store(uint8_t *pkt, uint16_t cksum) {
+#if RCP_CKSUM_LENGTH == 1
+    pkt[1] = cksum;
+#else
+    pkt[1] = cksum >> 8;
+    pkt[2] = cksum & 0xFF;
+#endif
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include "fec.h"
+#include "rcp-datagram.h"
+
+/* Compact RCP headers
+ * Once a connection is set up, nearly every packet is a pure ACK or a data segment whose
+ * source is implied by the connection, so the compact forms leave out what the receiver
+ * already knows (the layouts are in rcp-header.h). A full header starts with the payload
+ * length, which never has its top bit set, so that bit marks a compact header.
+ *
+ * - The source address is implicit: the receiver fills it in from its connection.
+ * - The destination and hop limit stay at the same offsets as in the full header, so a
+ *   router can forward either form without telling them apart.
+ * - SYN segments always use the full header; that's what sets up the connection context.
+ */
+
+#define RCP_COMPACT 0x80          /* Marks a compact header */
+#define RCP_COMPACT_DATA 0x40     /* Compact data segment (otherwise a compact ACK) */
+#define RCP_COMPACT_FIN 0x20      /* The data segment carries a FIN */
+#define RCP_COMPACT_LEN_MASK 0x1F /* Payload length of a compact data segment */
+#define RCP_COMPACT_PARITY 0x20     /* Compact FEC parity (otherwise a compact ACK) */
+#define RCP_COMPACT_PARITY_FIN 0x10 /* The parity covers the end of the stream */
+
+/* Forward declarations for inline functions */
+static inline int rcp_is_compact(const uint8_t* data);
+static inline int rcp_compact_encode(const rcp_datagram_t* dgram, uint8_t* data,
+                                     size_t max_length);
+static inline int rcp_compact_decode(rcp_datagram_t* dgram, const uint8_t* data, size_t length,
+                                     uint8_t src);
+
+/* Check if a packet uses a compact header */
+static inline int rcp_is_compact(const uint8_t* data) { return (data[0] & RCP_COMPACT) != 0; }
+
+/* Serialize an RCP datagram with a compact header and fill in its checksum
+ * Datagrams with the ACK flag become compact ACKs (the payload is dropped), FEC parity
+ * becomes compact parity, and anything else becomes a compact data segment. The source
+ * address is not sent.
+ * Returns number of bytes written, or -1 on error (including SYN segments, which need the
+ * full header) */
+static inline int rcp_compact_encode(const rcp_datagram_t* dgram, uint8_t* data,
+                                     size_t max_length) {
+    if (!dgram || !data) {
+        return -1;
+    }
+
+    const rcp_header_t* hdr = &dgram->header;
+    if (rcp_has_flag(hdr, RCP_FLAG_SYN)) {
+        return -1;  // The remote learns who we are from the full header
+    }
+
+    // Everything after the checksum field
+    uint8_t* fields = data + 1 + RCP_CKSUM_LENGTH;
+    size_t total_length;
+
+    if (rcp_has_flag(hdr, RCP_FLAG_ACK)) {
+        total_length = RCP_COMPACT_ACK_LENGTH;
+        if (max_length < total_length) {
+            return -1;
+        }
+
+        data[0] = RCP_COMPACT;
+        fields[0] = hdr->dst;
+        fields[1] = hdr->hops;
+        fields[2] = hdr->ackno >> 8;
+        fields[3] = hdr->ackno & 0xFF;
+        fields[4] = hdr->window >> 8;
+        fields[5] = hdr->window & 0xFF;
+    } else if (rcp_has_flag(hdr, RCP_FLAG_FEC)) {
+        // Parity always fills the packet; the ackno field holds the bytes it covers
+        total_length = RCP_COMPACT_PARITY_LENGTH + FEC_WIDTH;
+        if (hdr->payload_len != FEC_WIDTH || max_length < total_length) {
+            return -1;
+        }
+
+        data[0] = RCP_COMPACT | RCP_COMPACT_PARITY;
+        if (rcp_has_flag(hdr, RCP_FLAG_FIN)) {
+            data[0] |= RCP_COMPACT_PARITY_FIN;
+        }
+        fields[0] = hdr->dst;
+        fields[1] = hdr->hops;
+        fields[2] = hdr->seqno >> 8;
+        fields[3] = hdr->seqno & 0xFF;
+        fields[4] = hdr->ackno;
+        memcpy(data + RCP_COMPACT_PARITY_LENGTH, rcp_datagram_payload(dgram), FEC_WIDTH);
+    } else {
+        size_t payload_len = hdr->payload_len;
+        total_length = RCP_COMPACT_DATA_LENGTH + payload_len;
+        if (payload_len > RCP_COMPACT_MAX_PAYLOAD || max_length < total_length) {
+            return -1;  // Buffer too small or packet too large
+        }
+
+        data[0] = RCP_COMPACT | RCP_COMPACT_DATA | payload_len;
+        if (rcp_has_flag(hdr, RCP_FLAG_FIN)) {
+            data[0] |= RCP_COMPACT_FIN;
+        }
+        fields[0] = hdr->dst;
+        fields[1] = hdr->hops;
+        fields[2] = hdr->seqno >> 8;
+        fields[3] = hdr->seqno & 0xFF;
+
+        if (payload_len > 0) {
+            memcpy(data + RCP_COMPACT_DATA_LENGTH, rcp_datagram_payload(dgram), payload_len);
+        }
+    }
+
+    rcp_packet_cksum_store(data, rcp_packet_checksum(data, total_length));
+    return total_length;
+}
+
+/* Parse and verify a packet with a compact header
+ * The checksum is checked before anything is copied. On success the header is filled in
+ * as if it had been sent in full (with <src> from the connection context) and the payload
+ * is borrowed from <data>.
+ * Returns 1 on success, 0 on a bad length or checksum */
+static inline int rcp_compact_decode(rcp_datagram_t* dgram, const uint8_t* data, size_t length,
+                                     uint8_t src) {
+    if (!dgram || !data || length < 1 || !rcp_is_compact(data)) {
+        return 0;
+    }
+
+    bool is_data = data[0] & RCP_COMPACT_DATA;
+    bool is_parity = !is_data && (data[0] & RCP_COMPACT_PARITY);
+    size_t payload_len = is_data ? data[0] & RCP_COMPACT_LEN_MASK : is_parity ? FEC_WIDTH : 0;
+    size_t total_length = is_data     ? RCP_COMPACT_DATA_LENGTH + payload_len
+                          : is_parity ? RCP_COMPACT_PARITY_LENGTH + payload_len
+                                      : RCP_COMPACT_ACK_LENGTH;
+    if (payload_len > RCP_COMPACT_MAX_PAYLOAD || length < total_length) {
+        return 0;  // Invalid length or not enough data
+    }
+
+    if (rcp_packet_checksum(data, total_length) != rcp_packet_cksum_load(data)) {
+        return 0;  // Invalid checksum
+    }
+
+    const uint8_t* fields = data + 1 + RCP_CKSUM_LENGTH;
+    rcp_header_t* hdr = &dgram->header;
+    *hdr = rcp_header_init();
+    hdr->cksum = rcp_packet_cksum_load(data);
+    hdr->src = src;
+    hdr->dst = fields[0];
+    hdr->hops = fields[1];
+
+    if (is_data) {
+        hdr->payload_len = payload_len;
+        hdr->seqno = (fields[2] << 8) | fields[3];
+        if (data[0] & RCP_COMPACT_FIN) {
+            rcp_set_flag(hdr, RCP_FLAG_FIN);
+        }
+        dgram->borrowed = data + RCP_COMPACT_DATA_LENGTH;
+    } else if (is_parity) {
+        rcp_set_flag(hdr, RCP_FLAG_FEC);
+        if (data[0] & RCP_COMPACT_PARITY_FIN) {
+            rcp_set_flag(hdr, RCP_FLAG_FIN);
+        }
+        hdr->payload_len = payload_len;
+        hdr->seqno = (fields[2] << 8) | fields[3];
+        hdr->ackno = fields[4];
+        dgram->borrowed = data + RCP_COMPACT_PARITY_LENGTH;
+    } else {
+        rcp_set_flag(hdr, RCP_FLAG_ACK);
+        hdr->ackno = (fields[2] << 8) | fields[3];
+        hdr->window = (fields[4] << 8) | fields[5];
+        dgram->borrowed = NULL;
+    }
+
+    return 1;
+}
@@ -4,10 +4,15 @@
 
 /* RCP Datagram structure
  * Contains both the header and payload of an RCP packet
+ *
+ * The payload is either stored inline or borrowed from memory the caller owns (e.g. the
+ * wire buffer a packet was parsed from), so datagrams never allocate. Use
+ * rcp_datagram_payload to get at it; a borrowed payload is only valid while its owner is.
  */
 typedef struct rcp_datagram {
-    rcp_header_t header; /* RCP header */
-    uint8_t* payload;    /* Pointer to payload data */
+    rcp_header_t header;              /* RCP header */
+    const uint8_t* borrowed;          /* Borrowed payload, or NULL if the payload is inline */
+    uint8_t payload[RCP_MAX_PAYLOAD]; /* Inline payload data */
 } rcp_datagram_t;
 
 /* Forward declarations for inline functions */
@@ -16,19 +21,25 @@ static inline int rcp_datagram_parse(rcp_datagram_t* dgram, const void* data, si
 static inline int rcp_datagram_serialize(const rcp_datagram_t* dgram, void* data,
                                          size_t max_length);
 static inline int rcp_datagram_set_payload(rcp_datagram_t* dgram, const void* data, size_t length);
+static inline int rcp_datagram_borrow_payload(rcp_datagram_t* dgram, const void* data,
+                                              size_t length);
+static inline const uint8_t* rcp_datagram_payload(const rcp_datagram_t* dgram);
 static inline void rcp_datagram_compute_checksum(rcp_datagram_t* dgram);
 static inline int rcp_datagram_verify_checksum(const rcp_datagram_t* dgram);
+static inline int rcp_datagram_encode(rcp_datagram_t* dgram, uint8_t* data, size_t max_length);
+static inline int rcp_datagram_decode(rcp_datagram_t* dgram, const uint8_t* data, size_t length);
 
 /* Initialize a new RCP datagram with default header values */
 static inline rcp_datagram_t rcp_datagram_init(void) {
     rcp_datagram_t dgram = {
         .header = rcp_header_init(),
-        .payload = NULL,
+        .borrowed = NULL,
     };
     return dgram;
 }
 
 /* Parse raw network data into an RCP datagram
+ * The payload is borrowed from <data>, which must outlive the datagram
  * Returns 1 on success, 0 on failure
  */
 static inline int rcp_datagram_parse(rcp_datagram_t* dgram, const void* data, size_t length) {
@@ -45,15 +56,8 @@ static inline int rcp_datagram_parse(rcp_datagram_t* dgram, const void* data, si
         return 0;  // Invalid length or not enough data
     }
 
-    // Allocate and copy payload if present
-    if (payload_len > 0) {
-        dgram->payload = kmalloc(payload_len);
-        if (!dgram->payload) {
-            return 0;  // Memory allocation failed
-        }
-
-        memcpy(dgram->payload, (const uint8_t*)data + RCP_HEADER_LENGTH, payload_len);
-    }
+    // Point at the payload in place rather than copying it
+    dgram->borrowed = (const uint8_t*)data + RCP_HEADER_LENGTH;
 
     return 1;
 }
@@ -75,28 +79,24 @@ static inline int rcp_datagram_serialize(const rcp_datagram_t* dgram, void* data
     rcp_header_serialize(&dgram->header, data);
 
     // Copy payload if present
-    if (dgram->payload && dgram->header.payload_len > 0) {
-        memcpy((uint8_t*)data + RCP_HEADER_LENGTH, dgram->payload, dgram->header.payload_len);
+    if (dgram->header.payload_len > 0) {
+        memcpy((uint8_t*)data + RCP_HEADER_LENGTH, rcp_datagram_payload(dgram),
+               dgram->header.payload_len);
     }
 
     return total_length;
 }
 
 /* Set the payload of an RCP datagram
- * Makes a copy of the provided data
+ * Makes a copy of the provided data in the inline buffer
  * Returns 0 on success, -1 on error */
 static inline int rcp_datagram_set_payload(rcp_datagram_t* dgram, const void* data, size_t length) {
     if (!dgram || length > RCP_MAX_PAYLOAD) {
         return -1;
     }
 
+    dgram->borrowed = NULL;
     if (data && length > 0) {
-        // Allocate and copy new payload
-        dgram->payload = kmalloc(length);
-        if (!dgram->payload) {
-            return -1;  // Memory allocation failed
-        }
-
         memcpy(dgram->payload, data, length);
         dgram->header.payload_len = length;
     } else {
@@ -106,6 +106,32 @@ static inline int rcp_datagram_set_payload(rcp_datagram_t* dgram, const void* da
     return 0;
 }
 
+/* Set the payload of an RCP datagram without copying it
+ * <data> must stay valid (and unchanged) for as long as the datagram is used
+ * Up to RCP_COMPACT_MAX_PAYLOAD bytes are allowed, since compact headers fit more
+ * Returns 0 on success, -1 on error */
+static inline int rcp_datagram_borrow_payload(rcp_datagram_t* dgram, const void* data,
+                                              size_t length) {
+    if (!dgram || length > RCP_COMPACT_MAX_PAYLOAD) {
+        return -1;
+    }
+
+    if (data && length > 0) {
+        dgram->borrowed = data;
+        dgram->header.payload_len = length;
+    } else {
+        dgram->borrowed = NULL;
+        dgram->header.payload_len = 0;
+    }
+
+    return 0;
+}
+
+/* Get the payload of an RCP datagram, wherever it is stored */
+static inline const uint8_t* rcp_datagram_payload(const rcp_datagram_t* dgram) {
+    return dgram->borrowed ? dgram->borrowed : dgram->payload;
+}
+
 /* Compute and set the checksum for this datagram (header + payload) */
 static inline void rcp_datagram_compute_checksum(rcp_datagram_t* dgram) {
     if (!dgram) {
@@ -113,7 +139,7 @@ static inline void rcp_datagram_compute_checksum(rcp_datagram_t* dgram) {
     }
 
     // Compute checksum over header and payload
-    rcp_compute_checksum(&dgram->header, dgram->payload);
+    rcp_compute_checksum(&dgram->header, rcp_datagram_payload(dgram));
 }
 
 /* Verify the checksum of an RCP datagram
@@ -124,5 +150,89 @@ static inline int rcp_datagram_verify_checksum(const rcp_datagram_t* dgram) {
     }
 
     // Verify checksum of both header and payload
-    return rcp_verify_checksum(&dgram->header, dgram->payload);
-}
\ No newline at end of file
+    return rcp_verify_checksum(&dgram->header, rcp_datagram_payload(dgram));
+}
+
+/* Serialize an RCP datagram and fill in its checksum in one pass
+ * Header fields are written straight into <data>, and in the default mode they're summed
+ * as they're written and the payload is summed while it's copied, so nothing is staged or
+ * read twice. The CRC modes run the table-driven CRC over the freshly written bytes. The
+ * checksum is also stored back into the datagram's header.
+ * Returns number of bytes written, or -1 on error */
+static inline int rcp_datagram_encode(rcp_datagram_t* dgram, uint8_t* data, size_t max_length) {
+    if (!dgram || !data) {
+        return -1;
+    }
+
+    const rcp_header_t* hdr = &dgram->header;
+    size_t payload_len = hdr->payload_len;
+    size_t total_length = RCP_HEADER_LENGTH + payload_len;
+    if (payload_len > RCP_MAX_PAYLOAD || max_length < total_length) {
+        return -1;  // Buffer too small or packet too large
+    }
+
+    const uint8_t* payload = rcp_datagram_payload(dgram);
+
+#if RCP_INTEGRITY == RCP_INTEGRITY_SUM8
+    // Header, two bytes (one checksum word) at a time; the checksum byte and the hop limit
+    // count as zero
+    data[0] = payload_len;
+    data[2] = hdr->dst;
+    data[3] = hdr->hops;
+    data[4] = hdr->src;
+    data[5] = hdr->seqno >> 8;
+    data[6] = hdr->seqno & 0xFF;
+    data[7] = hdr->flags;
+    data[8] = hdr->ackno >> 8;
+    data[9] = hdr->ackno & 0xFF;
+    data[10] = hdr->window >> 8;
+    data[11] = hdr->window & 0xFF;
+    uint32_t sum = (payload_len << 8) + (hdr->dst << 8) + (hdr->src << 8 | hdr->seqno >> 8) +
+                   ((hdr->seqno & 0xFF) << 8 | hdr->flags) + hdr->ackno + hdr->window;
+
+    // Payload: byte 12 on the wire is the high half of a word, so even payload bytes are high
+    uint8_t* out = data + RCP_HEADER_LENGTH;
+    for (size_t i = 0; i < payload_len; i++) {
+        uint8_t b = payload[i];
+        out[i] = b;
+        sum += (i & 1) ? b : (uint32_t)b << 8;
+    }
+
+    data[1] = dgram->header.cksum = rcp_checksum_fold(sum);
+#else
+    rcp_header_serialize(hdr, data);
+    if (payload_len > 0) {
+        memcpy(data + RCP_HEADER_LENGTH, payload, payload_len);
+    }
+
+    dgram->header.cksum = rcp_packet_checksum(data, total_length);
+    rcp_packet_cksum_store(data, dgram->header.cksum);
+#endif
+
+    return total_length;
+}
+
+/* Parse and verify raw network data in one pass
+ * The checksum is checked on the raw bytes before the datagram is touched, so a corrupt
+ * packet is rejected without copying anything. On success the payload is borrowed from
+ * <data>.
+ * Returns 1 on success, 0 on a bad length or checksum */
+static inline int rcp_datagram_decode(rcp_datagram_t* dgram, const uint8_t* data, size_t length) {
+    if (!dgram || !data || length < RCP_HEADER_LENGTH) {
+        return 0;
+    }
+
+    size_t payload_len = data[0];
+    if (payload_len > RCP_MAX_PAYLOAD || length < RCP_HEADER_LENGTH + payload_len) {
+        return 0;  // Invalid length or not enough data
+    }
+
+    uint16_t cksum = rcp_packet_cksum_load(data);
+    if (rcp_packet_checksum(data, RCP_HEADER_LENGTH + payload_len) != cksum) {
+        return 0;  // Invalid checksum
+    }
+
+    rcp_header_parse(&dgram->header, data);
+    dgram->borrowed = data + RCP_HEADER_LENGTH;
+    return 1;
+}
@@ -1,31 +1,75 @@
 #pragma once
 
+#include "rcp-checksum.h"
 #include "rpi.h"
 
-#define RCP_HEADER_LENGTH 11 /* RCP header length in bytes */
-#define RCP_MAX_PAYLOAD 21   /* Maximum payload size to fit in 32-byte packet */
-#define RCP_TOTAL_SIZE 32    /* Total size of RCP packet (header + max payload) */
-
-/* Flag bits for the flags field */
-#define RCP_FLAG_FIN (1 << 0) /* FIN flag */
-#define RCP_FLAG_SYN (1 << 1) /* SYN flag */
-#define RCP_FLAG_ACK (1 << 2) /* ACK flag */
+#define RCP_HEADER_LENGTH (11 + RCP_CKSUM_LENGTH) /* RCP header length in bytes */
+#define RCP_TOTAL_SIZE 32 /* Total size of RCP packet (header + max payload) */
+#define RCP_MAX_PAYLOAD (RCP_TOTAL_SIZE - RCP_HEADER_LENGTH) /* Max payload to fit in a packet */
 
 /*
- * RCP Header Format (11 bytes total):
- * Byte 0:     Payload Length (1 byte)
- * Byte 1:     Checksum (1 byte)
+ * Compact header forms (see rcp-compact.h), used once a connection is set up
+ * Compact data (6 bytes with the default checksum):
+ * Byte 0:     1 | 1 | FIN | Payload Length (5 bits)
+ * Byte 1:     Checksum (1 byte; 2 bytes in the CRC modes, which shifts the rest by one)
  * Byte 2:     Destination Address (1 byte)
- * Byte 3:     Source Address (1 byte)
+ * Byte 3:     Hop Limit (1 byte)
  * Bytes 4-5:  Sequence Number (2 bytes)
- * Byte 6:     Flags (FIN, SYN, ACK) (1 byte)
- * Bytes 7-8:  Acknowledgment Number (2 bytes)
- * Bytes 9-10: Window Size (2 bytes)
+ * Compact ACK (8 bytes with the default checksum):
+ * Byte 0:     1 | 0 | 000000
+ * Byte 1:     Checksum
+ * Byte 2:     Destination Address (1 byte)
+ * Byte 3:     Hop Limit (1 byte)
+ * Bytes 4-5:  Acknowledgment Number (2 bytes)
+ * Bytes 6-7:  Window Size (2 bytes)
+ * Compact parity (7 bytes with the default checksum, followed by FEC_WIDTH bytes; see fec.h):
+ * Byte 0:     1 | 0 | 1 | FIN | 0000
+ * Byte 1:     Checksum
+ * Byte 2:     Destination Address (1 byte)
+ * Byte 3:     Hop Limit (1 byte)
+ * Bytes 4-5:  Sequence Number of the first byte covered (2 bytes)
+ * Byte 6:     Number of stream bytes covered (1 byte)
+ * Fragments of connectionless datagrams start with 0 | 1 (see fragment.h)
+ */
+#define RCP_COMPACT_DATA_LENGTH (5 + RCP_CKSUM_LENGTH) /* Compact data header length */
+#define RCP_COMPACT_ACK_LENGTH (7 + RCP_CKSUM_LENGTH)  /* Compact ACK header length */
+#define RCP_COMPACT_PARITY_LENGTH (6 + RCP_CKSUM_LENGTH) /* Compact parity header length */
+
+/*
+ * Hop limit
+ * Every wire form carries one right after the destination (at RCP_HOPS_OFFSET). A router
+ * drops a packet that arrives with no hops left and forwards the rest with one fewer, so
+ * a routing loop can't keep a packet on the air forever. It's left out of the checksum,
+ * so routers can count it down without touching anything else.
+ */
+#define RCP_DEFAULT_HOPS 8 /* Hop limit packets are sent with */
+#define RCP_COMPACT_MAX_PAYLOAD (RCP_TOTAL_SIZE - RCP_COMPACT_DATA_LENGTH) /* Max payload */
+
+/* Flag bits for the flags field */
+#define RCP_FLAG_FIN   (1 << 0) /* FIN flag */
+#define RCP_FLAG_SYN   (1 << 1) /* SYN flag */
+#define RCP_FLAG_ACK   (1 << 2) /* ACK flag */
+#define RCP_FLAG_FEC   (1 << 3) /* FEC parity (the ackno field holds the bytes covered) */
+#define RCP_FLAG_ROUTE (1 << 4) /* Routing update (see routing.h) */
+#define RCP_FLAG_MCAST (1 << 5) /* Multicast chunk or report (see mcast.h) */
+
+/*
+ * RCP Header Format (12 bytes total with the default checksum):
+ * Byte 0:      Payload Length (1 byte)
+ * Byte 1:      Checksum (1 byte; 2 bytes in the CRC modes, which shifts the rest by one)
+ * Byte 2:      Destination Address (1 byte)
+ * Byte 3:      Hop Limit (1 byte)
+ * Byte 4:      Source Address (1 byte)
+ * Bytes 5-6:   Sequence Number (2 bytes)
+ * Byte 7:      Flags (FIN, SYN, ACK) (1 byte)
+ * Bytes 8-9:   Acknowledgment Number (2 bytes)
+ * Bytes 10-11: Window Size (2 bytes)
  */
 typedef struct rcp_header {
     uint8_t payload_len; /* Length of payload */
-    uint8_t cksum;       /* Checksum covering header and payload */
+    uint16_t cksum;      /* Checksum covering header and payload (see rcp-checksum.h) */
     uint8_t dst;         /* Destination address */
+    uint8_t hops;        /* Hop limit: routers left before the packet is dropped */
     uint8_t src;         /* Source address */
     uint16_t seqno;      /* Sequence number */
     uint8_t flags;       /* Control flags (FIN, SYN, ACK) */
@@ -35,7 +79,7 @@ typedef struct rcp_header {
 
 /* Forward declarations for inline functions */
 static inline rcp_header_t rcp_header_init(void);
-static inline uint8_t rcp_calculate_checksum(const rcp_header_t *hdr, const uint8_t *payload);
+static inline uint16_t rcp_calculate_checksum(const rcp_header_t *hdr, const uint8_t *payload);
 static inline void rcp_compute_checksum(rcp_header_t *hdr, const uint8_t *payload);
 static inline int rcp_verify_checksum(const rcp_header_t *hdr, const uint8_t *payload);
 static inline void rcp_header_parse(rcp_header_t *hdr, const void *data);
@@ -55,6 +99,7 @@ static inline rcp_header_t rcp_header_init(void) {
     rcp_header_t hdr = {.payload_len = 0,
                         .cksum = 0,
                         .dst = 0,
+                        .hops = RCP_DEFAULT_HOPS,
                         .src = 0,
                         .seqno = 0,
                         .flags = 0,
@@ -64,59 +109,25 @@ static inline rcp_header_t rcp_header_init(void) {
 }
 
 /*
- * 16-bit one's complement sum checksum calculation
- * Similar to TCP/IP checksum but simplified for RCP
+ * Calculate the checksum of a header and payload in the configured integrity mode
+ * The check runs over the packet as it appears on the wire, so this lays it out first;
+ * rcp_datagram_encode and rcp_datagram_decode avoid the extra copy.
  */
-static inline uint8_t rcp_calculate_checksum(const rcp_header_t *hdr, const uint8_t *payload) {
+static inline uint16_t rcp_calculate_checksum(const rcp_header_t *hdr, const uint8_t *payload) {
     if (!hdr) {
         return 0;
     }
 
-    // Create a working copy of the header with checksum field zeroed
-    rcp_header_t temp_hdr = *hdr;
-    temp_hdr.cksum = 0;
-
-    // Use 16-bit one's complement sum
-    uint16_t sum = 0;
-    const uint8_t *data = (const uint8_t *)&temp_hdr;
-
-    // Sum header bytes as 16-bit words
-    for (size_t i = 0; i < RCP_HEADER_LENGTH; i += 2) {
-        if (i + 1 < RCP_HEADER_LENGTH) {
-            sum += (data[i] << 8) | data[i + 1];
-        } else {
-            // Handle odd byte count
-            sum += (data[i] << 8);
-        }
-
-        // Add carry
-        while (sum >> 16) {
-            sum = (sum & 0xFFFF) + (sum >> 16);
-        }
-    }
-
-    // Add payload bytes if present
-    if (payload && hdr->payload_len > 0) {
-        for (size_t i = 0; i < hdr->payload_len; i += 2) {
-            if (i + 1 < hdr->payload_len) {
-                sum += (payload[i] << 8) | payload[i + 1];
-            } else {
-                // Handle odd byte count
-                sum += (payload[i] << 8);
-            }
-
-            // Add carry
-            while (sum >> 16) {
-                sum = (sum & 0xFFFF) + (sum >> 16);
-            }
-        }
+    uint8_t bytes[RCP_TOTAL_SIZE];
+    size_t payload_len = hdr->payload_len < RCP_MAX_PAYLOAD ? hdr->payload_len : RCP_MAX_PAYLOAD;
+    rcp_header_serialize(hdr, bytes);
+    if (payload && payload_len > 0) {
+        memcpy(bytes + RCP_HEADER_LENGTH, payload, payload_len);
+    } else {
+        payload_len = 0;
     }
 
-    // Take one's complement
-    sum = ~sum;
-
-    // Return 8-bit checksum (fold the 16-bit value)
-    return (uint8_t)((sum & 0xFF) + ((sum >> 8) & 0xFF));
+    return rcp_packet_checksum(bytes, RCP_HEADER_LENGTH + payload_len);
 }
 
 /*
@@ -142,18 +153,8 @@ static inline int rcp_verify_checksum(const rcp_header_t *hdr, const uint8_t *pa
         return 0;
     }
 
-    // Save original checksum
-    uint8_t original_cksum = hdr->cksum;
-
-    // Create a copy of the header
-    rcp_header_t temp_hdr = *hdr;
-    temp_hdr.cksum = 0;
-
-    // Calculate checksum with zeroed checksum field
-    uint8_t calculated_cksum = rcp_calculate_checksum(&temp_hdr, payload);
-
-    // If checksum is valid, they should match
-    return (calculated_cksum == original_cksum) ? 1 : 0;
+    // The calculation skips the checksum field, so it can be compared directly
+    return (rcp_calculate_checksum(hdr, payload) == hdr->cksum) ? 1 : 0;
 }
 
 /* Parse raw network data into an RCP header structure */
@@ -165,13 +166,21 @@ static inline void rcp_header_parse(rcp_header_t *hdr, const void *data) {
     const uint8_t *bytes = (const uint8_t *)data;
 
     hdr->payload_len = bytes[0];
+#if RCP_CKSUM_LENGTH == 1
     hdr->cksum = bytes[1];
-    hdr->dst = bytes[2];
-    hdr->src = bytes[3];
-    hdr->seqno = (bytes[4] << 8) | bytes[5];
-    hdr->flags = bytes[6];
-    hdr->ackno = (bytes[7] << 8) | bytes[8];
-    hdr->window = (bytes[9] << 8) | bytes[10];
+#else
+    hdr->cksum = (bytes[1] << 8) | bytes[2];
+#endif
+
+    // Everything after the checksum field
+    bytes += 1 + RCP_CKSUM_LENGTH;
+    hdr->dst = bytes[0];
+    hdr->hops = bytes[1];
+    hdr->src = bytes[2];
+    hdr->seqno = (bytes[3] << 8) | bytes[4];
+    hdr->flags = bytes[5];
+    hdr->ackno = (bytes[6] << 8) | bytes[7];
+    hdr->window = (bytes[8] << 8) | bytes[9];
 }
 
 /* Serialize an RCP header structure into network data */
@@ -183,14 +192,23 @@ static inline void rcp_header_serialize(const rcp_header_t *hdr, void *data) {
     uint8_t *bytes = (uint8_t *)data;
 
     bytes[0] = hdr->payload_len;
+#if RCP_CKSUM_LENGTH == 1
     bytes[1] = hdr->cksum;
-    bytes[2] = hdr->dst;
-    bytes[3] = hdr->src;
-    bytes[4] = (hdr->seqno >> 8) & 0xFF;
-    bytes[5] = hdr->seqno & 0xFF;
-    bytes[6] = hdr->flags;
-    bytes[7] = (hdr->ackno >> 8) & 0xFF;
-    bytes[8] = hdr->ackno & 0xFF;
-    bytes[9] = (hdr->window >> 8) & 0xFF;
-    bytes[10] = hdr->window & 0xFF;
+#else
+    bytes[1] = (hdr->cksum >> 8) & 0xFF;
+    bytes[2] = hdr->cksum & 0xFF;
+#endif
+
+    // Everything after the checksum field
+    bytes += 1 + RCP_CKSUM_LENGTH;
+    bytes[0] = hdr->dst;
+    bytes[1] = hdr->hops;
+    bytes[2] = hdr->src;
+    bytes[3] = (hdr->seqno >> 8) & 0xFF;
+    bytes[4] = hdr->seqno & 0xFF;
+    bytes[5] = hdr->flags;
+    bytes[6] = (hdr->ackno >> 8) & 0xFF;
+    bytes[7] = hdr->ackno & 0xFF;
+    bytes[8] = (hdr->window >> 8) & 0xFF;
+    bytes[9] = hdr->window & 0xFF;
 }
\ No newline at end of file
@@ -1,7 +1,9 @@
 #pragma once
 
 #include "bytestream.h"
+#include "fec.h"
 #include "nrf.h"
+#include "stats.h"
 #include "types.h"
 
 /* Forward declarations for segment types */
@@ -19,10 +21,13 @@ typedef struct receiver {
 
     char reasm_buffer[MAX_WINDOW_SIZE];  /* Buffer for reassembled data */
     bool reasm_bitmask[MAX_WINDOW_SIZE]; /* Bitmask to track received segments */
+    uint8_t fec_history[FEC_HISTORY];    /* Last bytes written to <writer>, by stream index */
 
     uint32_t total_size; /* Total bytes received */
+    uint16_t isn;        /* Remote's initial sequence number (from its SYN) */
     bool syn_received;   /* Whether a SYN has been received */
     bool fin_received;   /* Whether a FIN has been received */
+    tcp_stats_t *stats;  /* Connection statistics to update (NULL if not kept) */
 
     receiver_transmit_fn_t transmit; /* Callback to send ACKs to the remote peer */
     tcp_peer_t *peer;                /* Pointer to the TCP peer containing this receiver */
@@ -33,6 +38,8 @@ static inline receiver_t receiver_init(nrf_t *nrf, receiver_transmit_fn_t transm
                                        tcp_peer_t *peer);
 static inline void reasm_insert(receiver_t *receiver, size_t first_idx, char *data, size_t len,
                                 bool is_last);
+static inline void reasm_recover(receiver_t *receiver, size_t first_idx, size_t span,
+                                 const uint8_t *parity, bool is_last);
 static inline uint16_t reasm_bytes_pending(receiver_t *receiver);
 static inline void recv_process_segment(receiver_t *receiver, sender_segment_t *segment);
 
@@ -51,9 +58,12 @@ static inline receiver_t receiver_init(nrf_t *nrf, receiver_transmit_fn_t transm
         .writer = bs_init(),
         .reasm_buffer = {0},
         .reasm_bitmask = {0},
+        .fec_history = {0},
         .total_size = 0,
+        .isn = 0,
         .fin_received = false,
         .syn_received = false,
+        .stats = NULL,
         .transmit = transmit,
         .peer = peer,
     };
@@ -114,6 +124,14 @@ static inline void reasm_insert(receiver_t *receiver, size_t first_idx, char *da
 
     // Push contiguous bytes to the writer if any exist
     if (index_to_push > 0) {
+        // Keep a copy of the newest bytes, which FEC repairs may need after the app
+        // has read them
+        size_t push_idx = bs_bytes_written(&receiver->writer);
+        for (size_t i = index_to_push > FEC_HISTORY ? index_to_push - FEC_HISTORY : 0;
+             i < index_to_push; i++) {
+            receiver->fec_history[(push_idx + i) % FEC_HISTORY] = receiver->reasm_buffer[i];
+        }
+
         bs_write(&receiver->writer, receiver->reasm_buffer, index_to_push);
 
         int remaining_sz = MAX_WINDOW_SIZE - index_to_push;
@@ -136,6 +154,82 @@ static inline void reasm_insert(receiver_t *receiver, size_t first_idx, char *da
     }
 }
 
+/**
+ * Rebuild missing bytes of an FEC group from its parity (see fec.h)
+ * - Only works if the missing bytes fit within FEC_WIDTH of each other (one lost segment);
+ *   otherwise the parity is dropped and retransmissions fill the gap.
+ *
+ * @param receiver The receiver to repair
+ * @param first_idx The stream index of the group's first byte
+ * @param span The number of bytes in the group
+ * @param parity The group's FEC_WIDTH parity bytes
+ * @param is_last Whether the group ends the stream
+ */
+static inline void reasm_recover(receiver_t *receiver, size_t first_idx, size_t span,
+                                 const uint8_t *parity, bool is_last) {
+    assert(receiver);
+    assert(parity);
+
+    const size_t end_idx = first_idx + span;
+
+    // The parity says where the stream ends even if the FIN itself was lost
+    if (is_last) {
+        reasm_insert(receiver, end_idx, (char *)parity, 0, true);
+    }
+
+    const size_t first_unassembled_idx = bs_bytes_written(&receiver->writer);
+
+    // Nothing to do if everything has arrived; give up if the bytes we already delivered
+    // are no longer in the history or the group doesn't fit in the window
+    if (end_idx <= first_unassembled_idx ||
+        first_unassembled_idx - MIN(first_idx, first_unassembled_idx) > FEC_HISTORY ||
+        end_idx - first_unassembled_idx > bs_remaining_capacity(&receiver->writer)) {
+        return;
+    }
+
+    // Find the range of missing bytes (everything before <first_unassembled_idx> arrived)
+    const size_t scan_idx = MAX(first_idx, first_unassembled_idx);
+    size_t missing_first = end_idx, missing_last = 0;
+    for (size_t i = scan_idx; i < end_idx; i++) {
+        if (!receiver->reasm_bitmask[i - first_unassembled_idx]) {
+            missing_first = MIN(missing_first, i);
+            missing_last = i;
+        }
+    }
+    if (missing_first == end_idx || missing_last - missing_first >= FEC_WIDTH) {
+        return;  // Nothing missing, or two unknowns in some column
+    }
+
+    // XOR every byte we have into its column; what's left in each column is the one
+    // missing byte there (if any)
+    uint8_t column[FEC_WIDTH];
+    memcpy(column, parity, FEC_WIDTH);
+    for (size_t i = first_idx; i < end_idx; i++) {
+        uint8_t byte;
+        if (i < first_unassembled_idx) {
+            byte = receiver->fec_history[i % FEC_HISTORY];
+        } else if (receiver->reasm_bitmask[i - first_unassembled_idx]) {
+            byte = receiver->reasm_buffer[i - first_unassembled_idx];
+        } else {
+            continue;
+        }
+        column[(i - first_idx) % FEC_WIDTH] ^= byte;
+    }
+
+    // Rebuild the missing range (bytes in it that did arrive are copied as they are)
+    char rebuilt[FEC_WIDTH];
+    size_t rebuilt_len = missing_last - missing_first + 1;
+    for (size_t i = missing_first; i <= missing_last; i++) {
+        size_t reasm_idx = i - first_unassembled_idx;
+        rebuilt[i - missing_first] = receiver->reasm_bitmask[reasm_idx]
+                                         ? receiver->reasm_buffer[reasm_idx]
+                                         : column[(i - first_idx) % FEC_WIDTH];
+    }
+
+    TCP_STAT(receiver->stats, fec_repairs, 1);
+    reasm_insert(receiver, missing_first, rebuilt, rebuilt_len, false);
+}
+
 /**
  * Get the number of bytes pending in the reassembler
  *
@@ -164,10 +258,11 @@ static inline void recv_process_segment(receiver_t *receiver, sender_segment_t *
     assert(receiver);
     assert(segment);
 
-    // Handle SYN flag
+    // Handle SYN flag (the SYN may carry data, which is delivered right away)
     if (!receiver->syn_received) {
         if (segment->is_syn) {
             receiver->syn_received = true;
+            receiver->isn = segment->seqno;
         } else {
             // Ignore segments before SYN is received
             return;
@@ -175,18 +270,43 @@ static inline void recv_process_segment(receiver_t *receiver, sender_segment_t *
     }
 
     // Process the segment data through the reassembler
-    // If the SYN flag is set, the data starts at index 1
+    // The SYN occupies the ISN, so the first data byte has sequence number ISN + 1
     uint16_t data_offset = segment->is_syn ? 1 : 0;
-    uint16_t first_stream_idx = data_offset + segment->seqno - 1;
+    uint16_t wrapped_idx = segment->seqno + data_offset - receiver->isn - 1;
+
+    // Sequence numbers are 16 bits: unwrap around the next stream index we expect
+    size_t expected_idx = bs_bytes_written(&receiver->writer);
+    int16_t delta = (uint16_t)(wrapped_idx - (uint16_t)expected_idx);
 
-    reasm_insert(receiver, first_stream_idx, segment->payload, segment->len, segment->is_fin);
+    // Segments that would start before the stream did are stale (e.g., from an old
+    // connection), so they're only acknowledged
+    if (delta >= 0 || (size_t)-delta <= expected_idx) {
+        size_t first_stream_idx = expected_idx + delta;
+
+        if (segment->is_parity) {
+            // Parity carries no new data of its own, but may fill a gap
+            reasm_recover(receiver, first_stream_idx, segment->fec_span, segment->payload,
+                          segment->is_fin);
+        } else {
+            // Data that's entirely behind us was already delivered; data ahead of us is
+            // past a gap
+            if (segment->len > 0 && first_stream_idx + segment->len <= expected_idx) {
+                TCP_STAT(receiver->stats, dup_segs, 1);
+            } else if (first_stream_idx > expected_idx) {
+                TCP_STAT(receiver->stats, ooo_segs, 1);
+            }
+
+            reasm_insert(receiver, first_stream_idx, segment->payload, segment->len,
+                         segment->is_fin);
+        }
+    }
 
     // Calculate ackno and window size for the ACK
     // Add 1 to ackno if FIN has been processed
     uint16_t fin_offset = bs_writer_finished(&receiver->writer) ? 1 : 0;
 
     // Add one to stream index to account for the SYN
-    uint16_t ackno = fin_offset + bs_bytes_written(&receiver->writer) + 1;
+    uint16_t ackno = receiver->isn + fin_offset + bs_bytes_written(&receiver->writer) + 1;
 
     // Update advertised window size
     uint32_t window_size = MIN(bs_remaining_capacity(&receiver->writer), MAX_WINDOW_SIZE);
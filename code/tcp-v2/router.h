@@ -1,6 +1,27 @@
 #pragma once
 
 #include "nrf.h"
+#include "routing.h"
+
+/**
+ * The router's receive pipe for each user (see nrf_init_piped)
+ * - Each user sends to its own pipe address, so the pipe a packet arrives on says which
+ *   neighbor it came from without looking at the packet.
+ * - Only a router whose receive radio is set up with nrf_init_piped (router_mk_noack)
+ *   listens on ROUTER_USER2_ADDR: the fixed tables below need one. A router built with
+ *   nrf_init only hears pipe 1, so the second user's packets would never arrive.
+ */
+#define ROUTER_USER1_ADDR NRF_PIPE_ADDR(router_server_addr, 1) /* Same as router_server_addr */
+#define ROUTER_USER2_ADDR NRF_PIPE_ADDR(router_server_addr, 2) /* Low byte + 2 */
+
+/**
+ * Router's neighbors by receive pipe: the NRF address of the user sending on each pipe
+ * - Matches router_rtable, so it's also how to reach that neighbor.
+ */
+static uint32_t router_pipe_nbr[NRF_NPIPES] = {
+    [1] = server_addr,  /* First server, via ROUTER_USER1_ADDR */
+    [2] = server_addr_2 /* Second server, via ROUTER_USER2_ADDR */
+};
 
 /**
  * Router's rtable: maps from RCP address to NRF address
@@ -16,26 +37,26 @@ static uint32_t router_rtable[256] = {
 
 /**
  * First user's rtable: maps from RCP address to NRF address
- * - RCP address 0 should route to the router's server (receiver)
+ * - RCP address 0 should route to the router's server (receiver), on the first user's pipe
  * - RCP address 1 is the user itself
- * - RCP address 2 should route to the router's server (receiver)
+ * - RCP address 2 should route to the router's server (receiver), on the first user's pipe
  */
 static uint32_t user1_rtable[256] = {
-    [0] = router_server_addr, /* Router itself */
-    [1] = 0,                  /* First server */
-    [2] = server_addr_2       /* Second server */
+    [0] = ROUTER_USER1_ADDR, /* Router itself */
+    [1] = 0,                 /* First server */
+    [2] = ROUTER_USER1_ADDR  /* Second server */
 };
 
 /**
  * Second user's rtable: maps from RCP address to NRF address
- * - RCP address 0 should route to the router's server (receiver)
- * - RCP address 1 should route to the router's server (receiver)
+ * - RCP address 0 should route to the router's server (receiver), on the second user's pipe
+ * - RCP address 1 should route to the router's server (receiver), on the second user's pipe
  * - RCP address 2 is the user itself
  */
 static uint32_t user2_rtable[256] = {
-    [0] = router_server_addr, /* Router itself */
-    [1] = server_addr,        /* First server */
-    [2] = 0                   /* Second server */
+    [0] = ROUTER_USER2_ADDR, /* Router itself */
+    [1] = ROUTER_USER2_ADDR, /* First server */
+    [2] = 0                  /* Second server */
 };
 
 /**
@@ -48,4 +69,34 @@ static uint32_t *rtable_map[256] = {
     [0] = router_rtable,
     [1] = user1_rtable,
     [2] = user2_rtable
-};
\ No newline at end of file
+};
+
+/* Distance-vector routing state, if routes are learned rather than fixed (see route_use_dv) */
+static dv_t *route_dv;
+
+/**
+ * Learn routes with distance-vector routing instead of the fixed tables above
+ * - Endpoints then send segments with hardware ACKs, so the radios they send from have
+ *   to be set up for ACKs (nrf_init_acked), and so do the next hops' receive pipes.
+ *   ACK replies and route updates still go without, from the same radio.
+ *
+ * @param dv The node's routing state (NULL to go back to the fixed tables)
+ */
+static inline void route_use_dv(dv_t *dv) { route_dv = dv; }
+
+/**
+ * Get the NRF address to send a packet for <dst> to
+ * - With the fixed tables, the next hop depends on who is sending: each user reaches the
+ *   router on its own pipe.
+ *
+ * @param src The sending node's RCP address
+ * @param dst The destination RCP address
+ * @return The next hop's NRF address (0 if there is no route)
+ */
+static inline uint32_t route_next_hop(uint8_t src, uint8_t dst) {
+    if (route_dv) {
+        uint32_t nrf_addr;
+        return dv_next_hop(route_dv, dst, &nrf_addr) ? nrf_addr : 0;
+    }
+    return rtable_map[src] ? rtable_map[src][dst] : 0;
+}
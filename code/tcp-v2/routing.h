@@ -0,0 +1,695 @@
+#pragma once
+
+#include "rcp-datagram.h"
+
+#include "nrf.h"
+#include "pi-random.h"
+
+/**
+ * Distance-vector routing
+ *
+ * Every node keeps a forwarding table with one entry per RCP address: the neighbor to
+ * forward through, that neighbor's NRF address, and the cost of the path. Nodes broadcast
+ * their table to whoever can hear them every <period_us> (with jitter, so neighbors don't
+ * fall into step) and send the entries that changed shortly after a change, so news of a
+ * broken link spreads in a few hops' worth of <trigger_delay_us> rather than a period per
+ * hop.
+ *
+ * Updates are broadcast, so one update goes to every neighbor at once. Split horizon is
+ * done with poisoned reverse at the receiver: every advertised route carries its next hop,
+ * and a node treats a route whose next hop is itself as unreachable. That stops two nodes
+ * from bouncing a dead route back and forth between them.
+ *
+ * A neighbor that isn't heard from for <timeout_us> is dropped, along with every route
+ * through it. Unreachable routes are still advertised (at DV_INFINITY) for <gc_us> so the
+ * news spreads, and are then forgotten.
+ *
+ * Costs are expected transmissions (ETX), not hops: a link that gets a packet through
+ * with probability df and its link-layer ACK back with probability dr costs 1 / (df * dr)
+ * sends, so two clean hops beat one marginal one. Both ratios are running averages:
+ *   - dr (how well we hear the neighbor) comes from gaps in its update sequence numbers;
+ *     every update packet doubles as a probe.
+ *   - df (how well it hears us) is reported back by the neighbor in its link reports, and
+ *     is adjusted between reports by the retransmissions and losses of data we send it
+ *     (see dv_link_observe and dv_send_acked).
+ * Costs are in units of 1 / DV_ETX_SCALE transmissions, so a perfect link costs
+ * DV_ETX_SCALE.
+ *
+ * Update format (a full RCP header with RCP_FLAG_ROUTE set):
+ *   header:  dst = RCP_BROADCAST, src = sender, seqno = update number
+ *   payload: sender's NRF address (3 bytes), kind (1 byte), then either
+ *     - DV_KIND_ROUTES: up to DV_ROUTES_PER_PKT entries of destination (1 byte),
+ *                       cost (1 byte), next hop (1 byte)
+ *     - DV_KIND_LINKS:  up to DV_LINKS_PER_PKT entries of neighbor (1 byte), fraction of
+ *                       its updates we heard (1 byte, 255 = all of them)
+ * A table too big for one packet is sent as several. Link reports go out with every full
+ * update.
+ */
+
+#define RCP_BROADCAST 0xFF   /* RCP address that every node accepts */
+#define RCP_MCAST_FIRST 0xF0 /* First multicast group address (they run up to RCP_BROADCAST) */
+
+#define DV_MAX_NODES 255       /* Table entries, by RCP address (all but RCP_BROADCAST) */
+#define DV_PREAMBLE_LENGTH 4   /* Bytes of NRF address and kind before the entries */
+#define DV_ROUTE_LENGTH 3      /* Bytes per advertised route */
+#define DV_LINK_LENGTH 2       /* Bytes per link report */
+#define DV_ROUTES_PER_PKT ((RCP_MAX_PAYLOAD - DV_PREAMBLE_LENGTH) / DV_ROUTE_LENGTH)
+#define DV_LINKS_PER_PKT ((RCP_MAX_PAYLOAD - DV_PREAMBLE_LENGTH) / DV_LINK_LENGTH)
+
+/* Kinds of update packet */
+#define DV_KIND_ROUTES 0 /* Forwarding table entries */
+#define DV_KIND_LINKS 1  /* How well we hear each neighbor */
+
+#define DV_ETX_SCALE 10                     /* Cost of one transmission */
+#define DV_MAX_LINK_COST (8 * DV_ETX_SCALE) /* Cost of the worst link we'll still use */
+#define DV_INFINITY 255                     /* Cost of an unreachable destination */
+
+/* Hysteresis: another neighbor has to beat the current route by this much to take over,
+   so routes don't flap between paths whose estimates are within noise of each other */
+#define DV_SWITCH_MARGIN (DV_ETX_SCALE / 4)
+
+#define DV_RATIO_ONE 4096   /* Delivery ratio of a perfect link */
+#define DV_RATIO_SAMPLES 16 /* Samples a delivery ratio averages over */
+#define DV_MIN_SAMPLES 4    /* Samples before a new link is trusted at its estimated cost */
+#define DV_MAX_GAP 16       /* Most lost updates counted from one sequence gap */
+
+#define DV_PERIOD_US 2000000             /* Default time between full updates */
+#define DV_TIMEOUT_US (6 * DV_PERIOD_US) /* Default neighbor/route timeout */
+#define DV_GC_US (2 * DV_PERIOD_US)      /* Default time unreachable routes are still advertised */
+#define DV_TRIGGER_DELAY_US 50000        /* Default wait before sending a triggered update */
+
+/* Default NRF address updates are broadcast to
+   - Every node receives on it as well as its own address: dv_init points the radio's
+     pipe 0 at it (see nrf_listen_bcast) */
+#define DV_BROADCAST_NRF 0xb5b5b5
+
+/**
+ * Forwarding table entry
+ */
+typedef struct dv_route {
+    bool in_use;           /* Whether the destination is known */
+    bool changed;          /* Changed since the last update we sent */
+    uint8_t next_hop;      /* RCP address of the neighbor to forward through */
+    uint8_t cost;          /* Cost of the path (DV_INFINITY if unreachable) */
+    uint32_t next_hop_nrf; /* NRF address of <next_hop> */
+    uint32_t updated_us;   /* When the route was last confirmed (or became unreachable) */
+} dv_route_t;
+
+/**
+ * A node we have heard an update from
+ */
+typedef struct dv_neighbor {
+    bool in_use;          /* Whether the neighbor is currently reachable */
+    uint16_t last_seqno;  /* Sequence number of its last update we heard */
+    uint16_t rx_ratio;    /* Fraction of its packets we hear (of DV_RATIO_ONE) */
+    uint16_t tx_ratio;    /* Fraction of our packets it hears (of DV_RATIO_ONE) */
+    uint8_t rx_samples;   /* Samples in <rx_ratio> so far (up to DV_RATIO_SAMPLES) */
+    uint8_t tx_samples;   /* Samples in <tx_ratio> so far (0 until it reports on us) */
+    uint32_t nrf_addr;    /* The neighbor's NRF address */
+    uint32_t heard_us;    /* When we last heard from the neighbor */
+} dv_neighbor_t;
+
+typedef struct dv dv_t;
+
+/* Callback to broadcast one update packet */
+typedef void (*dv_transmit_fn)(dv_t *dv, const uint8_t *pkt, size_t len);
+
+/**
+ * Routing state for one node
+ * - The timing fields may be changed after dv_init.
+ */
+struct dv {
+    nrf_t *nrf;              /* NRF interface updates are sent and heard on */
+    dv_transmit_fn transmit; /* How updates are sent (defaults to the NRF broadcast) */
+    void *arg;               /* Opaque pointer for <transmit> */
+    uint32_t bcast_nrf;      /* NRF address updates are broadcast to */
+    uint8_t local_addr;      /* Local RCP address */
+    uint32_t local_nrf;      /* NRF address neighbors should forward to us on */
+    uint16_t seqno;          /* Number of the next update */
+
+    uint32_t period_us;        /* Time between full updates */
+    uint32_t timeout_us;       /* Time before a silent neighbor or stale route is dropped */
+    uint32_t gc_us;            /* Time unreachable routes are still advertised */
+    uint32_t trigger_delay_us; /* Most time to wait before sending a triggered update */
+
+    uint32_t next_full_us;   /* When the next full update is due */
+    bool trigger_pending;    /* Whether a triggered update is scheduled */
+    uint32_t trigger_us;     /* When the triggered update is due */
+
+    dv_route_t routes[DV_MAX_NODES];       /* Forwarding table, by destination */
+    dv_neighbor_t neighbors[DV_MAX_NODES]; /* Neighbors, by RCP address */
+
+    uint32_t updates_sent;   /* Update packets sent (full and triggered) */
+    uint32_t triggered_sent; /* Triggered updates sent */
+    uint32_t updates_recv;   /* Valid update packets received */
+    uint32_t route_changes;  /* Changes of next hop or cost */
+};
+
+/* Forward declarations for all functions */
+static inline bool rcp_is_mcast(uint8_t addr);
+static inline void dv_init(dv_t *dv, nrf_t *nrf, uint8_t local_addr, uint32_t local_nrf);
+static inline bool rcp_is_route_update(const rcp_datagram_t *dgram);
+static inline bool dv_next_hop(const dv_t *dv, uint8_t dst, uint32_t *nrf_addr);
+static inline uint8_t dv_cost(const dv_t *dv, uint8_t dst);
+static inline uint8_t dv_link_cost(const dv_t *dv, uint8_t nbr_addr);
+static inline void dv_link_observe(dv_t *dv, uint8_t nbr_addr, unsigned attempts, bool delivered);
+static inline uint8_t dv_hop_addr(const dv_t *dv, uint8_t dst, uint32_t nrf_addr);
+static inline int dv_link_send(dv_t *dv, nrf_t *nrf, uint8_t nbr_addr, uint32_t nrf_addr,
+                               const void *msg, unsigned nbytes);
+static inline int dv_send_acked(dv_t *dv, uint8_t dst, const void *msg, unsigned nbytes);
+static inline bool dv_process_datagram(dv_t *dv, const rcp_datagram_t *dgram);
+static inline bool dv_process_packet(dv_t *dv, const uint8_t *data, size_t length);
+static inline void dv_send_update(dv_t *dv, bool changed_only);
+static inline void dv_check_timeouts(dv_t *dv);
+static inline void dv_tick(dv_t *dv);
+
+/* Broadcast an update packet on the NRF */
+static inline void dv_transmit_nrf(dv_t *dv, const uint8_t *pkt, size_t len) {
+    nrf_send_noack(dv->nrf, dv->bcast_nrf, pkt, len);
+}
+
+/* Check if <now> is at or past <deadline> (safe across timer wraparound) */
+static inline bool dv_due(uint32_t now, uint32_t deadline) {
+    return (int32_t)(now - deadline) >= 0;
+}
+
+/* Pick a time for the next full update: <period_us> from now, give or take a quarter */
+static inline uint32_t dv_next_full(const dv_t *dv, uint32_t now) {
+    uint32_t jitter = dv->period_us / 2;
+    return now + dv->period_us - jitter / 2 + (jitter ? pi_random() % jitter : 0);
+}
+
+/**
+ * Check if an RCP address is a multicast group (see mcast.h)
+ * - Groups are never routed as unicast destinations, and no node may take one as its own.
+ *
+ * @param addr The RCP address
+ * @return True if <addr> is in the multicast range
+ */
+static inline bool rcp_is_mcast(uint8_t addr) {
+    return addr >= RCP_MCAST_FIRST && addr != RCP_BROADCAST;
+}
+
+/**
+ * Initialize the routing state in place
+ * - The table starts with just the local node; routes appear as updates arrive.
+ * - <nrf> is set up to also receive DV_BROADCAST_NRF. A node that receives on another
+ *   radio, or changes <bcast_nrf>, has to call nrf_listen_bcast on that radio itself.
+ *
+ * @param dv The routing state to initialize
+ * @param nrf The NRF interface to broadcast updates on (NULL if <transmit> is replaced)
+ * @param local_addr The local RCP address
+ * @param local_nrf The NRF address neighbors should forward to us on
+ */
+static inline void dv_init(dv_t *dv, nrf_t *nrf, uint8_t local_addr, uint32_t local_nrf) {
+    assert(dv);
+    assert(local_addr != RCP_BROADCAST && !rcp_is_mcast(local_addr));
+
+    memset(dv, 0, sizeof(*dv));
+    dv->nrf = nrf;
+    dv->transmit = dv_transmit_nrf;
+    dv->local_addr = local_addr;
+    dv->local_nrf = local_nrf;
+    dv->bcast_nrf = DV_BROADCAST_NRF;
+    dv->seqno = pi_random();
+    if (nrf) {
+        nrf_listen_bcast(nrf, dv->bcast_nrf);
+    }
+
+    dv->period_us = DV_PERIOD_US;
+    dv->timeout_us = DV_TIMEOUT_US;
+    dv->gc_us = DV_GC_US;
+    dv->trigger_delay_us = DV_TRIGGER_DELAY_US;
+
+    // Announce ourselves right away so neighbors learn about us quickly
+    dv->next_full_us = timer_get_usec();
+
+    dv_route_t *self = &dv->routes[local_addr];
+    self->in_use = true;
+    self->next_hop = local_addr;
+    self->cost = 0;
+    self->next_hop_nrf = local_nrf;
+}
+
+/**
+ * Check if a datagram is a routing update
+ *
+ * @param dgram The datagram
+ * @return True if it carries RCP_FLAG_ROUTE
+ */
+static inline bool rcp_is_route_update(const rcp_datagram_t *dgram) {
+    assert(dgram);
+    return rcp_has_flag(&dgram->header, RCP_FLAG_ROUTE);
+}
+
+/**
+ * Look up where to send a packet for <dst>
+ *
+ * @param dv The routing state
+ * @param dst The destination RCP address
+ * @param nrf_addr Set to the next hop's NRF address if there is a route
+ * @return True if <dst> is reachable
+ */
+static inline bool dv_next_hop(const dv_t *dv, uint8_t dst, uint32_t *nrf_addr) {
+    assert(dv);
+    assert(nrf_addr);
+
+    if (dst == RCP_BROADCAST || rcp_is_mcast(dst)) {
+        return false;
+    }
+    const dv_route_t *route = &dv->routes[dst];
+    if (!route->in_use || route->cost >= DV_INFINITY) {
+        return false;
+    }
+    *nrf_addr = route->next_hop_nrf;
+    return true;
+}
+
+/**
+ * Get the cost of the path to <dst>
+ *
+ * @param dv The routing state
+ * @param dst The destination RCP address
+ * @return The cost, or DV_INFINITY if <dst> is unreachable
+ */
+static inline uint8_t dv_cost(const dv_t *dv, uint8_t dst) {
+    assert(dv);
+
+    if (dst == RCP_BROADCAST || !dv->routes[dst].in_use) {
+        return DV_INFINITY;
+    }
+    return dv->routes[dst].cost;
+}
+
+/* Fold one packet (delivered or lost) into a delivery ratio
+   - The first samples are averaged evenly, so a new link's estimate settles quickly;
+     after that each one moves the ratio 1/DV_RATIO_SAMPLES of the way, following changes */
+static inline uint16_t dv_ratio_sample(uint16_t ratio, uint8_t *n_samples, bool delivered) {
+    if (*n_samples < DV_RATIO_SAMPLES) {
+        (*n_samples)++;
+    }
+    unsigned n = *n_samples;
+    return delivered ? ratio + (DV_RATIO_ONE - ratio + n - 1) / n : ratio - (ratio + n - 1) / n;
+}
+
+/**
+ * Get the cost of the link to a neighbor: DV_ETX_SCALE / (df * dr), rounded
+ *
+ * @param dv The routing state
+ * @param nbr_addr The neighbor's RCP address
+ * @return The cost, at most DV_MAX_LINK_COST (DV_INFINITY if it isn't a neighbor)
+ */
+static inline uint8_t dv_link_cost(const dv_t *dv, uint8_t nbr_addr) {
+    assert(dv);
+
+    if (nbr_addr == RCP_BROADCAST || !dv->neighbors[nbr_addr].in_use) {
+        return DV_INFINITY;
+    }
+    // A link we've barely heard costs the most until we know better, so a neighbor at the
+    // edge of range doesn't attract routes for the moment it is heard
+    const dv_neighbor_t *nbr = &dv->neighbors[nbr_addr];
+    if (nbr->rx_samples < DV_MIN_SAMPLES) {
+        return DV_MAX_LINK_COST;
+    }
+
+    // Until the neighbor reports on us, assume the link is as good both ways
+    uint16_t tx_ratio = nbr->tx_samples ? nbr->tx_ratio : nbr->rx_ratio;
+    uint32_t product = (uint32_t)tx_ratio * nbr->rx_ratio;
+    uint32_t perfect = (uint32_t)DV_ETX_SCALE * DV_RATIO_ONE * DV_RATIO_ONE;
+    if (product <= perfect / DV_MAX_LINK_COST) {
+        return DV_MAX_LINK_COST;
+    }
+    return (perfect + product / 2) / product;
+}
+
+/**
+ * Fold the result of sending data to a neighbor into its link estimate
+ * - For hardware-ACKed sends, <attempts> is one plus the NRF's retransmission count.
+ *   Only the forward ratio is adjusted; the neighbor's next link report replaces it.
+ *
+ * @param dv The routing state
+ * @param nbr_addr The neighbor's RCP address
+ * @param attempts How many times the packet was sent
+ * @param delivered Whether the last attempt got through
+ */
+static inline void dv_link_observe(dv_t *dv, uint8_t nbr_addr, unsigned attempts, bool delivered) {
+    assert(dv);
+
+    if (nbr_addr == RCP_BROADCAST || !dv->neighbors[nbr_addr].in_use) {
+        return;
+    }
+    dv_neighbor_t *nbr = &dv->neighbors[nbr_addr];
+    for (unsigned i = 1; i < attempts && i < DV_MAX_GAP; i++) {
+        nbr->tx_ratio = dv_ratio_sample(nbr->tx_ratio, &nbr->tx_samples, false);
+    }
+    nbr->tx_ratio = dv_ratio_sample(nbr->tx_ratio, &nbr->tx_samples, delivered);
+}
+
+/**
+ * Get the RCP address of the next hop at <nrf_addr> on the route to <dst>
+ *
+ * @param dv The routing state
+ * @param dst The destination RCP address
+ * @param nrf_addr The next hop's NRF address (from dv_next_hop)
+ * @return The next hop, or RCP_BROADCAST if the route doesn't go through <nrf_addr>
+ */
+static inline uint8_t dv_hop_addr(const dv_t *dv, uint8_t dst, uint32_t nrf_addr) {
+    assert(dv);
+
+    uint32_t hop_nrf;
+    if (!dv_next_hop(dv, dst, &hop_nrf) || hop_nrf != nrf_addr) {
+        return RCP_BROADCAST;
+    }
+    return dv->routes[dst].next_hop;
+}
+
+/**
+ * Send a packet to a neighbor with hardware ACKs, and learn from how it went
+ * - The NRF's retransmission and loss counters before and after the send give the
+ *   number of attempts the link took (see dv_link_observe).
+ *
+ * @param dv The routing state
+ * @param nrf The NRF to send from (set up for ACKed sends)
+ * @param nbr_addr The neighbor's RCP address (RCP_BROADCAST: send without learning)
+ * @param nrf_addr The neighbor's NRF address
+ * @param msg The packet
+ * @param nbytes The packet length
+ * @return What nrf_send_ack returned
+ */
+static inline int dv_link_send(dv_t *dv, nrf_t *nrf, uint8_t nbr_addr, uint32_t nrf_addr,
+                               const void *msg, unsigned nbytes) {
+    assert(dv);
+    assert(nrf);
+
+    uint32_t retrans = nrf->tot_retrans, lost = nrf->tot_lost;
+    int ret = nrf_send_ack(nrf, nrf_addr, msg, nbytes);
+    dv_link_observe(dv, nbr_addr, 1 + (nrf->tot_retrans - retrans),
+                    ret == (int)nbytes && nrf->tot_lost == lost);
+    return ret;
+}
+
+/**
+ * Send a packet toward <dst> with hardware ACKs, and learn from how it went
+ *
+ * @param dv The routing state (its NRF must be set up for ACKed sends)
+ * @param dst The destination RCP address
+ * @param msg The packet
+ * @param nbytes The packet length
+ * @return What nrf_send_ack returned, or -1 if <dst> is unreachable
+ */
+static inline int dv_send_acked(dv_t *dv, uint8_t dst, const void *msg, unsigned nbytes) {
+    assert(dv);
+    assert(dv->nrf);
+
+    uint32_t nrf_addr;
+    if (!dv_next_hop(dv, dst, &nrf_addr)) {
+        return -1;
+    }
+    return dv_link_send(dv, dv->nrf, dv->routes[dst].next_hop, nrf_addr, msg, nbytes);
+}
+
+/* Note that the table changed, and schedule a triggered update if none is pending */
+static inline void dv_schedule_trigger(dv_t *dv, uint32_t now) {
+    if (!dv->trigger_pending) {
+        dv->trigger_pending = true;
+        uint32_t delay = dv->trigger_delay_us;
+        dv->trigger_us = now + (delay ? delay / 2 + pi_random() % (delay / 2 + 1) : 0);
+    }
+}
+
+/* Point <route> at a new next hop and/or cost, marking it for the next update
+   - Only a change the neighbors should hear about soon (a new next hop, a route going up
+     or down, or a cost change of a whole transmission) triggers an update; estimate noise
+     waits for the next full one */
+static inline void dv_set_route(dv_t *dv, dv_route_t *route, uint8_t next_hop, uint32_t next_hop_nrf,
+                                uint8_t cost, uint32_t now) {
+    bool changed = !route->in_use || route->next_hop != next_hop || route->cost != cost;
+    int delta = (int)cost - (int)route->cost;
+    bool significant = !route->in_use || route->next_hop != next_hop ||
+                       (cost >= DV_INFINITY) != (route->cost >= DV_INFINITY) ||
+                       delta >= DV_ETX_SCALE || delta <= -DV_ETX_SCALE;
+    route->in_use = true;
+    route->next_hop = next_hop;
+    route->next_hop_nrf = next_hop_nrf;
+
+    // An unreachable route keeps the time it went down, so it is forgotten on schedule
+    if (changed || cost < DV_INFINITY) {
+        route->updated_us = now;
+    }
+    if (changed) {
+        route->cost = cost;
+        route->changed = true;
+        dv->route_changes++;
+    }
+    if (significant) {
+        dv_schedule_trigger(dv, now);
+    }
+}
+
+/**
+ * Apply a routing update from a neighbor
+ *
+ * @param dv The routing state
+ * @param dgram The update (already verified)
+ * @return True if the datagram was a well-formed routing update
+ */
+static inline bool dv_process_datagram(dv_t *dv, const rcp_datagram_t *dgram) {
+    assert(dv);
+    assert(dgram);
+
+    const rcp_header_t *hdr = &dgram->header;
+    size_t len = hdr->payload_len;
+    if (!rcp_is_route_update(dgram) || len < DV_PREAMBLE_LENGTH || hdr->src == dv->local_addr ||
+        hdr->src == RCP_BROADCAST) {
+        return false;
+    }
+    const uint8_t *payload = rcp_datagram_payload(dgram);
+    uint8_t kind = payload[3];
+    size_t entry_len = kind == DV_KIND_ROUTES ? DV_ROUTE_LENGTH : DV_LINK_LENGTH;
+    if (kind > DV_KIND_LINKS || (len - DV_PREAMBLE_LENGTH) % entry_len != 0) {
+        return false;
+    }
+    dv->updates_recv++;
+
+    uint32_t now = timer_get_usec();
+    uint8_t from = hdr->src;
+    uint32_t from_nrf = (payload[0] << 16) | (payload[1] << 8) | payload[2];
+
+    // Hearing from a node makes it a neighbor
+    dv_neighbor_t *nbr = &dv->neighbors[from];
+    uint16_t gap = hdr->seqno - nbr->last_seqno - 1;
+    if (!nbr->in_use && (nbr->rx_samples == 0 || gap >= DV_MAX_GAP)) {
+        // A new neighbor, or one gone so long (or restarted) that what we knew is stale
+        nbr->rx_ratio = nbr->tx_ratio = DV_RATIO_ONE;
+        nbr->rx_samples = nbr->tx_samples = 0;
+        nbr->last_seqno = hdr->seqno;
+    } else if (gap < 0x8000) {
+        // Every update is a probe: a gap in the sequence numbers is updates we missed
+        // (anything older than the last one heard is a duplicate, and doesn't count)
+        // - Each update is counted as heard only when the next one arrives. The ratio is only
+        //   read right after hearing the neighbor, so counting it at once would bias it up.
+        nbr->rx_ratio = dv_ratio_sample(nbr->rx_ratio, &nbr->rx_samples, true);
+        for (uint16_t i = 0; i < gap && i < DV_MAX_GAP; i++) {
+            nbr->rx_ratio = dv_ratio_sample(nbr->rx_ratio, &nbr->rx_samples, false);
+        }
+        nbr->last_seqno = hdr->seqno;
+    }
+    nbr->in_use = true;
+    nbr->nrf_addr = from_nrf;
+    nbr->heard_us = now;
+
+    size_t n_entries = (len - DV_PREAMBLE_LENGTH) / entry_len;
+    const uint8_t *entry = payload + DV_PREAMBLE_LENGTH;
+    if (kind == DV_KIND_LINKS) {
+        // The neighbor's report on us is how well it hears us
+        for (size_t i = 0; i < n_entries; i++, entry += DV_LINK_LENGTH) {
+            if (entry[0] == dv->local_addr) {
+                nbr->tx_ratio = (entry[1] * DV_RATIO_ONE + 127) / 255;
+                nbr->tx_samples = DV_RATIO_SAMPLES;
+            }
+        }
+        return true;
+    }
+
+    uint8_t link_cost = dv_link_cost(dv, from);
+    for (size_t i = 0; i < n_entries; i++, entry += DV_ROUTE_LENGTH) {
+        uint8_t dst = entry[0], cost = entry[1], via = entry[2];
+        if (dst == dv->local_addr || dst == RCP_BROADCAST || rcp_is_mcast(dst)) {
+            continue;
+        }
+
+        // Poisoned reverse: a route that goes through us is no route at all
+        uint32_t total = (via == dv->local_addr || cost >= DV_INFINITY) ? DV_INFINITY
+                                                                         : cost + link_cost;
+        uint8_t new_cost = total < DV_INFINITY ? total : DV_INFINITY;
+
+        dv_route_t *route = &dv->routes[dst];
+        if (route->in_use && route->next_hop == from) {
+            // Our current next hop: believe it, whether the path got better or worse
+            dv_set_route(dv, route, from, from_nrf, new_cost, now);
+        } else if (new_cost + DV_SWITCH_MARGIN < dv_cost(dv, dst) ||
+                   (new_cost < DV_INFINITY && dv_cost(dv, dst) >= DV_INFINITY)) {
+            dv_set_route(dv, route, from, from_nrf, new_cost, now);
+        }
+    }
+    return true;
+}
+
+/**
+ * Verify a raw packet and apply it if it is a routing update
+ * - Use this when the NRF interface is shared with other traffic.
+ *
+ * @param dv The routing state
+ * @param data The received packet
+ * @param length The number of bytes received
+ * @return True if the packet was a valid routing update
+ */
+static inline bool dv_process_packet(dv_t *dv, const uint8_t *data, size_t length) {
+    assert(dv);
+    assert(data);
+
+    rcp_datagram_t dgram = rcp_datagram_init();
+    if (!rcp_datagram_decode(&dgram, data, length)) {
+        return false;
+    }
+    return dv_process_datagram(dv, &dgram);
+}
+
+/* Send one update packet of <kind> with <len> bytes of entries */
+static inline void dv_send_packet(dv_t *dv, uint8_t kind, const uint8_t *entries, size_t len) {
+    uint8_t payload[RCP_MAX_PAYLOAD];
+    payload[0] = (dv->local_nrf >> 16) & 0xFF;
+    payload[1] = (dv->local_nrf >> 8) & 0xFF;
+    payload[2] = dv->local_nrf & 0xFF;
+    payload[3] = kind;
+    memcpy(payload + DV_PREAMBLE_LENGTH, entries, len);
+
+    rcp_datagram_t dgram = rcp_datagram_init();
+    dgram.header.src = dv->local_addr;
+    dgram.header.dst = RCP_BROADCAST;
+    dgram.header.seqno = dv->seqno++;
+    rcp_set_flag(&dgram.header, RCP_FLAG_ROUTE);
+    rcp_datagram_borrow_payload(&dgram, payload, DV_PREAMBLE_LENGTH + len);
+
+    uint8_t pkt[RCP_TOTAL_SIZE];
+    int n = rcp_datagram_encode(&dgram, pkt, sizeof(pkt));
+    assert(n > 0);
+    dv->transmit(dv, pkt, n);
+    dv->updates_sent++;
+}
+
+/* Tell the neighbors how well we hear each of them */
+static inline void dv_send_links(dv_t *dv) {
+    uint8_t entries[DV_LINKS_PER_PKT * DV_LINK_LENGTH];
+    size_t n = 0;
+    for (size_t addr = 0; addr < DV_MAX_NODES; addr++) {
+        const dv_neighbor_t *nbr = &dv->neighbors[addr];
+        if (!nbr->in_use) {
+            continue;
+        }
+        entries[n * DV_LINK_LENGTH] = addr;
+        entries[n * DV_LINK_LENGTH + 1] = (nbr->rx_ratio * 255 + DV_RATIO_ONE / 2) / DV_RATIO_ONE;
+        if (++n == DV_LINKS_PER_PKT) {
+            dv_send_packet(dv, DV_KIND_LINKS, entries, n * DV_LINK_LENGTH);
+            n = 0;
+        }
+    }
+    if (n > 0) {
+        dv_send_packet(dv, DV_KIND_LINKS, entries, n * DV_LINK_LENGTH);
+    }
+}
+
+/**
+ * Broadcast the forwarding table
+ *
+ * @param dv The routing state
+ * @param changed_only True to send only the routes that changed since the last update
+ */
+static inline void dv_send_update(dv_t *dv, bool changed_only) {
+    assert(dv);
+
+    uint8_t entries[DV_ROUTES_PER_PKT * DV_ROUTE_LENGTH];
+    size_t n = 0;
+    for (size_t dst = 0; dst < DV_MAX_NODES; dst++) {
+        dv_route_t *route = &dv->routes[dst];
+        if (!route->in_use || (changed_only && !route->changed)) {
+            continue;
+        }
+        route->changed = false;
+
+        uint8_t *entry = entries + n * DV_ROUTE_LENGTH;
+        entry[0] = dst;
+        entry[1] = route->cost;
+        entry[2] = route->next_hop;
+        if (++n == DV_ROUTES_PER_PKT) {
+            dv_send_packet(dv, DV_KIND_ROUTES, entries, n * DV_ROUTE_LENGTH);
+            n = 0;
+        }
+    }
+
+    // A full update always goes out, even if it's only us, so neighbors know we're alive
+    if (n > 0 || !changed_only) {
+        dv_send_packet(dv, DV_KIND_ROUTES, entries, n * DV_ROUTE_LENGTH);
+    }
+    dv->trigger_pending = false;
+}
+
+/**
+ * Drop silent neighbors, expire stale routes, and forget old unreachable ones
+ *
+ * @param dv The routing state
+ */
+static inline void dv_check_timeouts(dv_t *dv) {
+    assert(dv);
+
+    uint32_t now = timer_get_usec();
+    for (size_t addr = 0; addr < DV_MAX_NODES; addr++) {
+        dv_neighbor_t *nbr = &dv->neighbors[addr];
+        if (nbr->in_use && now - nbr->heard_us >= dv->timeout_us) {
+            nbr->in_use = false;
+        }
+    }
+
+    for (size_t dst = 0; dst < DV_MAX_NODES; dst++) {
+        dv_route_t *route = &dv->routes[dst];
+        if (!route->in_use || dst == dv->local_addr) {
+            continue;
+        }
+
+        if (route->cost < DV_INFINITY) {
+            // The route went down if its next hop did, or if nobody confirmed it lately
+            if (!dv->neighbors[route->next_hop].in_use ||
+                now - route->updated_us >= dv->timeout_us) {
+                dv_set_route(dv, route, route->next_hop, route->next_hop_nrf, DV_INFINITY, now);
+            }
+        } else if (now - route->updated_us >= dv->gc_us) {
+            route->in_use = false;
+        }
+    }
+}
+
+/**
+ * Run the routing protocol: expire old state and send any updates that are due
+ * - Incoming updates are applied with dv_process_datagram / dv_process_packet as they
+ *   are received.
+ *
+ * @param dv The routing state
+ */
+static inline void dv_tick(dv_t *dv) {
+    assert(dv);
+
+    dv_check_timeouts(dv);
+
+    uint32_t now = timer_get_usec();
+    if (dv_due(now, dv->next_full_us)) {
+        dv_send_links(dv);
+        dv_send_update(dv, false);
+        for (size_t dst = 0; dst < DV_MAX_NODES; dst++) {
+            dv->routes[dst].changed = false;
+        }
+        dv->next_full_us = dv_next_full(dv, now);
+    } else if (dv->trigger_pending && dv_due(now, dv->trigger_us)) {
+        dv_send_update(dv, true);
+        dv->triggered_sent++;
+    }
+}
@@ -0,0 +1,364 @@
+#pragma once
+
+#include "tcp.h"
+
+/**
+ * Pipelined request/response RPC on top of a tcp-v2 peer in message mode
+ *
+ * Up to RPC_MAX_OUTSTANDING calls can be in flight at once, so a node can query many
+ * sensors on a peer without waiting a round trip per request. Responses are matched to
+ * calls by request ID and may complete in any order.
+ *
+ * Each RPC message is one tcp-v2 message:
+ * Byte 0:  Type (request, response, or error)
+ * Byte 1:  Request ID
+ * Byte 2:  Method
+ * Bytes 3+: Body
+ *
+ * The low bits of a request ID index the call table, and the high bits are a generation
+ * count, so a late response to a call that already timed out is recognized and dropped.
+ */
+
+#define RPC_MAX_OUTSTANDING 8 /* Maximum calls in flight (power of two) */
+#define RPC_MAX_METHODS 16    /* Number of method slots a peer can serve */
+#define RPC_HEADER_LEN 3      /* Type, request ID, method */
+#define RPC_MAX_BODY (MSG_MAX_LEN - RPC_HEADER_LEN)
+#define RPC_LATENCY_BUCKETS 24 /* Latency histogram buckets (powers of two in usec) */
+
+/* RPC message types */
+#define RPC_TYPE_REQUEST 0
+#define RPC_TYPE_RESPONSE 1
+#define RPC_TYPE_ERROR 2
+
+/* Completion status passed to the caller's callback */
+typedef enum {
+    RPC_OK = 0,             /* The remote handler replied */
+    RPC_ERR_TIMEOUT = -1,   /* No reply before the call's deadline */
+    RPC_ERR_NO_METHOD = -2, /* The remote has no handler for the method */
+    RPC_ERR_REMOTE = -3,    /* The remote handler reported a failure */
+} rpc_status_t;
+
+/* Called once per call when it completes (the response is only valid during the call) */
+typedef void (*rpc_done_fn_t)(void *arg, rpc_status_t status, const uint8_t *resp, size_t len);
+
+/* Serves one method: fills <resp> and returns its length, or -1 on failure */
+typedef int (*rpc_handler_fn_t)(void *arg, const uint8_t *req, size_t req_len, uint8_t *resp,
+                                size_t resp_max);
+
+/* An outstanding call */
+typedef struct rpc_call {
+    bool in_use;          /* Whether this slot holds an outstanding call */
+    uint8_t id;           /* Request ID sent with the call */
+    uint32_t start_us;    /* Time the call was issued */
+    uint32_t deadline_us; /* Time after which the call fails with RPC_ERR_TIMEOUT */
+    rpc_done_fn_t done;   /* Completion callback */
+    void *arg;            /* Opaque argument for the callback */
+} rpc_call_t;
+
+/* A registered method handler */
+typedef struct rpc_method {
+    rpc_handler_fn_t fn; /* Handler, or NULL if the method isn't served */
+    void *arg;           /* Opaque argument for the handler */
+} rpc_method_t;
+
+/* Per-endpoint RPC statistics */
+typedef struct rpc_stats {
+    uint32_t n_calls;     /* Calls issued */
+    uint32_t n_completed; /* Calls that got a reply (including error replies) */
+    uint32_t n_timeouts;  /* Calls that hit their deadline */
+    uint32_t n_stale;     /* Replies that matched no outstanding call */
+    uint32_t n_served;    /* Requests handled for the remote */
+    uint32_t latency_hist[RPC_LATENCY_BUCKETS]; /* Bucket i counts latencies in [2^i, 2^(i+1)) */
+} rpc_stats_t;
+
+/* RPC endpoint: one per peer */
+typedef struct rpc {
+    tcp_peer_t *peer;                      /* Connection carrying the RPC messages */
+    rpc_call_t calls[RPC_MAX_OUTSTANDING]; /* Outstanding calls, indexed by ID low bits */
+    uint8_t next_gen;                      /* Generation for the next request ID */
+    size_t n_outstanding;                  /* Number of slots in use */
+    rpc_method_t methods[RPC_MAX_METHODS]; /* Handlers for requests from the remote */
+    rpc_stats_t stats;                     /* Statistics */
+} rpc_t;
+
+/* Forward declarations for all functions */
+static inline void rpc_init(rpc_t *rpc, tcp_peer_t *peer);
+static inline void rpc_register(rpc_t *rpc, uint8_t method, rpc_handler_fn_t fn, void *arg);
+static inline int rpc_call(rpc_t *rpc, uint8_t method, const uint8_t *req, size_t len,
+                           uint32_t timeout_us, rpc_done_fn_t done, void *arg);
+static inline void rpc_poll(rpc_t *rpc);
+static inline void rpc_record_latency(rpc_stats_t *stats, uint32_t latency_us);
+static inline void rpc_handle_reply(rpc_t *rpc, uint8_t type, const uint8_t *msg, size_t len);
+static inline void rpc_handle_request(rpc_t *rpc, const uint8_t *msg, size_t len);
+static inline void rpc_process_incoming(rpc_t *rpc);
+static inline void rpc_check_deadlines(rpc_t *rpc);
+static inline size_t rpc_outstanding(const rpc_t *rpc);
+static inline void rpc_print_stats(const rpc_t *rpc);
+
+/**
+ * Initialize an RPC endpoint and switch its peer to message mode
+ *
+ * @param rpc The endpoint to initialize
+ * @param peer The connection to carry the RPC messages
+ */
+static inline void rpc_init(rpc_t *rpc, tcp_peer_t *peer) {
+    assert(rpc);
+    assert(peer);
+
+    memset(rpc, 0, sizeof(*rpc));
+    rpc->peer = peer;
+    tcp_set_msg_mode(peer, true);
+}
+
+/**
+ * Register the handler that serves <method> for the remote
+ *
+ * @param rpc The endpoint serving the method
+ * @param method The method number
+ * @param fn The handler (NULL to stop serving the method)
+ * @param arg Opaque argument passed to the handler
+ */
+static inline void rpc_register(rpc_t *rpc, uint8_t method, rpc_handler_fn_t fn, void *arg) {
+    assert(rpc);
+    assert(method < RPC_MAX_METHODS);
+
+    rpc->methods[method].fn = fn;
+    rpc->methods[method].arg = arg;
+}
+
+/**
+ * Issue a call without waiting for its reply
+ *
+ * @param rpc The endpoint to call from
+ * @param method The remote method to call
+ * @param req The request body
+ * @param len The request body length (at most RPC_MAX_BODY)
+ * @param timeout_us How long to wait for the reply
+ * @param done Called exactly once when the call completes or times out
+ * @param arg Opaque argument passed to <done>
+ * @return The request ID, or -1 if the call table or send buffer is full
+ */
+static inline int rpc_call(rpc_t *rpc, uint8_t method, const uint8_t *req, size_t len,
+                           uint32_t timeout_us, rpc_done_fn_t done, void *arg) {
+    assert(rpc);
+    assert(done);
+    assert(req || len == 0);
+
+    if (len > RPC_MAX_BODY || rpc->n_outstanding == RPC_MAX_OUTSTANDING) {
+        return -1;
+    }
+
+    /* Find a free slot */
+    size_t slot = 0;
+    while (rpc->calls[slot].in_use) {
+        slot++;
+    }
+
+    uint8_t id = (rpc->next_gen * RPC_MAX_OUTSTANDING) | slot;
+
+    /* Build and queue the request message */
+    uint8_t msg[MSG_MAX_LEN];
+    msg[0] = RPC_TYPE_REQUEST;
+    msg[1] = id;
+    msg[2] = method;
+    if (len > 0) {
+        memcpy(msg + RPC_HEADER_LEN, req, len);
+    }
+    if (!tcp_send_msg(rpc->peer, msg, RPC_HEADER_LEN + len)) {
+        return -1;
+    }
+
+    uint32_t now = timer_get_usec();
+    rpc->calls[slot] = (rpc_call_t){
+        .in_use = true,
+        .id = id,
+        .start_us = now,
+        .deadline_us = now + timeout_us,
+        .done = done,
+        .arg = arg,
+    };
+    rpc->next_gen++;
+    rpc->n_outstanding++;
+    rpc->stats.n_calls++;
+
+    return id;
+}
+
+/**
+ * Main polling function: drives the connection, completes calls, and serves requests
+ *
+ * @param rpc The endpoint to process
+ */
+static inline void rpc_poll(rpc_t *rpc) {
+    assert(rpc);
+
+    tcp_tick(rpc->peer);
+    rpc_process_incoming(rpc);
+    rpc_check_deadlines(rpc);
+}
+
+/**
+ * Record a completed call's latency in the histogram
+ *
+ * @param stats The statistics to update
+ * @param latency_us The call's latency
+ */
+static inline void rpc_record_latency(rpc_stats_t *stats, uint32_t latency_us) {
+    /* Bucket by the position of the highest set bit */
+    unsigned bucket = 31 - __builtin_clz(latency_us | 1);
+    stats->latency_hist[MIN(bucket, RPC_LATENCY_BUCKETS - 1)]++;
+}
+
+/**
+ * Complete the call a reply is addressed to
+ *
+ * @param rpc The endpoint that issued the call
+ * @param type The reply type (response or error)
+ * @param msg The full reply message
+ * @param len The reply message length
+ */
+static inline void rpc_handle_reply(rpc_t *rpc, uint8_t type, const uint8_t *msg, size_t len) {
+    uint8_t id = msg[1];
+    rpc_call_t *call = &rpc->calls[id % RPC_MAX_OUTSTANDING];
+
+    /* A reply to a call that already timed out (or garbage) */
+    if (!call->in_use || call->id != id) {
+        rpc->stats.n_stale++;
+        return;
+    }
+
+    /* Free the slot before the callback so the callback can issue a new call */
+    rpc_call_t done = *call;
+    call->in_use = false;
+    rpc->n_outstanding--;
+    rpc->stats.n_completed++;
+    rpc_record_latency(&rpc->stats, timer_get_usec() - done.start_us);
+
+    rpc_status_t status = RPC_OK;
+    if (type == RPC_TYPE_ERROR) {
+        status = (len > RPC_HEADER_LEN) ? (rpc_status_t)(int8_t)msg[RPC_HEADER_LEN] : RPC_ERR_REMOTE;
+    }
+    done.done(done.arg, status, msg + RPC_HEADER_LEN, len - RPC_HEADER_LEN);
+}
+
+/**
+ * Run the handler for a request and send back its reply
+ *
+ * @param rpc The endpoint serving the request
+ * @param msg The full request message
+ * @param len The request message length
+ */
+static inline void rpc_handle_request(rpc_t *rpc, const uint8_t *msg, size_t len) {
+    uint8_t method = msg[2];
+
+    uint8_t reply[MSG_MAX_LEN];
+    reply[0] = RPC_TYPE_RESPONSE;
+    reply[1] = msg[1];
+    reply[2] = method;
+
+    int reply_len = -1;
+    int8_t error = RPC_ERR_NO_METHOD;
+    if (method < RPC_MAX_METHODS && rpc->methods[method].fn) {
+        rpc_method_t *m = &rpc->methods[method];
+        reply_len = m->fn(m->arg, msg + RPC_HEADER_LEN, len - RPC_HEADER_LEN,
+                          reply + RPC_HEADER_LEN, RPC_MAX_BODY);
+        error = RPC_ERR_REMOTE;
+    }
+
+    /* Failed requests get a one-byte error reply with the status */
+    if (reply_len < 0) {
+        reply[0] = RPC_TYPE_ERROR;
+        reply[RPC_HEADER_LEN] = error;
+        reply_len = 1;
+    }
+    assert(reply_len <= RPC_MAX_BODY);
+
+    /* If the send buffer is full the reply is lost and the caller times out */
+    tcp_send_msg(rpc->peer, reply, RPC_HEADER_LEN + reply_len);
+    rpc->stats.n_served++;
+}
+
+/**
+ * Handle every complete RPC message that has arrived
+ *
+ * @param rpc The endpoint to process
+ */
+static inline void rpc_process_incoming(rpc_t *rpc) {
+    assert(rpc);
+
+    uint8_t msg[MSG_MAX_LEN];
+    while (tcp_has_msg(rpc->peer)) {
+        int len = tcp_recv_msg(rpc->peer, msg, sizeof(msg));
+        if (len < RPC_HEADER_LEN) {
+            continue; /* Malformed */
+        }
+
+        switch (msg[0]) {
+            case RPC_TYPE_REQUEST:
+                rpc_handle_request(rpc, msg, len);
+                break;
+            case RPC_TYPE_RESPONSE:
+            case RPC_TYPE_ERROR:
+                rpc_handle_reply(rpc, msg[0], msg, len);
+                break;
+            default:
+                break; /* Unknown type */
+        }
+    }
+}
+
+/**
+ * Fail any outstanding calls whose deadline has passed
+ *
+ * @param rpc The endpoint to check
+ */
+static inline void rpc_check_deadlines(rpc_t *rpc) {
+    assert(rpc);
+
+    if (rpc->n_outstanding == 0) {
+        return;
+    }
+
+    uint32_t now = timer_get_usec();
+    for (size_t i = 0; i < RPC_MAX_OUTSTANDING; i++) {
+        rpc_call_t *call = &rpc->calls[i];
+        if (!call->in_use || (int32_t)(now - call->deadline_us) < 0) {
+            continue;
+        }
+
+        rpc_call_t done = *call;
+        call->in_use = false;
+        rpc->n_outstanding--;
+        rpc->stats.n_timeouts++;
+        done.done(done.arg, RPC_ERR_TIMEOUT, NULL, 0);
+    }
+}
+
+/**
+ * Get the number of calls waiting for a reply
+ *
+ * @param rpc The endpoint to check
+ * @return The number of outstanding calls
+ */
+static inline size_t rpc_outstanding(const rpc_t *rpc) {
+    assert(rpc);
+    return rpc->n_outstanding;
+}
+
+/**
+ * Print the endpoint's statistics and latency histogram
+ *
+ * @param rpc The endpoint to print
+ */
+static inline void rpc_print_stats(const rpc_t *rpc) {
+    assert(rpc);
+
+    const rpc_stats_t *s = &rpc->stats;
+    printk("RPC: calls=%u completed=%u timeouts=%u stale=%u served=%u\n", s->n_calls,
+           s->n_completed, s->n_timeouts, s->n_stale, s->n_served);
+    for (size_t i = 0; i < RPC_LATENCY_BUCKETS; i++) {
+        if (s->latency_hist[i]) {
+            printk("RPC:   latency [%u, %u) usec: %u\n", 1 << i, 1 << (i + 1), s->latency_hist[i]);
+        }
+    }
+}
@@ -1,8 +1,10 @@
 #pragma once
 
 #include "bytestream.h"
+#include "fec.h"
 #include "nrf.h"
 #include "queue-ext-T.h"
+#include "stats.h"
 #include "types.h"
 
 /* Forward declarations for segment types */
@@ -14,11 +16,14 @@ typedef struct receiver_segment receiver_segment_t;
 #define INITIAL_WINDOW_SIZE 1024
 #define S_TO_US(s) ((s) * 1000000)
 #define RTO_INITIAL_US S_TO_US(1)
+#define DUP_ACK_THRESHOLD 3 /* Duplicate ACKs that trigger a fast retransmit */
 
 /* Segments that have been sent but not yet acknowledged */
 typedef struct unacked_segment {
     struct unacked_segment *next; /* Used for queue - next segment in the queue */
     sender_segment_t seg;         /* The actual segment that was sent */
+    uint32_t sent_us;             /* Time the segment was first sent (for RTT samples) */
+    bool retransmitted;           /* Whether the segment was resent (its RTT is ambiguous) */
 } unacked_segment_t;
 
 /* Retransmission queue */
@@ -37,15 +42,25 @@ typedef struct sender {
     nrf_t *nrf;          /* Sender's NRF interface for sending segments */
     bytestream_t reader; /* App writes data to it, sender reads from it */
 
+    uint16_t isn;         /* Initial sequence number (carried by the SYN) */
     uint16_t next_seqno;  /* Next sequence number to send */
     uint16_t acked_seqno; /* Sequence number of the highest acked segment */
     uint16_t window_size; /* Receiver's advertised window size */
+    bool syn_sent;        /* Whether the SYN has been sent */
+    bool fin_sent;        /* Whether the FIN has been sent */
 
     rtq_t pending_segs;      /* Queue of segments that have been sent but not yet acked */
+    rtq_t free_segs;         /* Acked queue entries kept for reuse (kmalloc can't free) */
     uint32_t initial_RTO_us; /* Initial RTO (in microseconds) */
     uint32_t rto_time_us;    /* Time when earliest outstanding segment will be retransmitted */
     uint32_t
         n_retransmits; /* Number of times the earliest outstanding segment has been retransmitted */
+    uint8_t n_dup_acks; /* Consecutive duplicate ACKs for the earliest outstanding segment */
+
+    bool window_blocked;       /* Whether data is waiting on the receiver's window */
+    uint32_t blocked_since_us; /* Time the sender became blocked on the window */
+    tcp_stats_t *stats;        /* Connection statistics to update (NULL if not kept) */
+    fec_encoder_t fec;         /* Parity for the data we send (off by default) */
 
     sender_transmit_fn_t transmit; /* Callback to send segments to the remote peer */
     tcp_peer_t *peer;              /* Pointer to the TCP peer containing this sender */
@@ -53,10 +68,14 @@ typedef struct sender {
 
 /* Function forward declarations */
 static inline sender_t sender_init(nrf_t *nrf, sender_transmit_fn_t transmit, tcp_peer_t *peer);
+static inline void sender_set_isn(sender_t *sender, uint16_t isn);
+static inline void sender_set_fec(sender_t *sender, uint8_t k, bool adaptive);
 static inline sender_segment_t make_segment(sender_t *sender, size_t len);
 static inline void sender_send_segment(sender_t *sender, sender_segment_t seg);
+static inline void sender_send_parity(sender_t *sender, bool is_fin);
 static inline void sender_push(sender_t *sender);
 static inline void sender_process_reply(sender_t *sender, receiver_segment_t *reply);
+static inline void sender_set_blocked(sender_t *sender, bool blocked);
 static inline void sender_check_retransmits(sender_t *sender);
 
 /* External functions needed */
@@ -75,19 +94,56 @@ static inline sender_t sender_init(nrf_t *nrf, sender_transmit_fn_t transmit, tc
     sender_t sender = {
         .nrf = nrf,
         .reader = bs_init(),
+        .isn = 0,
         .next_seqno = 0,
         .acked_seqno = 0,
         .window_size = INITIAL_WINDOW_SIZE,
+        .syn_sent = false,
+        .fin_sent = false,
         .initial_RTO_us = RTO_INITIAL_US,
         .rto_time_us = 0,
         .n_retransmits = 0,
+        .n_dup_acks = 0,
+        .window_blocked = false,
+        .blocked_since_us = 0,
+        .stats = NULL,
+        .fec = fec_encoder_init(),
         .transmit = transmit,
         .peer = peer,
     };
     rtq_init(&sender.pending_segs);
+    rtq_init(&sender.free_segs);
     return sender;
 }
 
+/**
+ * Set the initial sequence number (must be called before anything is sent)
+ *
+ * @param sender The sender to configure
+ * @param isn The sequence number the SYN will carry
+ */
+static inline void sender_set_isn(sender_t *sender, uint16_t isn) {
+    assert(sender);
+    assert(!sender->syn_sent);
+
+    sender->isn = isn;
+    sender->next_seqno = isn;
+    sender->acked_seqno = isn;
+}
+
+/**
+ * Configure forward error correction (see fec.h)
+ *
+ * @param sender The sender to configure
+ * @param k Data segments per parity segment (0 turns FEC off); the starting size in
+ *          adaptive mode
+ * @param adaptive Whether to retune <k> from the observed retransmission rate
+ */
+static inline void sender_set_fec(sender_t *sender, uint8_t k, bool adaptive) {
+    assert(sender);
+    fec_set_group(&sender->fec, k, adaptive);
+}
+
 /**
  * Create a segment to be sent
  *
@@ -101,12 +157,19 @@ static inline sender_segment_t make_segment(sender_t *sender, size_t len) {
     sender_segment_t seg = {
         .len = 0,
         .seqno = sender->next_seqno,
-        .is_syn = (sender->next_seqno == 0),
+        .is_syn = !sender->syn_sent,
         .is_fin = false,
     };
 
     // Determine how many bytes to send (limit by max payload and requested length)
-    size_t bytes_to_send = MIN(RCP_MAX_PAYLOAD, len);
+    // Only the SYN needs the full header, so later segments can carry a bit more
+    size_t max_payload = seg.is_syn ? RCP_MAX_PAYLOAD : RCP_COMPACT_MAX_PAYLOAD;
+
+    // A segment FEC protects can't be wider than the parity
+    if (!seg.is_syn && fec_in_use(&sender->fec)) {
+        max_payload = MIN(max_payload, FEC_WIDTH);
+    }
+    size_t bytes_to_send = MIN(max_payload, len);
     if (bytes_to_send > 0) {
         // Read data from bytestream into segment payload
         seg.len = bs_read(&sender->reader, seg.payload, bytes_to_send);
@@ -132,8 +195,12 @@ static inline void sender_send_segment(sender_t *sender, sender_segment_t seg) {
 
     // Only track segments with data, SYN, or FIN
     if (seg.len > 0 || seg.is_syn || seg.is_fin) {
-        // Create a new unacked segment and copy the segment data
-        unacked_segment_t *pending = kmalloc(sizeof(unacked_segment_t));
+        // Reuse an acked queue entry if there is one, so memory only grows with the
+        // largest number of segments ever in flight
+        unacked_segment_t *pending = rtq_pop(&sender->free_segs);
+        if (!pending) {
+            pending = kmalloc(sizeof(unacked_segment_t));
+        }
         if (!pending) {
             // Handle memory allocation failure
             return;
@@ -142,25 +209,65 @@ static inline void sender_send_segment(sender_t *sender, sender_segment_t seg) {
         // Copy the segment data
         memcpy(&pending->seg, &seg, sizeof(sender_segment_t));
         pending->next = NULL;
+        pending->sent_us = timer_get_usec();
+        pending->retransmitted = false;
 
         // Set retransmission timer if this is the first segment in the queue
         if (rtq_empty(&sender->pending_segs)) {
             sender->rto_time_us = timer_get_usec() + sender->initial_RTO_us;
         }
 
-        // Add the segment to the unacked queue
-        rtq_push(&sender->pending_segs, pending);
+        // Add the segment to the back of the unacked queue (oldest stays at the front)
+        rtq_append(&sender->pending_segs, pending);
 
         // Update next sequence number
         sender->next_seqno += seg.len;
+        sender->syn_sent |= seg.is_syn;
+        sender->fin_sent |= seg.is_fin;
 
         // SYN and FIN take up one sequence number each
         if (seg.is_syn || seg.is_fin) {
             sender->next_seqno++;
         }
+
+        // Add new data to the FEC group (the SYN isn't covered), and send the group's
+        // parity once it's full or the stream ends
+        if (!seg.is_syn) {
+            bool group_full = false;
+            if (seg.len > 0) {
+                if (fec_in_use(&sender->fec)) {
+                    group_full = fec_add(&sender->fec, seg.seqno, seg.payload, seg.len);
+                }
+                fec_note_segment(&sender->fec);
+            }
+            if (group_full || (seg.is_fin && sender->fec.n_segs > 0)) {
+                sender_send_parity(sender, seg.is_fin);
+            }
+        }
     }
 }
 
+/**
+ * Send the parity of the current FEC group
+ * - Parity isn't retransmitted: if it's lost, the data segments are retransmitted as usual.
+ *
+ * @param sender The sender to send the parity from
+ * @param is_fin Whether the group ends the stream (so the receiver can recover the FIN too)
+ */
+static inline void sender_send_parity(sender_t *sender, bool is_fin) {
+    assert(sender);
+
+    sender_segment_t parity = {
+        .is_parity = true,
+        .is_fin = is_fin,
+        .len = FEC_WIDTH,
+    };
+    fec_take_parity(&sender->fec, &parity.seqno, &parity.fec_span, parity.payload);
+
+    sender->transmit(sender->peer, &parity);
+    TCP_STAT(sender->stats, fec_parity_sent, 1);
+}
+
 /**
  * Push data from the bytestream to be sent to the remote peer
  *
@@ -170,14 +277,15 @@ static inline void sender_push(sender_t *sender) {
     assert(sender);
 
     // If FIN has been sent, no more data can be pushed
-    if (bs_reader_finished(&sender->reader) &&
-        (sender->next_seqno > bs_bytes_popped(&sender->reader) + 1)) {
-        // The seqno of FIN is `1 + bytes_popped`, so if next_seqno is greater, we've sent FIN
+    if (sender->fin_sent) {
         return;
     }
 
+    bool has_data = bs_bytes_available(&sender->reader) || bs_reader_finished(&sender->reader);
+
     // Edge case: if receiver window is 0 and no outstanding segments, send probe segment
     if (sender->window_size == 0) {
+        sender_set_blocked(sender, has_data);
         if (rtq_empty(&sender->pending_segs)) {
             // Send a zero-length segment to probe for window update
             sender_send_segment(sender, make_segment(sender, 0));
@@ -186,15 +294,18 @@ static inline void sender_push(sender_t *sender) {
     }
 
     // Check if receiver has enough space to receive more data
-    uint32_t receiver_max_seqno = sender->acked_seqno + sender->window_size;
-    if (receiver_max_seqno < sender->next_seqno) {
+    // (sequence numbers wrap, so compare distances from the last ACK)
+    uint16_t in_flight = sender->next_seqno - sender->acked_seqno;
+    if (in_flight >= sender->window_size) {
         // No space in receiver window
+        sender_set_blocked(sender, has_data);
         return;
     }
+    sender_set_blocked(sender, false);
 
-    // Send data if available in the bytestream
-    if (bs_bytes_available(&sender->reader)) {
-        uint32_t remaining_space = receiver_max_seqno - sender->next_seqno;
+    // Send data if available in the bytestream (or a bare FIN once the app has closed)
+    if (has_data) {
+        uint32_t remaining_space = sender->window_size - in_flight;
         sender_send_segment(sender, make_segment(sender, remaining_space));
     }
 }
@@ -211,14 +322,37 @@ static inline void sender_process_reply(sender_t *sender, receiver_segment_t *re
 
     if (reply->is_ack) {
         // Validate ACK number doesn't exceed what we've sent
-        if (reply->ackno > sender->next_seqno) {
+        if ((int16_t)(reply->ackno - sender->next_seqno) > 0) {
+            return;
+        }
+
+        // Ignore ACKs older than one we've already processed (reordered or stale)
+        if ((int16_t)(reply->ackno - sender->acked_seqno) < 0) {
             return;
         }
 
+        // The receiver re-ACKs the same point for every segment it gets past a gap, so
+        // repeated ACKs with data outstanding mean the earliest segment was likely lost
+        bool is_dup = reply->ackno == sender->acked_seqno &&
+                      reply->window_size == sender->window_size &&
+                      !rtq_empty(&sender->pending_segs);
+        if (is_dup) {
+            TCP_STAT(sender->stats, dup_acks, 1);
+            if (++sender->n_dup_acks == DUP_ACK_THRESHOLD) {
+                unacked_segment_t *seg = rtq_start(&sender->pending_segs);
+                seg->retransmitted = true;
+                sender->transmit(sender->peer, &seg->seg);
+                sender->rto_time_us = timer_get_usec() + sender->initial_RTO_us;
+                fec_note_loss(&sender->fec);
+                TCP_STAT(sender->stats, retrans_fast, 1);
+            }
+        }
+
         // Update highest acknowledged sequence number
         sender->acked_seqno = reply->ackno;
 
         // Process acknowledged segments
+        uint32_t now_us = timer_get_usec();
         bool new_data_acked = false;
         while (!rtq_empty(&sender->pending_segs)) {
             unacked_segment_t *seg = rtq_start(&sender->pending_segs);
@@ -230,28 +364,60 @@ static inline void sender_process_reply(sender_t *sender, receiver_segment_t *re
             }
 
             // If this segment is not fully acknowledged, stop
-            if (reply->ackno < seg_end_seqno) {
+            if ((int16_t)(reply->ackno - seg_end_seqno) < 0) {
                 break;
             }
 
-            // Remove fully acknowledged segment from queue
-            rtq_pop(&sender->pending_segs);
+            // Only segments sent once give an unambiguous RTT sample (Karn's algorithm)
+            if (!seg->retransmitted) {
+                tcp_stats_record_rtt(sender->stats, now_us - seg->sent_us);
+            }
+            TCP_STAT(sender->stats, bytes_acked, seg->seg.len);
+
+            // Remove fully acknowledged segment from queue and keep it for reuse
+            rtq_push(&sender->free_segs, rtq_pop(&sender->pending_segs));
             new_data_acked = true;
         }
 
         // Reset retransmission timer if new data was acknowledged
         if (new_data_acked) {
             if (!rtq_empty(&sender->pending_segs)) {
-                sender->rto_time_us = timer_get_usec() + sender->initial_RTO_us;
+                sender->rto_time_us = now_us + sender->initial_RTO_us;
             }
             sender->n_retransmits = 0;
+            sender->n_dup_acks = 0;
         }
     }
 
     // Update window size from receiver
+    if (reply->window_size == 0 && sender->window_size != 0) {
+        TCP_STAT(sender->stats, zero_window_events, 1);
+    }
     sender->window_size = reply->window_size;
 }
 
+/**
+ * Track whether queued data is waiting on the receiver's window
+ *
+ * @param sender The sender to update
+ * @param blocked Whether the sender is currently blocked
+ */
+static inline void sender_set_blocked(sender_t *sender, bool blocked) {
+    assert(sender);
+
+    if (blocked == sender->window_blocked) {
+        return;
+    }
+
+    uint32_t now_us = timer_get_usec();
+    if (blocked) {
+        sender->blocked_since_us = now_us;
+    } else {
+        TCP_STAT(sender->stats, window_blocked_us, now_us - sender->blocked_since_us);
+    }
+    sender->window_blocked = blocked;
+}
+
 /**
  * Check if any segments need to be retransmitted
  *
@@ -266,7 +432,10 @@ static inline void sender_check_retransmits(sender_t *sender) {
     if (time_since_rto >= 0 && !rtq_empty(&sender->pending_segs)) {
         // Retransmit the oldest unacknowledged segment
         unacked_segment_t *seg = rtq_start(&sender->pending_segs);
+        seg->retransmitted = true;
         sender->transmit(sender->peer, &seg->seg);
+        fec_note_loss(&sender->fec);
+        TCP_STAT(sender->stats, retrans_rto, 1);
 
         // Update retransmission timer - use exponential backoff if window is nonzero
         if (sender->window_size) {
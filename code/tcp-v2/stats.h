@@ -0,0 +1,125 @@
+#pragma once
+
+#include "rpi.h"
+
+/**
+ * Per-connection statistics
+ *
+ * The sender and receiver each hold a pointer to their peer's statistics (NULL when they
+ * are used on their own, e.g. in unit tests), so counting is done through TCP_STAT.
+ */
+
+#define TCP_RTT_BUCKETS 24 /* RTT histogram buckets (powers of two in usec) */
+
+typedef struct tcp_stats {
+    uint32_t start_us; /* Time the connection was initialized */
+
+    uint32_t segs_sent;   /* Segments transmitted, including retransmits and ACKs */
+    uint32_t bytes_sent;  /* Payload bytes transmitted, including retransmits */
+    uint32_t segs_recv;   /* Valid segments received, including ACKs */
+    uint32_t bytes_recv;  /* Payload bytes received, including duplicates */
+    uint32_t bytes_acked; /* Payload bytes the remote has acknowledged */
+
+    uint32_t retrans_rto;  /* Retransmits triggered by the retransmission timer */
+    uint32_t retrans_fast; /* Retransmits triggered by duplicate ACKs */
+    uint32_t dup_acks;     /* Duplicate ACKs received */
+
+    uint32_t dup_segs; /* Data segments that carried only bytes we already had */
+    uint32_t ooo_segs; /* Data segments that arrived ahead of a gap */
+
+    uint32_t zero_window_events; /* Times the remote's advertised window dropped to zero */
+    uint32_t window_blocked_us;  /* Time spent with data queued but no window to send it */
+
+    uint32_t fec_parity_sent; /* FEC parity segments transmitted */
+    uint32_t fec_repairs;     /* Lost segments rebuilt from parity */
+
+    uint32_t lz_bytes_in;  /* App bytes compressed before sending */
+    uint32_t lz_bytes_out; /* Compressed bytes those turned into */
+
+    uint32_t rtt_hist[TCP_RTT_BUCKETS]; /* Bucket i counts RTT samples in [2^i, 2^(i+1)) */
+} tcp_stats_t;
+
+/* Add <n> to a counter if statistics are being kept */
+#define TCP_STAT(stats, field, n) \
+    do {                          \
+        if (stats) {              \
+            (stats)->field += (n); \
+        }                         \
+    } while (0)
+
+/* Forward declarations for all functions */
+static inline tcp_stats_t tcp_stats_init(void);
+static inline void tcp_stats_record_rtt(tcp_stats_t *stats, uint32_t rtt_us);
+static inline void tcp_stats_print(const tcp_stats_t *stats, uint8_t local_addr,
+                                   uint8_t remote_addr);
+
+/**
+ * Initialize connection statistics
+ *
+ * @return Zeroed statistics with the start time set to now
+ */
+static inline tcp_stats_t tcp_stats_init(void) {
+    tcp_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.start_us = timer_get_usec();
+    return stats;
+}
+
+/**
+ * Record an RTT sample in the histogram
+ *
+ * @param stats The statistics to update (may be NULL)
+ * @param rtt_us The measured round-trip time
+ */
+static inline void tcp_stats_record_rtt(tcp_stats_t *stats, uint32_t rtt_us) {
+    if (!stats) {
+        return;
+    }
+
+    /* Bucket by the position of the highest set bit */
+    unsigned bucket = 31 - __builtin_clz(rtt_us | 1);
+    if (bucket >= TCP_RTT_BUCKETS) {
+        bucket = TCP_RTT_BUCKETS - 1;
+    }
+    stats->rtt_hist[bucket]++;
+}
+
+/**
+ * Print the statistics as one machine-parseable line
+ *
+ * Format (fields are only ever appended, never reordered):
+ *   TCP-STATS: v=1 local=<a> remote=<a> elapsed_us=<n> <counter>=<n> ... \
+ *              goodput_Bps=<n> rtt_hist=<b0>/<b1>/.../<b23> fec_sent=<n> fec_repairs=<n> \
+ *              lz_in=<n> lz_out=<n>
+ *
+ * @param stats The statistics to print
+ * @param local_addr The connection's local RCP address
+ * @param remote_addr The connection's remote RCP address
+ */
+static inline void tcp_stats_print(const tcp_stats_t *stats, uint8_t local_addr,
+                                   uint8_t remote_addr) {
+    assert(stats);
+
+    uint32_t elapsed_us = timer_get_usec() - stats->start_us;
+
+    /* Acked payload bytes per second, computed in ms to stay within 32 bits */
+    uint32_t elapsed_ms = elapsed_us / 1000;
+    uint32_t goodput =
+        elapsed_ms ? (uint32_t)((uint64_t)stats->bytes_acked * 1000 / elapsed_ms) : 0;
+
+    printk("TCP-STATS: v=1 local=%u remote=%u elapsed_us=%u", local_addr, remote_addr,
+           elapsed_us);
+    printk(" segs_sent=%u bytes_sent=%u segs_recv=%u bytes_recv=%u bytes_acked=%u",
+           stats->segs_sent, stats->bytes_sent, stats->segs_recv, stats->bytes_recv,
+           stats->bytes_acked);
+    printk(" retrans_rto=%u retrans_fast=%u dup_acks=%u dup_segs=%u ooo_segs=%u",
+           stats->retrans_rto, stats->retrans_fast, stats->dup_acks, stats->dup_segs,
+           stats->ooo_segs);
+    printk(" zero_window=%u window_blocked_us=%u goodput_Bps=%u rtt_hist=",
+           stats->zero_window_events, stats->window_blocked_us, goodput);
+    for (size_t i = 0; i < TCP_RTT_BUCKETS; i++) {
+        printk(i ? "/%u" : "%u", stats->rtt_hist[i]);
+    }
+    printk(" fec_sent=%u fec_repairs=%u", stats->fec_parity_sent, stats->fec_repairs);
+    printk(" lz_in=%u lz_out=%u\n", stats->lz_bytes_in, stats->lz_bytes_out);
+}
@@ -1,9 +1,20 @@
 #pragma once
 
+#include "compress.h"
+#include "framing.h"
+#include "mcast.h"
+#include "pi-random.h"
+#include "rcp-batch.h"
+#include "rcp-compact.h"
 #include "receiver.h"
 #include "router.h"
 #include "sender.h"
-#include "util.h"
+#include "stats.h"
+
+/* How long a closed connection lingers to re-ACK a retransmitted FIN (in RTOs)
+   - Randomized ISNs make stale segments from an old session harmless, so this only needs
+     to cover a lost final ACK, not the lifetime of every old segment */
+#define TCP_LINGER_RTOS 2
 
 /* TCP peer structure representing a connection endpoint */
 typedef struct tcp_peer {
@@ -15,23 +26,59 @@ typedef struct tcp_peer {
 
     uint32_t time_of_last_receipt;    /* Time when last packet was received */
     bool linger_after_streams_finish; /* Whether to linger after streams finish */
+
+    bool msg_mode;          /* Whether the streams carry length-prefixed messages */
+    msg_framer_t rx_framer; /* Tracks complete messages in the receiver's bytestream */
+
+    bool compress;      /* Whether the streams are LZ-compressed (see compress.h) */
+    lz_encoder_t tx_lz; /* Compresses what the app writes */
+    lz_decoder_t rx_lz; /* Expands what the app reads */
+
+    tcp_stats_t stats; /* Per-connection counters (see tcp_stats_dump) */
+
+    mcast_t *mcast; /* Multicast group this node takes part in, if any (see tcp_use_mcast) */
 } tcp_peer_t;
 
+/* Scatter-gather element for tcp_writev */
+typedef struct tcp_iovec {
+    const uint8_t *base; /* Start of the data */
+    size_t len;          /* Length of the data */
+} tcp_iovec_t;
+
+/* Conversion helpers need the complete tcp_peer_t */
+#include "util.h"
+
 /* Forward declarations for all functions */
 static inline void transmit_segment(tcp_peer_t *peer, sender_segment_t *segment);
 static inline void transmit_reply(tcp_peer_t *peer, receiver_segment_t *segment);
-static inline tcp_peer_t tcp_peer_init(nrf_t *sender_nrf, nrf_t *receiver_nrf, uint8_t local_addr,
-                                       uint8_t remote_addr);
+static inline void tcp_peer_init(tcp_peer_t *peer, nrf_t *sender_nrf, nrf_t *receiver_nrf,
+                                 uint8_t local_addr, uint8_t remote_addr);
+static inline void tcp_peer_reset(tcp_peer_t *peer);
+static inline uint16_t tcp_choose_isn(tcp_peer_t *peer);
 static inline void tcp_tick(tcp_peer_t *peer);
 static inline void tcp_check_incoming(tcp_peer_t *peer);
+static inline void tcp_process_incoming(tcp_peer_t *peer, rcp_datagram_t *datagram);
+static inline void tcp_process_datagram(tcp_peer_t *peer, rcp_datagram_t *datagram);
 static inline void tcp_send_pending(tcp_peer_t *peer);
 static inline void tcp_check_timeouts(tcp_peer_t *peer);
 static inline size_t tcp_write(tcp_peer_t *peer, const uint8_t *data, size_t len);
+static inline size_t tcp_writev(tcp_peer_t *peer, const tcp_iovec_t *iov, size_t iovcnt);
+static inline bool tcp_write_reserve(tcp_peer_t *peer, size_t min, uint8_t **ptr, size_t *len);
+static inline void tcp_write_commit(tcp_peer_t *peer, size_t len);
 static inline size_t tcp_read(tcp_peer_t *peer, uint8_t *data, size_t len);
 static inline bool tcp_has_data(tcp_peer_t *peer);
 static inline void tcp_close(tcp_peer_t *peer);
+static inline bool tcp_streams_finished(tcp_peer_t *peer);
 static inline bool tcp_is_active(tcp_peer_t *peer);
 static inline bool tcp_receive_closed(tcp_peer_t *peer);
+static inline void tcp_set_msg_mode(tcp_peer_t *peer, bool enable);
+static inline void tcp_set_fec(tcp_peer_t *peer, uint8_t k, bool adaptive);
+static inline void tcp_set_compress(tcp_peer_t *peer, bool enable);
+static inline void tcp_use_mcast(tcp_peer_t *peer, mcast_t *mc);
+static inline bool tcp_send_msg(tcp_peer_t *peer, const uint8_t *data, size_t len);
+static inline int tcp_recv_msg(tcp_peer_t *peer, uint8_t *data, size_t len);
+static inline bool tcp_has_msg(tcp_peer_t *peer);
+static inline void tcp_stats_dump(tcp_peer_t *peer);
 
 /**
  * Callback function for transmitting segments
@@ -48,17 +95,30 @@ static inline void transmit_segment(tcp_peer_t *peer, sender_segment_t *segment)
 
     /* Get the next hop NRF address from the routing table */
     uint8_t dst_rcp = peer->remote_addr;
-    uint32_t next_hop_nrf = rtable_map[dst_rcp][0];
+    uint32_t next_hop_nrf = route_next_hop(peer->local_addr, dst_rcp);
 
     /* Convert the sender_segment_t to a rcp_datagram_t */
     rcp_datagram_t datagram = sender_segment_to_rcp(peer, segment);
 
-    /* Serialize the datagram */
+    /* Serialize the datagram and fill in its checksum
+       - Only the SYN needs the full header: it's what tells the remote who we are */
     uint8_t buffer[RCP_TOTAL_SIZE];
-    uint16_t length = rcp_datagram_serialize(&datagram, buffer, RCP_TOTAL_SIZE);
+    uint16_t length = segment->is_syn ? rcp_datagram_encode(&datagram, buffer, RCP_TOTAL_SIZE)
+                                      : rcp_compact_encode(&datagram, buffer, RCP_TOTAL_SIZE);
+
+    /* Send the segment to the next hop NRF address
+       - With learned routes it goes with a hardware ACK, which feeds the link estimate */
+    if (route_dv) {
+        uint8_t next_hop = dv_hop_addr(route_dv, dst_rcp, next_hop_nrf);
+        dv_link_send(route_dv, sender_nrf, next_hop, next_hop_nrf, buffer, length);
+    } else {
+        nrf_send_noack(sender_nrf, next_hop_nrf, buffer, length);
+    }
 
-    /* Send the segment to the next hop NRF address */
-    nrf_send_noack(sender_nrf, next_hop_nrf, buffer, length);
+    peer->stats.segs_sent++;
+    if (!segment->is_parity) {
+        peer->stats.bytes_sent += segment->len;
+    }
 }
 
 /**
@@ -76,42 +136,93 @@ static inline void transmit_reply(tcp_peer_t *peer, receiver_segment_t *segment)
 
     /* Get the next hop NRF address from the routing table */
     uint8_t dst_rcp = peer->remote_addr;
-    uint32_t next_hop_nrf = rtable_map[dst_rcp][0];
+    uint32_t next_hop_nrf = route_next_hop(peer->local_addr, dst_rcp);
 
     /* Convert the receiver_segment_t to a rcp_datagram_t */
     rcp_datagram_t datagram = receiver_segment_to_rcp(peer, segment);
 
-    /* Serialize the datagram */
+    /* Serialize the datagram with the short ACK-only header and fill in its checksum */
     uint8_t buffer[RCP_TOTAL_SIZE];
-    uint16_t length = rcp_datagram_serialize(&datagram, buffer, RCP_TOTAL_SIZE);
+    uint16_t length = rcp_compact_encode(&datagram, buffer, RCP_TOTAL_SIZE);
 
     /* Send the reply to the next hop NRF address */
     nrf_send_noack(sender_nrf, next_hop_nrf, buffer, length);
+
+    peer->stats.segs_sent++;
 }
 
 /**
- * Initialize a new TCP peer
+ * Initialize a new TCP peer in place
+ * - The sender and receiver keep a pointer back to the peer, so the peer must not be
+ *   copied or moved after it is initialized.
  *
+ * @param peer The peer to initialize
  * @param sender_nrf The NRF interface to use for sending segments
  * @param receiver_nrf The NRF interface to use for receiving segments
  * @param local_addr The local RCP address
  * @param remote_addr The remote RCP address
- * @return Initialized TCP peer structure
  */
-static inline tcp_peer_t tcp_peer_init(nrf_t *sender_nrf, nrf_t *receiver_nrf, uint8_t local_addr,
-                                       uint8_t remote_addr) {
-    tcp_peer_t peer;
+static inline void tcp_peer_init(tcp_peer_t *peer, nrf_t *sender_nrf, nrf_t *receiver_nrf,
+                                 uint8_t local_addr, uint8_t remote_addr) {
+    assert(peer);
+
+    peer->sender = sender_init(sender_nrf, transmit_segment, peer);
+    peer->receiver = receiver_init(receiver_nrf, transmit_reply, peer);
 
-    peer.sender = sender_init(sender_nrf, transmit_segment, &peer);
-    peer.receiver = receiver_init(receiver_nrf, transmit_reply, &peer);
+    peer->local_addr = local_addr;
+    peer->remote_addr = remote_addr;
 
-    peer.local_addr = local_addr;
-    peer.remote_addr = remote_addr;
+    peer->time_of_last_receipt = timer_get_usec(); /* Initialize to current time */
+    peer->linger_after_streams_finish = true;
 
-    peer.time_of_last_receipt = timer_get_usec(); /* Initialize to current time */
-    peer.linger_after_streams_finish = true;
+    peer->msg_mode = false;
+    peer->rx_framer = framer_init();
 
-    return peer;
+    peer->compress = false;
+    lz_encoder_init(&peer->tx_lz);
+    lz_decoder_init(&peer->rx_lz);
+
+    peer->stats = tcp_stats_init();
+    peer->sender.stats = &peer->stats;
+    peer->receiver.stats = &peer->stats;
+
+    peer->mcast = NULL;
+
+    /* A fresh ISN per session lets the remote reject segments from an earlier one */
+    sender_set_isn(&peer->sender, tcp_choose_isn(peer));
+}
+
+/**
+ * Start a new session on an existing peer, keeping its radios, addresses, and modes
+ *
+ * @param peer The peer to reset
+ */
+static inline void tcp_peer_reset(tcp_peer_t *peer) {
+    assert(peer);
+
+    bool msg_mode = peer->msg_mode;
+    bool compress = peer->compress;
+    mcast_t *mcast = peer->mcast;
+    fec_encoder_t fec = peer->sender.fec;
+    tcp_peer_init(peer, peer->sender.nrf, peer->receiver.nrf, peer->local_addr,
+                  peer->remote_addr);
+    peer->msg_mode = msg_mode;
+    peer->compress = compress;
+    peer->mcast = mcast;
+    sender_set_fec(&peer->sender, fec.k, fec.adaptive);
+}
+
+/**
+ * Choose an initial sequence number for a new session
+ * - pi_random is deterministic across reboots, so mix in the time and the addresses to
+ *   make sessions after a reboot start somewhere different.
+ *
+ * @param peer The peer starting a session
+ * @return The ISN to use
+ */
+static inline uint16_t tcp_choose_isn(tcp_peer_t *peer) {
+    uint32_t x = pi_random() ^ timer_get_usec() ^ (peer->local_addr << 8 | peer->remote_addr);
+    return (uint16_t)(x ^ (x >> 16));
 }
 
 /**
@@ -125,6 +236,14 @@ static inline void tcp_tick(tcp_peer_t *peer) {
     tcp_check_incoming(peer);
     tcp_send_pending(peer);
     tcp_check_timeouts(peer);
+
+    /* Keep the routes fresh if they're learned (see route_use_dv) */
+    if (route_dv) {
+        dv_tick(route_dv);
+    }
+    if (peer->mcast) {
+        mcast_tick(peer->mcast);
+    }
 }
 
 /**
@@ -135,47 +254,93 @@ static inline void tcp_tick(tcp_peer_t *peer) {
 static inline void tcp_check_incoming(tcp_peer_t *peer) {
     assert(peer);
 
-    uint8_t buffer[RCP_TOTAL_SIZE];
-
-    /* Try to receive a packet from NRF with a 1 ms timeout */
-    int ret = nrf_read_exact_timeout(peer->receiver.nrf, buffer, RCP_TOTAL_SIZE, 1000);
-    if (ret <= 0) {
-        return; /* No data or error */
+    /* Wait up to 1 ms for packets to arrive, then take all of them at once
+       - A compact header leaves out the source, which is the remote of this connection */
+    rcp_batch_t batch;
+    uint32_t start_us = timer_get_usec();
+    while (rcp_recv_batch(peer->receiver.nrf, &batch, RCP_BATCH_MAX, peer->remote_addr) == 0) {
+        if (batch.n_dropped > 0 || timer_get_usec() - start_us >= 1000) {
+            return; /* No data, or only packets with a bad length or checksum */
+        }
     }
 
-    /* Try to parse the read packet into an RCP datagram */
-    rcp_datagram_t datagram = rcp_datagram_init();
-    if (rcp_datagram_parse(&datagram, buffer, ret) <= 0) {
-        return; /* Parsing failed */
+    /* Payloads stay in the batch's wire buffer, which lives until we return */
+    for (size_t i = 0; i < batch.count; i++) {
+        tcp_process_incoming(peer, &batch.pkts[i]);
     }
+}
+
+/**
+ * Hand one verified packet to whatever it's for
+ * - Routing updates and multicast packets share the radio, but aren't part of the
+ *   connection: they go to route_dv and the peer's multicast group (or are dropped if
+ *   there's none), and everything else is a segment from the remote.
+ *
+ * @param peer The TCP peer to process
+ * @param datagram The parsed packet
+ */
+static inline void tcp_process_incoming(tcp_peer_t *peer, rcp_datagram_t *datagram) {
+    assert(peer);
+    assert(datagram);
 
-    /* Verify the checksum of the received packet */
-    if (!rcp_datagram_verify_checksum(&datagram)) {
-        return; /* Invalid checksum */
+    if (rcp_is_route_update(datagram)) {
+        if (route_dv) {
+            dv_process_datagram(route_dv, datagram);
+        }
+        return;
+    }
+    if (rcp_is_mcast(datagram->header.dst) || rcp_has_flag(&datagram->header, RCP_FLAG_MCAST)) {
+        if (peer->mcast) {
+            mcast_process_datagram(peer->mcast, datagram);
+        }
+        return;
     }
+    tcp_process_datagram(peer, datagram);
+}
+
+/**
+ * Process one verified segment from the remote
+ *
+ * @param peer The TCP peer to process
+ * @param datagram The parsed segment
+ */
+static inline void tcp_process_datagram(tcp_peer_t *peer, rcp_datagram_t *datagram) {
+    assert(peer);
+    assert(datagram);
 
     /* Update time of last packet receipt */
     peer->time_of_last_receipt = timer_get_usec();
 
+    peer->stats.segs_recv++;
+    peer->stats.bytes_recv += datagram->header.payload_len;
+
     /* Process based on segment type (ACK or data) */
-    if (rcp_has_flag(&datagram.header, RCP_FLAG_ACK)) {
+    if (rcp_has_flag(&datagram->header, RCP_FLAG_ACK)) {
         /* Convert the RCP datagram to a receiver_segment_t */
-        receiver_segment_t segment = rcp_to_receiver_segment(&datagram);
+        receiver_segment_t segment = rcp_to_receiver_segment(datagram);
 
         /* Process the reply (might be ACK or window update) */
         sender_process_reply(&peer->sender, &segment);
     } else {
         /* Convert the RCP datagram to a sender_segment_t */
-        sender_segment_t segment = rcp_to_sender_segment(&datagram);
+        sender_segment_t segment = rcp_to_sender_segment(datagram);
+
+        /* A SYN with a new ISN after both streams finished (and the app has read
+           everything) means the remote reconnected: start the new session now instead of
+           waiting out the linger period */
+        if (segment.is_syn && peer->receiver.syn_received &&
+            segment.seqno != peer->receiver.isn && tcp_streams_finished(peer) &&
+            !tcp_has_data(peer)) {
+            tcp_peer_reset(peer);
+        }
 
         /* Process the segment (and potentially reply with an ACK) */
         recv_process_segment(&peer->receiver, &segment);
-    }
 
-    /* Free the payload if allocated */
-    if (datagram.payload) {
-        free(datagram.payload);
-        datagram.payload = NULL;
+        /* Pick up any messages the segment completed */
+        if (peer->msg_mode) {
+            framer_scan(&peer->rx_framer, &peer->receiver.writer);
+        }
     }
 }
 
@@ -219,8 +384,90 @@ static inline size_t tcp_write(tcp_peer_t *peer, const uint8_t *data, size_t len
     assert(peer);
     assert(data || len == 0);
 
-    /* Write to the bytestream that the sender reads from */
-    return bs_write(&peer->sender.reader, data, len);
+    if (!peer->compress) {
+        /* Write to the bytestream that the sender reads from */
+        return bs_write(&peer->sender.reader, data, len);
+    }
+
+    /* Compress on the way into the sender's bytestream */
+    size_t before = bs_bytes_written(&peer->sender.reader);
+    size_t taken = lz_write(&peer->tx_lz, &peer->sender.reader, data, len);
+    peer->stats.lz_bytes_in += taken;
+    peer->stats.lz_bytes_out += bs_bytes_written(&peer->sender.reader) - before;
+    return taken;
+}
+
+/**
+ * Write several buffers to the TCP connection in order (e.g., a header and a body)
+ *
+ * @param peer The TCP peer to write to
+ * @param iov The buffers to write
+ * @param iovcnt The number of buffers
+ * @return The number of bytes written (stops at the first short write)
+ */
+static inline size_t tcp_writev(tcp_peer_t *peer, const tcp_iovec_t *iov, size_t iovcnt) {
+    assert(peer);
+    assert(iov || iovcnt == 0);
+
+    size_t total = 0;
+    for (size_t i = 0; i < iovcnt; i++) {
+        size_t written = tcp_write(peer, iov[i].base, iov[i].len);
+        total += written;
+
+        /* Out of space: the rest can't go in without leaving a gap */
+        if (written < iov[i].len) {
+            break;
+        }
+    }
+    return total;
+}
+
+/**
+ * Reserve space in the sender's bytestream so the app can produce data in place
+ * - On success, the app writes up to <len> bytes at <ptr> and then calls tcp_write_commit.
+ * - No bytes are sent until they are committed.
+ * - With compression on, the space is a staging area of LZ_CHUNK bytes that is
+ *   compressed on commit.
+ *
+ * @param peer The TCP peer to write to
+ * @param min The minimum number of contiguous bytes the app needs
+ * @param ptr Set to where the app should write
+ * @param len Set to how many contiguous bytes the app may write
+ * @return True if at least <min> contiguous bytes were reserved
+ */
+static inline bool tcp_write_reserve(tcp_peer_t *peer, size_t min, uint8_t **ptr, size_t *len) {
+    assert(peer);
+
+    if (!peer->compress) {
+        return bs_reserve(&peer->sender.reader, min, ptr, len);
+    }
+
+    /* Only hand out the stage if its compressed form is sure to fit */
+    if (min > LZ_CHUNK || bs_remaining_capacity(&peer->sender.reader) < LZ_CHUNK_MAX_OUT) {
+        return false;
+    }
+    *ptr = peer->tx_lz.stage;
+    *len = LZ_CHUNK;
+    return true;
+}
+
+/**
+ * Commit bytes the app wrote into space returned by tcp_write_reserve
+ *
+ * @param peer The TCP peer to write to
+ * @param len The number of bytes the app wrote
+ */
+static inline void tcp_write_commit(tcp_peer_t *peer, size_t len) {
+    assert(peer);
+
+    if (!peer->compress) {
+        bs_commit(&peer->sender.reader, len);
+        return;
+    }
+
+    assert(len <= LZ_CHUNK);
+    size_t written = tcp_write(peer, peer->tx_lz.stage, len);
+    assert(written == len);
 }
 
 /**
@@ -235,7 +482,10 @@ static inline size_t tcp_read(tcp_peer_t *peer, uint8_t *data, size_t len) {
     assert(peer);
     assert(data || len == 0);
 
-    /* Read from the bytestream that the receiver writes to */
+    /* Read from the bytestream that the receiver writes to (expanding it if compressed) */
+    if (peer->compress) {
+        return lz_read(&peer->rx_lz, &peer->receiver.writer, data, len);
+    }
     return bs_read(&peer->receiver.writer, data, len);
 }
 
@@ -249,6 +499,9 @@ static inline bool tcp_has_data(tcp_peer_t *peer) {
     assert(peer);
 
     /* Check if the receiver's bytestream has data available to read */
+    if (peer->compress) {
+        return lz_has_output(&peer->rx_lz, &peer->receiver.writer);
+    }
     return bs_bytes_available(&peer->receiver.writer) > 0;
 }
 
@@ -274,16 +527,14 @@ static inline void tcp_close(tcp_peer_t *peer) {
 }
 
 /**
- * Check if the TCP connection is active
+ * Check if both directions of the connection have finished
  *
  * @param peer The TCP peer to check
- * @return True if the connection is still active
+ * @return True if all data and both FINs have been exchanged and acknowledged
  */
-static inline bool tcp_is_active(tcp_peer_t *peer) {
+static inline bool tcp_streams_finished(tcp_peer_t *peer) {
     assert(peer);
 
-    uint32_t now = timer_get_usec();
-
     /* Sender is active if it has pending segments or is still reading from the app */
     bool sender_active =
         !rtq_empty(&peer->sender.pending_segs) || !bs_reader_finished(&peer->sender.reader);
@@ -291,13 +542,29 @@ static inline bool tcp_is_active(tcp_peer_t *peer) {
     /* Receiver is active if it is still writing to the app */
     bool receiver_active = !bs_writer_finished(&peer->receiver.writer);
 
-    /* We should linger for 10 RTOs (10 seconds) after the last packet was received
+    return !sender_active && !receiver_active;
+}
+
+/**
+ * Check if the TCP connection is active
+ *
+ * @param peer The TCP peer to check
+ * @return True if the connection is still active
+ */
+static inline bool tcp_is_active(tcp_peer_t *peer) {
+    assert(peer);
+
+    uint32_t now = timer_get_usec();
+
+    /* We should linger for a couple of RTOs after the last packet was received
        - Mainly used when both sender and receiver is closed, and we want to ensure our
          ACK of the other side's FIN/ACK is received */
-    bool lingering = peer->linger_after_streams_finish &&
-                     (now < peer->time_of_last_receipt + 10 * peer->sender.initial_RTO_us);
+    bool lingering =
+        peer->linger_after_streams_finish &&
+        (int32_t)(now - (peer->time_of_last_receipt +
+                         TCP_LINGER_RTOS * peer->sender.initial_RTO_us)) < 0;
 
-    return (sender_active || receiver_active || lingering);
+    return !tcp_streams_finished(peer) || lingering;
 }
 
 /**
@@ -311,4 +578,119 @@ static inline bool tcp_receive_closed(tcp_peer_t *peer) {
 
     /* Check if the receiver's bytestream is finished */
     return bs_writer_finished(&peer->receiver.writer);
-}
\ No newline at end of file
+}
+
+/**
+ * Switch the connection between byte-stream and message mode
+ * - Both peers must agree, and the mode should be set before any data is exchanged.
+ * - Message mode can't be combined with compression.
+ *
+ * @param peer The TCP peer to configure
+ * @param enable True for message mode, false for byte-stream mode
+ */
+static inline void tcp_set_msg_mode(tcp_peer_t *peer, bool enable) {
+    assert(peer);
+    assert(!enable || !peer->compress);
+
+    peer->msg_mode = enable;
+}
+
+/**
+ * Configure forward error correction for the data we send (see fec.h)
+ * - Only the sending side needs to enable it; any receiver uses parity that arrives.
+ *
+ * @param peer The TCP peer to configure
+ * @param k Data segments per parity segment (0 turns FEC off); the starting size in
+ *          adaptive mode
+ * @param adaptive Whether to retune <k> from the observed retransmission rate
+ */
+static inline void tcp_set_fec(tcp_peer_t *peer, uint8_t k, bool adaptive) {
+    assert(peer);
+
+    sender_set_fec(&peer->sender, k, adaptive);
+}
+
+/**
+ * Turn LZ compression of both streams on or off (see compress.h)
+ * - Both peers must agree, and the mode should be set before any data is exchanged.
+ * - Compression can't be combined with message mode.
+ *
+ * @param peer The TCP peer to configure
+ * @param enable True to compress what the app writes and expand what it reads
+ */
+static inline void tcp_set_compress(tcp_peer_t *peer, bool enable) {
+    assert(peer);
+    assert(!enable || !peer->msg_mode);
+
+    peer->compress = enable;
+}
+
+/**
+ * Take part in a multicast group alongside the connection
+ * - Packets for the group that arrive on the connection's radio go to <mc> instead of
+ *   the connection, and tcp_tick runs its timers.
+ *
+ * @param peer The TCP peer to configure
+ * @param mc Initialized multicast state (NULL to drop multicast packets)
+ */
+static inline void tcp_use_mcast(tcp_peer_t *peer, mcast_t *mc) {
+    assert(peer);
+    peer->mcast = mc;
+}
+
+/**
+ * Send one message, preserving its boundary at the receiver
+ * - Messages written between calls to tcp_tick are packed into the same segments.
+ *
+ * @param peer The TCP peer to send on (must be in message mode)
+ * @param data The message bytes
+ * @param len The message length (at most MSG_MAX_LEN)
+ * @return True if the message was queued, false if it is too long or the buffer is full
+ */
+static inline bool tcp_send_msg(tcp_peer_t *peer, const uint8_t *data, size_t len) {
+    assert(peer);
+    assert(peer->msg_mode);
+
+    return framer_write(&peer->sender.reader, data, len);
+}
+
+/**
+ * Receive the next complete message
+ *
+ * @param peer The TCP peer to receive from (must be in message mode)
+ * @param data Buffer for the message (a longer message is truncated)
+ * @param len The size of the buffer
+ * @return The message length, or -1 if no complete message has arrived
+ */
+static inline int tcp_recv_msg(tcp_peer_t *peer, uint8_t *data, size_t len) {
+    assert(peer);
+    assert(peer->msg_mode);
+
+    return framer_read(&peer->rx_framer, &peer->receiver.writer, data, len);
+}
+
+/**
+ * Check if a complete message is ready to be received
+ *
+ * @param peer The TCP peer to check (must be in message mode)
+ * @return True if tcp_recv_msg would return a message
+ */
+static inline bool tcp_has_msg(tcp_peer_t *peer) {
+    assert(peer);
+    assert(peer->msg_mode);
+
+    return framer_has_msg(&peer->rx_framer);
+}
+
+/**
+ * Print the connection's statistics as one line over UART
+ * - The line starts with "TCP-STATS:" and holds space-separated key=value pairs, so host
+ *   tooling can scrape it out of the console log (see tcp_stats_print for the format).
+ *
+ * @param peer The TCP peer to report on
+ */
+static inline void tcp_stats_dump(tcp_peer_t *peer) {
+    assert(peer);
+
+    tcp_stats_print(&peer->stats, peer->local_addr, peer->remote_addr);
+}
@@ -0,0 +1,165 @@
+#include <string.h>
+
+#include "cycle-count.h"
+#include "rcp-batch.h"
+
+#define REMOTE_ADDR 2
+#define N_PKTS 12
+
+// Stands in for an NRF's receive queue (the driver pushes packets a byte at a time)
+static cq_t q;
+
+static void push_packet(const uint8_t *pkt) {
+    for (size_t i = 0; i < RCP_TOTAL_SIZE; i++) {
+        assert(cq_push(&q, pkt[i]));
+    }
+}
+
+// Build packet <i> of a burst: full data segments, compact ACKs, and compact data
+static void make_packet(size_t i, uint8_t *pkt) {
+    uint8_t payload[RCP_MAX_PAYLOAD];
+    for (size_t j = 0; j < sizeof(payload); j++) {
+        payload[j] = i * 16 + j;
+    }
+
+    memset(pkt, 0, RCP_TOTAL_SIZE);
+    rcp_datagram_t dgram = rcp_datagram_init();
+    dgram.header.src = REMOTE_ADDR;
+    dgram.header.dst = 1;
+    dgram.header.seqno = 100 + i;
+    if (i % 3 == 1) {
+        rcp_set_flag(&dgram.header, RCP_FLAG_ACK);
+        dgram.header.ackno = 200 + i;
+        dgram.header.window = 1000;
+        assert(rcp_compact_encode(&dgram, pkt, RCP_TOTAL_SIZE) > 0);
+    } else {
+        rcp_datagram_set_payload(&dgram, payload, 1 + i);
+        assert(i % 3 == 0 ? rcp_datagram_encode(&dgram, pkt, RCP_TOTAL_SIZE) > 0
+                          : rcp_compact_encode(&dgram, pkt, RCP_TOTAL_SIZE) > 0);
+    }
+}
+
+// Check that <dgram> is packet <i> of the burst
+static void check_packet(size_t i, const rcp_datagram_t *dgram) {
+    assert(dgram->header.src == REMOTE_ADDR && dgram->header.dst == 1);
+    if (i % 3 == 1) {
+        assert(rcp_has_flag(&dgram->header, RCP_FLAG_ACK));
+        assert(dgram->header.ackno == 200 + i && dgram->header.window == 1000);
+        return;
+    }
+    assert(dgram->header.seqno == 100 + i && dgram->header.payload_len == 1 + i);
+    const uint8_t *payload = rcp_datagram_payload(dgram);
+    for (size_t j = 0; j < dgram->header.payload_len; j++) {
+        assert(payload[j] == (uint8_t)(i * 16 + j));
+    }
+}
+
+// Test that a burst is copied out and parsed correctly, across the queue's wraparound
+static void test_batch_parse(void) {
+    printk("--------------------------------\n");
+    printk("Testing batch receive...\n");
+
+    static rcp_batch_t batch;
+    uint8_t pkt[RCP_TOTAL_SIZE];
+
+    // Start near the end of the buffer so the burst wraps around
+    memset(&q, 0, sizeof(q));
+    q.head = q.tail = CQ_N - 3 * RCP_TOTAL_SIZE - 5;
+    for (size_t i = 0; i < N_PKTS; i++) {
+        make_packet(i, pkt);
+        push_packet(pkt);
+    }
+
+    // Half a packet at the end stays queued until the rest arrives
+    cq_push(&q, pkt[0]);
+
+    assert(rcp_recv_batch_cq(&q, &batch, RCP_BATCH_MAX, REMOTE_ADDR) == N_PKTS);
+    assert(batch.n_dropped == 0);
+    for (size_t i = 0; i < N_PKTS; i++) {
+        check_packet(i, &batch.pkts[i]);
+    }
+    assert(cq_nelem(&q) == 1);
+    printk("%u packets parsed across the wraparound\n", N_PKTS);
+
+    // Finish the partial packet with a corrupt byte, and add a good one behind it
+    for (size_t i = 1; i < RCP_TOTAL_SIZE; i++) {
+        cq_push(&q, pkt[i] ^ (i == 5 ? 0x40 : 0));
+    }
+    make_packet(0, pkt);
+    push_packet(pkt);
+    assert(rcp_recv_batch_cq(&q, &batch, RCP_BATCH_MAX, REMOTE_ADDR) == 1);
+    assert(batch.n_dropped == 1);
+    check_packet(0, &batch.pkts[0]);
+    assert(cq_empty(&q));
+    printk("Corrupt packet dropped, the rest kept\n");
+
+    // No more than <max> packets are taken at a time
+    for (size_t i = 0; i < N_PKTS; i++) {
+        make_packet(i, pkt);
+        push_packet(pkt);
+    }
+    assert(rcp_recv_batch_cq(&q, &batch, 5, REMOTE_ADDR) == 5);
+    check_packet(4, &batch.pkts[4]);
+    assert(rcp_recv_batch_cq(&q, &batch, RCP_BATCH_MAX, REMOTE_ADDR) == N_PKTS - 5);
+    check_packet(5, &batch.pkts[0]);
+    assert(rcp_recv_batch_cq(&q, &batch, RCP_BATCH_MAX, REMOTE_ADDR) == 0);
+    printk("Batch size limit respected\n");
+
+    printk("Batch receive test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Compare the cost of one read per packet with one batch per burst
+static void test_batch_speed(void) {
+    printk("--------------------------------\n");
+    printk("Receive cost (cycles per packet, %u-packet bursts)...\n", RCP_BATCH_MAX);
+
+    static rcp_batch_t batch;
+    static uint8_t burst[RCP_BATCH_MAX][RCP_TOTAL_SIZE];
+    for (size_t i = 0; i < RCP_BATCH_MAX; i++) {
+        make_packet(i % N_PKTS, burst[i]);
+    }
+
+    enum { N_ROUNDS = 64 };
+    unsigned single_cycles = 0, batch_cycles = 0;
+    memset(&q, 0, sizeof(q));
+    cycle_cnt_init();
+    for (int r = 0; r < N_ROUNDS; r++) {
+        // One packet at a time, the way nrf_read_exact_noblk does it
+        for (size_t i = 0; i < RCP_BATCH_MAX; i++) {
+            push_packet(burst[i]);
+        }
+        unsigned start = cycle_cnt_read();
+        for (size_t i = 0; i < RCP_BATCH_MAX; i++) {
+            uint8_t pkt[RCP_TOTAL_SIZE];
+            rcp_datagram_t dgram = rcp_datagram_init();
+            assert(cq_pop_n_noblk(&q, pkt, RCP_TOTAL_SIZE));
+            assert(rcp_is_compact(pkt) ? rcp_compact_decode(&dgram, pkt, RCP_TOTAL_SIZE, 2)
+                                       : rcp_datagram_decode(&dgram, pkt, RCP_TOTAL_SIZE));
+        }
+        single_cycles += cycle_cnt_read() - start;
+
+        // The whole burst in one batch
+        for (size_t i = 0; i < RCP_BATCH_MAX; i++) {
+            push_packet(burst[i]);
+        }
+        start = cycle_cnt_read();
+        assert(rcp_recv_batch_cq(&q, &batch, RCP_BATCH_MAX, 2) == RCP_BATCH_MAX);
+        batch_cycles += cycle_cnt_read() - start;
+    }
+
+    printk("  one at a time: %u cycles/packet\n", single_cycles / (N_ROUNDS * RCP_BATCH_MAX));
+    printk("  batched: %u cycles/packet\n", batch_cycles / (N_ROUNDS * RCP_BATCH_MAX));
+
+    printk("Batch receive benchmark done!\n");
+    printk("--------------------------------\n");
+}
+
+void notmain(void) {
+    printk("Starting batch receive tests...\n\n");
+
+    test_batch_parse();
+    test_batch_speed();
+
+    printk("\nBatch receive tests passed!\n");
+}
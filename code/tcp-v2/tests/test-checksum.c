@@ -0,0 +1,199 @@
+#include <string.h>
+
+#include "rcp-header.h"
+
+#include "cycle-count.h"
+#include "pi-random.h"
+
+// The folded sum computed a byte pair at a time, for comparison with the word-at-a-time one
+static uint16_t sum8_bytewise(const uint8_t *data, size_t len) {
+    return rcp_checksum_fold(rcp_checksum_add(0, data, len, false));
+}
+
+// Every integrity check we can choose between, run over a whole packet
+typedef uint16_t (*check_fn_t)(const uint8_t *data, size_t len);
+
+static const struct {
+    const char *name;
+    check_fn_t fn;
+} checks[] = {
+    {"sum8", rcp_sum8},
+    {"sum8 (bytewise)", sum8_bytewise},
+    {"crc16", rcp_crc16},
+    {"crc32/16", rcp_crc32_16},
+};
+#define N_CHECKS (sizeof(checks) / sizeof(checks[0]))
+
+#define CRC16_CHECK 2 // Index of CRC-16 in <checks>
+#define PKT_BITS (RCP_TOTAL_SIZE * 8)
+
+// Corruption patterns to inject
+enum { SINGLE_BIT, DOUBLE_BIT, BURST_16, RANDOM_BYTES, N_PATTERNS };
+static const char *pattern_names[N_PATTERNS] = {"1-bit", "2-bit", "burst<=16", "1-4 bytes"};
+
+static void random_packet(uint8_t *pkt) {
+    for (size_t i = 0; i < RCP_TOTAL_SIZE; i++) {
+        pkt[i] = pi_random();
+    }
+}
+
+static void flip_bit(uint8_t *pkt, unsigned bit) { pkt[bit / 8] ^= 1 << (bit % 8); }
+
+// Corrupt <pkt> with the given pattern (always changes at least one bit)
+static void corrupt(uint8_t *pkt, int pattern) {
+    switch (pattern) {
+        case SINGLE_BIT:
+            flip_bit(pkt, pi_random() % PKT_BITS);
+            break;
+        case DOUBLE_BIT: {
+            unsigned a = pi_random() % PKT_BITS, b;
+            do {
+                b = pi_random() % PKT_BITS;
+            } while (b == a);
+            flip_bit(pkt, a);
+            flip_bit(pkt, b);
+            break;
+        }
+        case BURST_16: {
+            // First and last bits of the burst are flipped, the ones between are random
+            unsigned len = 1 + pi_random() % 16;
+            unsigned start = pi_random() % (PKT_BITS - len + 1);
+            for (unsigned i = 0; i < len; i++) {
+                if (i == 0 || i == len - 1 || (pi_random() & 1)) {
+                    flip_bit(pkt, start + i);
+                }
+            }
+            break;
+        }
+        case RANDOM_BYTES: {
+            unsigned n = 1 + pi_random() % 4;
+            for (unsigned i = 0; i < n; i++) {
+                pkt[pi_random() % RCP_TOTAL_SIZE] ^= 1 + pi_random() % 255;
+            }
+            break;
+        }
+    }
+}
+
+// Measure cycles per 32-byte packet for each check
+static void test_checksum_speed(void) {
+    printk("--------------------------------\n");
+    printk("Checksum speed (cycles per %u-byte packet)...\n", RCP_TOTAL_SIZE);
+
+    enum { N_PKTS = 1000 };
+    static uint8_t pkts[8][RCP_TOTAL_SIZE];
+    for (size_t i = 0; i < 8; i++) {
+        random_packet(pkts[i]);
+    }
+
+    cycle_cnt_init();
+    for (size_t c = 0; c < N_CHECKS; c++) {
+        volatile uint16_t sink = 0;
+        unsigned start = cycle_cnt_read();
+        for (unsigned i = 0; i < N_PKTS; i++) {
+            sink ^= checks[c].fn(pkts[i % 8], RCP_TOTAL_SIZE);
+        }
+        unsigned cycles = cycle_cnt_read() - start;
+        printk("  %s: %u cycles/packet\n", checks[c].name, cycles / N_PKTS);
+    }
+
+    printk("--------------------------------\n");
+}
+
+// Inject corruption and count how often each check misses it
+static void test_checksum_detection(void) {
+    printk("--------------------------------\n");
+    printk("Checksum corruption injection...\n");
+
+    enum { N_TRIALS = 20000 };
+    uint32_t missed[N_CHECKS][N_PATTERNS] = {0};
+
+    uint8_t pkt[RCP_TOTAL_SIZE], bad[RCP_TOTAL_SIZE];
+    for (unsigned trial = 0; trial < N_TRIALS; trial++) {
+        random_packet(pkt);
+        for (int p = 0; p < N_PATTERNS; p++) {
+            memcpy(bad, pkt, sizeof(pkt));
+            corrupt(bad, p);
+            if (memcmp(bad, pkt, sizeof(pkt)) == 0) {
+                continue;  // Two byte hits cancelled out: nothing to detect
+            }
+
+            for (size_t c = 0; c < N_CHECKS; c++) {
+                if (checks[c].fn(bad, sizeof(bad)) == checks[c].fn(pkt, sizeof(pkt))) {
+                    missed[c][p]++;
+                }
+            }
+        }
+    }
+
+    printk("  Undetected errors out of %u trials per pattern:\n", N_TRIALS);
+    for (size_t c = 0; c < N_CHECKS; c++) {
+        printk("  %s:", checks[c].name);
+        for (int p = 0; p < N_PATTERNS; p++) {
+            printk(" %s=%u", pattern_names[p], missed[c][p]);
+        }
+        printk("\n");
+    }
+
+    // CRC-16-CCITT catches every 1- and 2-bit error and every burst of up to 16 bits in
+    // a packet this short
+    assert(missed[CRC16_CHECK][SINGLE_BIT] == 0);
+    assert(missed[CRC16_CHECK][DOUBLE_BIT] == 0);
+    assert(missed[CRC16_CHECK][BURST_16] == 0);
+
+    printk("Checksum corruption injection passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Check the word-at-a-time sum against the bytewise one on random data, lengths, and
+// alignments (this exercises the UXTAB16 kernel on the Pi and the C fallback elsewhere)
+static void test_checksum_fast_matches(void) {
+    printk("--------------------------------\n");
+    printk("Word-at-a-time sum vs. bytewise sum...\n");
+
+    enum { N_TRIALS = 20000 };
+    static uint8_t buf[2 * RCP_TOTAL_SIZE + 8];
+
+    for (unsigned trial = 0; trial < N_TRIALS; trial++) {
+        for (size_t i = 0; i < sizeof(buf); i++) {
+            buf[i] = pi_random();
+        }
+
+        // Include all-0xFF buffers, which push the lanes hardest
+        if (trial % 16 == 0) {
+            memset(buf, 0xFF, sizeof(buf));
+        }
+
+        size_t offset = pi_random() % 8;
+        size_t len = pi_random() % (sizeof(buf) - offset + 1);
+        bool odd = pi_random() & 1;
+        uint32_t start = (trial % 4 == 0) ? 0 : pi_random();
+
+        uint32_t expected = rcp_checksum_add(start, buf + offset, len, odd);
+        uint32_t actual = rcp_checksum_add_fast(start, buf + offset, len, odd);
+        if (expected != actual) {
+            panic("mismatch: offset=%u len=%u odd=%d expected=%x actual=%x\n", offset, len, odd,
+                  expected, actual);
+        }
+    }
+
+    // A long run of 0xFF bytes crosses the lane flush point
+    static uint8_t big[4 * 256 * 2 + 3];
+    memset(big, 0xFF, sizeof(big));
+    assert(rcp_checksum_add(0, big + 1, sizeof(big) - 1, false) ==
+           rcp_checksum_add_fast(0, big + 1, sizeof(big) - 1, false));
+
+    printk("%u random buffers matched\n", N_TRIALS);
+    printk("Word-at-a-time sum passed!\n");
+    printk("--------------------------------\n");
+}
+
+void notmain(void) {
+    printk("Starting RCP checksum tests...\n\n");
+
+    test_checksum_fast_matches();
+    test_checksum_speed();
+    test_checksum_detection();
+
+    printk("\nRCP checksum tests passed!\n");
+}
@@ -0,0 +1,265 @@
+#include <string.h>
+
+#include "cycle-count.h"
+#include "tcp.h"
+
+// Two endpoints wired back to back (no radio: bytes are moved by hand)
+static tcp_peer_t tx_peer, rx_peer;
+
+#define SAMPLE_LEN 8192
+
+// Move up to <max> compressed bytes from <from> to <to>, one segment's worth at a time
+static size_t deliver(tcp_peer_t *from, tcp_peer_t *to, size_t max) {
+    uint8_t chunk[RCP_MAX_PAYLOAD];
+    size_t moved = 0, n;
+    while (moved < max &&
+           (n = bs_read(&from->sender.reader, chunk, MIN(sizeof(chunk), max - moved))) > 0) {
+        bs_write(&to->receiver.writer, chunk, n);
+        moved += n;
+    }
+    return moved;
+}
+
+// Append <str> to <buf> (stopping at <len>), returning the new length
+static size_t put_str(uint8_t *buf, size_t n, size_t len, const char *str) {
+    while (*str && n < len) {
+        buf[n++] = *str++;
+    }
+    return n;
+}
+
+// Append <v> in decimal, zero-padded to <width> digits
+static size_t put_uint(uint8_t *buf, size_t n, size_t len, unsigned v, int width) {
+    char digits[11];
+    int d = 0;
+    do {
+        digits[d++] = '0' + v % 10;
+        v /= 10;
+    } while (v > 0 || d < width);
+    while (d > 0 && n < len) {
+        buf[n++] = digits[--d];
+    }
+    return n;
+}
+
+// Sensor log lines, like what the nodes print over UART
+static size_t make_log(uint8_t *buf, size_t len) {
+    size_t n = 0;
+    for (unsigned i = 0; n < len; i++) {
+        n = put_str(buf, n, len, "[");
+        n = put_uint(buf, n, len, 1000 * i, 8);
+        n = put_str(buf, n, len, "] node ");
+        n = put_uint(buf, n, len, i % 4, 1);
+        n = put_str(buf, n, len, ": temp=");
+        n = put_uint(buf, n, len, 20 + i % 7, 1);
+        n = put_str(buf, n, len, ".");
+        n = put_uint(buf, n, len, i % 10, 1);
+        n = put_str(buf, n, len, "C rssi=-");
+        n = put_uint(buf, n, len, 40 + i % 23, 1);
+        n = put_str(buf, n, len, " seq=");
+        n = put_uint(buf, n, len, i, 1);
+        n = put_str(buf, n, len, " ok\n");
+    }
+    return n;
+}
+
+// JSON telemetry records
+static size_t make_json(uint8_t *buf, size_t len) {
+    size_t n = 0;
+    for (unsigned i = 0; n < len; i++) {
+        n = put_str(buf, n, len, "{\"id\":");
+        n = put_uint(buf, n, len, i, 1);
+        n = put_str(buf, n, len, ",\"type\":\"telemetry\",\"batt_mv\":");
+        n = put_uint(buf, n, len, 3000 + (i * 37) % 300, 1);
+        n = put_str(buf, n, len, ",\"uptime_s\":");
+        n = put_uint(buf, n, len, i * 5, 1);
+        n = put_str(buf, n, len, ",\"links\":[");
+        n = put_uint(buf, n, len, i % 5, 1);
+        n = put_str(buf, n, len, ",");
+        n = put_uint(buf, n, len, (i + 1) % 5, 1);
+        n = put_str(buf, n, len, "]}\n");
+    }
+    return n;
+}
+
+static size_t make_random(uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = pi_random();
+    }
+    return len;
+}
+
+// One byte repeated, then a short repeating pattern (matches overlap their own output)
+static size_t make_runs(uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = i < len / 2 ? 'a' : "xyz"[i % 3];
+    }
+    return len;
+}
+
+static void setup(void) {
+    tcp_peer_init(&tx_peer, NULL, NULL, 1, 2);
+    tcp_peer_init(&rx_peer, NULL, NULL, 2, 1);
+    tcp_set_compress(&tx_peer, true);
+    tcp_set_compress(&rx_peer, true);
+}
+
+// Send <len> bytes through the compressor using writes of <wsize> and reads of <rsize>
+static void round_trip(const uint8_t *data, size_t len, size_t wsize, size_t rsize,
+                       uint8_t *out) {
+    setup();
+    size_t written = 0, read = 0;
+    while (read < len) {
+        if (written < len) {
+            written += tcp_write(&tx_peer, data + written, MIN(wsize, len - written));
+        }
+
+        // Deliver in odd-sized pieces so tokens get split across the boundary
+        deliver(&tx_peer, &rx_peer, 7);
+        while (tcp_has_data(&rx_peer)) {
+            size_t got = tcp_read(&rx_peer, out + read, MIN(rsize, len - read));
+            assert(got > 0);
+            read += got;
+        }
+    }
+    assert(read == len);
+    assert(memcmp(data, out, len) == 0);
+    assert(!tcp_has_data(&rx_peer));
+}
+
+// Test that data of every kind survives compression, however it's split up
+static void test_compress_round_trip(void) {
+    printk("--------------------------------\n");
+    printk("Testing compression round trips...\n");
+
+    static uint8_t data[SAMPLE_LEN], out[SAMPLE_LEN];
+    static const struct {
+        const char *name;
+        size_t (*make)(uint8_t *buf, size_t len);
+    } samples[] = {
+        {"log", make_log}, {"json", make_json}, {"random", make_random}, {"runs", make_runs}};
+    static const size_t sizes[][2] = {{SAMPLE_LEN, SAMPLE_LEN}, {1, 1000}, {37, 3}, {500, 129}};
+
+    for (size_t s = 0; s < sizeof(samples) / sizeof(samples[0]); s++) {
+        size_t len = samples[s].make(data, sizeof(data));
+        for (size_t z = 0; z < sizeof(sizes) / sizeof(sizes[0]); z++) {
+            round_trip(data, len, sizes[z][0], sizes[z][1], out);
+        }
+        printk("%s data matched for all write/read sizes\n", samples[s].name);
+    }
+
+    // Reserve/commit goes through the same compressor
+    setup();
+    size_t len = make_log(data, sizeof(data)), written = 0, read = 0;
+    while (read < len) {
+        uint8_t *ptr;
+        size_t room;
+        if (written < len && tcp_write_reserve(&tx_peer, 1, &ptr, &room)) {
+            room = MIN(room, len - written);
+            memcpy(ptr, data + written, room);
+            tcp_write_commit(&tx_peer, room);
+            written += room;
+        }
+        deliver(&tx_peer, &rx_peer, BS_CAPACITY);
+        read += tcp_read(&rx_peer, out + read, len - read);
+    }
+    assert(memcmp(data, out, len) == 0);
+    assert(!tcp_write_reserve(&tx_peer, LZ_CHUNK + 1, &(uint8_t *){0}, &(size_t){0}));
+    printk("Reserve/commit matched\n");
+
+    printk("Compression round trip test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Test that a full send buffer holds input back instead of splitting a token
+static void test_compress_backpressure(void) {
+    printk("--------------------------------\n");
+    printk("Testing compression backpressure...\n");
+
+    static uint8_t data[SAMPLE_LEN], out[SAMPLE_LEN];
+    make_random(data, sizeof(data));
+    setup();
+
+    // Incompressible data grows slightly, so the buffer fills before BS_CAPACITY bytes go in
+    size_t taken = 0, n;
+    while ((n = tcp_write(&tx_peer, data, sizeof(data))) == sizeof(data)) {
+        taken += n;
+    }
+    taken += n;
+    assert(taken < BS_CAPACITY && taken % LZ_CHUNK == 0);
+    assert(tcp_write(&tx_peer, data, sizeof(data)) == 0);
+    assert(bs_remaining_capacity(&tx_peer.sender.reader) < LZ_CHUNK_MAX_OUT);
+    printk("Took %u incompressible bytes into a %u-byte buffer\n", taken, BS_CAPACITY);
+
+    deliver(&tx_peer, &rx_peer, BS_CAPACITY);
+    for (size_t read = 0; read < taken; read += sizeof(out)) {
+        size_t want = MIN(sizeof(out), taken - read);
+        assert(tcp_read(&rx_peer, out, want) == want);
+        assert(memcmp(data, out, want) == 0);
+    }
+    assert(!tcp_has_data(&rx_peer));
+    assert(tx_peer.stats.lz_bytes_in == taken);
+    assert(tx_peer.stats.lz_bytes_out == taken + taken / LZ_CHUNK);
+
+    printk("Compression backpressure test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Measure compression ratio and speed on each kind of data
+static void test_compress_ratio(void) {
+    printk("--------------------------------\n");
+    printk("Compression ratio and speed (%u-byte samples)...\n", SAMPLE_LEN);
+
+    static uint8_t data[SAMPLE_LEN], out[SAMPLE_LEN];
+    static uint8_t packed[SAMPLE_LEN + SAMPLE_LEN / LZ_CHUNK];
+    static const struct {
+        const char *name;
+        size_t (*make)(uint8_t *buf, size_t len);
+    } samples[] = {{"log", make_log}, {"json", make_json}, {"random", make_random}};
+
+    cycle_cnt_init();
+    for (size_t s = 0; s < sizeof(samples) / sizeof(samples[0]); s++) {
+        size_t len = samples[s].make(data, sizeof(data));
+        static lz_encoder_t enc;
+        static lz_decoder_t dec;
+        lz_encoder_init(&enc);
+        lz_decoder_init(&dec);
+
+        // Compress straight into a flat buffer so only the compressor is timed
+        unsigned start = cycle_cnt_read();
+        size_t n = 0;
+        for (size_t i = 0; i < len; i += LZ_CHUNK) {
+            n += lz_compress_chunk(&enc, data + i, MIN((size_t)LZ_CHUNK, len - i), packed + n);
+        }
+        unsigned enc_cycles = cycle_cnt_read() - start;
+
+        // Decompress through a bytestream, the way tcp_read does
+        static bytestream_t bs;
+        bs = bs_init();
+        size_t fed = 0, read = 0;
+        unsigned dec_cycles = 0;
+        while (read < len) {
+            fed += bs_write(&bs, packed + fed, n - fed);
+            start = cycle_cnt_read();
+            read += lz_read(&dec, &bs, out + read, len - read);
+            dec_cycles += cycle_cnt_read() - start;
+        }
+        assert(memcmp(data, out, len) == 0);
+
+        printk("  %s: %u -> %u bytes (%u%%), compress %u cycles/byte, expand %u cycles/byte\n",
+               samples[s].name, len, n, n * 100 / len, enc_cycles / len, dec_cycles / len);
+    }
+
+    printk("Compression benchmark done!\n");
+    printk("--------------------------------\n");
+}
+
+void notmain(void) {
+    printk("Starting compression tests...\n\n");
+
+    test_compress_round_trip();
+    test_compress_backpressure();
+    test_compress_ratio();
+
+    printk("\nCompression tests passed!\n");
+}
@@ -0,0 +1,301 @@
+#include <string.h>
+
+#include "rcp-compact.h"
+#include "receiver.h"
+#include "sender.h"
+
+#include "pi-random.h"
+
+/*
+ * The sender and receiver are wired back to back through two packet queues that stand
+ * in for the radio link. Segments and ACKs can be dropped on the way, either by a fixed
+ * rule or at random.
+ */
+
+#define LINK_QUEUE_LEN 1024
+#define XFER_LEN 8192
+
+static sender_t sender;
+static receiver_t receiver;
+
+static struct {
+    sender_segment_t data[LINK_QUEUE_LEN]; /* Sender to receiver */
+    receiver_segment_t acks[LINK_QUEUE_LEN]; /* Receiver to sender */
+    size_t data_head, data_tail, ack_head, ack_tail;
+
+    unsigned loss_pct;        /* Random loss in both directions */
+    bool (*drop_fn)(const sender_segment_t *seg); /* Rule for dropping data segments */
+    uint32_t n_sent;          /* Packets put on the link, in both directions */
+} link;
+
+static void link_transmit_data(tcp_peer_t *peer, sender_segment_t *segment) {
+    link.n_sent++;
+    if (link.drop_fn ? link.drop_fn(segment) : pi_random() % 100 < link.loss_pct) {
+        return;
+    }
+    assert(link.data_tail - link.data_head < LINK_QUEUE_LEN);
+    link.data[link.data_tail++ % LINK_QUEUE_LEN] = *segment;
+}
+
+static void link_transmit_ack(tcp_peer_t *peer, receiver_segment_t *segment) {
+    link.n_sent++;
+    if (!link.drop_fn && pi_random() % 100 < link.loss_pct) {
+        return;
+    }
+    assert(link.ack_tail - link.ack_head < LINK_QUEUE_LEN);
+    link.acks[link.ack_tail++ % LINK_QUEUE_LEN] = *segment;
+}
+
+// Deliver everything queued on the link
+static void link_deliver(void) {
+    while (link.data_head != link.data_tail) {
+        recv_process_segment(&receiver, &link.data[link.data_head++ % LINK_QUEUE_LEN]);
+    }
+    while (link.ack_head != link.ack_tail) {
+        sender_process_reply(&sender, &link.acks[link.ack_head++ % LINK_QUEUE_LEN]);
+    }
+}
+
+static void setup(uint8_t k, bool adaptive, unsigned loss_pct,
+                  bool (*drop_fn)(const sender_segment_t *seg)) {
+    memset(&link, 0, sizeof(link));
+    link.loss_pct = loss_pct;
+    link.drop_fn = drop_fn;
+
+    sender = sender_init(NULL, link_transmit_data, NULL);
+    receiver = receiver_init(NULL, link_transmit_ack, NULL);
+    sender.initial_RTO_us = 5000;
+    sender_set_fec(&sender, k, adaptive);
+}
+
+// Move <len> bytes from the sender to the receiver
+static void transfer(const uint8_t *data, size_t len, uint8_t *out) {
+    size_t written = 0, read = 0;
+    uint32_t start_us = timer_get_usec();
+    while (!bs_writer_finished(&receiver.writer) || bs_bytes_available(&receiver.writer)) {
+        if (written < len) {
+            written += bs_write(&sender.reader, data + written, len - written);
+            if (written == len) {
+                bs_end_input(&sender.reader);
+            }
+        }
+
+        // One new segment per tick, like a link with a fixed packet rate
+        sender_push(&sender);
+        link_deliver();
+        sender_check_retransmits(&sender);
+        read += bs_read(&receiver.writer, out + read, len - read);
+        assert(timer_get_usec() - start_us < S_TO_US(60));
+    }
+    assert(read == len);
+    assert(memcmp(data, out, len) == 0);
+}
+
+static void fill_random(uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        data[i] = pi_random();
+    }
+}
+
+// Test that parity segments survive the compact encoding
+static void test_fec_format(void) {
+    printk("--------------------------------\n");
+    printk("Testing FEC parity format...\n");
+
+    uint8_t parity[FEC_WIDTH];
+    fill_random(parity, sizeof(parity));
+
+    rcp_datagram_t dgram = rcp_datagram_init();
+    dgram.header.dst = 2;
+    dgram.header.seqno = 0xBEEF;
+    dgram.header.ackno = 200;
+    rcp_set_flag(&dgram.header, RCP_FLAG_FEC);
+    rcp_set_flag(&dgram.header, RCP_FLAG_FIN);
+    rcp_datagram_borrow_payload(&dgram, parity, FEC_WIDTH);
+
+    uint8_t pkt[RCP_TOTAL_SIZE];
+    assert(rcp_compact_encode(&dgram, pkt, sizeof(pkt)) == RCP_TOTAL_SIZE);
+
+    rcp_datagram_t parsed = rcp_datagram_init();
+    assert(rcp_compact_decode(&parsed, pkt, sizeof(pkt), 1));
+    assert(rcp_has_flag(&parsed.header, RCP_FLAG_FEC));
+    assert(rcp_has_flag(&parsed.header, RCP_FLAG_FIN));
+    assert(!rcp_has_flag(&parsed.header, RCP_FLAG_ACK));
+    assert(parsed.header.seqno == 0xBEEF && parsed.header.ackno == 200);
+    assert(parsed.header.payload_len == FEC_WIDTH);
+    assert(memcmp(rcp_datagram_payload(&parsed), parity, FEC_WIDTH) == 0);
+    printk("Parity round trip verified (%u parity bytes)\n", FEC_WIDTH);
+
+    printk("FEC parity format test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Drop the second data segment of every group of four, the first time it's sent
+static bool dropped[XFER_LEN / FEC_WIDTH + 2];
+static bool drop_one_per_group(const sender_segment_t *seg) {
+    if (seg->is_syn || seg->is_parity || seg->len == 0) {
+        return false;
+    }
+    size_t idx = (uint16_t)(seg->seqno - sender.isn - 1) / FEC_WIDTH;
+    if (idx % 4 == 1 && !dropped[idx]) {
+        dropped[idx] = true;
+        return true;
+    }
+    return false;
+}
+
+// Drop the second and third data segments of every group of four, the first time
+static bool drop_two_per_group(const sender_segment_t *seg) {
+    if (seg->is_syn || seg->is_parity || seg->len == 0) {
+        return false;
+    }
+    size_t idx = (uint16_t)(seg->seqno - sender.isn - 1) / FEC_WIDTH;
+    if ((idx % 4 == 1 || idx % 4 == 2) && !dropped[idx]) {
+        dropped[idx] = true;
+        return true;
+    }
+    return false;
+}
+
+// Drop the FIN segment the first time it's sent
+static bool drop_fin(const sender_segment_t *seg) {
+    if (seg->is_fin && !seg->is_parity && !dropped[0]) {
+        dropped[0] = true;
+        return true;
+    }
+    return false;
+}
+
+// Test that one lost segment per group is rebuilt without a retransmission
+static void test_fec_recovery(void) {
+    printk("--------------------------------\n");
+    printk("Testing FEC recovery...\n");
+
+    static uint8_t data[XFER_LEN], out[XFER_LEN];
+    static tcp_stats_t stats;
+    fill_random(data, sizeof(data));
+
+    // One loss per group: every one is repaired from parity
+    memset(dropped, 0, sizeof(dropped));
+    stats = tcp_stats_init();
+    setup(4, false, 0, drop_one_per_group);
+    sender.stats = &stats;
+    receiver.stats = &stats;
+    transfer(data, sizeof(data), out);
+    printk("One loss per group: %u repairs, %u retransmits\n", stats.fec_repairs,
+           stats.retrans_rto + stats.retrans_fast);
+    assert(stats.fec_repairs > 0);
+    assert(stats.retrans_rto + stats.retrans_fast == 0);
+    assert(stats.fec_parity_sent == (XFER_LEN / FEC_WIDTH + 3) / 4);
+
+    // Two losses per group: parity can't help, so retransmissions fill the gaps
+    memset(dropped, 0, sizeof(dropped));
+    stats = tcp_stats_init();
+    setup(4, false, 0, drop_two_per_group);
+    sender.stats = &stats;
+    receiver.stats = &stats;
+    transfer(data, sizeof(data), out);
+    printk("Two losses per group: %u repairs, %u retransmits\n", stats.fec_repairs,
+           stats.retrans_rto + stats.retrans_fast);
+    assert(stats.retrans_rto + stats.retrans_fast > 0);
+
+    // A lost FIN (and its data) is recovered from the last group's parity
+    memset(dropped, 0, sizeof(dropped));
+    stats = tcp_stats_init();
+    setup(4, false, 0, drop_fin);
+    sender.stats = &stats;
+    receiver.stats = &stats;
+    transfer(data, sizeof(data) - 5, out);
+    printk("Lost FIN: %u repairs, %u retransmits\n", stats.fec_repairs,
+           stats.retrans_rto + stats.retrans_fast);
+    assert(dropped[0] && stats.fec_repairs == 1);
+    assert(stats.retrans_rto + stats.retrans_fast == 0);
+
+    printk("FEC recovery test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Test the mapping from loss rate to group size and the adaptive mode
+static void test_fec_adaptive(void) {
+    printk("--------------------------------\n");
+    printk("Testing adaptive FEC...\n");
+
+    assert(fec_group_for_loss(0) == 0);
+    assert(fec_group_for_loss(1) == FEC_MAX_GROUP);
+    assert(fec_group_for_loss(10) == 5);
+    assert(fec_group_for_loss(20) == 2);
+    assert(fec_group_for_loss(100) == 2);
+
+    // No loss: adaptive mode turns itself off after one measurement
+    fec_encoder_t fec = fec_encoder_init();
+    fec_set_group(&fec, 4, true);
+    for (int i = 0; i < FEC_ADAPT_SEGS; i++) {
+        fec_note_segment(&fec);
+    }
+    assert(fec.k == 0);
+
+    // 10% retransmissions turn it back on, and the estimate decays slowly afterwards
+    for (int i = 0; i < FEC_ADAPT_SEGS; i++) {
+        fec_note_segment(&fec);
+        if (i % 10 == 0) {
+            fec_note_loss(&fec);
+        }
+    }
+    assert(fec.k > 0 && fec.k < FEC_MAX_GROUP);
+    uint8_t k = fec.k;
+    for (int i = 0; i < FEC_ADAPT_SEGS; i++) {
+        fec_note_segment(&fec);
+    }
+    assert(fec.k >= k && fec.k > 0);
+    printk("Group size followed the loss rate (%u after loss, %u after a clean window)\n", k,
+           fec.k);
+
+    printk("Adaptive FEC test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Measure goodput with and without FEC at several loss rates
+static void test_fec_goodput(void) {
+    printk("--------------------------------\n");
+    printk("FEC goodput under random loss (%u-byte transfers)...\n", XFER_LEN);
+
+    static uint8_t data[XFER_LEN], out[XFER_LEN];
+    fill_random(data, sizeof(data));
+
+    static const unsigned losses[] = {1, 2, 5, 10, 15, 20};
+    static const struct {
+        const char *name;
+        uint8_t k;
+        bool adaptive;
+    } modes[] = {{"off", 0, false}, {"k=8", 8, false}, {"k=4", 4, false},
+                 {"k=2", 2, false}, {"adaptive", 4, true}};
+
+    for (size_t l = 0; l < sizeof(losses) / sizeof(losses[0]); l++) {
+        printk("  loss=%u%%:", losses[l]);
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+            setup(modes[m].k, modes[m].adaptive, losses[l], NULL);
+            uint32_t start_us = timer_get_usec();
+            transfer(data, sizeof(data), out);
+            uint32_t elapsed_us = timer_get_usec() - start_us;
+
+            // Goodput in bytes/sec, and payload bytes delivered per packet on the link
+            uint32_t goodput = (uint64_t)XFER_LEN * 1000000 / (elapsed_us ? elapsed_us : 1);
+            printk(" %s=%uB/s,%uB/pkt", modes[m].name, goodput, XFER_LEN / link.n_sent);
+        }
+        printk("\n");
+    }
+
+    printk("FEC goodput benchmark done!\n");
+    printk("--------------------------------\n");
+}
+
+void notmain(void) {
+    printk("Starting FEC tests...\n\n");
+
+    test_fec_format();
+    test_fec_recovery();
+    test_fec_adaptive();
+    test_fec_goodput();
+
+    printk("\nFEC tests passed!\n");
+}
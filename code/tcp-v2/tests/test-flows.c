@@ -0,0 +1,251 @@
+#include <string.h>
+
+#include "forward.h"
+
+// Test that packets, bytes and drops add up per flow
+static void test_flows_count(void) {
+    printk("--------------------------------\n");
+    printk("Testing flow counting...\n");
+
+    static flows_t ft;
+    flows_init(&ft);
+
+    for (int i = 0; i < 10; i++) {
+        flows_count(&ft, 1, 2, 20);
+        flows_count(&ft, 2, 1, 0);
+    }
+    flow_t *flow = flows_count(&ft, 1, 3, 5);
+    flow_drop(flow);
+    assert(ft.n_flows == 3 && ft.n_evicted == 0);
+
+    flow = flows_find(&ft, 1, 2);
+    assert(flow && flow->packets == 10 && flow->bytes == 200 && flow->drops == 0);
+    flow = flows_find(&ft, 2, 1);
+    assert(flow && flow->packets == 10 && flow->bytes == 0);
+    flow = flows_find(&ft, 1, 3);
+    assert(flow && flow->packets == 1 && flow->drops == 1);
+    assert(!flows_find(&ft, 3, 1));
+
+    // Drop counts stop rather than wrap
+    flow->drops = FLOW_MAX_DROPS;
+    flow_drop(flow);
+    assert(flow->drops == FLOW_MAX_DROPS);
+
+    printk("Flow counting test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Test that a full table makes room by reusing stale flows, and keeps busy ones
+static void test_flows_full(void) {
+    printk("--------------------------------\n");
+    printk("Testing a full table...\n");
+
+    static flows_t ft;
+    flows_init(&ft);
+
+    // One busy flow, among many more flows than there are slots
+    unsigned n_new = 0;
+    for (unsigned src = 0; src < 64; src++) {
+        for (unsigned dst = 0; dst < 8; dst++) {
+            flows_count(&ft, 200, 201, 1);
+            delay_us(1);
+            flow_t *flow = flows_count(&ft, src, dst, 1);
+            assert(flow->src == src && flow->dst == dst);
+            assert(flows_find(&ft, src, dst) == flow);
+            n_new++;
+        }
+    }
+    assert(ft.n_flows <= FLOW_SLOTS && ft.n_evicted > 0);
+    assert(ft.n_flows + ft.n_evicted == n_new + 1);
+
+    flow_t *busy = flows_find(&ft, 200, 201);
+    assert(busy && busy->packets == n_new);
+    printk("%u flows in %u slots: %u evicted, busy flow kept\n", n_new + 1, ft.n_flows,
+           ft.n_evicted);
+
+    printk("Full table test passed!\n");
+    printk("--------------------------------\n");
+}
+
+static unsigned n_transmitted;
+
+static void count_transmit(fwd_t *fwd, uint32_t nrf_addr, const uint8_t *frame) {
+    n_transmitted++;
+}
+
+static bool never_acked(fwd_t *fwd, uint32_t nrf_addr, const uint8_t *frame) { return false; }
+
+static void make_full(uint8_t src, uint8_t dst, size_t len, uint8_t *frame) {
+    uint8_t payload[RCP_MAX_PAYLOAD] = {0};
+    rcp_datagram_t dgram = rcp_datagram_init();
+    dgram.header.src = src;
+    dgram.header.dst = dst;
+    rcp_datagram_set_payload(&dgram, payload, len);
+    memset(frame, 0, RCP_TOTAL_SIZE);
+    assert(rcp_datagram_encode(&dgram, frame, RCP_TOTAL_SIZE) > 0);
+}
+
+// Test that the router counts what it forwards and drops, in every wire form
+static void test_flows_router(void) {
+    printk("--------------------------------\n");
+    printk("Testing flows through the router...\n");
+
+    static fwd_t fwd;
+    static flows_t ft;
+    fwd_init(&fwd, NULL, NULL, 0);
+    fwd.transmit = count_transmit;
+    flows_init(&ft);
+    fwd_use_flows(&fwd, &ft);
+
+    uint8_t frame[RCP_TOTAL_SIZE];
+    for (int i = 0; i < 5; i++) {
+        make_full(2, 1, 10, frame);
+        fwd_frame(&fwd, frame);
+    }
+    make_full(2, 9, 4, frame);  // No route
+    fwd_frame(&fwd, frame);
+    make_full(1, 0, 3, frame);  // For the router
+    fwd_frame(&fwd, frame);
+
+    rcp_datagram_t dgram = rcp_datagram_init();
+    dgram.header.dst = 2;
+    rcp_set_flag(&dgram.header, RCP_FLAG_ACK);
+    assert(rcp_compact_encode(&dgram, frame, RCP_TOTAL_SIZE) > 0);
+    fwd_frame(&fwd, frame);
+    uint8_t compact[RCP_TOTAL_SIZE];
+    memcpy(compact, frame, RCP_TOTAL_SIZE);
+    fwd_frame_from(&fwd, frame, 1);  // From the first user, who sent it
+
+    uint8_t payload[7] = {0};
+    frag_header_t hdr = {.payload_len = 7, .dst = 1, .hops = 1, .src = 5, .count = 1};
+    assert(frag_encode(&hdr, payload, frame, RCP_TOTAL_SIZE) > 0);
+    fwd_frame(&fwd, frame);
+    hdr.hops = 0;  // Out of hops
+    assert(frag_encode(&hdr, payload, frame, RCP_TOTAL_SIZE) > 0);
+    fwd_frame(&fwd, frame);
+
+    assert(n_transmitted == 8);
+    flow_t *flow = flows_find(&ft, 2, 1);
+    assert(flow && flow->packets == 5 && flow->bytes == 50 && flow->drops == 0);
+    flow = flows_find(&ft, 2, 9);
+    assert(flow && flow->packets == 1 && flow->drops == 1);
+    flow = flows_find(&ft, 1, 0);
+    assert(flow && flow->packets == 1 && flow->bytes == 3 && flow->drops == 0);
+    flow = flows_find(&ft, RCP_BROADCAST, 2);
+    assert(flow && flow->packets == 1 && flow->bytes == 0);
+    flow = flows_find(&ft, 1, 2);
+    assert(flow && flow->packets == 1 && flow->bytes == 0);
+    flow = flows_find(&ft, 5, 1);
+    assert(flow && flow->packets == 2 && flow->bytes == 14 && flow->drops == 1);
+
+    // Frames the next hop never acknowledges are drops too
+    fwd_use_arq(&fwd, 0);
+    fwd.link_send = never_acked;
+    make_full(2, 1, 10, frame);
+    fwd_frame(&fwd, frame);
+    assert(flows_find(&ft, 2, 1)->drops == 1 && fwd.n_link_lost == 1);
+    memcpy(frame, compact, RCP_TOTAL_SIZE);
+    fwd_frame_from(&fwd, frame, 1);
+    assert(flows_find(&ft, 1, 2)->drops == 1 && fwd.n_link_lost == 2);
+
+    flows_dump(&ft);
+
+    // With learned routes, the pipe's neighbor is looked up among the ones heard from
+    static dv_t dv;
+    dv_init(&dv, NULL, 0, router_server_addr);
+    dv.neighbors[7].in_use = true;
+    dv.neighbors[7].nrf_addr = router_pipe_nbr[1];
+    route_use_dv(&dv);
+    fwd_use_flows(&fwd, &ft);
+    assert(fwd_frame_src(&fwd, compact, 1) == 7);
+    assert(fwd_frame_src(&fwd, compact, 3) == RCP_BROADCAST);
+    route_use_dv(NULL);
+
+    printk("Router flow test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Test that dumps come out on schedule, and only then
+static void test_flows_tick(void) {
+    printk("--------------------------------\n");
+    printk("Testing periodic dumps...\n");
+
+    static flows_t ft;
+    flows_init(&ft);
+    ft.dump_us = 0;
+    flows_count(&ft, 1, 2, 3);
+    assert(!flows_tick(&ft));
+
+    ft.dump_us = 2000;
+    ft.next_dump_us = timer_get_usec() + ft.dump_us;
+    assert(!flows_tick(&ft));
+    delay_us(2500);
+
+    // A summary, a header and a row per flow, a few bytes at a time: no call waits for the
+    // UART the way a printk of a whole line would
+    flows_count(&ft, 3, 4, 5);
+    unsigned n_ticks = 0;
+    uint32_t slowest_us = 0;
+    while (1) {
+        uint32_t start_us = timer_get_usec();
+        bool dumping = flows_tick(&ft);
+        uint32_t tick_us = timer_get_usec() - start_us;
+        slowest_us = tick_us > slowest_us ? tick_us : slowest_us;
+        if (!dumping) {
+            break;
+        }
+        n_ticks++;
+    }
+    assert(n_ticks > 0 && slowest_us < 1000);
+    assert(!flows_tick(&ft));
+    printk("Dump sent over %u calls, the slowest taking %u us\n", n_ticks, slowest_us);
+
+    printk("Periodic dump test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Measure what counting flows adds to forwarding a frame
+static void test_flows_overhead(void) {
+    printk("--------------------------------\n");
+    printk("Measuring flow counting overhead...\n");
+
+    enum { N_FRAMES = 20000 };
+    static fwd_t fwd;
+    static flows_t ft;
+    fwd_init(&fwd, NULL, NULL, 0);
+    fwd.transmit = count_transmit;
+    flows_init(&ft);
+
+    uint8_t frames[4][RCP_TOTAL_SIZE];
+    for (int i = 0; i < 4; i++) {
+        make_full(1 + i % 2, 2 - i % 2, 10, frames[i]);
+    }
+
+    uint32_t us[2];
+    for (int with = 0; with < 2; with++) {
+        fwd_use_flows(&fwd, with ? &ft : NULL);
+        uint32_t start = timer_get_usec();
+        for (int i = 0; i < N_FRAMES; i++) {
+            frames[i % 4][RCP_HOPS_OFFSET] = RCP_DEFAULT_HOPS;
+            fwd_frame(&fwd, frames[i % 4]);
+        }
+        us[with] = timer_get_usec() - start;
+    }
+    assert(flows_find(&ft, 1, 2)->packets == N_FRAMES / 2);
+    printk("%u frames: %u us without flows, %u us with\n", N_FRAMES, us[0], us[1]);
+
+    printk("Overhead measurement done!\n");
+    printk("--------------------------------\n");
+}
+
+void notmain(void) {
+    printk("Starting flow table tests...\n\n");
+
+    test_flows_count();
+    test_flows_full();
+    test_flows_router();
+    test_flows_tick();
+    test_flows_overhead();
+
+    printk("\nFlow table tests passed!\n");
+}
@@ -0,0 +1,603 @@
+#include <string.h>
+
+#include "cycle-count.h"
+#include "forward.h"
+#include "fragment.h"
+
+#define ROUTER_ADDR 0
+#define N_KINDS 5 /* Destinations cycled through (see test_forward_frames) */
+#define N_PKTS 20
+
+// Stands in for the router's receive queue (the driver pushes packets a byte at a time)
+static cq_t q;
+
+// Frames the router sent, in order
+static uint8_t sent[N_PKTS][RCP_TOTAL_SIZE];
+static uint32_t sent_to[N_PKTS];
+static size_t n_sent;
+
+static void record_transmit(fwd_t *fwd, uint32_t nrf_addr, const uint8_t *frame) {
+    assert(n_sent < N_PKTS);
+    memcpy(sent[n_sent], frame, RCP_TOTAL_SIZE);
+    sent_to[n_sent++] = nrf_addr;
+}
+
+static size_t n_delivered;
+
+static void record_deliver(fwd_t *fwd, const uint8_t *frame) {
+    assert(rcp_frame_dst(frame) == ROUTER_ADDR);
+    n_delivered++;
+}
+
+static void push_packet(const uint8_t *pkt) {
+    for (size_t i = 0; i < RCP_TOTAL_SIZE; i++) {
+        assert(cq_push(&q, pkt[i]));
+    }
+}
+
+// Build packet <i> in one of the wire forms, addressed to <dst>
+static void make_packet(size_t i, uint8_t dst, uint8_t *pkt) {
+    uint8_t payload[RCP_TOTAL_SIZE];
+    for (size_t j = 0; j < sizeof(payload); j++) {
+        payload[j] = i * 16 + j;
+    }
+
+    memset(pkt, 0, RCP_TOTAL_SIZE);
+    rcp_datagram_t dgram = rcp_datagram_init();
+    dgram.header.src = 3;
+    dgram.header.dst = dst;
+    dgram.header.seqno = 100 + i;
+
+    switch (i % 4) {
+    case 0:
+        rcp_datagram_set_payload(&dgram, payload, 1 + i % RCP_MAX_PAYLOAD);
+        assert(rcp_datagram_encode(&dgram, pkt, RCP_TOTAL_SIZE) > 0);
+        break;
+    case 1:
+        rcp_set_flag(&dgram.header, RCP_FLAG_ACK);
+        dgram.header.ackno = 200 + i;
+        assert(rcp_compact_encode(&dgram, pkt, RCP_TOTAL_SIZE) > 0);
+        break;
+    case 2:
+        rcp_datagram_set_payload(&dgram, payload, 1 + i % RCP_COMPACT_MAX_PAYLOAD);
+        assert(rcp_compact_encode(&dgram, pkt, RCP_TOTAL_SIZE) > 0);
+        break;
+    default: {
+        frag_header_t hdr = {.payload_len = FRAG_MAX_PAYLOAD, .dst = dst,
+                             .hops = RCP_DEFAULT_HOPS, .src = 3,
+                             .id = i, .index = 0, .count = 2};
+        assert(frag_encode(&hdr, payload, pkt, RCP_TOTAL_SIZE) > 0);
+        break;
+    }
+    }
+}
+
+// Test that every wire form goes to the right next hop with only its hop limit changed,
+// across the wraparound
+static void test_forward_frames(void) {
+    printk("--------------------------------\n");
+    printk("Testing router forwarding...\n");
+
+    static fwd_t fwd;
+    fwd_init(&fwd, NULL, NULL, ROUTER_ADDR);
+    fwd.transmit = record_transmit;
+    fwd.deliver = record_deliver;
+
+    // Destinations: the two servers, the router itself, nowhere, and route updates
+    static const uint8_t dsts[N_KINDS] = {1, 2, ROUTER_ADDR, 9, RCP_BROADCAST};
+    static uint8_t pkts[N_PKTS][RCP_TOTAL_SIZE];
+
+    memset(&q, 0, sizeof(q));
+    q.head = q.tail = CQ_N - 5 * RCP_TOTAL_SIZE - 7;
+    for (size_t i = 0; i < N_PKTS; i++) {
+        make_packet(i, dsts[i % N_KINDS], pkts[i]);
+        assert(rcp_frame_dst(pkts[i]) == dsts[i % N_KINDS]);
+        push_packet(pkts[i]);
+    }
+
+    // Half a packet stays queued until the rest arrives
+    cq_push(&q, pkts[0][0]);
+
+    assert(fwd_drain_cq(&fwd, &q) == N_PKTS);
+    assert(cq_nelem(&q) == 1);
+    assert(fwd.n_batches == (N_PKTS + FWD_BATCH_MAX - 1) / FWD_BATCH_MAX);
+
+    size_t k = 0;
+    for (size_t i = 0; i < N_PKTS; i++) {
+        uint8_t dst = dsts[i % N_KINDS];
+        if (dst != 1 && dst != 2) {
+            continue;
+        }
+        assert(sent_to[k] == (dst == 1 ? server_addr : server_addr_2));
+        uint8_t expect[RCP_TOTAL_SIZE];
+        memcpy(expect, pkts[i], RCP_TOTAL_SIZE);
+        expect[RCP_HOPS_OFFSET]--;
+        assert(memcmp(sent[k], expect, RCP_TOTAL_SIZE) == 0);
+        k++;
+    }
+    assert(n_sent == k && fwd.n_forwarded == k);
+    assert(fwd.n_local == N_PKTS / N_KINDS && n_delivered == fwd.n_local);
+    assert(fwd.n_no_route == N_PKTS / N_KINDS);
+    assert(fwd.n_updates == N_PKTS / N_KINDS);
+    printk("%u frames forwarded untouched but for the hop limit, %u delivered, %u without a "
+           "route\n", fwd.n_forwarded, fwd.n_local, fwd.n_no_route);
+
+    // An empty queue is a no-op
+    cq_pop(&q);
+    assert(fwd_drain_cq(&fwd, &q) == 0);
+
+    printk("Router forwarding test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Test that the receive pipe names the previous hop, and frames don't go back to it
+static void test_forward_pipes(void) {
+    printk("--------------------------------\n");
+    printk("Testing neighbors by receive pipe...\n");
+
+    // Each user reaches the router on its own pipe
+    assert(ROUTER_USER1_ADDR == router_server_addr);
+    assert(route_next_hop(1, 2) == ROUTER_USER1_ADDR && route_next_hop(1, 0) == ROUTER_USER1_ADDR);
+    assert(route_next_hop(2, 1) == ROUTER_USER2_ADDR && route_next_hop(2, 0) == ROUTER_USER2_ADDR);
+    assert(ROUTER_USER2_ADDR != ROUTER_USER1_ADDR);
+    assert(route_next_hop(ROUTER_ADDR, 2) == server_addr_2);
+
+    // A receive radio whose driver tagged each packet with its pipe
+    static nrf_t radio;
+    static uint8_t tags[CQ_N / RCP_TOTAL_SIZE];
+    memset(&radio, 0, sizeof(radio));
+    radio.config.nbytes = RCP_TOTAL_SIZE;
+    radio.rx_pipes = tags;
+    radio.recvq.head = radio.recvq.tail = CQ_N - 3 * RCP_TOTAL_SIZE;
+
+    static fwd_t fwd;
+    fwd_init(&fwd, &radio, NULL, ROUTER_ADDR);
+    fwd.transmit = record_transmit;
+    n_sent = 0;
+
+    // From user 1 to user 2, from user 2 to user 1, and from user 1 back to itself
+    static const uint8_t pipes[] = {1, 2, 1, 1, 2, 1, 2, 1, 1, 2};
+    static const uint8_t dsts[] = {2, 1, 1, 2, 1, 2, 1, 1, 2, 1};
+    size_t n_bounced = 0;
+    uint8_t pkt[RCP_TOTAL_SIZE];
+    for (size_t i = 0; i < sizeof(pipes); i++) {
+        make_packet(i, dsts[i], pkt);
+        tags[radio.recvq.head / RCP_TOTAL_SIZE] = pipes[i];
+        for (size_t j = 0; j < RCP_TOTAL_SIZE; j++) {
+            assert(cq_push(&radio.recvq, pkt[j]));
+        }
+        n_bounced += pipes[i] == dsts[i];
+    }
+
+    assert(fwd_drain_cq(&fwd, &radio.recvq) == sizeof(pipes));
+    assert(fwd.n_from_pipe[1] == 6 && fwd.n_from_pipe[2] == 4);
+    assert(fwd.n_bounced == n_bounced);
+    assert(n_sent == sizeof(pipes) - n_bounced && fwd.n_forwarded == n_sent);
+    for (size_t i = 0; i < n_sent; i++) {
+        assert(sent_to[i] == router_rtable[rcp_frame_dst(sent[i])]);
+    }
+    printk("%u frames from pipe 1, %u from pipe 2, %u sent back dropped\n", fwd.n_from_pipe[1],
+           fwd.n_from_pipe[2], fwd.n_bounced);
+
+    // Frames from some other queue have no pipe
+    memset(&q, 0, sizeof(q));
+    make_packet(0, 1, pkt);
+    push_packet(pkt);
+    assert(fwd_drain_cq(&fwd, &q) == 1);
+    assert(fwd.n_from_pipe[1] == 6 && fwd.n_bounced == n_bounced);
+
+    printk("Receive pipe test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// The air between routers: the last frame sent, and who it was sent to
+static uint8_t air[RCP_TOTAL_SIZE];
+static uint32_t air_to;
+static unsigned n_on_air;
+
+static void air_transmit(fwd_t *fwd, uint32_t nrf_addr, const uint8_t *frame) {
+    memcpy(air, frame, RCP_TOTAL_SIZE);
+    air_to = nrf_addr;
+    n_on_air++;
+}
+
+// Three routers that each think the next one is the way to LOOP_DST. Each hears the one
+// before it on pipe 1, and A also hears a source on pipe 2.
+enum { A_ADDR = 0xa0a0a0, B_ADDR = 0xb0b0b0, C_ADDR = 0xc0c0c0, S_ADDR = 0xd0d0d0 };
+enum { LOOP_DST = 5 };
+static fwd_t loop_a, loop_b, loop_c;
+
+static void loop_init(void) {
+    static uint32_t a_rtable[256] = {[LOOP_DST] = B_ADDR};
+    static uint32_t b_rtable[256] = {[LOOP_DST] = C_ADDR};
+    static uint32_t c_rtable[256] = {[LOOP_DST] = A_ADDR};
+    static const uint32_t a_nbr[NRF_NPIPES] = {[1] = C_ADDR, [2] = S_ADDR};
+    static const uint32_t b_nbr[NRF_NPIPES] = {[1] = A_ADDR};
+    static const uint32_t c_nbr[NRF_NPIPES] = {[1] = B_ADDR};
+    fwd_init(&loop_a, NULL, NULL, 10);
+    fwd_init(&loop_b, NULL, NULL, 11);
+    fwd_init(&loop_c, NULL, NULL, 12);
+    loop_a.rtable = a_rtable;
+    loop_b.rtable = b_rtable;
+    loop_c.rtable = c_rtable;
+    loop_a.pipe_nbr = a_nbr;
+    loop_b.pipe_nbr = b_nbr;
+    loop_c.pipe_nbr = c_nbr;
+    loop_a.transmit = loop_b.transmit = loop_c.transmit = air_transmit;
+}
+
+// Send <frame> from the source to A and pass it around until a router drops it
+static unsigned run_loop(const uint8_t *frame) {
+    n_on_air = 0;
+    memcpy(air, frame, RCP_TOTAL_SIZE);
+    fwd_frame_from(&loop_a, air, 2);
+    for (unsigned sent = 0; n_on_air != sent;) {
+        sent = n_on_air;
+        fwd_t *at = air_to == A_ADDR ? &loop_a : air_to == B_ADDR ? &loop_b : &loop_c;
+        fwd_frame_from(at, air, 1);
+    }
+    return n_on_air;
+}
+
+// Test that a routing loop can't keep a packet on the air
+static void test_forward_loop(void) {
+    printk("--------------------------------\n");
+    printk("Testing hop limit and duplicate suppression...\n");
+
+    loop_init();
+
+    // The hop limit ends it: every form loses one hop per router
+    uint8_t frame[RCP_TOTAL_SIZE];
+    for (size_t i = 0; i < 4; i++) {
+        make_packet(i, LOOP_DST, frame);
+        assert(frame[RCP_HOPS_OFFSET] == RCP_DEFAULT_HOPS);
+        assert(run_loop(frame) == RCP_DEFAULT_HOPS);
+        assert(air[RCP_HOPS_OFFSET] == 0);
+    }
+    assert(loop_a.n_expired + loop_b.n_expired + loop_c.n_expired == 4);
+    printk("Looping frames sent %u times before running out of hops\n", RCP_DEFAULT_HOPS);
+
+    // With duplicate suppression, a data frame makes one lap in any form: it comes back to
+    // A from C
+    fwd_use_dedup(&loop_a, FWD_DUP_US);
+    fwd_use_dedup(&loop_b, FWD_DUP_US);
+    fwd_use_dedup(&loop_c, FWD_DUP_US);
+    make_packet(0, LOOP_DST, frame);
+    assert(run_loop(frame) == 3);
+    make_packet(3, LOOP_DST, frame);
+    assert(run_loop(frame) == 3);
+    assert(loop_a.n_duplicates == 2);
+
+    // So does a stream of compact data segments, each with the next sequence number
+    for (size_t i = 2; i < 2 + 4 * 8; i += 4) {
+        make_packet(i, LOOP_DST, frame);
+        assert(run_loop(frame) == 3);
+    }
+    assert(loop_a.n_duplicates == 2 + 8);
+    assert(loop_b.n_duplicates == 0 && loop_c.n_duplicates == 0);
+
+    // ... but repeated ACKs aren't duplicates, and a data frame sent again later is new
+    make_packet(1, LOOP_DST, frame);
+    assert(run_loop(frame) == RCP_DEFAULT_HOPS);
+    fwd_use_dedup(&loop_a, 1000);
+    fwd_use_dedup(&loop_b, 1000);
+    fwd_use_dedup(&loop_c, 1000);
+    make_packet(0, LOOP_DST, frame);
+    assert(run_loop(frame) == 3);
+    delay_us(2000);
+    assert(run_loop(frame) == 3);
+    printk("With duplicate suppression, a looping data frame is sent once per router\n");
+
+    printk("Hop limit test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Test that duplicate suppression lets retransmissions through
+static void test_forward_retransmit(void) {
+    printk("--------------------------------\n");
+    printk("Testing retransmissions through the router...\n");
+
+    loop_init();
+    fwd_use_dedup(&loop_a, FWD_DUP_US);
+
+    // A fast retransmit comes right behind the original, from the same neighbor, in
+    // either form
+    uint8_t frame[RCP_TOTAL_SIZE];
+    for (size_t i = 0; i < 4; i += 2) {
+        make_packet(i, LOOP_DST, frame);
+        for (int copy = 0; copy < 2; copy++) {
+            n_on_air = 0;
+            memcpy(air, frame, RCP_TOTAL_SIZE);
+            fwd_frame_from(&loop_a, air, 2);
+            assert(n_on_air == 1 && air_to == B_ADDR);
+        }
+    }
+
+    // Two connections to the same destination can use the same sequence number in
+    // compact frames: only the one whose payload (and so check value) matches is a copy
+    make_packet(2, LOOP_DST, frame);
+    frame[RCP_COMPACT_DATA_LENGTH] ^= 1;
+    size_t length = RCP_COMPACT_DATA_LENGTH + (frame[0] & RCP_COMPACT_LEN_MASK);
+    rcp_packet_cksum_store(frame, rcp_packet_checksum(frame, length));
+    memcpy(air, frame, RCP_TOTAL_SIZE);
+    fwd_frame_from(&loop_a, air, 1);
+    assert(loop_a.n_duplicates == 0 && loop_a.n_forwarded == 5);
+    make_packet(2, LOOP_DST, frame);
+    memcpy(air, frame, RCP_TOTAL_SIZE);
+    fwd_frame_from(&loop_a, air, 1);
+    assert(loop_a.n_duplicates == 1 && loop_a.n_forwarded == 5);
+
+    printk("Retransmission test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Stands in for the transmit radio's FIFO in full-duplex mode
+static uint8_t fifo[NRF_TX_FIFO_DEPTH][RCP_TOTAL_SIZE];
+static uint32_t fifo_addr;
+static size_t fifo_count;
+
+static size_t fifo_room(fwd_t *fwd) {
+    if (fifo_count == 0) {
+        return NRF_TX_FIFO_DEPTH;
+    }
+    return fifo_count < NRF_TX_FIFO_DEPTH ? 1 : 0;
+}
+
+static void fifo_load(fwd_t *fwd, uint32_t nrf_addr, const uint8_t *frame) {
+    assert(fifo_count < NRF_TX_FIFO_DEPTH);
+    assert(fifo_count == 0 || nrf_addr == fifo_addr);  // One TX address for the whole FIFO
+    fifo_addr = nrf_addr;
+    memcpy(fifo[fifo_count++], frame, RCP_TOTAL_SIZE);
+}
+
+// Send the frame at the front of the FIFO, as the radio does once per packet time
+static bool fifo_send(uint32_t *nrf_addr, uint8_t *frame) {
+    if (fifo_count == 0) {
+        return false;
+    }
+    *nrf_addr = fifo_addr;
+    memcpy(frame, fifo[0], RCP_TOTAL_SIZE);
+    memmove(fifo[0], fifo[1], --fifo_count * RCP_TOTAL_SIZE);
+    return true;
+}
+
+// Test full-duplex forwarding: receiving goes on while the FIFO is loaded and sent
+static void test_forward_duplex(void) {
+    printk("--------------------------------\n");
+    printk("Testing full-duplex forwarding...\n");
+
+    static fwd_t fwd;
+    static outq_t outq;
+    fwd_init(&fwd, NULL, NULL, ROUTER_ADDR);
+    outq_init(&outq);
+    fwd_use_outq(&fwd, &outq);
+    fwd.transmit = fifo_load;
+    fwd.tx_room = fifo_room;
+
+    // Bursts of three packets every four packet times: data for both servers, and ACKs
+    enum { N_TICKS = 3000 };
+    uint8_t frame[RCP_TOTAL_SIZE];
+    unsigned n_arrived = 0, n_sent = 0, idle = 0;
+    memset(&q, 0, sizeof(q));
+    fifo_count = 0;
+    for (unsigned tick = 0; tick < N_TICKS + 50; tick++) {
+        for (int i = 0; tick < N_TICKS && tick % 4 == 0 && i < 3; i++) {
+            bool ack = i == 2 && tick % 8 == 0;
+            make_packet(ack ? 1 : 0, 1 + (tick / 4 + i) % 2, frame);
+            push_packet(frame);
+            n_arrived++;
+        }
+
+        fwd_drain_cq(&fwd, &q);
+        fwd_send_queued(&fwd);
+
+        uint32_t nrf_addr;
+        if (!fifo_send(&nrf_addr, frame)) {
+            idle += !outq_empty(&outq);
+            continue;
+        }
+        uint8_t dst = rcp_frame_dst(frame);
+        assert(nrf_addr == (dst == 1 ? server_addr : server_addr_2));
+        n_sent++;
+    }
+
+    // Everything got through, loaded a FIFO at a time, and the radio never sat idle
+    // with frames waiting
+    assert(n_sent == n_arrived && fwd.n_forwarded == n_arrived);
+    assert(outq.n_red_drops == 0 && outq.n_tail_drops[OUTQ_DATA] == 0);
+    assert(idle == 0);
+    assert(fwd.n_tx_loads < n_sent);
+    printk("%u frames sent in %u FIFO loads, radio never idle with frames queued\n", n_sent,
+           fwd.n_tx_loads);
+
+    printk("Full-duplex forwarding test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Stands in for the next hops' hardware ACKs: each link loses a share of frames at
+// random, and the link to <link_down_addr> loses all of them
+static unsigned link_loss_pct;
+static uint32_t link_down_addr;
+static uint32_t link_rand = 1;
+static unsigned link_attempts[2];
+static unsigned link_acked[2];
+static uint16_t link_last_tag[2];
+static unsigned link_passes;
+
+static uint16_t frame_tag(const uint8_t *frame) {
+    return frame[RCP_TOTAL_SIZE - 2] | frame[RCP_TOTAL_SIZE - 1] << 8;
+}
+
+static bool lossy_link_send(fwd_t *fwd, uint32_t nrf_addr, const uint8_t *frame) {
+    int hop = nrf_addr == server_addr ? 0 : 1;
+    assert(nrf_addr == (hop == 0 ? server_addr : server_addr_2));
+    link_attempts[hop]++;
+
+    link_rand = link_rand * 1103515245 + 12345;
+    if (nrf_addr == link_down_addr || (link_rand >> 16) % 100 < link_loss_pct) {
+        return false;
+    }
+
+    // Each next hop gets its frames in order, once each
+    assert(frame_tag(frame) > link_last_tag[hop]);
+    link_last_tag[hop] = frame_tag(frame);
+    link_acked[hop]++;
+    return true;
+}
+
+// Run <n> frames through the router over lossy links, a retry pass after each one
+static unsigned run_lossy(fwd_t *fwd, unsigned n) {
+    memset(link_attempts, 0, sizeof(link_attempts));
+    memset(link_acked, 0, sizeof(link_acked));
+    memset(link_last_tag, 0, sizeof(link_last_tag));
+    link_passes = 0;
+
+    uint8_t frame[RCP_TOTAL_SIZE];
+    for (unsigned i = 1; i <= n; i++) {
+        make_packet(0, 1 + i % 2, frame);
+        frame[RCP_TOTAL_SIZE - 2] = i;  // The router forwards the frame byte for byte
+        frame[RCP_TOTAL_SIZE - 1] = i >> 8;
+        fwd_frame(fwd, frame);
+        if (fwd->n_held) {
+            fwd_arq_retry(fwd);
+            link_passes++;
+        }
+    }
+
+    // Every held frame is acknowledged or given up on eventually
+    for (int i = 0; i < FWD_ARQ_SLOTS * FWD_ARQ_TRIES && fwd->n_held; i++) {
+        fwd_arq_retry(fwd);
+        link_passes++;
+    }
+    assert(fwd->n_held == 0);
+    return link_acked[0] + link_acked[1];
+}
+
+// Test hop-by-hop ARQ: the router retries what the next hop didn't acknowledge
+static void test_forward_arq(void) {
+    printk("--------------------------------\n");
+    printk("Testing hop-by-hop ARQ...\n");
+
+    enum { N = 2000 };
+    static fwd_t fwd;
+    link_loss_pct = 20;
+    link_down_addr = 0;
+
+    // Without local retries, a fifth of the frames are lost for good
+    fwd_init(&fwd, NULL, NULL, ROUTER_ADDR);
+    fwd_use_arq(&fwd, 0);
+    fwd.link_send = lossy_link_send;
+    unsigned plain = run_lossy(&fwd, N);
+    assert(plain + fwd.n_link_lost == N && fwd.n_link_retries == 0);
+    assert(plain < N * 9 / 10);
+
+    // With them, almost none are
+    fwd_init(&fwd, NULL, NULL, ROUTER_ADDR);
+    fwd_use_arq(&fwd, FWD_ARQ_TRIES);
+    fwd.link_send = lossy_link_send;
+    unsigned arq = run_lossy(&fwd, N);
+    assert(arq + fwd.n_link_lost == N);
+    assert(fwd.n_link_lost < N / 100);
+    printk("20%% link loss: %u of %u delivered without ARQ, %u with (%u local retries)\n", plain,
+           N, arq, fwd.n_link_retries);
+
+    // A dead link costs one try per pass, and doesn't hold up the other next hop
+    fwd_init(&fwd, NULL, NULL, ROUTER_ADDR);
+    fwd_use_arq(&fwd, FWD_ARQ_TRIES);
+    fwd.link_send = lossy_link_send;
+    link_loss_pct = 0;
+    link_down_addr = server_addr;
+    run_lossy(&fwd, 100);
+    assert(link_acked[0] == 0 && link_acked[1] == 50);
+    assert(link_attempts[0] <= link_passes + 1);
+    assert(fwd.n_link_lost == 50);
+    printk("Dead link: %u tries in %u retry passes, other next hop unaffected\n",
+           link_attempts[0], link_passes);
+
+    printk("Hop-by-hop ARQ test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Keeps the benchmark's sends live
+static volatile uint32_t sink;
+
+static void count_transmit(fwd_t *fwd, uint32_t nrf_addr, const uint8_t *frame) {
+    sink += nrf_addr + frame[RCP_TOTAL_SIZE - 1];
+}
+
+// Compare the old router loop (minus its trace prints) with the fast path
+static void test_forward_speed(void) {
+    printk("--------------------------------\n");
+    printk("Router cost (%u-packet bursts)...\n", FWD_BATCH_MAX);
+
+    static fwd_t fwd;
+    fwd_init(&fwd, NULL, NULL, ROUTER_ADDR);
+    fwd.transmit = count_transmit;
+
+    // Full headers only, since that's all the old loop could parse
+    static uint8_t burst[FWD_BATCH_MAX][RCP_TOTAL_SIZE];
+    for (size_t i = 0; i < FWD_BATCH_MAX; i++) {
+        make_packet(i * 4, 1 + i % 2, burst[i]);
+    }
+
+    enum { N_ROUNDS = 256 };
+    unsigned parse_cycles = 0, fast_cycles = 0;
+    unsigned parse_us = 0, fast_us = 0;
+    memset(&q, 0, sizeof(q));
+    cycle_cnt_init();
+    for (int r = 0; r < N_ROUNDS; r++) {
+        // One read and a full parse per packet, the way tcp-router.c does it
+        for (size_t i = 0; i < FWD_BATCH_MAX; i++) {
+            push_packet(burst[i]);
+        }
+        unsigned start_us = timer_get_usec();
+        unsigned start = cycle_cnt_read();
+        for (size_t i = 0; i < FWD_BATCH_MAX; i++) {
+            uint8_t pkt[RCP_TOTAL_SIZE];
+            rcp_datagram_t dgram = rcp_datagram_init();
+            assert(cq_pop_n_noblk(&q, pkt, RCP_TOTAL_SIZE));
+            assert(rcp_datagram_parse(&dgram, pkt, RCP_TOTAL_SIZE));
+            uint32_t next_hop = router_rtable[dgram.header.dst];
+            assert(next_hop);
+            count_transmit(&fwd, next_hop, pkt);
+        }
+        parse_cycles += cycle_cnt_read() - start;
+        parse_us += timer_get_usec() - start_us;
+
+        // The whole burst straight off the raw frames
+        for (size_t i = 0; i < FWD_BATCH_MAX; i++) {
+            push_packet(burst[i]);
+        }
+        start_us = timer_get_usec();
+        start = cycle_cnt_read();
+        assert(fwd_drain_cq(&fwd, &q) == FWD_BATCH_MAX);
+        fast_cycles += cycle_cnt_read() - start;
+        fast_us += timer_get_usec() - start_us;
+    }
+    assert(fwd.n_forwarded == N_ROUNDS * FWD_BATCH_MAX);
+
+    unsigned n = N_ROUNDS * FWD_BATCH_MAX;
+    unsigned parse_per = parse_cycles / n, fast_per = fast_cycles / n;
+    printk("  parse each packet: %u cycles/packet (%u packets/s)\n", parse_per,
+           parse_us ? (unsigned)(n * 1000000ULL / parse_us) : 0);
+    printk("  fast path: %u cycles/packet (%u packets/s)\n", fast_per,
+           fast_us ? (unsigned)(n * 1000000ULL / fast_us) : 0);
+    assert(fast_cycles * 2 <= parse_cycles);
+
+    printk("Router benchmark done!\n");
+    printk("--------------------------------\n");
+}
+
+void notmain(void) {
+    printk("Starting router forwarding tests...\n\n");
+
+    test_forward_frames();
+    test_forward_pipes();
+    test_forward_loop();
+    test_forward_retransmit();
+    test_forward_duplex();
+    test_forward_arq();
+    test_forward_speed();
+
+    printk("\nRouter forwarding tests passed!\n");
+}
@@ -0,0 +1,305 @@
+#include <string.h>
+
+#include "fragment.h"
+#include "rcp-compact.h"
+
+#define LOCAL_ADDR 1
+
+// Fragments of one datagram, as they'd appear on the air
+typedef struct {
+    uint8_t pkts[FRAG_MAX_COUNT][RCP_TOTAL_SIZE];
+    int lens[FRAG_MAX_COUNT];
+    size_t count;
+} frags_t;
+
+// Split a datagram into fragments the same way frag_send does, without a radio
+static void split(frags_t *f, uint8_t src, uint8_t id, const uint8_t *data, size_t len) {
+    frag_header_t hdr = {
+        .dst = LOCAL_ADDR,
+        .hops = RCP_DEFAULT_HOPS,
+        .src = src,
+        .id = id,
+        .count = len ? (len + FRAG_MAX_PAYLOAD - 1) / FRAG_MAX_PAYLOAD : 1,
+    };
+    f->count = hdr.count;
+
+    for (size_t i = 0; i < hdr.count; i++) {
+        size_t offset = i * FRAG_MAX_PAYLOAD;
+        hdr.index = i;
+        hdr.payload_len = len - offset < FRAG_MAX_PAYLOAD ? len - offset : FRAG_MAX_PAYLOAD;
+        f->lens[i] = frag_encode(&hdr, data + offset, f->pkts[i], RCP_TOTAL_SIZE);
+        assert(f->lens[i] == FRAG_HEADER_LENGTH + hdr.payload_len);
+    }
+}
+
+static void fill_random(uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        data[i] = pi_random();
+    }
+}
+
+// Test the fragment header format
+static void test_frag_format(void) {
+    printk("--------------------------------\n");
+    printk("Testing fragment format...\n");
+
+    uint8_t payload[FRAG_MAX_PAYLOAD];
+    fill_random(payload, sizeof(payload));
+
+    frag_header_t hdr = {.payload_len = FRAG_MAX_PAYLOAD, .dst = 7, .hops = 5, .src = 3,
+                         .id = 200, .index = 4, .count = 9};
+    uint8_t pkt[RCP_TOTAL_SIZE];
+    assert(frag_encode(&hdr, payload, pkt, sizeof(pkt)) == RCP_TOTAL_SIZE);
+
+    // Fragments can't be mistaken for either of the other header forms, and the destination
+    // is where routers look for it
+    assert(rcp_is_fragment(pkt));
+    assert(!rcp_is_compact(pkt));
+    rcp_datagram_t dgram = rcp_datagram_init();
+    assert(!rcp_datagram_decode(&dgram, pkt, sizeof(pkt)));
+    assert(pkt[1 + RCP_CKSUM_LENGTH] == 7 && pkt[RCP_HOPS_OFFSET] == 5);
+
+    frag_header_t parsed;
+    const uint8_t *parsed_payload;
+    assert(frag_decode(&parsed, &parsed_payload, pkt, sizeof(pkt)));
+    assert(parsed.payload_len == FRAG_MAX_PAYLOAD && parsed.dst == 7 && parsed.src == 3);
+    assert(parsed.hops == 5);
+    assert(parsed.id == 200 && parsed.index == 4 && parsed.count == 9);
+    assert(memcmp(parsed_payload, payload, FRAG_MAX_PAYLOAD) == 0);
+    printk("Fragment round trip verified (%u-byte header)\n", FRAG_HEADER_LENGTH);
+
+    // Corruption, truncation, and impossible numbering are all rejected
+    pkt[RCP_TOTAL_SIZE - 1] ^= 0x10;
+    assert(!frag_decode(&parsed, &parsed_payload, pkt, sizeof(pkt)));
+    pkt[RCP_TOTAL_SIZE - 1] ^= 0x10;
+    assert(!frag_decode(&parsed, &parsed_payload, pkt, RCP_TOTAL_SIZE - 1));
+
+    hdr.index = 9;
+    frag_encode(&hdr, payload, pkt, sizeof(pkt));
+    assert(!frag_decode(&parsed, &parsed_payload, pkt, sizeof(pkt)));
+
+    // Only the last fragment may be short
+    hdr.index = 4;
+    hdr.payload_len = 3;
+    frag_encode(&hdr, payload, pkt, sizeof(pkt));
+    assert(!frag_decode(&parsed, &parsed_payload, pkt, sizeof(pkt)));
+    printk("Bad fragments rejected\n");
+
+    // A full last fragment of the most fragments a datagram can have would end past
+    // FRAG_MAX_DATAGRAM: it is rejected before it can touch any reassembly state
+    static frag_t frag;
+    frag_init(&frag, NULL, LOCAL_ADDR);
+    hdr = (frag_header_t){.payload_len = FRAG_MAX_PAYLOAD, .dst = LOCAL_ADDR, .src = 2,
+                          .index = FRAG_MAX_COUNT - 1, .count = FRAG_MAX_COUNT};
+    memset(payload, 0xab, sizeof(payload));
+    frag_encode(&hdr, payload, pkt, sizeof(pkt));
+    assert(!frag_decode(&parsed, &parsed_payload, pkt, sizeof(pkt)));
+    static frag_t before;
+    memcpy(&before, &frag, sizeof(frag));
+    assert(!frag_process_packet(&frag, pkt, sizeof(pkt)));
+    assert(memcmp(&before, &frag, sizeof(frag)) == 0);
+    assert(frag.frags_sent == 0 && frag.frags_recv == 0);
+
+    // One that ends exactly at FRAG_MAX_DATAGRAM is fine
+    hdr.payload_len = FRAG_MAX_DATAGRAM - hdr.index * FRAG_MAX_PAYLOAD;
+    frag_encode(&hdr, payload, pkt, sizeof(pkt));
+    assert(frag_process_packet(&frag, pkt, FRAG_HEADER_LENGTH + hdr.payload_len));
+    assert(frag.frags_sent == 0 && frag.frags_recv == 1);
+    printk("Fragments past the largest datagram rejected\n");
+
+    printk("Fragment format test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Test reassembly of datagrams whose fragments arrive shuffled and duplicated
+static void test_frag_reassembly(void) {
+    printk("--------------------------------\n");
+    printk("Testing fragment reassembly...\n");
+
+    static frag_t frag;
+    static frags_t f;
+    static uint8_t data[FRAG_MAX_DATAGRAM], out[FRAG_MAX_DATAGRAM];
+    frag_init(&frag, NULL, LOCAL_ADDR);
+
+    const size_t sizes[] = {0, 1, FRAG_MAX_PAYLOAD, FRAG_MAX_PAYLOAD + 1, 220, 1000,
+                            FRAG_MAX_DATAGRAM};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t len = sizes[s];
+        fill_random(data, len);
+        split(&f, 2, s, data, len);
+
+        // Deliver in a random order, sending some fragments twice
+        uint8_t order[FRAG_MAX_COUNT];
+        for (size_t i = 0; i < f.count; i++) {
+            order[i] = i;
+        }
+        for (size_t i = f.count - 1; i > 0; i--) {
+            size_t j = pi_random() % (i + 1);
+            uint8_t tmp = order[i];
+            order[i] = order[j];
+            order[j] = tmp;
+        }
+        for (size_t i = 0; i < f.count; i++) {
+            assert(!frag_has_datagram(&frag));
+            assert(frag_process_packet(&frag, f.pkts[order[i]], f.lens[order[i]]));
+            if (i % 3 == 0) {
+                frag_process_packet(&frag, f.pkts[order[i]], f.lens[order[i]]);
+            }
+        }
+
+        uint8_t src = 0;
+        assert(frag_has_datagram(&frag));
+        assert(frag_recv(&frag, &src, out, sizeof(out)) == (int)len);
+        assert(src == 2);
+        assert(memcmp(out, data, len) == 0);
+        assert(frag.mem_used == 0);
+        printk("%u-byte datagram reassembled from %u fragments\n", len, f.count);
+    }
+
+    // Fragments for someone else are ignored
+    frag_header_t hdr = {.payload_len = 10, .dst = LOCAL_ADDR + 1, .src = 2, .id = 99, .count = 1};
+    uint8_t pkt[RCP_TOTAL_SIZE];
+    int pkt_len = frag_encode(&hdr, data, pkt, sizeof(pkt));
+    assert(!frag_process_packet(&frag, pkt, pkt_len));
+    assert(!frag_has_datagram(&frag));
+
+    printk("Fragment reassembly test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Test that datagrams from different sources with the same ID don't get mixed up
+static void test_frag_interleaved(void) {
+    printk("--------------------------------\n");
+    printk("Testing interleaved sources...\n");
+
+    static frag_t frag;
+    static frags_t fa, fb;
+    static uint8_t a[500], b[300], out[FRAG_MAX_DATAGRAM];
+    frag_init(&frag, NULL, LOCAL_ADDR);
+
+    fill_random(a, sizeof(a));
+    fill_random(b, sizeof(b));
+    split(&fa, 2, 5, a, sizeof(a));
+    split(&fb, 3, 5, b, sizeof(b));
+
+    for (size_t i = 0; i < fa.count || i < fb.count; i++) {
+        if (i < fa.count) {
+            frag_process_packet(&frag, fa.pkts[i], fa.lens[i]);
+        }
+        if (i < fb.count) {
+            frag_process_packet(&frag, fb.pkts[i], fb.lens[i]);
+        }
+    }
+
+    // <b> has fewer fragments, so it completes (and is delivered) first
+    uint8_t src;
+    int len = frag_recv(&frag, &src, out, sizeof(out));
+    assert(src == 3 && len == sizeof(b) && memcmp(out, b, sizeof(b)) == 0);
+    len = frag_recv(&frag, &src, out, sizeof(out));
+    assert(src == 2 && len == sizeof(a) && memcmp(out, a, sizeof(a)) == 0);
+    assert(frag_recv(&frag, &src, out, sizeof(out)) == -1);
+    printk("Two sources reassembled independently\n");
+
+    printk("Interleaved sources test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Test that lost fragments time out and that the memory cap evicts old datagrams
+static void test_frag_limits(void) {
+    printk("--------------------------------\n");
+    printk("Testing reassembly timeout and memory cap...\n");
+
+    static frag_t frag;
+    static frags_t f;
+    static uint8_t data[FRAG_MAX_DATAGRAM], out[FRAG_MAX_DATAGRAM];
+    frag_init(&frag, NULL, LOCAL_ADDR);
+    frag.timeout_us = 5000;
+
+    // Lose the last fragment: the context holds its space until the timeout
+    fill_random(data, 200);
+    split(&f, 2, 1, data, 200);
+    for (size_t i = 0; i + 1 < f.count; i++) {
+        frag_process_packet(&frag, f.pkts[i], f.lens[i]);
+    }
+    assert(frag.mem_used == f.count * FRAG_MAX_PAYLOAD);
+    frag_check_timeouts(&frag);
+    assert(frag.timeouts == 0);
+
+    delay_ms(10);
+    frag_check_timeouts(&frag);
+    assert(frag.timeouts == 1 && frag.mem_used == 0);
+
+    // The late fragment starts a new context, which times out in turn
+    frag_process_packet(&frag, f.pkts[f.count - 1], f.lens[f.count - 1]);
+    assert(!frag_has_datagram(&frag));
+    delay_ms(10);
+    frag_check_timeouts(&frag);
+    assert(frag.timeouts == 2 && frag.mem_used == 0);
+    printk("Incomplete datagrams expired\n");
+
+    // With room for two large datagrams, starting a third evicts the oldest
+    frag.timeout_us = FRAG_TIMEOUT_US;
+    frag.mem_cap = 2 * 1000;
+    fill_random(data, 3 * 1000);
+    for (uint8_t id = 0; id < 3; id++) {
+        split(&f, 2, id, data + id * 1000, 900);
+        frag_process_packet(&frag, f.pkts[0], f.lens[0]);
+        delay_us(100);
+    }
+    assert(frag.evictions == 1);
+    assert(frag.mem_used <= frag.mem_cap);
+    printk("Memory cap enforced (%u bytes reserved of %u)\n", frag.mem_used, frag.mem_cap);
+
+    // Finishing the newest datagram still works; the evicted one can't complete
+    split(&f, 2, 2, data + 2 * 1000, 900);
+    for (size_t i = 1; i < f.count; i++) {
+        frag_process_packet(&frag, f.pkts[i], f.lens[i]);
+    }
+    assert(frag_recv(&frag, NULL, out, sizeof(out)) == 900);
+    assert(memcmp(out, data + 2 * 1000, 900) == 0);
+
+    // A datagram bigger than the whole cap is refused outright
+    frag.mem_cap = 100;
+    split(&f, 3, 0, data, 500);
+    frag_process_packet(&frag, f.pkts[0], f.lens[0]);
+    assert(frag.drops == 1);
+    printk("Oversized datagram dropped\n");
+
+    // The cap is real memory: every context reassembles into its own part of one pool, so
+    // datagrams filling the whole pool at once all come out intact
+    enum { N_BIG = FRAG_MAX_CONTEXTS, BIG_LEN = FRAG_MEM_CAP / N_BIG - FRAG_MAX_PAYLOAD };
+    static frags_t big[N_BIG];
+    static uint8_t big_data[N_BIG][BIG_LEN];
+    frag_init(&frag, NULL, LOCAL_ADDR);
+    for (uint8_t src = 0; src < N_BIG; src++) {
+        fill_random(big_data[src], BIG_LEN);
+        split(&big[src], src + 2, 0, big_data[src], BIG_LEN);
+    }
+    for (size_t i = 0; i < big[0].count; i++) {
+        for (size_t src = 0; src < N_BIG; src++) {
+            frag_process_packet(&frag, big[src].pkts[i], big[src].lens[i]);
+        }
+    }
+    assert(frag.mem_used <= FRAG_MEM_CAP && frag.evictions == 0);
+    for (size_t n = 0; n < N_BIG; n++) {
+        uint8_t src;
+        assert(frag_recv(&frag, &src, out, sizeof(out)) == BIG_LEN);
+        assert(memcmp(out, big_data[src - 2], BIG_LEN) == 0);
+    }
+    printk("%u datagrams reassembled at once in a %u-byte pool (%u bytes of state)\n", N_BIG,
+           FRAG_MEM_CAP, sizeof(frag_t));
+
+    printk("Reassembly limits test passed!\n");
+    printk("--------------------------------\n");
+}
+
+void notmain(void) {
+    printk("Starting fragmentation tests...\n\n");
+
+    test_frag_format();
+    test_frag_reassembly();
+    test_frag_interleaved();
+    test_frag_limits();
+
+    printk("\nFragmentation tests passed!\n");
+}
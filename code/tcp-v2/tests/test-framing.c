@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "framing.h"
+#include "rcp-header.h"
+
+// Move up to <len> bytes from one bytestream to another (stands in for the network)
+static size_t transfer(bytestream_t *from, bytestream_t *to, size_t len) {
+    uint8_t chunk[RCP_MAX_PAYLOAD];
+    size_t n = bs_read(from, chunk, MIN(len, sizeof(chunk)));
+    return bs_write(to, chunk, n);
+}
+
+// Test message framing over a bytestream
+static void test_framing(void) {
+    printk("--------------------------------\n");
+    printk("Starting framing test...\n");
+
+    static bytestream_t tx, rx;
+    tx = bs_init();
+    rx = bs_init();
+    msg_framer_t framer = framer_init();
+
+    // Queue several small messages; they pack back to back in the stream
+    const char *msgs[] = {"ping", "", "status?", "a somewhat longer request body"};
+    const size_t n_msgs = sizeof(msgs) / sizeof(msgs[0]);
+    for (size_t i = 0; i < n_msgs; i++) {
+        assert(framer_write(&tx, (const uint8_t *)msgs[i], strlen(msgs[i])));
+    }
+    printk("Wrote %u messages, %u bytes in stream\n", n_msgs, bs_bytes_available(&tx));
+
+    // Deliver the first segment: "ping", "" and "status?" fit in 21 bytes
+    transfer(&tx, &rx, RCP_MAX_PAYLOAD);
+    framer_scan(&framer, &rx);
+    assert(framer.n_complete == 3);
+    printk("First segment carried %u complete messages\n", framer.n_complete);
+
+    uint8_t buf[64];
+    int len = framer_read(&framer, &rx, buf, sizeof(buf));
+    assert(len == 4 && memcmp(buf, "ping", 4) == 0);
+    len = framer_read(&framer, &rx, buf, sizeof(buf));
+    assert(len == 0);
+    len = framer_read(&framer, &rx, buf, sizeof(buf));
+    assert(len == 7 && memcmp(buf, "status?", 7) == 0);
+
+    // The partial last message must not be reported until it is complete
+    transfer(&tx, &rx, RCP_MAX_PAYLOAD);
+    framer_scan(&framer, &rx);
+    assert(!framer_has_msg(&framer));
+    assert(framer_read(&framer, &rx, buf, sizeof(buf)) == -1);
+    printk("Partial message held back\n");
+
+    while (bs_bytes_available(&tx)) {
+        transfer(&tx, &rx, RCP_MAX_PAYLOAD);
+    }
+    framer_scan(&framer, &rx);
+    assert(framer_has_msg(&framer));
+
+    // Truncated read drops the rest of the message but keeps the stream in sync
+    len = framer_read(&framer, &rx, buf, 8);
+    assert(len == strlen(msgs[3]));
+    assert(memcmp(buf, msgs[3], 8) == 0);
+    assert(!framer_has_msg(&framer));
+    assert(bs_bytes_available(&rx) == 0);
+    printk("Truncated read kept the stream aligned\n");
+
+    // Oversized messages are rejected whole
+    uint8_t big[MSG_MAX_LEN + 1] = {0};
+    assert(!framer_write(&tx, big, sizeof(big)));
+    assert(bs_bytes_available(&tx) == 0);
+
+    printk("Framing test passed!\n");
+    printk("--------------------------------\n");
+}
+
+void notmain(void) {
+    printk("Starting TCP implementation tests...\n\n");
+    kmalloc_init(64);
+    printk("Memory initialized\n");
+
+    test_framing();
+
+    printk("\nFraming test passed!\n");
+}
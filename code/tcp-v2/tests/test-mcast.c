@@ -0,0 +1,418 @@
+#include <string.h>
+
+#include "forward.h"
+#include "mcast.h"
+#include "tcp.h"
+
+#define SIDE 5                  /* Nodes are on a SIDE x SIDE grid, each hearing its 4 neighbors */
+#define N_NODES (SIDE * SIDE)
+#define GROUP (RCP_MCAST_FIRST + 1)
+#define OBJECT_SIZE 2000        /* Bytes in the object pushed to every node */
+#define MAX_QUEUED 4096         /* Packets in flight at once */
+
+#define NODE_ADDR(i) ((uint8_t)((i) + 1)) /* RCP address of node <i> */
+#define N_CHUNKS ((OBJECT_SIZE + MCAST_CHUNK - 1) / MCAST_CHUNK)
+
+// The simulated network: a grid, with some chance of each neighbor missing each packet
+static mcast_t nodes[N_NODES];
+static uint8_t bufs[N_NODES][OBJECT_SIZE];
+static bool alive[N_NODES];
+static unsigned loss_pct;
+
+// Packets broadcast but not yet heard
+static struct {
+    int from;
+    uint8_t pkt[RCP_TOTAL_SIZE];
+    size_t len;
+} air[MAX_QUEUED];
+static size_t n_air;
+
+static uint8_t object[OBJECT_SIZE];
+
+static void broadcast(mcast_t *mc, const uint8_t *pkt, size_t len) {
+    assert(n_air < MAX_QUEUED);
+    air[n_air].from = mc - nodes;
+    memcpy(air[n_air].pkt, pkt, len);
+    air[n_air].len = len;
+    n_air++;
+}
+
+static bool neighbors(int i, int j) {
+    int dx = i % SIDE - j % SIDE, dy = i / SIDE - j / SIDE;
+    return dx * dx + dy * dy == 1;
+}
+
+// Hops from the corner node 0 to node <i>
+static int hops_from_origin(int i) { return i % SIDE + i / SIDE; }
+
+// Hand every packet in flight to the live neighbors of its sender
+static void deliver(void) {
+    for (size_t p = 0; p < n_air; p++) {
+        for (int j = 0; j < N_NODES; j++) {
+            if (alive[j] && neighbors(air[p].from, j) && pi_random() % 100 >= loss_pct) {
+                assert(mcast_process_packet(&nodes[j], air[p].pkt, air[p].len));
+            }
+        }
+    }
+    n_air = 0;
+}
+
+static void start_node(int i) {
+    mcast_init(&nodes[i], NULL, NODE_ADDR(i), GROUP, bufs[i], sizeof(bufs[i]));
+    nodes[i].transmit = broadcast;
+    nodes[i].nack_us = 4000;
+    nodes[i].repair_us = 1000;
+    nodes[i].adv_us = 20000;
+    alive[i] = true;
+}
+
+static bool all_have(uint16_t version) {
+    for (int i = 0; i < N_NODES; i++) {
+        if (alive[i] && (!mcast_complete(&nodes[i]) || nodes[i].version != version)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Run the protocol on every live node until they all have <version>, or <limit_us> passes
+static bool run_until_done(uint16_t version, uint32_t limit_us) {
+    uint32_t start = timer_get_usec();
+    while (timer_get_usec() - start < limit_us) {
+        for (int i = 0; i < N_NODES; i++) {
+            if (alive[i]) {
+                mcast_tick(&nodes[i]);
+            }
+        }
+        deliver();
+        if (all_have(version)) {
+            printk("Version %u everywhere in %u us\n", version, timer_get_usec() - start);
+            return true;
+        }
+    }
+    printk("Version %u not everywhere after %u us\n", version, limit_us);
+    return false;
+}
+
+// Run the protocol for <us> microseconds
+static void run_for(uint32_t us) {
+    uint32_t start = timer_get_usec();
+    while (timer_get_usec() - start < us) {
+        for (int i = 0; i < N_NODES; i++) {
+            if (alive[i]) {
+                mcast_tick(&nodes[i]);
+            }
+        }
+        deliver();
+    }
+}
+
+static void check_objects(void) {
+    for (int i = 0; i < N_NODES; i++) {
+        const uint8_t *data;
+        assert(mcast_object(&nodes[i], &data) == OBJECT_SIZE);
+        assert(memcmp(data, object, OBJECT_SIZE) == 0);
+    }
+}
+
+// Chunks broadcast by every node, first sends and repairs
+static unsigned total_chunks_sent(void) {
+    unsigned n = 0;
+    for (int i = 0; i < N_NODES; i++) {
+        n += nodes[i].chunks_sent + nodes[i].repairs_sent;
+    }
+    return n;
+}
+
+// What sending the object to every node over its own unicast path would take, losses aside
+static unsigned unicast_cost(void) {
+    unsigned n = 0;
+    for (int i = 1; i < N_NODES; i++) {
+        n += hops_from_origin(i) * N_CHUNKS;
+    }
+    return n;
+}
+
+static void publish(int origin, uint16_t version) {
+    for (size_t i = 0; i < OBJECT_SIZE; i++) {
+        object[i] = pi_random();
+    }
+    assert(mcast_publish(&nodes[origin], version, object, OBJECT_SIZE));
+}
+
+// Test that a lossless flood reaches everyone with one broadcast per node per chunk
+static void test_mcast_flood(void) {
+    printk("--------------------------------\n");
+    printk("Testing lossless flooding...\n");
+
+    loss_pct = 0;
+    n_air = 0;
+    for (int i = 0; i < N_NODES; i++) {
+        start_node(i);
+    }
+    publish(0, 1);
+    assert(run_until_done(1, 1000000));
+    check_objects();
+
+    // The last nodes to finish still pass the chunks on, to nobody new
+    run_for(2000);
+    unsigned sent = total_chunks_sent();
+    assert(sent == N_NODES * N_CHUNKS);
+    for (int i = 0; i < N_NODES; i++) {
+        assert(nodes[i].repairs_sent == 0 && nodes[i].nacks_sent == 0);
+    }
+    printk("%u chunks to %u nodes: %u broadcasts (%u sends with unicast)\n", N_CHUNKS,
+           N_NODES - 1, sent, unicast_cost());
+
+    printk("Lossless flooding test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Test that NACKs repair what a lossy network drops, at a fraction of the unicast cost
+static void test_mcast_repair(void) {
+    printk("--------------------------------\n");
+    printk("Testing NACK repair...\n");
+
+    loss_pct = 20;
+    n_air = 0;
+    for (int i = 0; i < N_NODES; i++) {
+        start_node(i);
+    }
+    publish(0, 1);
+    assert(run_until_done(1, 2000000));
+    check_objects();
+
+    unsigned sent = total_chunks_sent(), nacks = 0, repairs = 0;
+    for (int i = 0; i < N_NODES; i++) {
+        nacks += nodes[i].nacks_sent;
+        repairs += nodes[i].repairs_sent;
+    }
+    assert(nacks > 0 && repairs > 0);
+    assert(sent < unicast_cost() / 2);
+    printk("With %u%% loss: %u broadcasts (%u repairs for %u NACKs), unicast needs %u+\n",
+           loss_pct, sent, repairs, nacks, unicast_cost());
+
+    printk("NACK repair test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Test that a newer version replaces the old one, and a node that missed it catches up
+static void test_mcast_versions(void) {
+    printk("--------------------------------\n");
+    printk("Testing versions and late joiners...\n");
+
+    loss_pct = 0;
+    n_air = 0;
+    for (int i = 0; i < N_NODES; i++) {
+        start_node(i);
+    }
+    publish(0, 1);
+    assert(run_until_done(1, 1000000));
+
+    // The middle node misses version 2 entirely, then comes back still holding version 1
+    int late = N_NODES / 2;
+    alive[late] = false;
+    publish(0, 2);
+    assert(run_until_done(2, 1000000));
+    assert(nodes[late].version == 1);
+
+    alive[late] = true;
+    assert(run_until_done(2, 1000000));
+    check_objects();
+    assert(nodes[late].nacks_sent > 0);
+    printk("Late node caught up with %u NACKs\n", nodes[late].nacks_sent);
+
+    // An older version published somewhere is ignored, and the node publishing it catches up
+    uint8_t old[OBJECT_SIZE];
+    memcpy(old, object, OBJECT_SIZE);
+    old[0] ^= 0xFF;
+    assert(mcast_publish(&nodes[N_NODES - 1], 1, old, OBJECT_SIZE));
+    assert(run_until_done(2, 1000000));
+    check_objects();
+
+    // Objects that don't fit are refused
+    static uint8_t too_big[OBJECT_SIZE + 1];
+    assert(!mcast_publish(&nodes[0], 3, too_big, sizeof(too_big)));
+
+    printk("Version test passed!\n");
+    printk("--------------------------------\n");
+}
+
+static mcast_t *sender;
+static uint8_t sent_pkt[RCP_TOTAL_SIZE];
+static unsigned n_sent;
+
+static void capture(mcast_t *mc, const uint8_t *pkt, size_t len) {
+    sender = mc;
+    memset(sent_pkt, 0, sizeof(sent_pkt));
+    memcpy(sent_pkt, pkt, len);
+    n_sent++;
+}
+
+// Test that the router passes multicast packets to its own multicast state
+static void test_mcast_router(void) {
+    printk("--------------------------------\n");
+    printk("Testing multicast through the router...\n");
+
+    static fwd_t fwd;
+    static mcast_t origin, router;
+    static uint8_t origin_buf[64], router_buf[64];
+    mcast_init(&origin, NULL, 1, GROUP, origin_buf, sizeof(origin_buf));
+    mcast_init(&router, NULL, 0, GROUP, router_buf, sizeof(router_buf));
+    origin.transmit = router.transmit = capture;
+    fwd_init(&fwd, NULL, NULL, 0);
+
+    // Without multicast state, the router drops them
+    uint8_t msg[MCAST_CHUNK + 1] = {1, 2, 3};
+    assert(mcast_publish(&origin, 7, msg, sizeof(msg)));
+    mcast_tick(&origin);
+    assert(n_sent == 2 && sender == &origin);
+    fwd_frame(&fwd, sent_pkt);
+    assert(fwd.n_mcast == 1 && fwd.n_forwarded == 0 && fwd.n_no_route == 0);
+
+    // With it, the router keeps the chunk, sends it on, and asks for the one it missed
+    fwd_use_mcast(&fwd, &router);
+    fwd_frame(&fwd, sent_pkt);
+    assert(fwd.n_mcast == 2 && router.version == 7 && router.n_have == 1);
+    mcast_tick(&router);
+    assert(n_sent == 3 && sender == &router && rcp_frame_class(sent_pkt) == OUTQ_DATA);
+
+    router.nack_due_us = timer_get_usec();
+    mcast_tick(&router);
+    assert(n_sent == 4 && router.nacks_sent == 1 && rcp_frame_class(sent_pkt) == OUTQ_CONTROL);
+    assert(mcast_process_packet(&origin, sent_pkt, RCP_TOTAL_SIZE));
+    assert(origin.repair_pending);
+
+    // Multicast groups are never unicast destinations
+    static dv_t dv;
+    uint32_t nrf_addr;
+    dv_init(&dv, NULL, 1, 0xc00001);
+    assert(!dv_next_hop(&dv, GROUP, &nrf_addr));
+
+    printk("Router multicast test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Two endpoints joined by a simulated radio: packets are encoded, queued, and parsed again
+static tcp_peer_t peer_a, peer_b;
+static struct {
+    tcp_peer_t *to;
+    uint8_t pkt[RCP_TOTAL_SIZE];
+} wire[64];
+static size_t wire_head, wire_tail;
+
+static void wire_put(tcp_peer_t *to, const uint8_t *pkt) {
+    assert(wire_tail - wire_head < 64);
+    wire[wire_tail % 64].to = to;
+    memcpy(wire[wire_tail % 64].pkt, pkt, RCP_TOTAL_SIZE);
+    wire_tail++;
+}
+
+static void wire_datagram(tcp_peer_t *from, rcp_datagram_t *dgram) {
+    uint8_t pkt[RCP_TOTAL_SIZE] = {0};
+    assert(rcp_datagram_encode(dgram, pkt, RCP_TOTAL_SIZE) > 0);
+    wire_put(from == &peer_a ? &peer_b : &peer_a, pkt);
+}
+
+static void wire_segment(tcp_peer_t *peer, sender_segment_t *segment) {
+    rcp_datagram_t dgram = sender_segment_to_rcp(peer, segment);
+    wire_datagram(peer, &dgram);
+}
+
+static void wire_reply(tcp_peer_t *peer, receiver_segment_t *segment) {
+    rcp_datagram_t dgram = receiver_segment_to_rcp(peer, segment);
+    wire_datagram(peer, &dgram);
+}
+
+// Deliver everything on the wire, including whatever that makes the peers send
+static void wire_run(void) {
+    for (int round = 0; round < 8; round++) {
+        tcp_send_pending(&peer_a);
+        tcp_send_pending(&peer_b);
+        while (wire_head != wire_tail) {
+            rcp_datagram_t dgram = rcp_datagram_init();
+            size_t i = wire_head++ % 64;
+            assert(rcp_datagram_parse(&dgram, wire[i].pkt, RCP_TOTAL_SIZE) > 0);
+            tcp_process_incoming(wire[i].to, &dgram);
+        }
+    }
+}
+
+static uint8_t mc_pkts[4][RCP_TOTAL_SIZE];
+static size_t n_mc_pkts;
+
+static void capture_all(mcast_t *mc, const uint8_t *pkt, size_t len) {
+    assert(n_mc_pkts < 4);
+    memset(mc_pkts[n_mc_pkts], 0, RCP_TOTAL_SIZE);
+    memcpy(mc_pkts[n_mc_pkts++], pkt, len);
+}
+
+// Test that multicast packets arriving in the middle of a connection never reach it
+static void test_mcast_endpoint(void) {
+    printk("--------------------------------\n");
+    printk("Testing multicast next to a connection...\n");
+
+    static mcast_t origin, member;
+    static uint8_t origin_buf[64], member_buf[64];
+    mcast_init(&origin, NULL, 3, GROUP, origin_buf, sizeof(origin_buf));
+    mcast_init(&member, NULL, 2, GROUP, member_buf, sizeof(member_buf));
+    origin.transmit = member.transmit = capture_all;
+    uint8_t obj[MCAST_CHUNK + 1] = {9, 8, 7};
+    assert(mcast_publish(&origin, 5, obj, sizeof(obj)));
+    mcast_tick(&origin);
+    assert(n_mc_pkts == 2);
+
+    tcp_peer_init(&peer_a, NULL, NULL, 1, 2);
+    tcp_peer_init(&peer_b, NULL, NULL, 2, 1);
+    peer_a.sender.transmit = peer_b.sender.transmit = wire_segment;
+    peer_a.receiver.transmit = peer_b.receiver.transmit = wire_reply;
+
+    // Without a group to hand them to, the endpoint drops them
+    const char *first = "before the chunks, ", *second = "and after them";
+    tcp_write(&peer_a, (const uint8_t *)first, strlen(first));
+    tcp_send_pending(&peer_a);
+    wire_put(&peer_b, mc_pkts[0]);
+    wire_put(&peer_a, mc_pkts[0]);
+    wire_run();
+    uint32_t segs_recv = peer_b.stats.segs_recv;
+
+    // With one, they go to the group; either way the stream is untouched
+    tcp_use_mcast(&peer_b, &member);
+    tcp_write(&peer_a, (const uint8_t *)second, strlen(second));
+    tcp_send_pending(&peer_a);
+    wire_put(&peer_b, mc_pkts[0]);
+    wire_put(&peer_b, mc_pkts[1]);
+    wire_run();
+    assert(mcast_complete(&member) && member.version == 5);
+    assert(peer_b.stats.segs_recv > segs_recv);
+
+    char got[64] = {0};
+    size_t n = tcp_read(&peer_b, (uint8_t *)got, sizeof(got) - 1);
+    assert(n == strlen(first) + strlen(second));
+    assert(strncmp(got, first, strlen(first)) == 0);
+    assert(strcmp(got + strlen(first), second) == 0);
+    assert(peer_a.sender.n_retransmits == 0 && !tcp_has_data(&peer_a));
+
+    // On their own, they don't count as segments from the remote
+    uint32_t a_recv = peer_a.stats.segs_recv, b_recv = peer_b.stats.segs_recv;
+    wire_put(&peer_a, mc_pkts[1]);
+    wire_put(&peer_b, mc_pkts[1]);
+    wire_run();
+    assert(peer_a.stats.segs_recv == a_recv && peer_b.stats.segs_recv == b_recv);
+    printk("Connection read \"%s\" with multicast packets mixed in\n", got);
+
+    printk("Endpoint multicast test passed!\n");
+    printk("--------------------------------\n");
+}
+
+void notmain(void) {
+    printk("Starting multicast tests...\n\n");
+
+    test_mcast_flood();
+    test_mcast_repair();
+    test_mcast_versions();
+    test_mcast_router();
+    test_mcast_endpoint();
+
+    printk("\nMulticast tests passed!\n");
+}
@@ -0,0 +1,300 @@
+#include <string.h>
+
+#include "forward.h"
+#include "fragment.h"
+
+#define HOP_A 0xa1a1a1
+#define HOP_B 0xb2b2b2
+
+// Build a frame of one kind, tagging it with <tag> so it can be recognized later
+static void make_data(uint8_t tag, uint8_t *frame) {
+    uint8_t payload[RCP_MAX_PAYLOAD] = {tag};
+    rcp_datagram_t dgram = rcp_datagram_init();
+    dgram.header.src = 3;
+    dgram.header.dst = 1;
+    dgram.header.seqno = tag;
+    rcp_datagram_set_payload(&dgram, payload, sizeof(payload));
+    memset(frame, 0, RCP_TOTAL_SIZE);
+    assert(rcp_datagram_encode(&dgram, frame, RCP_TOTAL_SIZE) > 0);
+}
+
+static void make_ack(uint8_t tag, bool compact, uint8_t *frame) {
+    rcp_datagram_t dgram = rcp_datagram_init();
+    dgram.header.src = 1;
+    dgram.header.dst = 2;
+    dgram.header.seqno = tag;
+    dgram.header.ackno = tag;
+    rcp_set_flag(&dgram.header, RCP_FLAG_ACK);
+    memset(frame, 0, RCP_TOTAL_SIZE);
+    assert(compact ? rcp_compact_encode(&dgram, frame, RCP_TOTAL_SIZE) > 0
+                   : rcp_datagram_encode(&dgram, frame, RCP_TOTAL_SIZE) > 0);
+}
+
+// The tag a frame from make_data or make_ack was built with
+static uint8_t frame_tag(const uint8_t *frame) {
+    rcp_datagram_t dgram = rcp_datagram_init();
+    if (rcp_is_compact(frame)) {
+        assert(rcp_compact_decode(&dgram, frame, RCP_TOTAL_SIZE, 1));
+        return dgram.header.ackno;
+    }
+    assert(rcp_datagram_decode(&dgram, frame, RCP_TOTAL_SIZE));
+    return dgram.header.seqno;
+}
+
+// Test that each wire form lands in the right queue
+static void test_outq_classify(void) {
+    printk("--------------------------------\n");
+    printk("Testing frame classes...\n");
+
+    uint8_t frame[RCP_TOTAL_SIZE];
+    make_data(1, frame);
+    assert(rcp_frame_class(frame) == OUTQ_DATA);
+    make_ack(1, false, frame);
+    assert(rcp_frame_class(frame) == OUTQ_CONTROL);
+    make_ack(1, true, frame);
+    assert(rcp_frame_class(frame) == OUTQ_CONTROL);
+
+    // A SYN with no payload, compact data, FEC parity, and a fragment
+    rcp_datagram_t dgram = rcp_datagram_init();
+    dgram.header.dst = 1;
+    rcp_set_flag(&dgram.header, RCP_FLAG_SYN);
+    assert(rcp_datagram_encode(&dgram, frame, RCP_TOTAL_SIZE) > 0);
+    assert(rcp_frame_class(frame) == OUTQ_CONTROL);
+
+    uint8_t payload[FEC_WIDTH] = {0};
+    dgram = rcp_datagram_init();
+    dgram.header.dst = 1;
+    rcp_datagram_borrow_payload(&dgram, payload, 4);
+    assert(rcp_compact_encode(&dgram, frame, RCP_TOTAL_SIZE) > 0);
+    assert(rcp_frame_class(frame) == OUTQ_DATA);
+
+    rcp_set_flag(&dgram.header, RCP_FLAG_FEC);
+    rcp_datagram_borrow_payload(&dgram, payload, FEC_WIDTH);
+    assert(rcp_compact_encode(&dgram, frame, RCP_TOTAL_SIZE) > 0);
+    assert(rcp_frame_class(frame) == OUTQ_DATA);
+
+    frag_header_t hdr = {.payload_len = 4, .dst = 1, .src = 3, .count = 1};
+    assert(frag_encode(&hdr, payload, frame, RCP_TOTAL_SIZE) > 0);
+    assert(rcp_frame_class(frame) == OUTQ_DATA);
+
+    printk("Frame class test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Test that ACKs jump ahead of data, and next hops take turns within a class
+static void test_outq_priority(void) {
+    printk("--------------------------------\n");
+    printk("Testing ACK priority...\n");
+
+    static outq_t q;
+    outq_init(&q);
+    q.red_min = q.red_max = OUTQ_SLOTS + 1;  // Drop-tail only, for a predictable order
+
+    uint8_t frame[RCP_TOTAL_SIZE];
+    for (uint8_t i = 0; i < 6; i++) {
+        make_data(10 + i, frame);
+        assert(outq_push(&q, i % 2 ? HOP_B : HOP_A, frame));
+    }
+    make_ack(50, true, frame);
+    assert(outq_push(&q, HOP_A, frame));
+    make_ack(51, false, frame);
+    assert(outq_push(&q, HOP_B, frame));
+    assert(outq_depth(&q, HOP_A, OUTQ_DATA) == 3 && outq_depth(&q, HOP_A, OUTQ_CONTROL) == 1);
+
+    // Both ACKs first, then data alternating between the next hops in arrival order
+    static const uint8_t order[] = {50, 51, 10, 11, 12, 13, 14, 15};
+    uint32_t nrf_addr;
+    for (size_t i = 0; i < sizeof(order); i++) {
+        assert(outq_pop(&q, &nrf_addr, frame));
+        assert(frame_tag(frame) == order[i]);
+        assert(nrf_addr == (order[i] % 2 ? HOP_B : HOP_A));
+    }
+    assert(!outq_pop(&q, &nrf_addr, frame));
+    assert(outq_empty(&q));
+    assert(q.n_sent[OUTQ_CONTROL] == 2 && q.n_sent[OUTQ_DATA] == 6);
+    printk("ACKs sent ahead of %u queued data frames\n", q.n_sent[OUTQ_DATA]);
+
+    // Full queues drop the newest frame, whatever the class
+    for (uint8_t i = 0; i < OUTQ_SLOTS + 3; i++) {
+        make_ack(i, true, frame);
+        assert(outq_push(&q, HOP_A, frame) == (i < OUTQ_SLOTS));
+    }
+    assert(q.n_tail_drops[OUTQ_CONTROL] == 3);
+    assert(outq_pop(&q, &nrf_addr, frame) && frame_tag(frame) == 0);
+
+    printk("ACK priority test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Test that RED starts dropping data before the queue fills, and never drops ACKs
+static void test_outq_red(void) {
+    printk("--------------------------------\n");
+    printk("Testing RED...\n");
+
+    static outq_t q;
+    outq_init(&q);
+
+    // Data arrives twice as fast as it can be sent
+    enum { N_ARRIVALS = 2000 };
+    uint8_t frame[RCP_TOTAL_SIZE];
+    uint32_t nrf_addr;
+    unsigned max_depth = 0;
+    for (unsigned i = 0; i < N_ARRIVALS; i++) {
+        make_data(i, frame);
+        outq_push(&q, HOP_A, frame);
+        if (i % 2) {
+            assert(outq_pop(&q, &nrf_addr, frame));
+        }
+        unsigned depth = outq_depth(&q, HOP_A, OUTQ_DATA);
+        max_depth = depth > max_depth ? depth : max_depth;
+    }
+    assert(q.n_queued[OUTQ_DATA] + q.n_red_drops + q.n_tail_drops[OUTQ_DATA] == N_ARRIVALS);
+    assert(q.n_red_drops > 0);
+    assert(max_depth < OUTQ_SLOTS && q.n_tail_drops[OUTQ_DATA] == 0);
+    printk("%u early drops, no overflow (deepest %u of %u slots)\n", q.n_red_drops, max_depth,
+           OUTQ_SLOTS);
+
+    // ACKs still get through while the data queue is congested
+    make_ack(7, true, frame);
+    assert(outq_push(&q, HOP_A, frame));
+    assert(outq_pop(&q, &nrf_addr, frame) && frame_tag(frame) == 7);
+
+    printk("RED test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Test that next hops share the entries, and an idle one makes way for a new one
+static void test_outq_hops(void) {
+    printk("--------------------------------\n");
+    printk("Testing next hop entries...\n");
+
+    static outq_t q;
+    outq_init(&q);
+
+    uint8_t frame[RCP_TOTAL_SIZE];
+    make_data(1, frame);
+    for (uint32_t i = 0; i < OUTQ_MAX_HOPS; i++) {
+        assert(outq_push(&q, 0x100 + i, frame));
+    }
+    assert(!outq_push(&q, 0x200, frame));
+    assert(q.n_no_hop == 1);
+
+    uint32_t nrf_addr;
+    assert(outq_pop(&q, &nrf_addr, frame) && nrf_addr == 0x100);
+    assert(outq_push(&q, 0x200, frame));
+    assert(outq_depth(&q, 0x200, OUTQ_DATA) == 1 && outq_depth(&q, 0x100, OUTQ_DATA) == 0);
+
+    printk("Next hop entry test passed!\n");
+    printk("--------------------------------\n");
+}
+
+static uint8_t last_sent;
+
+static void record_transmit(fwd_t *fwd, uint32_t nrf_addr, const uint8_t *frame) {
+    last_sent = frame_tag(frame);
+}
+
+// Test the router under congestion: ACKs shouldn't wait behind queued data
+static void test_outq_router(void) {
+    printk("--------------------------------\n");
+    printk("Testing queued forwarding under load...\n");
+
+    static fwd_t fwd;
+    static outq_t q;
+    fwd_init(&fwd, NULL, NULL, 0);
+    fwd.transmit = record_transmit;
+    outq_init(&q);
+    fwd_use_outq(&fwd, &q);
+
+    // Three data frames and one ACK arrive for every two the radio can send
+    uint8_t frame[RCP_TOTAL_SIZE];
+    uint8_t ack_tag = 0;
+    unsigned n_acks = 0, worst_wait = 0, wait = 0;
+    bool ack_waiting = false;
+    uint8_t popped[RCP_TOTAL_SIZE];
+    uint32_t nrf_addr;
+    for (unsigned round = 0; round < 500; round++) {
+        for (int i = 0; i < 3; i++) {
+            make_data(i, frame);
+            fwd_frame(&fwd, frame);
+        }
+        if (round % 4 == 0 && !ack_waiting) {
+            make_ack(200 + round % 50, true, frame);
+            ack_tag = frame_tag(frame);
+            fwd_frame(&fwd, frame);
+            ack_waiting = true;
+            wait = 0;
+        }
+
+        for (int i = 0; i < 2 && outq_pop(&q, &nrf_addr, popped); i++) {
+            fwd.transmit(&fwd, nrf_addr, popped);
+            wait++;
+            if (ack_waiting && rcp_is_compact(popped)) {
+                assert(last_sent == ack_tag && nrf_addr == server_addr_2);
+                ack_waiting = false;
+                n_acks++;
+                worst_wait = wait > worst_wait ? wait : worst_wait;
+            }
+        }
+    }
+    assert(n_acks == 125);
+    assert(worst_wait == 1);
+    assert(q.n_red_drops > 0);
+    printk("%u ACKs, each sent next; %u data frames dropped early\n", n_acks, q.n_red_drops);
+
+    printk("Queued forwarding test passed!\n");
+    printk("--------------------------------\n");
+}
+
+static unsigned n_refills;
+
+// A frame arrives for the same next hop during every send
+static void refill_transmit(fwd_t *fwd, uint32_t nrf_addr, const uint8_t *frame) {
+    assert(++n_refills < 100);  // fwd_send_queued would never return
+    uint8_t next[RCP_TOTAL_SIZE];
+    make_data(frame_tag(frame) + 1, next);
+    fwd_frame(fwd, next);
+}
+
+// Test that a queue that refills as fast as it drains doesn't keep the router sending
+static void test_outq_budget(void) {
+    printk("--------------------------------\n");
+    printk("Testing the send budget...\n");
+
+    static fwd_t fwd;
+    static outq_t q;
+    fwd_init(&fwd, NULL, NULL, 0);
+    fwd.transmit = refill_transmit;
+    outq_init(&q);
+    fwd_use_outq(&fwd, &q);
+
+    uint8_t frame[RCP_TOTAL_SIZE];
+    for (int i = 0; i < 3; i++) {
+        make_data(i, frame);
+        fwd_frame(&fwd, frame);
+    }
+    assert(outq_count(&q) == 3);
+
+    // Only what was queued on entry goes out; what arrived meanwhile waits for the next pass
+    for (int pass = 1; pass <= 5; pass++) {
+        assert(fwd_send_queued(&fwd) == 3);
+        assert(n_refills == 3 * pass && outq_count(&q) == 3);
+    }
+    printk("%u frames sent, 3 at a time, with 3 arriving each pass\n", n_refills);
+
+    printk("Send budget test passed!\n");
+    printk("--------------------------------\n");
+}
+
+void notmain(void) {
+    printk("Starting output queue tests...\n\n");
+
+    test_outq_classify();
+    test_outq_priority();
+    test_outq_red();
+    test_outq_hops();
+    test_outq_router();
+    test_outq_budget();
+
+    printk("\nOutput queue tests passed!\n");
+}
@@ -2,7 +2,7 @@
 #include <string.h>
 #include <stdbool.h>
 
-#include "rcp-datagram.h"
+#include "rcp-compact.h"
 
 // Test RCP header flag operations
 static void test_rcp_flags(void) {
@@ -128,17 +128,190 @@ static void test_rcp_serialization(void) {
     assert(parsed_datagram.header.flags == datagram.header.flags);
     assert(parsed_datagram.header.cksum == datagram.header.cksum);
     assert(parsed_datagram.header.payload_len == datagram.header.payload_len);
-    assert(memcmp(parsed_datagram.payload, datagram.payload, datagram.header.payload_len) == 0);
+    assert(memcmp(rcp_datagram_payload(&parsed_datagram), rcp_datagram_payload(&datagram),
+                  datagram.header.payload_len) == 0);
     printk("Parsed datagram fields match original\n");
 
     // Verify the checksum of the parsed datagram
-    assert(rcp_verify_checksum(&parsed_datagram.header, parsed_datagram.payload));
+    assert(rcp_datagram_verify_checksum(&parsed_datagram));
     printk("Parsed datagram checksum verified\n");
 
     printk("RCP serialization and parsing passed!\n");
     printk("--------------------------------\n");
 }
 
+// Test that datagram payloads are inline or borrowed, never allocated
+static void test_rcp_payload_storage(void) {
+    printk("--------------------------------\n");
+    printk("Testing RCP payload storage...\n");
+
+    // An inline payload travels with the datagram when it is copied
+    const char *test_payload = "inline payload";
+    rcp_datagram_t datagram = rcp_datagram_init();
+    rcp_datagram_set_payload(&datagram, test_payload, strlen(test_payload));
+    rcp_datagram_t copy = datagram;
+    assert(rcp_datagram_payload(&copy) == copy.payload);
+    assert(memcmp(rcp_datagram_payload(&copy), test_payload, strlen(test_payload)) == 0);
+    printk("Inline payload survives a copy\n");
+
+    // A borrowed payload is serialized straight from the caller's memory
+    const char *borrowed_payload = "borrowed payload";
+    rcp_datagram_borrow_payload(&datagram, borrowed_payload, strlen(borrowed_payload));
+    assert(rcp_datagram_payload(&datagram) == (const uint8_t *)borrowed_payload);
+    rcp_datagram_compute_checksum(&datagram);
+
+    uint8_t buffer[RCP_TOTAL_SIZE];
+    int length = rcp_datagram_serialize(&datagram, buffer, sizeof(buffer));
+    assert(length == RCP_HEADER_LENGTH + (int)strlen(borrowed_payload));
+
+    // Parsing borrows the payload from the wire buffer
+    rcp_datagram_t parsed = rcp_datagram_init();
+    assert(rcp_datagram_parse(&parsed, buffer, length));
+    assert(rcp_datagram_payload(&parsed) == buffer + RCP_HEADER_LENGTH);
+    assert(rcp_datagram_verify_checksum(&parsed));
+    printk("Parsed payload points into the wire buffer\n");
+
+    // Corrupting the wire buffer is seen through the borrowed payload
+    buffer[RCP_HEADER_LENGTH] ^= 0xFF;
+    assert(!rcp_datagram_verify_checksum(&parsed));
+
+    printk("RCP payload storage passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Test that the one-pass encoder and decoder agree with the separate steps
+static void test_rcp_encode_decode(void) {
+    printk("--------------------------------\n");
+    printk("Testing RCP one-pass encode/decode...\n");
+
+    uint8_t payload[RCP_MAX_PAYLOAD];
+    for (unsigned trial = 0; trial < 200; trial++) {
+        // Vary every field, including odd and even payload lengths
+        rcp_datagram_t datagram = rcp_datagram_init();
+        datagram.header.src = trial;
+        datagram.header.dst = trial * 7;
+        datagram.header.seqno = trial * 331;
+        datagram.header.ackno = ~trial * 17;
+        datagram.header.window = trial * 101;
+        datagram.header.flags = trial & (RCP_FLAG_SYN | RCP_FLAG_ACK | RCP_FLAG_FIN);
+        size_t len = trial % (RCP_MAX_PAYLOAD + 1);
+        for (size_t i = 0; i < len; i++) {
+            payload[i] = trial * 13 + i * 29;
+        }
+        rcp_datagram_borrow_payload(&datagram, payload, len);
+
+        // The encoder writes the same bytes and checksum as compute + serialize
+        uint8_t encoded[RCP_TOTAL_SIZE], serialized[RCP_TOTAL_SIZE];
+        int length = rcp_datagram_encode(&datagram, encoded, sizeof(encoded));
+        assert(length == RCP_HEADER_LENGTH + (int)len);
+        uint16_t cksum = datagram.header.cksum;
+        rcp_datagram_compute_checksum(&datagram);
+        assert(datagram.header.cksum == cksum);
+        assert(rcp_datagram_serialize(&datagram, serialized, sizeof(serialized)) == length);
+        assert(memcmp(encoded, serialized, length) == 0);
+
+        // The decoder accepts it and matches parse + verify
+        rcp_datagram_t decoded = rcp_datagram_init();
+        assert(rcp_datagram_decode(&decoded, encoded, length));
+        assert(decoded.header.seqno == datagram.header.seqno);
+        assert(decoded.header.ackno == datagram.header.ackno);
+        assert(decoded.header.window == datagram.header.window);
+        assert(decoded.header.flags == datagram.header.flags);
+        assert(memcmp(rcp_datagram_payload(&decoded), payload, len) == 0);
+        assert(rcp_datagram_verify_checksum(&decoded));
+
+        // A corrupted byte, or a length past the end of the buffer, is rejected (the hop
+        // limit is the one byte routers may change)
+        size_t at = trial % length == RCP_HOPS_OFFSET ? RCP_HOPS_OFFSET + 1 : trial % length;
+        encoded[at] ^= 0x01;
+        assert(!rcp_datagram_decode(&decoded, encoded, length));
+        encoded[at] ^= 0x01;
+        assert(!rcp_datagram_decode(&decoded, encoded, length - 1));
+    }
+    printk("Encoder and decoder match the reference path\n");
+
+    printk("RCP one-pass encode/decode passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Test the compact ACK and data header forms
+static void test_rcp_compact(void) {
+    printk("--------------------------------\n");
+    printk("Testing RCP compact headers...\n");
+
+    uint8_t buffer[RCP_TOTAL_SIZE];
+
+    // A compact ACK keeps the ackno and window and gets its source from the context
+    rcp_datagram_t ack = rcp_datagram_init();
+    ack.header.src = 1;
+    ack.header.dst = 2;
+    ack.header.ackno = 0xBEEF;
+    ack.header.window = 1000;
+    rcp_set_flag(&ack.header, RCP_FLAG_ACK);
+    int length = rcp_compact_encode(&ack, buffer, sizeof(buffer));
+    assert(length == RCP_COMPACT_ACK_LENGTH && length < RCP_HEADER_LENGTH);
+    assert(rcp_is_compact(buffer));
+
+    rcp_datagram_t parsed = rcp_datagram_init();
+    assert(!rcp_datagram_decode(&parsed, buffer, length));  // Not a full header
+    assert(rcp_compact_decode(&parsed, buffer, length, 1));
+    assert(rcp_has_flag(&parsed.header, RCP_FLAG_ACK));
+    assert(parsed.header.src == 1 && parsed.header.dst == 2);
+    assert(parsed.header.ackno == 0xBEEF && parsed.header.window == 1000);
+    assert(parsed.header.payload_len == 0);
+    printk("Compact ACK is %d bytes (full header is %d)\n", length, RCP_HEADER_LENGTH);
+
+    // A compact data segment carries more payload than a full header allows
+    uint8_t payload[RCP_COMPACT_MAX_PAYLOAD];
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = i * 7;
+    }
+    rcp_datagram_t data = rcp_datagram_init();
+    data.header.src = 1;
+    data.header.dst = 2;
+    data.header.seqno = 0x1234;
+    rcp_set_flag(&data.header, RCP_FLAG_FIN);
+    assert(rcp_datagram_borrow_payload(&data, payload, sizeof(payload)) == 0);
+    length = rcp_compact_encode(&data, buffer, sizeof(buffer));
+    assert(length == RCP_TOTAL_SIZE);
+    assert(RCP_COMPACT_MAX_PAYLOAD > RCP_MAX_PAYLOAD);
+
+    assert(rcp_compact_decode(&parsed, buffer, length, 1));
+    assert(parsed.header.seqno == 0x1234 && parsed.header.dst == 2);
+    assert(rcp_has_flag(&parsed.header, RCP_FLAG_FIN));
+    assert(!rcp_has_flag(&parsed.header, RCP_FLAG_ACK));
+    assert(parsed.header.payload_len == sizeof(payload));
+    assert(memcmp(rcp_datagram_payload(&parsed), payload, sizeof(payload)) == 0);
+    printk("Compact data carries %d payload bytes (full header: %d)\n",
+           RCP_COMPACT_MAX_PAYLOAD, RCP_MAX_PAYLOAD);
+
+    // Routers find the destination at the same offset in both forms
+    uint8_t full[RCP_TOTAL_SIZE];
+    rcp_datagram_t syn = rcp_datagram_init();
+    syn.header.dst = 2;
+    rcp_set_flag(&syn.header, RCP_FLAG_SYN);
+    assert(rcp_compact_encode(&syn, full, sizeof(full)) == -1);  // SYNs need the full header
+    rcp_datagram_encode(&syn, full, sizeof(full));
+    assert(full[1 + RCP_CKSUM_LENGTH] == buffer[1 + RCP_CKSUM_LENGTH]);
+
+    // ... and the hop limit, which they count down without touching the checksum
+    assert(full[RCP_HOPS_OFFSET] == RCP_DEFAULT_HOPS);
+    assert(buffer[RCP_HOPS_OFFSET] == RCP_DEFAULT_HOPS);
+    full[RCP_HOPS_OFFSET]--;
+    buffer[RCP_HOPS_OFFSET]--;
+    assert(rcp_datagram_decode(&parsed, full, sizeof(full)));
+    assert(parsed.header.hops == RCP_DEFAULT_HOPS - 1);
+    assert(rcp_compact_decode(&parsed, buffer, length, 1));
+    assert(parsed.header.hops == RCP_DEFAULT_HOPS - 1);
+
+    // Corruption is caught before anything is parsed
+    buffer[RCP_COMPACT_DATA_LENGTH] ^= 0x10;
+    assert(!rcp_compact_decode(&parsed, buffer, length, 1));
+
+    printk("RCP compact headers passed!\n");
+    printk("--------------------------------\n");
+}
+
 void notmain(void) {
     printk("Starting RCP implementation tests...\n\n");
     kmalloc_init(64);
@@ -147,6 +320,9 @@ void notmain(void) {
     test_rcp_flags();
     test_rcp_checksum();
     test_rcp_serialization();
+    test_rcp_payload_storage();
+    test_rcp_encode_decode();
+    test_rcp_compact();
 
     printk("\nAll RCP tests passed!\n");
 }
\ No newline at end of file
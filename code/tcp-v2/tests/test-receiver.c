@@ -289,12 +289,63 @@ static void test_receiver(void) {
     printk("--------------------------------\n");
 }
 
+// Test a session whose ISN makes sequence numbers wrap around
+static void test_receiver_wrapping_isn(void) {
+    printk("--------------------------------\n");
+    printk("Starting wrapping ISN test...\n");
+
+    mock_nrf_t mock_nrf = mock_nrf_init();
+    static sender_t sender;
+    static receiver_t receiver;
+    sender = sender_init((nrf_t *)&mock_nrf, sender_mock_transmit, NULL);
+    receiver = receiver_init((nrf_t *)&mock_nrf, receiver_mock_transmit, NULL);
+
+    // Start close to the top of the 16-bit sequence space
+    const uint16_t isn = 0xFFF0;
+    sender_set_isn(&sender, isn);
+
+    // The first segment is the SYN and carries data
+    const char *test_data = "Data in the SYN, then more data that wraps the seqno";
+    size_t len = strlen(test_data);
+    bs_write(&sender.reader, (uint8_t *)test_data, len);
+    send_and_process(&sender, &receiver);
+    assert(last_sender_segment.is_syn && last_sender_segment.len > 0);
+    assert(receiver.syn_received && receiver.isn == isn);
+    assert(bs_bytes_available(&receiver.writer) == last_sender_segment.len);
+    printk("SYN delivered %u bytes\n", last_sender_segment.len);
+
+    while (bs_bytes_available(&sender.reader) > 0) {
+        send_and_process(&sender, &receiver);
+    }
+    assert(sender.next_seqno < isn);  // Wrapped
+    assert(last_ack.ackno == (uint16_t)(isn + 1 + len));
+    assert(rtq_empty(&sender.pending_segs));
+
+    uint8_t read_buffer[100];
+    size_t read = bs_read(&receiver.writer, read_buffer, sizeof(read_buffer));
+    assert(read == len);
+    assert(memcmp(read_buffer, test_data, len) == 0);
+    printk("Data reassembled across the wraparound\n");
+
+    // A segment from an older session lands before the start of this stream: ignored
+    sender_segment_t stale = {.seqno = isn - 100, .len = 5, .is_syn = false, .is_fin = false};
+    memcpy(stale.payload, "stale", 5);
+    recv_process_segment(&receiver, &stale);
+    assert(bs_bytes_written(&receiver.writer) == len);
+    assert(last_ack.ackno == (uint16_t)(isn + 1 + len));
+    printk("Stale segment rejected\n");
+
+    printk("Wrapping ISN test passed!\n");
+    printk("--------------------------------\n");
+}
+
 void notmain(void) {
     printk("Starting TCP implementation tests...\n\n");
     kmalloc_init(64);
     printk("Memory initialized\n");
 
     test_receiver();
+    test_receiver_wrapping_isn();
 
     printk("\nReceiver test passed!\n");
 }
\ No newline at end of file
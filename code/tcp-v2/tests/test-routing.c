@@ -0,0 +1,502 @@
+#include <string.h>
+
+#include "routing.h"
+
+#define N_NODES 24
+#define FIELD 1000      /* Nodes are placed on a FIELD x FIELD square */
+#define RADIO_RANGE 280 /* Nodes closer than this hear each other */
+#define MIN_DIAMETER 4  /* Shortest longest path we accept, so routes are multi-hop */
+#define MAX_QUEUED 1024 /* Updates in flight at once */
+
+#define NODE_ADDR(i) ((uint8_t)((i) + 1))  /* RCP address of node <i> */
+#define NODE_NRF(i) (0xc00000 + (i))       /* NRF address of node <i> */
+#define NODE_INDEX(addr) ((int)(addr) - 1) /* Node with RCP address <addr> */
+
+// The simulated network: where each node is, and who can hear whom
+static dv_t nodes[N_NODES];
+static int x[N_NODES], y[N_NODES];
+static bool alive[N_NODES];
+static bool link_up[N_NODES][N_NODES];
+static unsigned loss_pct[N_NODES][N_NODES]; /* Chance each neighbor misses an update */
+
+// Updates broadcast but not yet heard
+static struct {
+    int from;
+    uint8_t pkt[RCP_TOTAL_SIZE];
+    size_t len;
+} air[MAX_QUEUED];
+static size_t n_air;
+
+static void broadcast(dv_t *dv, const uint8_t *pkt, size_t len) {
+    assert(n_air < MAX_QUEUED);
+    air[n_air].from = dv - nodes;
+    memcpy(air[n_air].pkt, pkt, len);
+    air[n_air].len = len;
+    n_air++;
+}
+
+// Hand every update in flight to the live nodes in range of its sender
+static void deliver(void) {
+    for (size_t p = 0; p < n_air; p++) {
+        for (int j = 0; j < N_NODES; j++) {
+            if (alive[j] && link_up[air[p].from][j] &&
+                pi_random() % 100 >= loss_pct[air[p].from][j]) {
+                assert(dv_process_packet(&nodes[j], air[p].pkt, air[p].len));
+            }
+        }
+    }
+    n_air = 0;
+}
+
+static void set_loss(unsigned pct) {
+    for (int i = 0; i < N_NODES; i++) {
+        for (int j = 0; j < N_NODES; j++) {
+            loss_pct[i][j] = pct;
+        }
+    }
+}
+
+static void update_links(void) {
+    for (int i = 0; i < N_NODES; i++) {
+        for (int j = 0; j < N_NODES; j++) {
+            int dx = x[i] - x[j], dy = y[i] - y[j];
+            link_up[i][j] = i != j && dx * dx + dy * dy <= RADIO_RANGE * RADIO_RANGE;
+        }
+    }
+}
+
+// Hop counts from <src> over the live links (-1 if unreachable)
+static void bfs(int src, int *dist) {
+    int queue[N_NODES], head = 0, tail = 0;
+    for (int i = 0; i < N_NODES; i++) {
+        dist[i] = -1;
+    }
+    dist[src] = 0;
+    queue[tail++] = src;
+    while (head < tail) {
+        int u = queue[head++];
+        for (int v = 0; v < N_NODES; v++) {
+            if (alive[v] && link_up[u][v] && dist[v] < 0) {
+                dist[v] = dist[u] + 1;
+                queue[tail++] = v;
+            }
+        }
+    }
+}
+
+// Longest shortest path between live nodes (-1 if the network is split)
+static int diameter(void) {
+    int longest = 0, dist[N_NODES];
+    for (int i = 0; i < N_NODES; i++) {
+        if (!alive[i]) {
+            continue;
+        }
+        bfs(i, dist);
+        for (int j = 0; j < N_NODES; j++) {
+            if (alive[j] && dist[j] < 0) {
+                return -1;
+            }
+            if (dist[j] > longest) {
+                longest = dist[j];
+            }
+        }
+    }
+    return longest;
+}
+
+// Check that every node's next hops lead to every destination without loops, and that
+// nothing routes to a destination it can't reach
+// - With <shortest>, every route must also be a fewest-hop path over perfect links.
+static bool converged(bool shortest) {
+    int dist[N_NODES];
+    for (int src = 0; src < N_NODES; src++) {
+        if (!alive[src]) {
+            continue;
+        }
+        bfs(src, dist);
+        for (int dst = 0; dst < N_NODES; dst++) {
+            if (dst == src) {
+                continue;
+            }
+            uint32_t nrf_addr;
+            if (dist[dst] < 0) {
+                if (dv_next_hop(&nodes[src], NODE_ADDR(dst), &nrf_addr)) {
+                    return false;
+                }
+                continue;
+            }
+            if (shortest && dv_cost(&nodes[src], NODE_ADDR(dst)) != dist[dst] * DV_ETX_SCALE) {
+                return false;
+            }
+
+            // Follow the next hops, which must be links that exist
+            int at = src, hops = 0;
+            while (at != dst && hops < N_NODES) {
+                if (!dv_next_hop(&nodes[at], NODE_ADDR(dst), &nrf_addr)) {
+                    return false;
+                }
+                int next = NODE_INDEX(nodes[at].routes[NODE_ADDR(dst)].next_hop);
+                if (next < 0 || next >= N_NODES || !alive[next] || !link_up[at][next] ||
+                    nrf_addr != NODE_NRF(next)) {
+                    return false;
+                }
+                at = next;
+                hops++;
+            }
+            if (at != dst || (shortest && hops != dist[dst])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static unsigned total_updates(void) {
+    unsigned n = 0;
+    for (int i = 0; i < N_NODES; i++) {
+        n += nodes[i].updates_sent;
+    }
+    return n;
+}
+
+// Run the protocol on every live node until the routes are right, or <limit_us> passes
+static bool run_until_converged(const char *what, uint32_t limit_us, bool shortest) {
+    uint32_t start = timer_get_usec();
+    unsigned start_updates = total_updates();
+
+    while (timer_get_usec() - start < limit_us) {
+        for (int i = 0; i < N_NODES; i++) {
+            if (alive[i]) {
+                dv_tick(&nodes[i]);
+            }
+        }
+        deliver();
+        if (converged(shortest)) {
+            printk("%s: converged in %u us (%u update packets)\n", what,
+                   timer_get_usec() - start, total_updates() - start_updates);
+            return true;
+        }
+    }
+    printk("%s: did not converge in %u us\n", what, limit_us);
+    return false;
+}
+
+// Run the protocol for <us> microseconds
+static void run_for(uint32_t us) {
+    uint32_t start = timer_get_usec();
+    while (timer_get_usec() - start < us) {
+        for (int i = 0; i < N_NODES; i++) {
+            if (alive[i]) {
+                dv_tick(&nodes[i]);
+            }
+        }
+        deliver();
+    }
+}
+
+static void start_node(int i) {
+    dv_init(&nodes[i], NULL, NODE_ADDR(i), NODE_NRF(i));
+    nodes[i].transmit = broadcast;
+    nodes[i].period_us = 20000;
+    nodes[i].timeout_us = 120000;
+    nodes[i].gc_us = 40000;
+    nodes[i].trigger_delay_us = 4000;
+    alive[i] = true;
+}
+
+// Scatter the nodes until they form a connected network at least MIN_DIAMETER hops across
+static void make_topology(void) {
+    int d;
+    do {
+        for (int i = 0; i < N_NODES; i++) {
+            x[i] = pi_random() % FIELD;
+            y[i] = pi_random() % FIELD;
+            alive[i] = true;
+        }
+        update_links();
+        d = diameter();
+    } while (d < MIN_DIAMETER);
+    printk("%u nodes, diameter %d hops\n", N_NODES, d);
+}
+
+// Limit for (re)convergence: a neighbor timeout, then a few periods to spread the news
+#define CONVERGE_LIMIT_US (120000 + 10 * 20000)
+
+// Test that routes are learned from scratch, even with some updates lost
+static void test_routing_converge(void) {
+    printk("--------------------------------\n");
+    printk("Testing route discovery...\n");
+
+    make_topology();
+    n_air = 0;
+    for (int i = 0; i < N_NODES; i++) {
+        start_node(i);
+    }
+    assert(run_until_converged("Initial", CONVERGE_LIMIT_US, true));
+
+    // Routes stay put while nothing changes
+    unsigned changes = 0;
+    for (int i = 0; i < N_NODES; i++) {
+        changes += nodes[i].route_changes;
+    }
+    run_for(50000);
+    assert(converged(true));
+    for (int i = 0; i < N_NODES; i++) {
+        changes -= nodes[i].route_changes;
+    }
+    assert(changes == 0);
+    printk("Routes stable with no topology change\n");
+
+    // Lost updates are made up for by the periodic ones (the routes needn't be fewest-hop,
+    // since lossy links cost more)
+    set_loss(20);
+    for (int i = 0; i < N_NODES; i++) {
+        start_node(i);
+    }
+    assert(run_until_converged("With 20% loss", CONVERGE_LIMIT_US, false));
+
+    set_loss(0);
+    for (int i = 0; i < N_NODES; i++) {
+        start_node(i);
+    }
+    assert(run_until_converged("Lossless again", CONVERGE_LIMIT_US, true));
+
+    printk("Route discovery test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Test that the network routes around broken links, failed nodes, and nodes that move
+static void test_routing_changes(void) {
+    printk("--------------------------------\n");
+    printk("Testing route changes...\n");
+
+    // Break a link, as long as the network stays connected
+    bool broke = false;
+    for (int i = 0; i < N_NODES && !broke; i++) {
+        for (int j = i + 1; j < N_NODES && !broke; j++) {
+            if (!link_up[i][j]) {
+                continue;
+            }
+            link_up[i][j] = link_up[j][i] = false;
+            if (diameter() > 0) {
+                broke = true;
+                printk("Link %d-%d broken\n", i, j);
+            } else {
+                link_up[i][j] = link_up[j][i] = true;
+            }
+        }
+    }
+    assert(broke);
+    assert(!converged(true));
+    assert(run_until_converged("Link break", CONVERGE_LIMIT_US, true));
+
+    // Fail a node with the most neighbors; everyone must stop routing to it
+    int victim = 0, most = 0;
+    for (int i = 0; i < N_NODES; i++) {
+        int degree = 0;
+        for (int j = 0; j < N_NODES; j++) {
+            degree += link_up[i][j];
+        }
+        if (degree > most) {
+            most = degree;
+            victim = i;
+        }
+    }
+    alive[victim] = false;
+    printk("Node %d failed (%d neighbors)\n", victim, most);
+    assert(run_until_converged("Node failure", CONVERGE_LIMIT_US, true));
+
+    // Once the news has spread, the dead node is forgotten entirely
+    run_for(nodes[0].gc_us + nodes[0].timeout_us);
+    for (int i = 0; i < N_NODES; i++) {
+        assert(!alive[i] || !nodes[i].routes[NODE_ADDR(victim)].in_use);
+    }
+    printk("Failed node garbage-collected\n");
+
+    // Move a node somewhere else (keeping the network connected)
+    int mover = (victim + 1) % N_NODES;
+    int old_x = x[mover], old_y = y[mover];
+    do {
+        x[mover] = pi_random() % FIELD;
+        y[mover] = pi_random() % FIELD;
+        update_links();
+    } while (diameter() < 0);
+    printk("Node %d moved (%d,%d) -> (%d,%d)\n", mover, old_x, old_y, x[mover], y[mover]);
+    assert(run_until_converged("Node move", CONVERGE_LIMIT_US, true));
+
+    // The failed node comes back
+    start_node(victim);
+    update_links();
+    assert(run_until_converged("Node recovery", CONVERGE_LIMIT_US, true));
+
+    printk("Route change test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Expected transmissions to cross the link from <i> to <j> and get the ACK back (x1000)
+static unsigned true_etx(int i, int j) {
+    return 1000 * 10000 / ((100 - loss_pct[i][j]) * (100 - loss_pct[j][i]));
+}
+
+// Expected transmissions along the fewest-hop path from <src> to <dst> (x1000)
+static unsigned min_hop_etx(int src, int dst) {
+    int dist[N_NODES];
+    bfs(dst, dist);
+    unsigned total = 0;
+    for (int at = src; at != dst;) {
+        int next = -1;
+        for (int v = 0; v < N_NODES && next < 0; v++) {
+            if (alive[v] && link_up[at][v] && dist[v] == dist[at] - 1) {
+                next = v;
+            }
+        }
+        total += true_etx(at, next);
+        at = next;
+    }
+    return total;
+}
+
+// Least expected transmissions from <src> to every node (x1000, Dijkstra)
+static void best_etx(int src, unsigned *best) {
+    bool done[N_NODES] = {false};
+    for (int i = 0; i < N_NODES; i++) {
+        best[i] = ~0u;
+    }
+    best[src] = 0;
+    for (int round = 0; round < N_NODES; round++) {
+        int u = -1;
+        for (int i = 0; i < N_NODES; i++) {
+            if (alive[i] && !done[i] && best[i] != ~0u && (u < 0 || best[i] < best[u])) {
+                u = i;
+            }
+        }
+        if (u < 0) {
+            break;
+        }
+        done[u] = true;
+        for (int v = 0; v < N_NODES; v++) {
+            if (alive[v] && link_up[u][v] && best[u] + true_etx(u, v) < best[v]) {
+                best[v] = best[u] + true_etx(u, v);
+            }
+        }
+    }
+}
+
+// Test that routes avoid lossy links, preferring more hops over better links
+static void test_routing_etx(void) {
+    printk("--------------------------------\n");
+    printk("Testing ETX route selection...\n");
+
+    // A triangle whose direct link loses 60% each way: two clean hops are cheaper
+    make_topology();
+    set_loss(0);
+    for (int i = 0; i < N_NODES; i++) {
+        alive[i] = false;
+        for (int j = 0; j < N_NODES; j++) {
+            link_up[i][j] = false;
+        }
+    }
+    link_up[0][1] = link_up[1][0] = link_up[1][2] = link_up[2][1] = true;
+    link_up[0][2] = link_up[2][0] = true;
+    loss_pct[0][2] = loss_pct[2][0] = 60;
+    n_air = 0;
+    for (int i = 0; i < 3; i++) {
+        start_node(i);
+    }
+    run_for(20 * nodes[0].period_us);
+    uint8_t direct = dv_link_cost(&nodes[0], NODE_ADDR(2));
+    printk("Lossy link costs %u (a clean one costs %u)\n", direct, DV_ETX_SCALE);
+    assert(dv_link_cost(&nodes[0], NODE_ADDR(1)) == DV_ETX_SCALE);
+
+    // The estimates are noisy, so check the routes over a while rather than once
+    int via_clean = 0;
+    for (int i = 0; i < 10; i++) {
+        run_for(nodes[0].period_us);
+        via_clean += nodes[0].routes[NODE_ADDR(2)].next_hop == NODE_ADDR(1) &&
+                     nodes[2].routes[NODE_ADDR(0)].next_hop == NODE_ADDR(1) &&
+                     dv_cost(&nodes[0], NODE_ADDR(2)) == 2 * DV_ETX_SCALE;
+    }
+    printk("Routed around the lossy link in %d of 10 checks\n", via_clean);
+    assert(via_clean >= 8);
+    printk("Two clean hops chosen over one lossy one\n");
+
+    // Retransmissions seen while sending data raise a link's cost, and clean sends lower it
+    for (int i = 0; i < 16; i++) {
+        dv_link_observe(&nodes[0], NODE_ADDR(1), 3, true);
+    }
+    uint8_t retrying = dv_link_cost(&nodes[0], NODE_ADDR(1));
+    for (int i = 0; i < 64; i++) {
+        dv_link_observe(&nodes[0], NODE_ADDR(1), 1, true);
+    }
+    printk("Link with 3 tries per packet costs %u, then %u once clean\n", retrying,
+           dv_link_cost(&nodes[0], NODE_ADDR(1)));
+    assert(retrying >= 2 * DV_ETX_SCALE);
+    assert(dv_link_cost(&nodes[0], NODE_ADDR(1)) == DV_ETX_SCALE);
+
+    // Data sends learn about the next hop they went to, and only while the route uses it
+    assert(dv_hop_addr(&nodes[0], NODE_ADDR(1), NODE_NRF(1)) == NODE_ADDR(1));
+    assert(dv_hop_addr(&nodes[0], NODE_ADDR(1), NODE_NRF(2)) == RCP_BROADCAST);
+    assert(dv_hop_addr(&nodes[0], RCP_BROADCAST, 0) == RCP_BROADCAST);
+
+    // A multi-hop network where the longest links are marginal (the ones fewest-hop routing
+    // likes best), but the good links alone still connect everyone
+    int good_diameter;
+    do {
+        make_topology();
+        for (int i = 0; i < N_NODES; i++) {
+            for (int j = 0; j < N_NODES; j++) {
+                int dx = x[i] - x[j], dy = y[i] - y[j];
+                bool marginal = 4 * (dx * dx + dy * dy) > 3 * RADIO_RANGE * RADIO_RANGE;
+                loss_pct[i][j] = marginal ? 50 + pi_random() % 26 : pi_random() % 11;
+                link_up[i][j] = link_up[i][j] && !marginal;
+            }
+        }
+        good_diameter = diameter();
+        update_links();
+    } while (good_diameter < 0);
+    n_air = 0;
+    for (int i = 0; i < N_NODES; i++) {
+        start_node(i);
+    }
+    run_for(20 * nodes[0].period_us);
+    assert(run_until_converged("Mixed links", CONVERGE_LIMIT_US, false));
+
+    // Compare the expected transmissions of the routes chosen with fewest-hop routes and
+    // the best possible
+    unsigned long long chosen = 0, min_hop = 0, optimal = 0;
+    for (int src = 0; src < N_NODES; src++) {
+        unsigned best[N_NODES];
+        best_etx(src, best);
+        for (int dst = 0; dst < N_NODES; dst++) {
+            if (dst == src) {
+                continue;
+            }
+            for (int at = src; at != dst;) {
+                int next = NODE_INDEX(nodes[at].routes[NODE_ADDR(dst)].next_hop);
+                chosen += true_etx(at, next);
+                at = next;
+            }
+            min_hop += min_hop_etx(src, dst);
+            optimal += best[dst];
+        }
+    }
+    unsigned n_pairs = N_NODES * (N_NODES - 1);
+    printk("Mean transmissions per delivery (x1000): chosen %u, fewest-hop %u, best %u\n",
+           (unsigned)(chosen / n_pairs), (unsigned)(min_hop / n_pairs),
+           (unsigned)(optimal / n_pairs));
+    assert(chosen < min_hop);
+    assert(chosen * 100 <= optimal * 110);
+
+    printk("ETX route selection test passed!\n");
+    printk("--------------------------------\n");
+}
+
+void notmain(void) {
+    printk("Starting routing tests...\n\n");
+
+    test_routing_converge();
+    test_routing_changes();
+    test_routing_etx();
+
+    printk("\nRouting tests passed!\n");
+}
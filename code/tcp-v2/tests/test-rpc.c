@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "rpc.h"
+
+// Two endpoints wired back to back (no radio: bytes are moved by hand)
+static tcp_peer_t client_peer, server_peer;
+static rpc_t client, server;
+
+// Completion tracking
+static int n_done = 0;
+static int order[RPC_MAX_OUTSTANDING];
+static rpc_status_t last_status;
+static uint32_t last_value;
+
+// Move everything queued on <from> to <to> and let <to> find the complete messages
+static void deliver(tcp_peer_t *from, tcp_peer_t *to) {
+    uint8_t chunk[RCP_MAX_PAYLOAD];
+    size_t n;
+    while ((n = bs_read(&from->sender.reader, chunk, sizeof(chunk))) > 0) {
+        bs_write(&to->receiver.writer, chunk, n);
+    }
+    framer_scan(&to->rx_framer, &to->receiver.writer);
+}
+
+// Method 1: read "sensor" <n>, replies with 100 * n
+static int read_sensor(void *arg, const uint8_t *req, size_t req_len, uint8_t *resp,
+                       size_t resp_max) {
+    if (req_len != 1) {
+        return -1;
+    }
+    uint32_t value = 100 * req[0];
+    memcpy(resp, &value, sizeof(value));
+    return sizeof(value);
+}
+
+static void on_done(void *arg, rpc_status_t status, const uint8_t *resp, size_t len) {
+    order[n_done++] = (int)(uintptr_t)arg;
+    last_status = status;
+    if (status == RPC_OK && len == sizeof(last_value)) {
+        memcpy(&last_value, resp, sizeof(last_value));
+    }
+}
+
+// Test pipelined RPC calls
+static void test_rpc(void) {
+    printk("--------------------------------\n");
+    printk("Starting RPC test...\n");
+
+    tcp_peer_init(&client_peer, NULL, NULL, 1, 2);
+    tcp_peer_init(&server_peer, NULL, NULL, 2, 1);
+    rpc_init(&client, &client_peer);
+    rpc_init(&server, &server_peer);
+    rpc_register(&server, 1, read_sensor, NULL);
+
+    // Fill the call table without waiting for any reply
+    for (int i = 0; i < RPC_MAX_OUTSTANDING; i++) {
+        uint8_t sensor = i;
+        assert(rpc_call(&client, 1, &sensor, 1, S_TO_US(1), on_done, (void *)(uintptr_t)i) >= 0);
+    }
+    assert(rpc_outstanding(&client) == RPC_MAX_OUTSTANDING);
+    uint8_t sensor = 0;
+    assert(rpc_call(&client, 1, &sensor, 1, S_TO_US(1), on_done, NULL) == -1);
+    printk("%u calls in flight, table full\n", rpc_outstanding(&client));
+
+    // One round trip completes all of them
+    deliver(&client_peer, &server_peer);
+    rpc_process_incoming(&server);
+    assert(server.stats.n_served == RPC_MAX_OUTSTANDING);
+    deliver(&server_peer, &client_peer);
+    rpc_process_incoming(&client);
+    assert(n_done == RPC_MAX_OUTSTANDING);
+    assert(rpc_outstanding(&client) == 0);
+    assert(last_status == RPC_OK && last_value == 100 * (RPC_MAX_OUTSTANDING - 1));
+    printk("All calls completed in one round trip\n");
+
+    // Replies are matched by ID, so they may arrive in any order
+    n_done = 0;
+    uint8_t a = 1, b = 2;
+    int id_a = rpc_call(&client, 1, &a, 1, S_TO_US(1), on_done, (void *)1);
+    int id_b = rpc_call(&client, 1, &b, 1, S_TO_US(1), on_done, (void *)2);
+    assert(id_a >= 0 && id_b >= 0 && id_a != id_b);
+
+    // Drop the requests in transit and reply to them in reverse order by hand
+    uint8_t lost[64];
+    bs_read(&client_peer.sender.reader, lost, sizeof(lost));
+
+    uint8_t reply_b[] = {RPC_TYPE_RESPONSE, id_b, 1, 0, 0, 0, 0};
+    uint8_t reply_a[] = {RPC_TYPE_RESPONSE, id_a, 1, 0, 0, 0, 0};
+    framer_write(&client_peer.receiver.writer, reply_b, sizeof(reply_b));
+    framer_write(&client_peer.receiver.writer, reply_a, sizeof(reply_a));
+    framer_scan(&client_peer.rx_framer, &client_peer.receiver.writer);
+    rpc_process_incoming(&client);
+    assert(n_done == 2 && order[0] == 2 && order[1] == 1);
+    printk("Out-of-order replies completed the right calls\n");
+
+    // Unknown methods and handler failures come back as errors
+    n_done = 0;
+    assert(rpc_call(&client, 7, NULL, 0, S_TO_US(1), on_done, NULL) >= 0);
+    deliver(&client_peer, &server_peer);
+    rpc_process_incoming(&server);
+    deliver(&server_peer, &client_peer);
+    rpc_process_incoming(&client);
+    assert(n_done == 1 && last_status == RPC_ERR_NO_METHOD);
+
+    n_done = 0;
+    assert(rpc_call(&client, 1, NULL, 0, S_TO_US(1), on_done, NULL) >= 0);
+    deliver(&client_peer, &server_peer);
+    rpc_process_incoming(&server);
+    deliver(&server_peer, &client_peer);
+    rpc_process_incoming(&client);
+    assert(n_done == 1 && last_status == RPC_ERR_REMOTE);
+    printk("Error replies reported\n");
+
+    // A call that times out is completed once; its late reply is dropped
+    n_done = 0;
+    assert(rpc_call(&client, 1, &sensor, 1, 0, on_done, NULL) >= 0);
+    rpc_check_deadlines(&client);
+    assert(n_done == 1 && last_status == RPC_ERR_TIMEOUT);
+    deliver(&client_peer, &server_peer);
+    rpc_process_incoming(&server);
+    deliver(&server_peer, &client_peer);
+    rpc_process_incoming(&client);
+    assert(n_done == 1);
+    assert(client.stats.n_stale == 1);
+    printk("Timed-out call's late reply dropped\n");
+
+    rpc_print_stats(&client);
+
+    printk("RPC test passed!\n");
+    printk("--------------------------------\n");
+}
+
+void notmain(void) {
+    printk("Starting TCP implementation tests...\n\n");
+    kmalloc_init(64);
+    printk("Memory initialized\n");
+
+    test_rpc();
+
+    printk("\nRPC test passed!\n");
+}
@@ -169,12 +169,151 @@ static void test_sender(void) {
     printk("--------------------------------\n");
 }
 
+// Test that the sender keeps its connection statistics
+static void test_sender_stats(void) {
+    printk("--------------------------------\n");
+    printk("Starting sender stats test...\n");
+
+    mock_nrf_t mock_nrf = mock_nrf_init();
+    sender_t sender = sender_init((nrf_t *)&mock_nrf, mock_transmit, NULL);
+    tcp_stats_t stats = tcp_stats_init();
+    sender.stats = &stats;
+
+    // Send the SYN and three full segments
+    uint8_t data[3 * RCP_MAX_PAYLOAD];
+    memset(data, 'x', sizeof(data));
+    bs_write(&sender.reader, data, sizeof(data));
+    for (int i = 0; i < 3; i++) {
+        sender_push(&sender);
+    }
+    assert(bs_bytes_available(&sender.reader) == 0);
+
+    // ACK the first segment, then repeat that ACK as if the second segment was lost
+    unacked_segment_t *first = rtq_start(&sender.pending_segs);
+    receiver_segment_t reply = {
+        .is_ack = true,
+        .ackno = first->seg.seqno + first->seg.len + 1,
+        .window_size = INITIAL_WINDOW_SIZE,
+    };
+    sender_process_reply(&sender, &reply);
+
+    segment_count = 0;
+    for (int i = 0; i < DUP_ACK_THRESHOLD; i++) {
+        sender_process_reply(&sender, &reply);
+    }
+    assert(stats.dup_acks == DUP_ACK_THRESHOLD);
+    assert(stats.retrans_fast == 1);
+    assert(segment_count == 1);
+    assert(last_segment.seqno == reply.ackno);
+    printk("Fast retransmit after %u duplicate ACKs\n", stats.dup_acks);
+
+    // A timer retransmit is counted separately
+    sender.rto_time_us = timer_get_usec() - 1;
+    sender_check_retransmits(&sender);
+    assert(stats.retrans_rto == 1);
+
+    // ACK everything while closing the window: only the first segment gives an RTT sample
+    reply.ackno = sender.next_seqno;
+    reply.window_size = 0;
+    sender_process_reply(&sender, &reply);
+    assert(rtq_empty(&sender.pending_segs));
+    assert(stats.bytes_acked == sizeof(data));
+    assert(stats.zero_window_events == 1);
+
+    uint32_t n_samples = 0;
+    for (size_t i = 0; i < TCP_RTT_BUCKETS; i++) {
+        n_samples += stats.rtt_hist[i];
+    }
+    assert(n_samples == 2); // The SYN+data segment and the third one, never retransmitted
+
+    // Data stuck behind the zero window counts as blocked time
+    bs_write(&sender.reader, data, 1);
+    sender_push(&sender);
+    assert(sender.window_blocked);
+    delay_ms(2);
+    reply.window_size = INITIAL_WINDOW_SIZE;
+    sender_process_reply(&sender, &reply);
+    sender_push(&sender);
+    assert(!sender.window_blocked);
+    assert(stats.window_blocked_us >= 2000);
+
+    tcp_stats_print(&stats, 1, 2);
+
+    printk("Sender stats test passed!\n");
+    printk("--------------------------------\n");
+}
+
+// Test that repeated ACKs resend the oldest unacked segment without waiting for the RTO
+static void test_sender_fast_retransmit(void) {
+    printk("--------------------------------\n");
+    printk("Starting fast retransmit test...\n");
+
+    mock_nrf_t mock_nrf = mock_nrf_init();
+    sender_t sender = sender_init((nrf_t *)&mock_nrf, mock_transmit, NULL);
+
+    // Send the SYN and three full segments, and ACK the first
+    uint8_t data[3 * RCP_MAX_PAYLOAD];
+    memset(data, 'x', sizeof(data));
+    bs_write(&sender.reader, data, sizeof(data));
+    for (int i = 0; i < 3; i++) {
+        sender_push(&sender);
+    }
+    unacked_segment_t *first = rtq_start(&sender.pending_segs);
+    receiver_segment_t reply = {
+        .is_ack = true,
+        .ackno = first->seg.seqno + first->seg.len + 1,
+        .window_size = INITIAL_WINDOW_SIZE,
+    };
+    sender_process_reply(&sender, &reply);
+    unacked_segment_t *oldest = rtq_start(&sender.pending_segs);
+    assert(oldest->seg.seqno == reply.ackno && !oldest->retransmitted);
+
+    // Let the RTO come due, so only the fast retransmit can push it back
+    sender.rto_time_us = timer_get_usec() - 1;
+
+    // Fewer duplicates than the threshold could just be reordering
+    segment_count = 0;
+    for (int i = 0; i < DUP_ACK_THRESHOLD - 1; i++) {
+        sender_process_reply(&sender, &reply);
+    }
+    assert(segment_count == 0);
+
+    // The last one resends the oldest unacked segment and restarts the timer
+    uint32_t before_us = timer_get_usec();
+    sender_process_reply(&sender, &reply);
+    assert(segment_count == 1);
+    assert(last_segment.seqno == reply.ackno && last_segment.len == oldest->seg.len);
+    assert(oldest->retransmitted);
+    assert((int32_t)(sender.rto_time_us - (before_us + sender.initial_RTO_us)) >= 0);
+    sender_check_retransmits(&sender);
+    assert(segment_count == 1);
+    printk("Resent seqno %u after %u duplicate ACKs\n", last_segment.seqno, DUP_ACK_THRESHOLD);
+
+    // More duplicates of the same ACK don't resend it again
+    sender_process_reply(&sender, &reply);
+    assert(segment_count == 1);
+
+    // New data ACKed starts the count over
+    reply.ackno += oldest->seg.len;
+    sender_process_reply(&sender, &reply);
+    assert(sender.n_dup_acks == 0);
+    for (int i = 0; i < DUP_ACK_THRESHOLD; i++) {
+        sender_process_reply(&sender, &reply);
+    }
+    assert(segment_count == 2 && last_segment.seqno == reply.ackno);
+
+    printk("Fast retransmit test passed!\n");
+    printk("--------------------------------\n");
+}
+
 void notmain(void) {
     printk("Starting TCP implementation tests...\n\n");
     kmalloc_init(64);
     printk("Memory initialized\n");
 
     test_sender();
+    test_sender_stats();
+    test_sender_fast_retransmit();
 
     printk("\nSender test passed!\n");
 }
\ No newline at end of file
@@ -17,6 +17,8 @@ typedef struct sender_segment {
     uint16_t seqno;
     bool is_syn;  // Whether the segment is a SYN
     bool is_fin;  // Whether the segment is a FIN
+    bool is_parity;    // Whether the segment is FEC parity rather than data (see fec.h)
+    uint8_t fec_span;  // Stream bytes the parity covers, starting at seqno
     size_t len;   // Length of the payload
-    uint8_t payload[RCP_MAX_PAYLOAD];
+    uint8_t payload[RCP_COMPACT_MAX_PAYLOAD];  // Sized for the compact header
 } sender_segment_t;
\ No newline at end of file
@@ -22,12 +22,18 @@ static inline sender_segment_t rcp_to_sender_segment(rcp_datagram_t *datagram) {
         .seqno = datagram->header.seqno,
         .is_syn = rcp_has_flag(&datagram->header, RCP_FLAG_SYN),
         .is_fin = rcp_has_flag(&datagram->header, RCP_FLAG_FIN),
+        .is_parity = rcp_has_flag(&datagram->header, RCP_FLAG_FEC),
         .len = datagram->header.payload_len,
     };
 
+    /* Parity segments carry the number of bytes they cover in the ackno field */
+    if (seg.is_parity) {
+        seg.fec_span = datagram->header.ackno;
+    }
+
     /* Copy payload if present */
-    if (datagram->payload && datagram->header.payload_len > 0) {
-        memcpy(seg.payload, datagram->payload, seg.len);
+    if (datagram->header.payload_len > 0) {
+        memcpy(seg.payload, rcp_datagram_payload(datagram), seg.len);
     }
 
     return seg;
@@ -77,21 +83,25 @@ static inline rcp_datagram_t sender_segment_to_rcp(tcp_peer_t *peer, sender_segm
         rcp_set_flag(&datagram.header, RCP_FLAG_FIN);
     }
 
+    if (segment->is_parity) {
+        rcp_set_flag(&datagram.header, RCP_FLAG_FEC);
+    }
+
     /* Set the sequence number */
     datagram.header.seqno = segment->seqno;
 
-    /* Set the payload (only if there is data to send) */
+    /* Borrow the payload (only if there is data to send); the segment outlives the
+       datagram, so there's no need to copy it */
     if (segment->len > 0) {
-        rcp_datagram_set_payload(&datagram, segment->payload, segment->len);
+        rcp_datagram_borrow_payload(&datagram, segment->payload, segment->len);
     }
 
-    /* Zero out the unused fields (for the receiving message) */
-    datagram.header.ackno = 0;
+    /* Zero out the unused fields (for the receiving message); parity segments carry the
+       number of bytes they cover in the ackno field */
+    datagram.header.ackno = segment->is_parity ? segment->fec_span : 0;
     datagram.header.window = 0;
 
-    /* Compute the checksum over header and payload */
-    rcp_datagram_compute_checksum(&datagram);
-
+    /* The checksum is filled in by rcp_datagram_encode as the packet is written */
     return datagram;
 }
 
@@ -128,8 +138,6 @@ static inline rcp_datagram_t receiver_segment_to_rcp(tcp_peer_t *peer,
     datagram.header.seqno = 0;
     datagram.header.payload_len = 0;
 
-    /* Compute the checksum over header only (no payload) */
-    rcp_datagram_compute_checksum(&datagram);
-
+    /* The checksum is filled in by rcp_datagram_encode as the packet is written */
     return datagram;
 }
\ No newline at end of file
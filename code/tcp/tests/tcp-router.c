@@ -44,6 +44,8 @@ void notmain(void)
     uart_init();
 
     trace("configuring no-ack server=[%x] with %d nbyte msgs\n", router_server_addr, RCP_TOTAL_SIZE);
+    // listens on all five pipes: users with the fixed tables in tcp-v2/router.h
+    // send to their own pipe address, not just router_server_addr.
     nrf_t *s = router_mk_noack(router_server_addr, RCP_TOTAL_SIZE);
     // nrf_dump("unreliable server config:\n", s);
 